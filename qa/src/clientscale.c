@@ -0,0 +1,172 @@
+/*
+ * Copyright (c) 2021 Red Hat.
+ *
+ * Measure pmcd fetch throughput as the number of connected clients grows.
+ *
+ * For each client count, open that many idle connections to pmcd (raw
+ * sockets, so that this process is not itself limited by FD_SETSIZE),
+ * then time a fixed number of pmFetch calls for the given metrics on a
+ * single PMAPI context.  The idle clients add no work of their own, so
+ * any change in throughput is the cost to pmcd of having them connected.
+ */
+
+#include <pcp/pmapi.h>
+#include "libpcp.h"
+#include <sys/resource.h>
+#include <netdb.h>
+
+static pmLongOptions longopts[] = {
+    PMAPI_OPTIONS_HEADER("Options"),
+    PMOPT_DEBUG,
+    PMOPT_HOST,
+    { "clients", 1, 'c', "N,...", "client counts to measure [default 10,100,500,1000,2000,5000]" },
+    { "fetches", 1, 's', "N", "fetches per client count [default 10000]" },
+    { "port", 1, 'p', "N", "pmcd port for idle clients [default $PMCD_PORT or 44321]" },
+    PMOPT_HELP,
+    PMAPI_OPTIONS_END
+};
+
+static pmOptions opts = {
+    .short_options = "c:D:h:p:s:?",
+    .long_options = longopts,
+    .short_usage = "[options] metricname ...",
+};
+
+static int
+idle_client(const char *host, const char *port)
+{
+    struct addrinfo	hints, *res;
+    int			fd, sts;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if ((sts = getaddrinfo(host, port, &hints, &res)) != 0) {
+	fprintf(stderr, "getaddrinfo(%s, %s): %s\n", host, port, gai_strerror(sts));
+	return -1;
+    }
+    if ((fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol)) >= 0 &&
+	connect(fd, res->ai_addr, res->ai_addrlen) < 0) {
+	close(fd);
+	fd = -1;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+int
+main(int argc, char **argv)
+{
+    struct rlimit	limit;
+    struct timeval	start, end;
+    pmResult		*rp;
+    pmID		*pmids;
+    char		*clients = "10,100,500,1000,2000,5000";
+    char		*port = getenv("PMCD_PORT");
+    char		*host = "localhost";
+    char		*p, *endnum;
+    int			*fds = NULL;
+    int			nfds = 0;
+    int			fetches = 10000;
+    int			c, i, n, sts;
+    double		elapsed;
+
+    while ((c = pmgetopt_r(argc, argv, &opts)) != EOF) {
+	switch (c) {
+	case 'c':
+	    clients = opts.optarg;
+	    break;
+	case 'p':
+	    port = opts.optarg;
+	    break;
+	case 's':
+	    fetches = (int)strtol(opts.optarg, &endnum, 10);
+	    if (*endnum != '\0' || fetches < 1) {
+		pmprintf("%s: -s requires a positive numeric argument\n",
+			pmGetProgname());
+		opts.errors++;
+	    }
+	    break;
+	default:
+	    opts.errors++;
+	    break;
+	}
+    }
+    if (opts.errors || opts.optind == argc) {
+	pmUsageMessage(&opts);
+	exit(1);
+    }
+    if (opts.nhosts > 0)
+	host = opts.hosts[0];
+    if (port == NULL)
+	port = "44321";
+    /* PMCD_PORT may be a list, only the first is needed here */
+    if ((p = strchr(port, ',')) != NULL)
+	*p = '\0';
+
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+	limit.rlim_cur = limit.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    if ((sts = pmNewContext(PM_CONTEXT_HOST, host)) < 0) {
+	fprintf(stderr, "pmNewContext(%s): %s\n", host, pmErrStr(sts));
+	exit(1);
+    }
+    n = argc - opts.optind;
+    if ((pmids = (pmID *)malloc(n * sizeof(pmID))) == NULL) {
+	pmNoMem("pmids", n * sizeof(pmID), PM_FATAL_ERR);
+	/* NOTREACHED */
+    }
+    if ((sts = pmLookupName(n, (const char **)&argv[opts.optind], pmids)) < 0) {
+	fprintf(stderr, "pmLookupName: %s\n", pmErrStr(sts));
+	exit(1);
+    }
+
+    printf("%8s %10s %12s\n", "clients", "fetches", "fetches/sec");
+    for (p = clients; p != NULL && *p != '\0'; ) {
+	int	want = (int)strtol(p, &endnum, 10);
+
+	if (endnum == p || want < 0) {
+	    fprintf(stderr, "%s: bad client count list \"%s\"\n",
+			pmGetProgname(), clients);
+	    exit(1);
+	}
+	p = (*endnum == ',') ? endnum + 1 : NULL;
+
+	if (want > nfds) {
+	    if ((fds = (int *)realloc(fds, want * sizeof(int))) == NULL) {
+		pmNoMem("fds", want * sizeof(int), PM_FATAL_ERR);
+		/* NOTREACHED */
+	    }
+	}
+	while (nfds < want) {
+	    if ((fds[nfds] = idle_client(host, port)) < 0) {
+		fprintf(stderr, "%s: connection %d failed: %s\n",
+			pmGetProgname(), nfds, osstrerror());
+		exit(1);
+	    }
+	    nfds++;
+	}
+	while (nfds > want)
+	    close(fds[--nfds]);
+
+	pmtimevalNow(&start);
+	for (i = 0; i < fetches; i++) {
+	    if ((sts = pmFetch(n, pmids, &rp)) < 0) {
+		fprintf(stderr, "pmFetch: %s\n", pmErrStr(sts));
+		exit(1);
+	    }
+	    pmFreeResult(rp);
+	}
+	pmtimevalNow(&end);
+	elapsed = pmtimevalSub(&end, &start);
+	printf("%8d %10d %12.1f\n", want, fetches,
+		elapsed > 0 ? fetches / elapsed : 0.0);
+	fflush(stdout);
+    }
+
+    while (nfds > 0)
+	close(fds[--nfds]);
+    return 0;
+}
@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2021 Red Hat.
+ *
+ * Benchmark derived metric evaluation over a large instance domain.
+ *
+ * Each derived metric below is fetched repeatedly from pmcd, with the
+ * number of sample.many.int instances set by the caller (sample.many.count).
+ * The expressions cover binary operators with operands whose instances
+ * are in the same order (the common case) and in a different order or
+ * with missing instances (instance filters), which need the instances
+ * of the two operands to be joined, plus delta() and rate() history.
+ *
+ * For each metric, report the number of values and their sum from the
+ * last fetch (so the results can be checked), and fetches per second.
+ */
+
+#include <pcp/pmapi.h>
+
+static pmLongOptions longopts[] = {
+    PMAPI_OPTIONS_HEADER("Options"),
+    PMOPT_DEBUG,
+    PMOPT_HOST,
+    PMOPT_SAMPLES,
+    PMOPT_HELP,
+    PMAPI_OPTIONS_END
+};
+
+static pmOptions opts = {
+    .short_options = "D:h:s:?",
+    .long_options = longopts,
+};
+
+static struct {
+    char	*name;
+    char	*expr;
+} derived[] = {
+    { "bench.same",	"sample.many.int + sample.many.int * 2" },
+    { "bench.join",	"sample.many.int + matchinst(/[13579]$/, sample.many.int)" },
+    { "bench.rjoin",	"matchinst(/[02468]$/, sample.many.int) * sample.many.int" },
+    { "bench.filter",	"matchinst(/[13579]$/, sample.many.int)" },
+    { "bench.delta",	"delta(sample.many.int)" },
+    { "bench.rate",	"rate(sample.many.int)" },
+    { "bench.cond",	"sample.many.int > 100 ? sample.many.int : -sample.many.int" },
+    { "bench.sum",	"sum(sample.many.int) + count(sample.many.int)" },
+};
+static int	nderived = sizeof(derived) / sizeof(derived[0]);
+
+static int	nfetch = 100;	/* -s to change */
+static int	errors;
+
+static void
+bench(int n)
+{
+    pmResult		*rp = NULL;
+    pmValueSet		*vsp;
+    pmAtomValue		av;
+    pmDesc		desc;
+    pmID		pmid;
+    struct timeval	start;
+    struct timeval	end;
+    double		elapsed;
+    double		sum = 0;
+    int			numval = 0;
+    int			i;
+    int			sts;
+
+    if ((sts = pmLookupName(1, (const char **)&derived[n].name, &pmid)) < 0) {
+	fprintf(stderr, "pmLookupName(%s): %s\n", derived[n].name, pmErrStr(sts));
+	errors++;
+	return;
+    }
+    if ((sts = pmLookupDesc(pmid, &desc)) < 0) {
+	fprintf(stderr, "pmLookupDesc(%s): %s\n", derived[n].name, pmErrStr(sts));
+	errors++;
+	return;
+    }
+
+    pmtimevalNow(&start);
+    for (i = 0; i < nfetch; i++) {
+	if (rp != NULL)
+	    pmFreeResult(rp);
+	if ((sts = pmFetch(1, &pmid, &rp)) < 0) {
+	    fprintf(stderr, "pmFetch(%s): %s\n", derived[n].name, pmErrStr(sts));
+	    errors++;
+	    return;
+	}
+    }
+    pmtimevalNow(&end);
+    elapsed = pmtimevalSub(&end, &start);
+
+    vsp = rp->vset[0];
+    for (i = 0; i < vsp->numval; i++) {
+	if ((sts = pmExtractValue(vsp->valfmt, &vsp->vlist[i], desc.type,
+				  &av, PM_TYPE_DOUBLE)) < 0) {
+	    fprintf(stderr, "pmExtractValue(%s): %s\n", derived[n].name, pmErrStr(sts));
+	    errors++;
+	    break;
+	}
+	sum += av.d;
+	numval++;
+    }
+    pmFreeResult(rp);
+
+    printf("%-16s %8d %16.0f %14.0f\n", derived[n].name, numval, sum,
+		elapsed > 0 ? nfetch / elapsed : 0.0);
+    fflush(stdout);
+}
+
+int
+main(int argc, char **argv)
+{
+    char	*host = "local:";
+    char	*errmsg;
+    int		c;
+    int		i;
+    int		sts;
+
+    while ((c = pmGetOptions(argc, argv, &opts)) != EOF) {
+	switch (c) {
+	default:
+	    opts.errors++;
+	    break;
+	}
+    }
+    if (opts.errors || opts.optind != argc) {
+	pmUsageMessage(&opts);
+	exit(1);
+    }
+    if (opts.nhosts > 0)
+	host = opts.hosts[0];
+    if (opts.samples > 0)
+	nfetch = opts.samples;
+
+    for (i = 0; i < nderived; i++) {
+	if (pmRegisterDerivedMetric(derived[i].name, derived[i].expr, &errmsg) < 0) {
+	    fprintf(stderr, "pmRegisterDerivedMetric(%s): %s", derived[i].name, errmsg);
+	    free(errmsg);
+	    exit(1);
+	}
+    }
+    if ((sts = pmNewContext(PM_CONTEXT_HOST, host)) < 0) {
+	fprintf(stderr, "pmNewContext(%s): %s\n", host, pmErrStr(sts));
+	exit(1);
+    }
+
+    printf("%-16s %8s %16s %14s\n", "metric", "numval", "sum", "fetches/sec");
+    for (i = 0; i < nderived; i++)
+	bench(i);
+
+    if (errors)
+	printf("%d errors\n", errors);
+    return errors != 0;
+}
@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) 2021 Red Hat.
+ *
+ * Benchmark reading (possibly compressed) files through the libpcp
+ * __pmFopen i/o handlers, as the archive code does.
+ *
+ * For each file, time a sequential read of the whole file and then
+ * reads of 4K (about one archive record) at pseudo-random offsets, as
+ * happens when an archive is positioned with pmSetMode or read in
+ * reverse.  The uncompressed size and a checksum of the contents are
+ * reported so the same data compressed in different formats can be
+ * compared.
+ */
+
+#include <pcp/pmapi.h>
+#include "libpcp.h"
+
+static pmLongOptions longopts[] = {
+    PMAPI_OPTIONS_HEADER("Options"),
+    PMOPT_DEBUG,
+    { "repeat", 1, 'r', "N", "times to repeat each measurement [default 5]" },
+    { "count", 1, 'c', "N", "number of random reads [default 200]" },
+    PMOPT_HELP,
+    PMAPI_OPTIONS_END
+};
+
+static pmOptions opts = {
+    .short_options = "c:D:r:?",
+    .long_options = longopts,
+    .short_usage = "[options] file ...",
+};
+
+#define CHUNK	65536	/* sequential read size */
+#define RECORD	4096	/* random read size */
+
+static int	repeat = 5;
+static int	nseeks = 200;
+static int	errors;
+
+static void
+report(const char *what, long count, struct timeval *start)
+{
+    struct timeval	end;
+    double		elapsed;
+
+    pmtimevalNow(&end);
+    elapsed = pmtimevalSub(&end, start);
+    printf("%-24s %10ld %14.0f\n", what, count,
+		elapsed > 0 ? count / elapsed : 0.0);
+    fflush(stdout);
+}
+
+static unsigned int
+checksum(unsigned int sum, const unsigned char *p, size_t len)
+{
+    /* FNV-1a */
+    while (len-- > 0)
+	sum = (sum ^ *p++) * 16777619U;
+    return sum;
+}
+
+static __pmFILE *
+open_file(const char *path, long *sizep)
+{
+    __pmFILE		*f;
+    struct stat		sbuf;
+
+    if ((f = __pmFopen(path, "r")) == NULL) {
+	fprintf(stderr, "__pmFopen(%s): %s\n", path, osstrerror());
+	errors++;
+	return NULL;
+    }
+    /* uncompressed size - some handlers return a short read as zero */
+    if (__pmFstat(f, &sbuf) < 0) {
+	fprintf(stderr, "__pmFstat(%s): %s\n", path, osstrerror());
+	errors++;
+	__pmFclose(f);
+	return NULL;
+    }
+    *sizep = (long)sbuf.st_size;
+    return f;
+}
+
+static void
+bench(const char *path)
+{
+    __pmFILE		*f;
+    struct timeval	start;
+    char		buf[CHUNK];
+    unsigned int	sum = 2166136261U;
+    __uint64_t		seed;
+    long		size = 0, done;
+    off_t		offset;
+    size_t		bytes;
+    int			r, i;
+
+    /*
+     * Each measurement opens the file afresh, so it includes building
+     * any index and nothing is already decompressed in the cache.
+     */
+    for (r = 0; r < repeat; r++) {
+	pmtimevalNow(&start);
+	if ((f = open_file(path, &size)) == NULL)
+	    return;
+	for (done = 0; done < size; done += bytes) {
+	    bytes = size - done < CHUNK ? size - done : CHUNK;
+	    if (__pmFread(buf, 1, bytes, f) != bytes) {
+		fprintf(stderr, "%s: read %d bytes at %ld failed\n",
+			path, (int)bytes, done);
+		errors++;
+		break;
+	    }
+	    if (r == 0)
+		sum = checksum(sum, (unsigned char *)buf, bytes);
+	}
+	__pmFclose(f);
+	report("sequential read (KB)", done / 1024, &start);
+	if (r == 0)
+	    fprintf(stderr, "%s: %ld bytes, checksum %08x\n",
+			pmGetProgname(), done, sum);
+    }
+
+    for (r = 0; size > RECORD && r < repeat; r++) {
+	pmtimevalNow(&start);
+	if ((f = open_file(path, &size)) == NULL)
+	    return;
+	/* same offsets each time, spread across the whole file */
+	seed = 1;
+	for (i = 0; i < nseeks; i++) {
+	    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+	    offset = (off_t)((seed >> 16) % (size - RECORD));
+	    if (__pmFseek(f, offset, SEEK_SET) < 0 ||
+		__pmFread(buf, 1, RECORD, f) != RECORD) {
+		fprintf(stderr, "%s: read %d bytes at %ld failed\n",
+			path, RECORD, (long)offset);
+		errors++;
+		break;
+	    }
+	}
+	__pmFclose(f);
+	report("random read", i, &start);
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    char	*endnum;
+    int		c;
+
+    while ((c = pmGetOptions(argc, argv, &opts)) != EOF) {
+	switch (c) {
+	case 'r':
+	    repeat = (int)strtol(opts.optarg, &endnum, 10);
+	    if (*endnum != '\0' || repeat < 1) {
+		pmprintf("%s: -r requires a positive numeric argument\n",
+			pmGetProgname());
+		opts.errors++;
+	    }
+	    break;
+	case 'c':
+	    nseeks = (int)strtol(opts.optarg, &endnum, 10);
+	    if (*endnum != '\0' || nseeks < 1) {
+		pmprintf("%s: -c requires a positive numeric argument\n",
+			pmGetProgname());
+		opts.errors++;
+	    }
+	    break;
+	default:
+	    opts.errors++;
+	    break;
+	}
+    }
+    if (opts.errors || opts.optind >= argc) {
+	pmUsageMessage(&opts);
+	exit(1);
+    }
+
+    for (c = opts.optind; c < argc; c++) {
+	printf("%s\n", argv[c]);
+	printf("%-24s %10s %14s\n", "operation", "count", "rate/sec");
+	bench(argv[c]);
+    }
+
+    if (errors)
+	printf("%d errors\n", errors);
+    return errors != 0;
+}
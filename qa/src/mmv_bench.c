@@ -0,0 +1,294 @@
+/*
+ * Copyright (c) 2021 Red Hat.
+ *
+ * Benchmark updating MMV values, versus the number of metrics.
+ *
+ * For each metric count on the command line, create an MMV file with
+ * that many counters (each with -i instances) and time increments of
+ * values chosen in a scattered order, both by name (mmv_stats_inc,
+ * which looks the value up each time) and through handles returned by
+ * mmv_lookup_value_desc beforehand (mmv_inc_value).  The counters are
+ * then checked against the number of increments made.
+ *
+ * With -w, several threads make the increments through handles at the
+ * same time, and -P gives the counters per-CPU stripes so they do not
+ * all contend for the same cache lines.
+ */
+
+#include <pthread.h>
+#include <pcp/pmapi.h>
+#include <pcp/mmv_stats.h>
+#include <pcp/mmv_dev.h>
+
+static pmLongOptions longopts[] = {
+    PMAPI_OPTIONS_HEADER("Options"),
+    PMOPT_DEBUG,
+    { "count", 1, 'c', "N", "number of increments [default 1000000]" },
+    { "instances", 1, 'i', "N", "instances of each metric [default none]" },
+    { "stripes", 0, 'P', 0, "give the counters per-CPU stripes" },
+    { "repeat", 1, 'r', "N", "times to repeat each measurement [default 3]" },
+    { "writers", 1, 'w', "N", "threads incrementing by handle [default 1]" },
+    PMOPT_HELP,
+    PMAPI_OPTIONS_END
+};
+
+static pmOptions opts = {
+    .short_options = "c:D:i:Pr:w:?",
+    .long_options = longopts,
+    .short_usage = "[options] nmetrics ...",
+};
+
+#define SCATTER	40503		/* odd and not a multiple of 5, to visit values out of order */
+
+static int	count = 1000000;
+static int	ninst;
+static int	repeat = 3;
+static int	nwriters = 1;
+static int	stripes;
+static int	errors;
+
+static void		*map;
+static pmAtomValue	**handles;
+static int		nvalues;
+
+static void *
+writer(void *arg)
+{
+    int		i, j;
+
+    for (i = 0, j = 0; i < count; i++, j = (j + SCATTER) % nvalues)
+	mmv_inc_value(map, handles[j], 1);
+    return NULL;
+}
+
+/* a counter's value, plus its slot in every stripe if it has them */
+static double
+total(pmAtomValue *av)
+{
+    mmv_disk_header_t	*hdr = (mmv_disk_header_t *)map;
+    mmv_disk_toc_t	*toc = (mmv_disk_toc_t *)(hdr + 1);
+    mmv_disk_value_t	*v = (mmv_disk_value_t *)av;
+    mmv_disk_stripes_t	*sp;
+    pmAtomValue		*slot;
+    double		sum = av->ull;
+    int			i, j;
+
+    for (i = 0; v->extra && i < hdr->tocs; i++) {
+	if (toc[i].type != MMV_TOC_STRIPES)
+	    continue;
+	sp = (mmv_disk_stripes_t *)((char *)map + toc[i].offset);
+	for (j = 0; j < sp->count; j++) {
+	    slot = (pmAtomValue *)((char *)map + v->extra + j * sp->size);
+	    sum += slot->ull;
+	}
+    }
+    return sum;
+}
+
+static void
+report(int nmetrics, const char *what, int ops, struct timeval *start)
+{
+    struct timeval	end;
+    double		elapsed;
+
+    pmtimevalNow(&end);
+    elapsed = pmtimevalSub(&end, start);
+    printf("%8d %-16s %10d %14.0f\n", nmetrics, what, ops,
+		elapsed > 0 ? ops / elapsed : 0.0);
+    fflush(stdout);
+}
+
+static void
+bench(int nmetrics)
+{
+    mmv_registry_t	*registry;
+    pmAtomValue		*av;
+    pthread_t		*threads;
+    struct timeval	start;
+    char		**names, **insts = NULL;
+    char		buf[MMV_NAMEMAX];
+    double		sum, expect;
+    int			i, j, r;
+
+    nvalues = nmetrics * (ninst ? ninst : 1);
+    threads = (pthread_t *)calloc(nwriters, sizeof(pthread_t));
+    names = (char **)calloc(nmetrics, sizeof(char *));
+    handles = (pmAtomValue **)calloc(nvalues, sizeof(pmAtomValue *));
+    if (names == NULL || handles == NULL || threads == NULL) {
+	fprintf(stderr, "%s: out of memory\n", pmGetProgname());
+	exit(1);
+    }
+
+    if ((registry = mmv_stats_registry("mmv_bench", 1, MMV_FLAG_PROCESS)) == NULL) {
+	fprintf(stderr, "mmv_stats_registry: %s\n", osstrerror());
+	exit(1);
+    }
+    if (ninst) {
+	if ((insts = (char **)calloc(ninst, sizeof(char *))) == NULL) {
+	    fprintf(stderr, "%s: out of memory\n", pmGetProgname());
+	    exit(1);
+	}
+	mmv_stats_add_indom(registry, 1, "benchmark instances", NULL);
+	for (j = 0; j < ninst; j++) {
+	    pmsprintf(buf, sizeof(buf), "instance-%d", j);
+	    insts[j] = strdup(buf);
+	    mmv_stats_add_instance(registry, 1, j, insts[j]);
+	}
+    }
+    for (i = 0; i < nmetrics; i++) {
+	pmsprintf(buf, sizeof(buf), "bench.group%d.counter%d", i % 10, i);
+	names[i] = strdup(buf);
+	if (mmv_stats_add_metric(registry, names[i], i + 1, MMV_TYPE_U64,
+			MMV_SEM_COUNTER, (pmUnits)MMV_UNITS(0,0,1,0,0,PM_COUNT_ONE),
+			ninst ? 1 : MMV_INDOM_NULL, NULL, NULL) < 0) {
+	    fprintf(stderr, "mmv_stats_add_metric: %s\n", osstrerror());
+	    exit(1);
+	}
+	if (stripes && mmv_stats_add_metric_stripes(registry, i + 1) < 0) {
+	    fprintf(stderr, "mmv_stats_add_metric_stripes: %s\n", osstrerror());
+	    exit(1);
+	}
+    }
+    if ((map = mmv_stats_start(registry)) == NULL) {
+	fprintf(stderr, "mmv_stats_start: %s\n", osstrerror());
+	exit(1);
+    }
+
+    for (r = 0; r < repeat; r++) {
+	pmtimevalNow(&start);
+	for (i = 0, j = 0; i < count; i++, j = (j + SCATTER) % nvalues)
+	    mmv_stats_inc(map, names[j % nmetrics],
+			  ninst ? insts[j / nmetrics] : NULL);
+	report(nmetrics, "by name", count, &start);
+    }
+
+    pmtimevalNow(&start);
+    for (j = 0; j < nvalues; j++) {
+	handles[j] = mmv_lookup_value_desc(map, names[j % nmetrics],
+			  ninst ? insts[j / nmetrics] : NULL);
+	if (handles[j] == NULL) {
+	    fprintf(stderr, "mmv_lookup_value_desc(%s, %s) failed\n",
+		    names[j % nmetrics], ninst ? insts[j / nmetrics] : "NULL");
+	    errors++;
+	    return;
+	}
+    }
+    report(nmetrics, "lookup", nvalues, &start);
+
+    if (nwriters > 1)
+	pmsprintf(buf, sizeof(buf), "by handle x%d", nwriters);
+    else
+	pmsprintf(buf, sizeof(buf), "by handle");
+    for (r = 0; r < repeat; r++) {
+	pmtimevalNow(&start);
+	if (nwriters == 1)
+	    writer(NULL);
+	else {
+	    for (i = 0; i < nwriters; i++) {
+		if (pthread_create(&threads[i], NULL, writer, NULL) != 0) {
+		    fprintf(stderr, "pthread_create: %s\n", osstrerror());
+		    exit(1);
+		}
+	    }
+	    for (i = 0; i < nwriters; i++)
+		pthread_join(threads[i], NULL);
+	}
+	report(nmetrics, buf, count * nwriters, &start);
+    }
+
+    /* every increment must have landed on exactly one value */
+    for (sum = 0, j = 0; j < nvalues; j++) {
+	av = mmv_lookup_value_desc(map, names[j % nmetrics],
+			  ninst ? insts[j / nmetrics] : NULL);
+	if (av != handles[j]) {
+	    fprintf(stderr, "%s: handle %d changed\n", pmGetProgname(), j);
+	    errors++;
+	}
+	sum += total(av);
+    }
+    expect = (1.0 + nwriters) * repeat * count;
+    if (sum != expect) {
+	fprintf(stderr, "%s: counters total %.0f, expected %.0f\n",
+		pmGetProgname(), sum, expect);
+	errors++;
+    }
+
+    mmv_stats_free(registry);
+    for (i = 0; i < nmetrics; i++)
+	free(names[i]);
+    for (j = 0; j < ninst; j++)
+	free(insts[j]);
+    free(names);
+    free(insts);
+    free(handles);
+    free(threads);
+}
+
+int
+main(int argc, char **argv)
+{
+    char	*endnum;
+    int		c, n;
+
+    while ((c = pmGetOptions(argc, argv, &opts)) != EOF) {
+	switch (c) {
+	case 'c':
+	    count = (int)strtol(opts.optarg, &endnum, 10);
+	    if (*endnum != '\0' || count < 1) {
+		pmprintf("%s: -c requires a positive numeric argument\n",
+			pmGetProgname());
+		opts.errors++;
+	    }
+	    break;
+	case 'i':
+	    ninst = (int)strtol(opts.optarg, &endnum, 10);
+	    if (*endnum != '\0' || ninst < 0) {
+		pmprintf("%s: -i requires a numeric argument\n",
+			pmGetProgname());
+		opts.errors++;
+	    }
+	    break;
+	case 'P':
+	    stripes = 1;
+	    break;
+	case 'r':
+	    repeat = (int)strtol(opts.optarg, &endnum, 10);
+	    if (*endnum != '\0' || repeat < 1) {
+		pmprintf("%s: -r requires a positive numeric argument\n",
+			pmGetProgname());
+		opts.errors++;
+	    }
+	    break;
+	case 'w':
+	    nwriters = (int)strtol(opts.optarg, &endnum, 10);
+	    if (*endnum != '\0' || nwriters < 1) {
+		pmprintf("%s: -w requires a positive numeric argument\n",
+			pmGetProgname());
+		opts.errors++;
+	    }
+	    break;
+	default:
+	    opts.errors++;
+	    break;
+	}
+    }
+    if (opts.errors || opts.optind >= argc) {
+	pmUsageMessage(&opts);
+	exit(1);
+    }
+
+    printf("%8s %-16s %10s %14s\n", "metrics", "operation", "count", "rate/sec");
+    for (c = opts.optind; c < argc; c++) {
+	n = (int)strtol(argv[c], &endnum, 10);
+	if (*endnum != '\0' || n < 1) {
+	    fprintf(stderr, "%s: bad metric count \"%s\"\n",
+		    pmGetProgname(), argv[c]);
+	    exit(1);
+	}
+	bench(n);
+    }
+
+    if (errors)
+	printf("%d errors\n", errors);
+    return errors != 0;
+}
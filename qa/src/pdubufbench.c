@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) 2021 Red Hat.
+ *
+ * Microbenchmark for the libpcp PDU buffer pool.
+ *
+ * Each thread repeatedly allocates a PDU buffer, pins and unpins it
+ * via an address inside the buffer (as the pmResult decoding does),
+ * tries to unpin an address that is not a PDU buffer (as pmFreeResult
+ * does for locally built results), and finally releases it.  Buffers
+ * are filled and checked so that any sharing between threads would be
+ * noticed.  Run with PCP_PDUBUF_SLAB=0 in the environment to measure
+ * the tsearch(3) tree used for all buffers in earlier releases.
+ *
+ * With -b, finally allocate a burst of buffers all held at once, release
+ * them and report whether the pool kept fewer buffers than the burst
+ * needed (i.e. memory is returned once the burst is over).
+ */
+
+#include <pcp/pmapi.h>
+#include "libpcp.h"
+#include <pthread.h>
+
+static pmLongOptions longopts[] = {
+    PMAPI_OPTIONS_HEADER("Options"),
+    PMOPT_DEBUG,
+    { "burst", 1, 'b', "N", "allocate N buffers at once, then release them" },
+    { "iterations", 1, 'i', "N", "buffers allocated per thread [default 1000000]" },
+    { "sizes", 1, 's', "N,...", "PDU sizes to cycle through [default 64,1024,4096]" },
+    { "threads", 1, 't', "N,...", "thread counts to measure [default 1,2,4,8]" },
+    PMOPT_HELP,
+    PMAPI_OPTIONS_END
+};
+
+static pmOptions opts = {
+    .short_options = "b:D:i:s:t:?",
+    .long_options = longopts,
+};
+
+static int	iterations = 1000000;
+static int	burst;
+static int	*sizes;
+static int	nsizes;
+static int	errors;
+
+static int *
+parse_list(char *list, int *count)
+{
+    char	*p, *end;
+    int		*vals = NULL;
+    int		n = 0;
+
+    for (p = list; p != NULL && *p != '\0'; ) {
+	if ((vals = (int *)realloc(vals, (n + 1) * sizeof(int))) == NULL) {
+	    pmNoMem("list", (n + 1) * sizeof(int), PM_FATAL_ERR);
+	    /* NOTREACHED */
+	}
+	vals[n] = (int)strtol(p, &end, 10);
+	if (end == p || vals[n] <= 0) {
+	    fprintf(stderr, "%s: bad number list \"%s\"\n", pmGetProgname(), list);
+	    exit(1);
+	}
+	n++;
+	p = (*end == ',') ? end + 1 : NULL;
+    }
+    *count = n;
+    return vals;
+}
+
+static void *
+worker(void *arg)
+{
+    int		id = (int)(__psint_t)arg;
+    int		notpdu[4];
+    int		i, j, need;
+    char	*buf;
+
+    for (i = 0; i < iterations; i++) {
+	need = sizes[(i + id) % nsizes];
+	if ((buf = (char *)__pmFindPDUBuf(need)) == NULL) {
+	    fprintf(stderr, "thread %d: __pmFindPDUBuf(%d) failed\n", id, need);
+	    __sync_add_and_fetch(&errors, 1);
+	    break;
+	}
+	memset(buf, id, need);
+	__pmPinPDUBuf(&buf[need / 2 & ~(sizeof(int) - 1)]);
+	__pmUnpinPDUBuf(&buf[need - sizeof(int)]);
+	if (__pmUnpinPDUBuf(notpdu) != 0) {
+	    fprintf(stderr, "thread %d: unpin of non-PDU address succeeded\n", id);
+	    __sync_add_and_fetch(&errors, 1);
+	}
+	for (j = 0; j < need; j += 64) {
+	    if (buf[j] != (char)id) {
+		fprintf(stderr, "thread %d: buffer %p trampled\n", id, buf);
+		__sync_add_and_fetch(&errors, 1);
+		break;
+	    }
+	}
+	__pmUnpinPDUBuf(buf);
+    }
+    return NULL;
+}
+
+static void
+do_burst(void)
+{
+    char	**bufs;
+    int		i, need;
+    int		alloc, nfree;
+
+    if ((bufs = (char **)malloc(burst * sizeof(char *))) == NULL) {
+	pmNoMem("bufs", burst * sizeof(char *), PM_FATAL_ERR);
+	/* NOTREACHED */
+    }
+    for (i = 0; i < burst; i++) {
+	need = sizes[i % nsizes];
+	if ((bufs[i] = (char *)__pmFindPDUBuf(need)) == NULL) {
+	    fprintf(stderr, "burst: __pmFindPDUBuf(%d) failed\n", need);
+	    errors++;
+	    burst = i;
+	    break;
+	}
+    }
+    __pmCountPDUBuf(0, &alloc, &nfree);
+    fprintf(stderr, "burst: %d buffers in use, %d free\n", alloc, nfree);
+    for (i = 0; i < burst; i++)
+	__pmUnpinPDUBuf(bufs[i]);
+    free(bufs);
+    __pmCountPDUBuf(0, &alloc, &nfree);
+    fprintf(stderr, "after burst: %d buffers in use, %d free\n", alloc, nfree);
+    printf("burst of %d buffers: %d in use after release, %s buffers retained\n",
+		burst, alloc, nfree < burst / 2 ? "few" : "most");
+}
+
+int
+main(int argc, char **argv)
+{
+    struct timeval	start, end;
+    pthread_t		*tids;
+    char		*threadlist = "1,2,4,8";
+    char		*sizelist = "64,1024,4096";
+    char		*endnum;
+    int			*threads;
+    int			nthreads;
+    int			c, i, t;
+    double		elapsed, rate;
+
+    while ((c = pmgetopt_r(argc, argv, &opts)) != EOF) {
+	switch (c) {
+	case 'b':
+	    burst = (int)strtol(opts.optarg, &endnum, 10);
+	    if (*endnum != '\0' || burst < 1) {
+		pmprintf("%s: -b requires a positive numeric argument\n",
+			pmGetProgname());
+		opts.errors++;
+	    }
+	    break;
+	case 'i':
+	    iterations = (int)strtol(opts.optarg, &endnum, 10);
+	    if (*endnum != '\0' || iterations < 1) {
+		pmprintf("%s: -i requires a positive numeric argument\n",
+			pmGetProgname());
+		opts.errors++;
+	    }
+	    break;
+	case 's':
+	    sizelist = opts.optarg;
+	    break;
+	case 't':
+	    threadlist = opts.optarg;
+	    break;
+	default:
+	    opts.errors++;
+	    break;
+	}
+    }
+    if (opts.errors || opts.optind != argc) {
+	pmUsageMessage(&opts);
+	exit(1);
+    }
+    sizes = parse_list(sizelist, &nsizes);
+    threads = parse_list(threadlist, &nthreads);
+
+    printf("%8s %14s %18s\n", "threads", "allocs/sec", "allocs/sec/thread");
+    for (t = 0; t < nthreads; t++) {
+	if ((tids = (pthread_t *)malloc(threads[t] * sizeof(pthread_t))) == NULL) {
+	    pmNoMem("tids", threads[t] * sizeof(pthread_t), PM_FATAL_ERR);
+	    /* NOTREACHED */
+	}
+	pmtimevalNow(&start);
+	for (i = 0; i < threads[t]; i++) {
+	    if (pthread_create(&tids[i], NULL, worker, (void *)(__psint_t)(i + 1)) != 0) {
+		fprintf(stderr, "pthread_create: %s\n", osstrerror());
+		exit(1);
+	    }
+	}
+	for (i = 0; i < threads[t]; i++)
+	    pthread_join(tids[i], NULL);
+	pmtimevalNow(&end);
+	free(tids);
+
+	elapsed = pmtimevalSub(&end, &start);
+	rate = elapsed > 0 ? (double)iterations * threads[t] / elapsed : 0.0;
+	printf("%8d %14.0f %18.0f\n", threads[t], rate, rate / threads[t]);
+	fflush(stdout);
+    }
+
+    if (burst)
+	do_burst();
+
+    if (errors)
+	printf("%d errors\n", errors);
+    return errors != 0;
+}
@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) 2021 Red Hat.
+ *
+ * Benchmark pmseries function evaluation through the libpcp_web query
+ * engine - each query is made with pmSeriesQuery, so the values are
+ * fetched from Redis and evaluated by the series_query_* phases just
+ * as for pmseries(1) and pmproxy(1).
+ *
+ * Each query is made several times.  The number of values reported
+ * and their sum go to stdout, the best elapsed and CPU times of each
+ * query to stderr - the CPU time is that of this process only, not of
+ * the Redis server.  The time to evaluate a function is the difference
+ * from the time of the same query without the function, so the queries
+ * given usually include those without functions as well.  Running
+ * this with libpcp_web builds from before and after a change to the
+ * engine (LD_LIBRARY_PATH) compares the two.
+ */
+
+#include <sys/resource.h>
+#include <uv.h>
+#include <pcp/pmapi.h>
+#include <pcp/pmwebapi.h>
+
+static int
+overrides(int opt, pmOptions *opts)
+{
+    return (opt == 'h' || opt == 'p');
+}
+
+static pmLongOptions longopts[] = {
+    PMAPI_OPTIONS_HEADER("Options"),
+    PMOPT_DEBUG,
+    { "host", 1, 'h', "HOST", "connect to Redis using given host name" },
+    { "port", 1, 'p', "PORT", "connect to Redis using given TCP/IP port" },
+    { "runs", 1, 'r', "N", "make each query N times [default 5]" },
+    PMOPT_HELP,
+    PMAPI_OPTIONS_END
+};
+
+static pmOptions opts = {
+    .short_options = "D:h:p:r:?",
+    .long_options = longopts,
+    .short_usage = "[options] query ...",
+    .override = overrides,
+};
+
+typedef struct bench {
+    pmSeriesSettings	settings;
+    uv_loop_t		*loop;
+    char		**queries;
+    int			nqueries;
+    int			query;		/* current query */
+    int			runs;
+    int			run;		/* current run of this query */
+    struct timeval	start;
+    double		cpustart;
+    double		best;		/* elapsed time of fastest run */
+    double		bestcpu;	/* CPU time of least costly run */
+    unsigned long	count;		/* values reported by this run */
+    double		sum;
+    int			status;
+} bench_t;
+
+static void bench_query(bench_t *);
+
+static double
+cputime(void)
+{
+    struct rusage	usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+    return pmtimevalToReal(&usage.ru_utime) + pmtimevalToReal(&usage.ru_stime);
+}
+
+static void
+on_info(pmLogLevel level, sds message, void *arg)
+{
+    bench_t		*bp = (bench_t *)arg;
+
+    if (level >= PMLOG_ERROR)
+	bp->status = 1;
+    if (level >= PMLOG_WARNING || pmDebugOptions.series)
+	pmLogLevelPrint(stderr, level, message, 0);
+}
+
+static int
+on_value(pmSID sid, pmSeriesValue *value, void *arg)
+{
+    bench_t		*bp = (bench_t *)arg;
+
+    bp->count++;
+    bp->sum += strtod(value->data, NULL);
+    return 0;
+}
+
+static void
+on_done(int sts, void *arg)
+{
+    bench_t		*bp = (bench_t *)arg;
+    struct timeval	end;
+    double		elapsed, cpu;
+    char		msg[PM_MAXERRMSGLEN];
+
+    pmtimevalNow(&end);
+    elapsed = pmtimevalSub(&end, &bp->start);
+    cpu = cputime() - bp->cpustart;
+    if (sts < 0) {
+	fprintf(stderr, "%s: %s: %s\n", pmGetProgname(),
+			bp->queries[bp->query], pmErrStr_r(sts, msg, sizeof(msg)));
+	bp->status = 1;
+    }
+    if (bp->run == 0 || elapsed < bp->best)
+	bp->best = elapsed;
+    if (bp->run == 0 || cpu < bp->bestcpu)
+	bp->bestcpu = cpu;
+
+    if (++bp->run == bp->runs) {
+	printf("%s: %lu values, sum %.6e\n",
+		bp->queries[bp->query], bp->count, bp->sum);
+	fprintf(stderr, "%s: %.3f sec elapsed, %.3f sec cpu (best of %d)\n",
+		bp->queries[bp->query], bp->best, bp->bestcpu, bp->runs);
+	bp->run = 0;
+	bp->query++;
+    }
+    if (bp->query < bp->nqueries)
+	bench_query(bp);
+    else
+	pmSeriesClose(&bp->settings.module);
+}
+
+static void
+bench_query(bench_t *bp)
+{
+    sds			query = sdsnew(bp->queries[bp->query]);
+    int			sts;
+
+    bp->count = 0;
+    bp->sum = 0;
+    pmtimevalNow(&bp->start);
+    bp->cpustart = cputime();
+    sts = pmSeriesQuery(&bp->settings, query, 0, bp);
+    sdsfree(query);
+    if (sts < 0)
+	on_done(sts, bp);
+}
+
+static void
+on_setup(void *arg)
+{
+    bench_query((bench_t *)arg);
+}
+
+static void
+bench_start(uv_timer_t *arg)
+{
+    uv_handle_t		*handle = (uv_handle_t *)arg;
+    bench_t		*bp = (bench_t *)handle->data;
+
+    pmSeriesSetup(&bp->settings.module, bp);
+}
+
+int
+main(int argc, char **argv)
+{
+    bench_t		bench = {0};
+    uv_timer_t		request;
+    struct dict		*config;
+    char		*host = "localhost";
+    int			c, port = 6379;
+
+    pmSetProgname(argv[0]);
+    setlinebuf(stdout);
+    bench.runs = 5;
+
+    while ((c = pmGetOptions(argc, argv, &opts)) != EOF) {
+	switch (c) {
+	case 'h':
+	    host = opts.optarg;
+	    break;
+	case 'p':
+	    port = atoi(opts.optarg);
+	    break;
+	case 'r':
+	    bench.runs = atoi(opts.optarg);
+	    break;
+	}
+    }
+    if (opts.errors || opts.optind == argc || bench.runs < 1) {
+	pmUsageMessage(&opts);
+	exit(1);
+    }
+    bench.queries = &argv[opts.optind];
+    bench.nqueries = argc - opts.optind;
+
+    if ((config = pmIniFileSetup(NULL)) == NULL) {
+	fprintf(stderr, "%s: cannot setup configuration\n", pmGetProgname());
+	exit(1);
+    }
+    pmIniFileUpdate(config, "pmseries", "servers",
+		sdscatfmt(sdsempty(), "%s:%u", host, port));
+    /* every run must evaluate the query in full, not from cached samples */
+    pmIniFileUpdate(config, "pmseries", "query.cache.size", sdsnew("0"));
+
+    bench.loop = uv_default_loop();
+    bench.settings.callbacks.on_value = on_value;
+    bench.settings.callbacks.on_done = on_done;
+    bench.settings.module.on_info = on_info;
+    bench.settings.module.on_setup = on_setup;
+    pmSeriesSetEventLoop(&bench.settings.module, bench.loop);
+    pmSeriesSetConfiguration(&bench.settings.module, config);
+
+    request.data = &bench;
+    uv_timer_init(bench.loop, &request);
+    uv_timer_start(&request, bench_start, 0, 0);
+    uv_run(bench.loop, UV_RUN_DEFAULT);
+    uv_loop_close(bench.loop);
+
+    exit(bench.status);
+}
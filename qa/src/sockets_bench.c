@@ -0,0 +1,308 @@
+/*
+ * Copyright (c) 2021 Red Hat.
+ *
+ * Benchmark pmdasockets refresh time, collecting over netlink versus
+ * running ss(8).
+ *
+ * Opens -P connected TCP socket pairs over the loopback interface, then
+ * for each collector (stored into network.persocket.collector) times -c
+ * fetches of network.persocket.state, each of which refreshes the
+ * sockets instance domain.  The sockets opened here (on either side of
+ * the listening port) are then fetched once more through each collector
+ * and must be reported the same way by both.
+ *
+ * With -f, the filter is stored into network.persocket.filter first;
+ * any %d in it is replaced by the listening port.
+ */
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <pcp/pmapi.h>
+
+static pmLongOptions longopts[] = {
+    PMAPI_OPTIONS_HEADER("Options"),
+    PMOPT_DEBUG,
+    PMOPT_HOST,
+    PMOPT_LOCALPMDA,
+    PMOPT_SPECLOCAL,
+    PMOPT_NAMESPACE,
+    { "count", 1, 'c', "N", "fetches timed for each collector [default 100]" },
+    { "filter", 1, 'f', "FILTER", "network.persocket.filter to use" },
+    { "pairs", 1, 'P', "N", "socket pairs to open [default 100]" },
+    PMOPT_HELP,
+    PMAPI_OPTIONS_END
+};
+
+static pmOptions opts = {
+    .short_options = "c:D:f:h:K:Ln:P:?",
+    .long_options = longopts,
+    .short_usage = "[options]",
+};
+
+static const char *names[] = {
+    "network.persocket.filter",
+    "network.persocket.collector",
+    "network.persocket.state",
+    "network.persocket.src",
+    "network.persocket.dst",
+    "network.persocket.inode",
+    "network.persocket.recvq",
+    "network.persocket.sendq",
+};
+#define NAMES	(sizeof(names) / sizeof(names[0]))
+#define FILTER		0
+#define COLLECTOR	1
+#define STATE		2
+#define SRC		3	/* STATE..SENDQ describe each socket */
+
+static pmID	pmids[NAMES];
+static int	count = 100;
+static int	npairs = 100;
+static int	errors;
+
+static void
+store(int n, const char *value)
+{
+    pmResult	*result;
+    pmValueSet	*vsp;
+    size_t	len = strlen(value) + 1;
+    int		sts;
+
+    result = (pmResult *)calloc(1, sizeof(pmResult));
+    vsp = (pmValueSet *)calloc(1, sizeof(pmValueSet));
+    if (result == NULL || vsp == NULL ||
+	(vsp->vlist[0].value.pval = (pmValueBlock *)malloc(PM_VAL_HDR_SIZE + len)) == NULL) {
+	fprintf(stderr, "%s: out of memory\n", pmGetProgname());
+	exit(1);
+    }
+    result->numpmid = 1;
+    result->vset[0] = vsp;
+    vsp->pmid = pmids[n];
+    vsp->numval = 1;
+    vsp->valfmt = PM_VAL_DPTR;
+    vsp->vlist[0].inst = PM_IN_NULL;
+    vsp->vlist[0].value.pval->vtype = PM_TYPE_STRING;
+    vsp->vlist[0].value.pval->vlen = PM_VAL_HDR_SIZE + len;
+    memcpy(vsp->vlist[0].value.pval->vbuf, value, len);
+    if ((sts = pmStore(result)) < 0) {
+	fprintf(stderr, "pmStore(%s, \"%s\"): %s\n", names[n], value, pmErrStr(sts));
+	exit(1);
+    }
+    pmFreeResult(result);
+}
+
+static pmResult *
+fetch(int n, int first)
+{
+    pmResult	*result;
+    int		sts;
+
+    if ((sts = pmFetch(n, &pmids[first], &result)) < 0) {
+	fprintf(stderr, "pmFetch(%s): %s\n", names[first], pmErrStr(sts));
+	exit(1);
+    }
+    return result;
+}
+
+static char *
+value(pmValueSet *vsp, int inst)
+{
+    pmAtomValue	av;
+    char	buf[64];
+    int		i;
+
+    for (i = 0; i < vsp->numval; i++) {
+	if (vsp->vlist[i].inst != inst)
+	    continue;
+	if (vsp->valfmt == PM_VAL_INSITU) {
+	    pmsprintf(buf, sizeof(buf), "%d", vsp->vlist[i].value.lval);
+	    return strdup(buf);
+	}
+	if (vsp->vlist[i].value.pval->vtype == PM_TYPE_STRING) {
+	    pmExtractValue(vsp->valfmt, &vsp->vlist[i], PM_TYPE_STRING, &av, PM_TYPE_STRING);
+	    return av.cp;
+	}
+	pmExtractValue(vsp->valfmt, &vsp->vlist[i],
+			vsp->vlist[i].value.pval->vtype, &av, PM_TYPE_64);
+	pmsprintf(buf, sizeof(buf), "%lld", (long long)av.ll);
+	return strdup(buf);
+    }
+    return strdup("?");
+}
+
+static int
+compare(const void *a, const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/*
+ * Describe each socket with an address on the benchmark port as one
+ * string, sorted so different collectors can be compared.
+ */
+static int
+own_sockets(const char *port, char ***list)
+{
+    pmResult	*result = fetch(NAMES - STATE, STATE);
+    pmValueSet	*vsp = result->vset[SRC - STATE];
+    char	**own = NULL, *field, line[256];
+    int		i, j, n = 0, len;
+
+    for (i = 0; i < vsp->numval; i++) {
+	for (len = 0, j = STATE; j < NAMES; j++) {
+	    field = value(result->vset[j - STATE], vsp->vlist[i].inst);
+	    len += pmsprintf(line + len, sizeof(line) - len, " %s", field);
+	    free(field);
+	}
+	if (strstr(line, port) == NULL)
+	    continue;
+	if ((own = (char **)realloc(own, (n + 1) * sizeof(char *))) == NULL ||
+	    (own[n++] = strdup(line)) == NULL) {
+	    fprintf(stderr, "%s: out of memory\n", pmGetProgname());
+	    exit(1);
+	}
+    }
+    pmFreeResult(result);
+    qsort(own, n, sizeof(char *), compare);
+    *list = own;
+    return n;
+}
+
+int
+main(int argc, char **argv)
+{
+    static char		*collectors[] = { "netlink", "ss" };
+    struct sockaddr_in	addr;
+    struct timeval	start, end;
+    socklen_t		addrlen = sizeof(addr);
+    pmResult		*result;
+    char		*filter = NULL, *oldfilter = NULL, *used;
+    char		*endnum, port[16], buf[256];
+    char		**own[2];
+    int			*fds, lfd, c, i, n, sts, nown[2], ninst;
+
+    while ((c = pmGetOptions(argc, argv, &opts)) != EOF) {
+	switch (c) {
+	case 'c':
+	    count = (int)strtol(opts.optarg, &endnum, 10);
+	    if (*endnum != '\0' || count < 1) {
+		pmprintf("%s: -c requires a positive numeric argument\n",
+			pmGetProgname());
+		opts.errors++;
+	    }
+	    break;
+	case 'f':
+	    filter = opts.optarg;
+	    break;
+	case 'P':
+	    npairs = (int)strtol(opts.optarg, &endnum, 10);
+	    if (*endnum != '\0' || npairs < 0) {
+		pmprintf("%s: -P requires a numeric argument\n",
+			pmGetProgname());
+		opts.errors++;
+	    }
+	    break;
+	default:
+	    opts.errors++;
+	    break;
+	}
+    }
+    if (opts.errors || opts.optind != argc) {
+	pmUsageMessage(&opts);
+	exit(1);
+    }
+
+    if (opts.context == PM_CONTEXT_LOCAL)
+	sts = pmNewContext(PM_CONTEXT_LOCAL, NULL);
+    else
+	sts = pmNewContext(PM_CONTEXT_HOST,
+			opts.nhosts > 0 ? opts.hosts[0] : "local:");
+    if (sts < 0) {
+	fprintf(stderr, "%s: cannot create context: %s\n",
+		pmGetProgname(), pmErrStr(sts));
+	exit(1);
+    }
+    if ((sts = pmLookupName(NAMES, names, pmids)) < 0) {
+	fprintf(stderr, "%s: pmLookupName: %s\n", pmGetProgname(), pmErrStr(sts));
+	exit(1);
+    }
+
+    /* listening socket on an ephemeral loopback port, then the pairs */
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if ((lfd = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+	bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	listen(lfd, npairs + 1) < 0 ||
+	getsockname(lfd, (struct sockaddr *)&addr, &addrlen) < 0) {
+	fprintf(stderr, "%s: listen: %s\n", pmGetProgname(), osstrerror());
+	exit(1);
+    }
+    if ((fds = (int *)calloc(2 * npairs + 1, sizeof(int))) == NULL) {
+	fprintf(stderr, "%s: out of memory\n", pmGetProgname());
+	exit(1);
+    }
+    for (i = 0; i < npairs; i++) {
+	if ((fds[2*i] = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+	    connect(fds[2*i], (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    (fds[2*i+1] = accept(lfd, NULL, NULL)) < 0) {
+	    fprintf(stderr, "%s: connect: %s\n", pmGetProgname(), osstrerror());
+	    exit(1);
+	}
+    }
+    pmsprintf(port, sizeof(port), ":%d ", ntohs(addr.sin_port));
+
+    if (filter) {
+	result = fetch(1, FILTER);
+	oldfilter = value(result->vset[0], PM_IN_NULL);
+	pmFreeResult(result);
+	pmsprintf(buf, sizeof(buf), filter, ntohs(addr.sin_port));
+	store(FILTER, buf);
+    }
+
+    printf("%-10s %-10s %10s %8s %12s\n",
+		"collector", "used", "instances", "own", "ms/fetch");
+    for (c = 0; c < 2; c++) {
+	store(COLLECTOR, collectors[c]);
+	pmtimevalNow(&start);
+	for (ninst = i = 0; i < count; i++) {
+	    result = fetch(1, STATE);
+	    ninst = result->vset[0]->numval;
+	    pmFreeResult(result);
+	}
+	pmtimevalNow(&end);
+	result = fetch(1, COLLECTOR);
+	used = value(result->vset[0], PM_IN_NULL);
+	pmFreeResult(result);
+	nown[c] = own_sockets(port, &own[c]);
+	printf("%-10s %-10s %10d %8d %12.3f\n", collectors[c], used, ninst,
+		nown[c], 1000 * pmtimevalSub(&end, &start) / count);
+	free(used);
+    }
+
+    if (nown[0] != nown[1]) {
+	fprintf(stderr, "%s: %d sockets over netlink, %d from ss\n",
+		pmGetProgname(), nown[0], nown[1]);
+	errors++;
+    }
+    for (n = 0; n < nown[0] && n < nown[1]; n++) {
+	if (strcmp(own[0][n], own[1][n]) != 0) {
+	    fprintf(stderr, "netlink:%s\nss:     %s\n", own[0][n], own[1][n]);
+	    errors++;
+	}
+    }
+
+    /* put back the defaults for anyone else using the agent */
+    store(COLLECTOR, collectors[0]);
+    if (oldfilter)
+	store(FILTER, oldfilter);
+
+    for (i = 0; i < 2 * npairs; i++)
+	close(fds[i]);
+    close(lfd);
+
+    if (errors)
+	printf("%d errors\n", errors);
+    return errors != 0;
+}
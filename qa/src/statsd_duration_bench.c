@@ -0,0 +1,368 @@
+/*
+ * Copyright (c) 2021 Red Hat.
+ *
+ * Benchmark pmdastatsd duration metric aggregation.
+ *
+ * Sends count values (drawn from the -d distribution) to each of -m
+ * duration metrics, waits for the agent to aggregate them and reports,
+ * for whichever duration_aggregation_type the agent is configured with:
+ * the aggregation cost per value (from statsd.pmda.time_spent_aggregating),
+ * the time to fetch all instances of one metric, the growth in maximum
+ * resident size per metric (only with -L, when the agent is a DSO in
+ * this process, and only meaningful with large enough -c or -m) and the
+ * largest relative error of the median and percentile instances over all
+ * the metrics, against the exact values computed here.
+ */
+
+#include <math.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <pcp/pmapi.h>
+
+static pmLongOptions longopts[] = {
+    PMAPI_OPTIONS_HEADER("Options"),
+    PMOPT_DEBUG,
+    PMOPT_HOST,
+    PMOPT_LOCALPMDA,
+    PMOPT_SPECLOCAL,
+    { "count", 1, 'c', "N", "values sent to each metric [default 10000]" },
+    { "distribution", 1, 'd', "NAME", "uniform, exponential or lognormal [default lognormal]" },
+    { "metrics", 1, 'm', "N", "number of duration metrics [default 10]" },
+    { "port", 1, 'P', "N", "pmdastatsd UDP port [default 8125]" },
+    { "rate", 1, 'r', "N", "datagrams per second [default 20000]" },
+    PMOPT_HELP,
+    PMAPI_OPTIONS_END
+};
+
+static pmOptions opts = {
+    .short_options = "c:D:d:h:K:Lm:P:r:?",
+    .long_options = longopts,
+    .short_usage = "[options]",
+};
+
+#define BURST	100	/* datagrams sent between rate checks */
+
+enum { UNIFORM, EXPONENTIAL, LOGNORMAL };
+
+static const char	*quantiles[] = { "/median", "/percentile90", "/percentile95", "/percentile99" };
+static const double	fractions[] = { 0.5, 0.9, 0.95, 0.99 };
+#define NQUANTILES	(sizeof(quantiles) / sizeof(quantiles[0]))
+
+static const char	*names[] = {
+    "statsd.pmda.aggregated",
+    "statsd.pmda.time_spent_aggregating",
+    "statsd.pmda.settings.duration_aggregation_type",
+};
+static pmID		pmids[3];
+
+static int		count = 10000;
+static int		nmetrics = 10;
+static int		distribution = LOGNORMAL;
+static int		port = 8125;
+static double		rate = 20000;
+static int		errors;
+
+static __uint64_t	seed = 1;
+
+/* uniform in (0,1) */
+static double
+random_fraction(void)
+{
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    return ((seed >> 11) + 0.5) / 9007199254740992.0;
+}
+
+/* whole milliseconds, as the exact and HDR histogram aggregation keep */
+static double
+random_duration(void)
+{
+    double	u = random_fraction();
+
+    switch (distribution) {
+    case UNIFORM:
+	return floor(u * 1000000);
+    case EXPONENTIAL:
+	return floor(-1000 * log(u));
+    default:	/* Box-Muller, median 1000, spanning about 1 to 10^6 */
+	return floor(exp(log(1000) + 1.5 * sqrt(-2 * log(u)) *
+			cos(2 * M_PI * random_fraction())));
+    }
+}
+
+static int
+compare(const void *a, const void *b)
+{
+    double	x = *(double *)a, y = *(double *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* same rank as the exact duration aggregation uses */
+static double
+exact_quantile(double *sorted, double fraction)
+{
+    int		rank;
+
+    if (fraction == 0.5)
+	rank = (int)ceil(count / 2.0 - 1);
+    else
+	rank = (int)round(fraction * count) - 1;
+    return sorted[rank < 0 ? 0 : rank];
+}
+
+static pmResult *
+fetch(int n, pmID *list)
+{
+    pmResult	*result;
+    int		sts;
+
+    if ((sts = pmFetch(n, list, &result)) < 0) {
+	fprintf(stderr, "pmFetch: %s\n", pmErrStr(sts));
+	exit(1);
+    }
+    return result;
+}
+
+static __uint64_t
+value_u64(pmValueSet *vsp)
+{
+    pmAtomValue	av;
+
+    if (vsp->numval != 1)
+	return 0;
+    pmExtractValue(vsp->valfmt, &vsp->vlist[0], PM_TYPE_U64, &av, PM_TYPE_U64);
+    return av.ull;
+}
+
+static long
+maxrss(void)
+{
+    struct rusage	usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+int
+main(int argc, char **argv)
+{
+    struct addrinfo	hints, *target;
+    struct timeval	start, now;
+    pmResult		*result;
+    pmAtomValue		av;
+    pmValueSet		*vsp;
+    pmDesc		desc;
+    pmID		pmid;
+    double		**values, worst[NQUANTILES] = { 0 };
+    double		elapsed, ahead, exact, error, fetchtime = 0;
+    __uint64_t		before, after, last, nsbefore, nsafter, sent;
+    const char		*host, *name;
+    char		*endnum, *iname, service[16], buf[64];
+    long		rss;
+    int			c, i, j, k, fd, len, sts, idle;
+
+    while ((c = pmGetOptions(argc, argv, &opts)) != EOF) {
+	switch (c) {
+	case 'c':
+	    count = (int)strtol(opts.optarg, &endnum, 10);
+	    if (*endnum != '\0' || count < 1) {
+		pmprintf("%s: -c requires a positive numeric argument\n",
+			pmGetProgname());
+		opts.errors++;
+	    }
+	    break;
+	case 'd':
+	    if (strcmp(opts.optarg, "uniform") == 0)
+		distribution = UNIFORM;
+	    else if (strcmp(opts.optarg, "exponential") == 0)
+		distribution = EXPONENTIAL;
+	    else if (strcmp(opts.optarg, "lognormal") == 0)
+		distribution = LOGNORMAL;
+	    else {
+		pmprintf("%s: unknown distribution \"%s\"\n",
+			pmGetProgname(), opts.optarg);
+		opts.errors++;
+	    }
+	    break;
+	case 'm':
+	    nmetrics = (int)strtol(opts.optarg, &endnum, 10);
+	    if (*endnum != '\0' || nmetrics < 1) {
+		pmprintf("%s: -m requires a positive numeric argument\n",
+			pmGetProgname());
+		opts.errors++;
+	    }
+	    break;
+	case 'P':
+	    port = (int)strtol(opts.optarg, &endnum, 10);
+	    if (*endnum != '\0' || port < 1 || port > 65535) {
+		pmprintf("%s: -P requires a port number argument\n",
+			pmGetProgname());
+		opts.errors++;
+	    }
+	    break;
+	case 'r':
+	    rate = strtod(opts.optarg, &endnum);
+	    if (*endnum != '\0' || rate <= 0) {
+		pmprintf("%s: -r requires a positive numeric argument\n",
+			pmGetProgname());
+		opts.errors++;
+	    }
+	    break;
+	default:
+	    opts.errors++;
+	    break;
+	}
+    }
+    if (opts.errors || opts.optind != argc) {
+	pmUsageMessage(&opts);
+	exit(1);
+    }
+
+    if (opts.context == PM_CONTEXT_LOCAL) {
+	host = "localhost";
+	sts = pmNewContext(PM_CONTEXT_LOCAL, NULL);
+    } else {
+	host = opts.nhosts > 0 ? opts.hosts[0] : "localhost";
+	sts = pmNewContext(PM_CONTEXT_HOST, host);
+    }
+    if (sts < 0) {
+	fprintf(stderr, "%s: cannot create context: %s\n",
+		pmGetProgname(), pmErrStr(sts));
+	exit(1);
+    }
+    if ((sts = pmLookupName(3, names, pmids)) < 0) {
+	fprintf(stderr, "%s: statsd.pmda metrics: %s\n", pmGetProgname(), pmErrStr(sts));
+	exit(1);
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    pmsprintf(service, sizeof(service), "%d", port);
+    if ((sts = getaddrinfo(host, service, &hints, &target)) != 0) {
+	fprintf(stderr, "%s: %s: %s\n", pmGetProgname(), host, gai_strerror(sts));
+	exit(1);
+    }
+    if ((fd = socket(target->ai_family, SOCK_DGRAM, 0)) < 0) {
+	fprintf(stderr, "socket: %s\n", osstrerror());
+	exit(1);
+    }
+
+    if ((values = (double **)calloc(nmetrics, sizeof(double *))) == NULL) {
+	fprintf(stderr, "%s: out of memory\n", pmGetProgname());
+	exit(1);
+    }
+    for (j = 0; j < nmetrics; j++) {
+	if ((values[j] = (double *)malloc(count * sizeof(double))) == NULL) {
+	    fprintf(stderr, "%s: out of memory\n", pmGetProgname());
+	    exit(1);
+	}
+	for (i = 0; i < count; i++)
+	    values[j][i] = random_duration();
+    }
+
+    result = fetch(3, pmids);
+    before = value_u64(result->vset[0]);
+    nsbefore = value_u64(result->vset[1]);
+    if (result->vset[2]->numval == 1)
+	printf("duration aggregation: %s\n", result->vset[2]->vlist[0].value.pval->vbuf);
+    pmFreeResult(result);
+    rss = maxrss();
+
+    /* interleave the metrics, as updates from many clients would be */
+    pmtimevalNow(&start);
+    sent = (__uint64_t)count * nmetrics;
+    for (k = 0; k < sent; k++) {
+	i = k / nmetrics;
+	j = k % nmetrics;
+	len = pmsprintf(buf, sizeof(buf), "duration_bench.metric%d:%.0f|ms",
+			j, values[j][i]);
+	if (sendto(fd, buf, len, 0, target->ai_addr, target->ai_addrlen) < 0) {
+	    if (oserror() == ENOBUFS || oserror() == EAGAIN) {
+		k--;
+		continue;
+	    }
+	    fprintf(stderr, "sendto: %s\n", osstrerror());
+	    exit(1);
+	}
+	if (k % BURST == BURST - 1) {
+	    pmtimevalNow(&now);
+	    elapsed = pmtimevalSub(&now, &start);
+	    ahead = (k + 1) / rate - elapsed;
+	    if (ahead > 0)
+		usleep((useconds_t)(ahead * 1000000));
+	}
+    }
+    close(fd);
+
+    for (last = before, idle = 0; idle < 10; last = after) {
+	usleep(100000);
+	result = fetch(2, pmids);
+	after = value_u64(result->vset[0]);
+	nsafter = value_u64(result->vset[1]);
+	pmFreeResult(result);
+	if (after - before >= sent)
+	    break;
+	idle = (after == last) ? idle + 1 : 0;
+    }
+    if (after - before != sent) {
+	printf("aggregated %llu of %llu values sent, try a lower -r\n",
+		(unsigned long long)(after - before), (unsigned long long)sent);
+	errors++;
+    }
+    printf("aggregation: %.0f ns per value\n",
+		after > before ? (double)(nsafter - nsbefore) / (after - before) : 0.0);
+
+    for (j = 0; j < nmetrics; j++) {
+	pmsprintf(buf, sizeof(buf), "statsd.duration_bench.metric%d", j);
+	name = buf;
+	if ((sts = pmLookupName(1, &name, &pmid)) < 0 ||
+	    (sts = pmLookupDesc(pmid, &desc)) < 0) {
+	    fprintf(stderr, "%s: %s: %s\n", pmGetProgname(), name, pmErrStr(sts));
+	    errors++;
+	    continue;
+	}
+	pmtimevalNow(&start);
+	result = fetch(1, &pmid);
+	pmtimevalNow(&now);
+	fetchtime += pmtimevalSub(&now, &start);
+
+	qsort(values[j], count, sizeof(double), compare);
+	vsp = result->vset[0];
+	for (i = 0; i < vsp->numval; i++) {
+	    if (pmNameInDom(desc.indom, vsp->vlist[i].inst, &iname) < 0)
+		continue;
+	    pmExtractValue(vsp->valfmt, &vsp->vlist[i], desc.type, &av, PM_TYPE_DOUBLE);
+	    if (strcmp(iname, "/count") == 0 && av.d != count) {
+		printf("%s: count %.0f, expected %d\n", name, av.d, count);
+		errors++;
+	    }
+	    for (k = 0; k < NQUANTILES; k++) {
+		if (strcmp(iname, quantiles[k]) != 0)
+		    continue;
+		exact = exact_quantile(values[j], fractions[k]);
+		error = fabs(av.d - exact) / (exact > 0 ? exact : 1);
+		if (error > worst[k])
+		    worst[k] = error;
+	    }
+	    free(iname);
+	}
+	pmFreeResult(result);
+    }
+    printf("fetch: %.3f msec per metric\n", 1000 * fetchtime / nmetrics);
+    if (opts.context == PM_CONTEXT_LOCAL)
+	printf("memory: %.1f KB per metric (maximum resident size growth)\n",
+		(double)(maxrss() - rss) / nmetrics);
+    printf("largest relative error:\n");
+    for (k = 0; k < NQUANTILES; k++)
+	printf("    %-16s %.6f\n", quantiles[k], worst[k]);
+
+    for (j = 0; j < nmetrics; j++)
+	free(values[j]);
+    free(values);
+    freeaddrinfo(target);
+    if (errors)
+	printf("%d errors\n", errors);
+    return errors != 0;
+}
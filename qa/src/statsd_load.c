@@ -0,0 +1,250 @@
+/*
+ * Copyright (c) 2021 Red Hat.
+ *
+ * Load generator for pmdastatsd, reporting sustained packet rate and
+ * drop rate.
+ *
+ * Each sender thread sends count datagrams of one counter update each,
+ * cycling through -m metric names, from its own socket (so with several
+ * pmdastatsd listener threads the kernel can spread them across the
+ * listener sockets).  The rate sent is optionally limited with -r.
+ * statsd.pmda.received is fetched before and after (waiting for the
+ * agent to catch up), and the difference from the number sent is
+ * reported as dropped.
+ */
+
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <pcp/pmapi.h>
+
+static pmLongOptions longopts[] = {
+    PMAPI_OPTIONS_HEADER("Options"),
+    PMOPT_DEBUG,
+    PMOPT_HOST,
+    PMOPT_LOCALPMDA,
+    PMOPT_SPECLOCAL,
+    { "count", 1, 'c', "N", "datagrams sent by each sender [default 100000]" },
+    { "metrics", 1, 'm', "N", "number of distinct metric names [default 100]" },
+    { "port", 1, 'P', "N", "pmdastatsd UDP port [default 8125]" },
+    { "rate", 1, 'r', "N", "total datagrams per second [default unlimited]" },
+    { "senders", 1, 'w', "N", "sender threads [default 1]" },
+    PMOPT_HELP,
+    PMAPI_OPTIONS_END
+};
+
+static pmOptions opts = {
+    .short_options = "c:D:h:K:Lm:P:r:w:?",
+    .long_options = longopts,
+    .short_usage = "[options]",
+};
+
+#define BURST	100	/* datagrams sent between rate checks */
+
+static const char	*received = "statsd.pmda.received";
+static pmID		pmid;
+static struct addrinfo	*target;
+static int		count = 100000;
+static int		nmetrics = 100;
+static int		port = 8125;
+static double		rate;
+static int		nsenders = 1;
+
+static void *
+sender(void *arg)
+{
+    struct timeval	start, now;
+    double		elapsed, ahead;
+    char		buf[64];
+    int			id = (int)(long)arg;
+    int			fd, i, len;
+
+    if ((fd = socket(target->ai_family, SOCK_DGRAM, 0)) < 0) {
+	fprintf(stderr, "socket: %s\n", osstrerror());
+	exit(1);
+    }
+    pmtimevalNow(&start);
+    for (i = 0; i < count; i++) {
+	len = pmsprintf(buf, sizeof(buf), "statsd_load.counter%d:1|c",
+			(id + i) % nmetrics);
+	if (sendto(fd, buf, len, 0, target->ai_addr, target->ai_addrlen) < 0) {
+	    if (oserror() == ENOBUFS || oserror() == EAGAIN) {
+		i--;
+		continue;
+	    }
+	    fprintf(stderr, "sendto: %s\n", osstrerror());
+	    exit(1);
+	}
+	if (rate > 0 && i % BURST == BURST - 1) {
+	    /* each sender sends its share of the total rate */
+	    pmtimevalNow(&now);
+	    elapsed = pmtimevalSub(&now, &start);
+	    ahead = (i + 1) * nsenders / rate - elapsed;
+	    if (ahead > 0)
+		usleep((useconds_t)(ahead * 1000000));
+	}
+    }
+    close(fd);
+    return NULL;
+}
+
+static __uint64_t
+fetch_received(void)
+{
+    pmResult	*result;
+    pmAtomValue	av;
+    int		sts;
+
+    if ((sts = pmFetch(1, &pmid, &result)) < 0) {
+	fprintf(stderr, "pmFetch(%s): %s\n", received, pmErrStr(sts));
+	exit(1);
+    }
+    if (result->vset[0]->numval != 1) {
+	fprintf(stderr, "%s: no value\n", received);
+	exit(1);
+    }
+    pmExtractValue(result->vset[0]->valfmt, &result->vset[0]->vlist[0],
+		    PM_TYPE_U64, &av, PM_TYPE_U64);
+    pmFreeResult(result);
+    return av.ull;
+}
+
+int
+main(int argc, char **argv)
+{
+    struct addrinfo	hints;
+    struct timeval	start, end;
+    pthread_t		*threads;
+    __uint64_t		before, after, last;
+    double		elapsed, sent;
+    const char		*host;
+    char		*endnum, service[16];
+    int			c, i, sts, idle;
+
+    while ((c = pmGetOptions(argc, argv, &opts)) != EOF) {
+	switch (c) {
+	case 'c':
+	    count = (int)strtol(opts.optarg, &endnum, 10);
+	    if (*endnum != '\0' || count < 1) {
+		pmprintf("%s: -c requires a positive numeric argument\n",
+			pmGetProgname());
+		opts.errors++;
+	    }
+	    break;
+	case 'm':
+	    nmetrics = (int)strtol(opts.optarg, &endnum, 10);
+	    if (*endnum != '\0' || nmetrics < 1) {
+		pmprintf("%s: -m requires a positive numeric argument\n",
+			pmGetProgname());
+		opts.errors++;
+	    }
+	    break;
+	case 'P':
+	    port = (int)strtol(opts.optarg, &endnum, 10);
+	    if (*endnum != '\0' || port < 1 || port > 65535) {
+		pmprintf("%s: -P requires a port number argument\n",
+			pmGetProgname());
+		opts.errors++;
+	    }
+	    break;
+	case 'r':
+	    rate = strtod(opts.optarg, &endnum);
+	    if (*endnum != '\0' || rate <= 0) {
+		pmprintf("%s: -r requires a positive numeric argument\n",
+			pmGetProgname());
+		opts.errors++;
+	    }
+	    break;
+	case 'w':
+	    nsenders = (int)strtol(opts.optarg, &endnum, 10);
+	    if (*endnum != '\0' || nsenders < 1) {
+		pmprintf("%s: -w requires a positive numeric argument\n",
+			pmGetProgname());
+		opts.errors++;
+	    }
+	    break;
+	default:
+	    opts.errors++;
+	    break;
+	}
+    }
+    if (opts.errors || opts.optind != argc) {
+	pmUsageMessage(&opts);
+	exit(1);
+    }
+
+    if (opts.context == PM_CONTEXT_LOCAL) {
+	host = "localhost";
+	sts = pmNewContext(PM_CONTEXT_LOCAL, NULL);
+    } else {
+	host = opts.nhosts > 0 ? opts.hosts[0] : "localhost";
+	sts = pmNewContext(PM_CONTEXT_HOST, host);
+    }
+    if (sts < 0) {
+	fprintf(stderr, "%s: cannot create context: %s\n",
+		pmGetProgname(), pmErrStr(sts));
+	exit(1);
+    }
+    if ((sts = pmLookupName(1, &received, &pmid)) < 0) {
+	fprintf(stderr, "%s: %s: %s\n", pmGetProgname(), received, pmErrStr(sts));
+	exit(1);
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    pmsprintf(service, sizeof(service), "%d", port);
+    if ((sts = getaddrinfo(host, service, &hints, &target)) != 0) {
+	fprintf(stderr, "%s: %s: %s\n", pmGetProgname(), host, gai_strerror(sts));
+	exit(1);
+    }
+    if ((threads = (pthread_t *)calloc(nsenders, sizeof(pthread_t))) == NULL) {
+	fprintf(stderr, "%s: out of memory\n", pmGetProgname());
+	exit(1);
+    }
+
+    before = fetch_received();
+    pmtimevalNow(&start);
+    for (i = 0; i < nsenders; i++) {
+	if (pthread_create(&threads[i], NULL, sender, (void *)(long)i) != 0) {
+	    fprintf(stderr, "pthread_create: %s\n", osstrerror());
+	    exit(1);
+	}
+    }
+    for (i = 0; i < nsenders; i++)
+	pthread_join(threads[i], NULL);
+    pmtimevalNow(&end);
+    elapsed = pmtimevalSub(&end, &start);
+    sent = (double)count * nsenders;
+
+    /*
+     * Wait until the agent has processed everything it is going to,
+     * the received rate being up to the last change seen.
+     */
+    for (last = before, idle = 0; idle < 10; ) {
+	usleep(100000);
+	after = fetch_received();
+	if (after == last)
+	    idle++;
+	else {
+	    pmtimevalNow(&end);
+	    idle = 0;
+	}
+	if (after - before >= sent)
+	    break;
+	last = after;
+    }
+
+    printf("%-10s %12s %14s\n", "", "datagrams", "rate/sec");
+    printf("%-10s %12.0f %14.0f\n", "sent", sent,
+		elapsed > 0 ? sent / elapsed : 0.0);
+    elapsed = pmtimevalSub(&end, &start);
+    printf("%-10s %12.0f %14.0f\n", "received", (double)(after - before),
+		elapsed > 0 ? (after - before) / elapsed : 0.0);
+    printf("dropped %.0f (%.2f%%)\n", sent - (after - before),
+		100.0 * (sent - (after - before)) / sent);
+
+    freeaddrinfo(target);
+    free(threads);
+    return 0;
+}
@@ -0,0 +1,55 @@
+#!/usr/bin/env pmpython
+# -*- coding: utf-8 -*-
+
+# Exercises multiple listener, parser and aggregator threads
+
+import sys
+import socket
+import glob
+import os
+import time
+
+utils_path = os.path.abspath(os.path.join("utils"))
+sys.path.append(utils_path)
+
+import pmdastatsd_test_utils as utils
+
+utils.print_test_file_separator()
+print(os.path.basename(__file__))
+
+ip = "0.0.0.0"
+port = 8125
+senders = 4
+n = 500
+
+testconfigs = [utils.configs["threads"][0], utils.configs["threads"][1]]
+
+def send_payloads():
+    # each sender has its own socket, so they may reach different listeners
+    socks = [socket.socket(socket.AF_INET, socket.SOCK_DGRAM) for i in range(senders)]
+    for i in range(n):
+        for j, sock in enumerate(socks):
+            sock.sendto("test_threads_counter{}:1|c".format(i % 10).encode("utf-8"), (ip, port))
+            sock.sendto("test_threads_labeled:2|c|#sender:{}".format(j).encode("utf-8"), (ip, port))
+        if i % 10 == 9:
+            time.sleep(0.05)
+    time.sleep(1)
+
+def run_test():
+    for testconfig in testconfigs:
+        utils.print_test_section_separator()
+        utils.pmdastatsd_install(testconfig)
+        send_payloads()
+        for i in range(10):
+            utils.print_metric("statsd.test_threads_counter{}".format(i))
+        # instance numbers depend on which sender was seen first
+        labels_output = utils.request_metric("statsd.test_threads_labeled")
+        output = utils.get_instances(labels_output)
+        for k, v in output.items():
+            print(k, v)
+        utils.print_metric("statsd.pmda.received")
+        utils.print_metric("statsd.pmda.dropped")
+        utils.pmdastatsd_remove()
+        utils.restore_config()
+
+run_test()
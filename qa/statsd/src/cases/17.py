@@ -0,0 +1,51 @@
+#!/usr/bin/env pmpython
+# -*- coding: utf-8 -*-
+
+# Exercises median and percentiles of duration metrics with each aggregation type,
+# against exact values computed by the statsd_duration_bench program
+
+import sys
+import os
+import subprocess
+
+utils_path = os.path.abspath(os.path.join("utils"))
+sys.path.append(utils_path)
+
+import pmdastatsd_test_utils as utils
+
+utils.print_test_file_separator()
+print(os.path.basename(__file__))
+
+bench = os.path.abspath(os.path.join("..", "..", "src", "statsd_duration_bench"))
+# slow enough that no datagrams are lost, so the agent sees every value
+command = [bench, "-c", "2000", "-m", "5", "-r", "2000"]
+
+# largest relative error expected of each aggregation type
+testconfigs = [
+    (utils.configs["duration_aggregation_type"][0], 0),
+    (utils.configs["duration_aggregation_type"][1], 0.001),
+    (utils.configs["duration_aggregation_type"][2], 0.01),
+    (utils.configs["duration_sketch_relative_error"][0], 0.05),
+    (utils.configs["duration_sketch_relative_error"][1], 0.002)
+]
+
+def run_test():
+    for testconfig, bound in testconfigs:
+        utils.print_test_section_separator()
+        utils.pmdastatsd_install(testconfig)
+        output = subprocess.run(command, stdout=subprocess.PIPE, universal_newlines=True).stdout
+        sys.stderr.write(output)
+        for line in output.splitlines():
+            fields = line.split()
+            if line.startswith("duration aggregation:") or "errors" in line or "count" in line:
+                print(line)
+            elif len(fields) == 2 and fields[0].startswith("/"):
+                # allow for rounding in printing the error
+                if float(fields[1]) <= bound + 0.000001:
+                    print(fields[0], "OK")
+                else:
+                    print(fields[0], fields[1])
+        utils.pmdastatsd_remove()
+        utils.restore_config()
+
+run_test()
@@ -53,6 +53,21 @@ duration_aggregation_type = 0
 """
 [global]
 duration_aggregation_type = 1
+""",
+"""
+[global]
+duration_aggregation_type = 2
+"""],
+	"duration_sketch_relative_error": [
+"""
+[global]
+duration_aggregation_type = 2
+duration_sketch_relative_error = 0.05
+""",
+"""
+[global]
+duration_aggregation_type = 2
+duration_sketch_relative_error = 0.002
 """],
 	"max_udp_packet_size": [
 """
@@ -93,6 +108,19 @@ port = 8125
 """
 [global]
 port = 8126
+"""],
+	"threads": [
+"""
+[global]
+listener_threads = 2
+parser_threads = 2
+aggregator_threads = 4
+""",
+"""
+[global]
+listener_threads = 4
+parser_threads = 3
+aggregator_threads = 1
 """],
 	"verbose": [
 """
@@ -187,6 +187,9 @@ PCP_CALL extern int __pmAddPMNSNode(__pmnsTree *, int, const char *);
 /* return true if the named pmns file has changed */
 PCP_CALL extern int __pmHasPMNSFileChanged(const char *);
 
+/* write a compiled image of the loaded PMNS, for the named pmns file */
+PCP_CALL extern int __pmWritePMNSImage(const char *);
+
 /* PDU types */
 #define PDU_START		0x7000
 #define PDU_ERROR		PDU_START
@@ -658,6 +661,11 @@ typedef struct __pmLogHdr {
  * as well as buffer allocation, 
  * the namelist has been allocated separately and so
  * both the buf and namelist should be freed.
+ *
+ * When an archive is opened using its metadata index (.mindex), the
+ * records are not read until they are needed ... until then, pending
+ * is the offset of the record in the .meta file, and only stamp and
+ * next are valid.
  */
 typedef struct __pmLogInDom {
     struct __pmLogInDom	*next;
@@ -667,6 +675,7 @@ typedef struct __pmLogInDom {
     char		**namelist;
     int			*buf; 
     int			allinbuf; 
+    __pm_off_t		pending;	/* not loaded, see above */
 } __pmLogInDom;
 
 /*
@@ -701,6 +710,10 @@ typedef struct __pmLogText {
  *	jsonb offset (int)
  *	jsonb length (int)
  *	label[0] ... label[nlabels-1] (struct pmLabel)
+ *
+ * As for __pmLogInDom, pending is non-zero for a record that has not
+ * been loaded from the .meta file yet, when nsets and labelsets are
+ * not valid.
  */
 typedef struct __pmLogLabelSet {
     struct __pmLogLabelSet *next;
@@ -709,6 +722,7 @@ typedef struct __pmLogLabelSet {
     int			ident;
     int			nsets;
     pmLabelSet		*labelsets;
+    __pm_off_t		pending;	/* not loaded, see above */
 } __pmLogLabelSet;
 
 /*
@@ -766,6 +780,10 @@ typedef struct {
     __pmLogTI	*l_ti;		/* (when reading) temporal index */
     struct __pmnsTree	*l_pmns;        /* namespace from meta data */
     int		l_multi;	/* part of a multi-archive context */
+    const char	*l_compress;	/* (when writing) compression suffix for */
+				/* data volumes, NULL for none */
+    __pmFILE	*l_mifp;	/* (when writing) metadata index, NULL */
+				/* for none */
 } __pmLogCtl;
 
 /* l_state values */
@@ -798,7 +816,7 @@ typedef struct {
     void		*ac_want;	/* used in interp.c */
     void		*ac_unbound;	/* used in interp.c */
     void		*ac_cache;	/* used in interp.c */
-    int			ac_cache_idx;	/* used in interp.c */
+    int			ac_cache_idx;	/* unused, retained for the ABI */
     /*
      * These were added to the ABI in order to support multiple archives
      * in a single context.
@@ -868,6 +886,7 @@ typedef struct {
 PCP_CALL extern int __pmLogChkLabel(__pmArchCtl *, __pmFILE *, __pmLogLabel *, int);
 PCP_CALL extern int __pmLogCreate(const char *, const char *, int, __pmArchCtl *);
 PCP_CALL extern __pmFILE *__pmLogNewFile(const char *, int);
+PCP_CALL extern __pmFILE *__pmLogNewFileCompress(const char *, int, const char *);
 PCP_CALL extern void __pmLogClose(__pmArchCtl *);
 PCP_CALL extern int __pmLogPutDesc(__pmArchCtl *, const pmDesc *, int, char **);
 PCP_CALL extern int __pmLogPutInDom(__pmArchCtl *, pmInDom, const pmTimeval *, int, int *, char **);
@@ -879,6 +898,9 @@ PCP_CALL extern int __pmLogPutText(__pmArchCtl *, unsigned int , unsigned int, c
 PCP_CALL extern int __pmLogWriteLabel(__pmFILE *, const __pmLogLabel *);
 PCP_CALL extern int __pmLogLoadLabel(__pmArchCtl *, const char *);
 PCP_CALL extern int __pmLogLoadMeta(__pmArchCtl *);
+PCP_CALL extern int __pmLogLoadAllMeta(__pmArchCtl *);
+PCP_CALL extern int __pmLogCreateMetaIndex(const char *, __pmArchCtl *);
+PCP_CALL extern int __pmLogWriteMetaIndex(__pmArchCtl *);
 PCP_CALL extern int __pmLogAddDesc(__pmArchCtl *, const pmDesc *);
 PCP_CALL extern int __pmLogAddInDom(__pmArchCtl *, const pmTimespec *, const pmInResult *, int *, int);
 PCP_CALL extern int __pmLogAddPMNSNode(__pmArchCtl *, pmID, const char *);
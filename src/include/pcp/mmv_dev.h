@@ -18,7 +18,7 @@
 
 #define MMV_VERSION1	1	/* original on-disk format */
 #define MMV_VERSION2	2	/* + mmv_disk_{metric2,instance2}_t */
-#define MMV_VERSION3	3	/* + labels support */
+#define MMV_VERSION3	3	/* + labels and striped values support */
 #define MMV_VERSION     1	/* default, upgrading to v3 only if needed */
 
 typedef enum mmv_toc_type {
@@ -28,6 +28,7 @@ typedef enum mmv_toc_type {
     MMV_TOC_VALUES	= 4,	/* mmv_disk_value_t */
     MMV_TOC_STRINGS	= 5,	/* mmv_disk_string_t */
     MMV_TOC_LABELS	= 6,	/* mmv_disk_label_t */
+    MMV_TOC_STRIPES	= 7,	/* mmv_disk_stripes_t */
 } mmv_toc_type_t;
 
 /* The way the Table Of Contents is written into the file */
@@ -70,6 +71,21 @@ typedef struct mmv_disk_label {
     char              payload[MMV_LABELMAX];
 } mmv_disk_label_t;
 
+/*
+ * Striped values have a slot in each of "count" stripes (one per CPU,
+ * each starting on a cache line) as well as in the values section, and
+ * the value of the metric is the sum of all of them.  The value "extra"
+ * field holds the offset of its slot in the first stripe.
+ */
+#define MMV_STRIPE_ALIGN	64	/* stripes start on a cache line */
+
+typedef struct mmv_disk_stripes {
+    __uint32_t		count;		/* Number of stripes */
+    __uint32_t		slots;		/* Number of values in each stripe */
+    __uint64_t		size;		/* Bytes from one stripe to the next */
+    __uint64_t		offset;		/* Offset of first stripe */
+} mmv_disk_stripes_t;
+
 typedef struct mmv_disk_metric {
     char		name[MMV_NAMEMAX];
     __uint32_t		item;		/* Unique identifier */
@@ -96,7 +112,7 @@ typedef struct mmv_disk_metric2 {
 
 typedef struct mmv_disk_value {
     pmAtomValue		value;		/* Union of all possible value types */
-    __int64_t		extra;		/* INTEGRAL(starttime)/STRING(offset) */
+    __int64_t		extra;		/* INTEGRAL(starttime)/STRING(offset)/stripe */
     __uint64_t		metric;		/* Offset into the metric section */
     __uint64_t		instance;	/* Offset into the instance section */
 } mmv_disk_value_t;
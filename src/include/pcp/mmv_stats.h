@@ -142,6 +142,7 @@ extern int mmv_stats_add_metric_label(mmv_registry_t *,
 		int, const char *, const char *, mmv_value_type_t, int);
 extern int mmv_stats_add_instance_label(mmv_registry_t *,
 		int, int, const char *, const char *, mmv_value_type_t, int);
+extern int mmv_stats_add_metric_stripes(mmv_registry_t *, int);
 
 extern void * mmv_stats_start(mmv_registry_t *);
 extern void mmv_stats_free(mmv_registry_t *);
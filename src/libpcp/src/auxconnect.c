@@ -26,6 +26,9 @@
 #endif
 #define SOCKET_INTERNAL
 #include "internal.h"
+#ifdef HAVE_POLL_H
+#include <poll.h>
+#endif
 
 /* default connect timeout is 5 seconds */
 static struct timeval	conn_wait = { 5, 0 };
@@ -1634,11 +1637,34 @@ __pmRecv(int socket, void *buffer, size_t length, int flags)
 int
 __pmSocketReady(int fd, struct timeval *timeout)
 {
+    return __pmSocketReadable(fd, timeout);
+}
+
+#endif /* !HAVE_SECURE_SOCKETS */
+
+/*
+ * Wait for input on a single descriptor, with select(2) semantics.
+ * Uses poll(2) where available so that descriptors beyond FD_SETSIZE
+ * (e.g. in a pmcd with thousands of clients) can be waited on safely.
+ */
+int
+__pmSocketReadable(int fd, struct timeval *timeout)
+{
+#ifdef HAVE_POLL_H
+    struct pollfd	onefd;
+    int			msec = -1;
+
+    if (timeout != NULL)
+	msec = timeout->tv_sec * 1000 + (timeout->tv_usec + 999) / 1000;
+    onefd.fd = fd;
+    onefd.events = POLLIN;
+    onefd.revents = 0;
+    return poll(&onefd, 1, msec);
+#else
     __pmFdSet	onefd;
 
     FD_ZERO(&onefd);
     FD_SET(fd, &onefd);
     return select(fd+1, &onefd, NULL, NULL, timeout);
+#endif
 }
-
-#endif /* !HAVE_SECURE_SOCKETS */
@@ -532,6 +532,16 @@ extern const char *compress_suffix_list(void);
 #else
 #define LZMA_DECOMPRESS		disabled
 #endif
+#if defined(HAVE_ZSTD_DECOMPRESSION)
+#define ZSTD_DECOMPRESS		enabled
+#else
+#define ZSTD_DECOMPRESS		disabled
+#endif
+#if defined(HAVE_LZ4_DECOMPRESSION)
+#define LZ4_DECOMPRESS		enabled
+#else
+#define LZ4_DECOMPRESS		disabled
+#endif
 #if defined(HAVE_TRANSPARENT_DECOMPRESSION)
 #define TRANSPARENT_DECOMPRESS	enabled
 #else
@@ -564,6 +574,8 @@ static struct {
 	{ "lzma_decompress",	LZMA_DECOMPRESS },		/* from pcp-4.0.0 */
 	{ "transparent_decompress", TRANSPARENT_DECOMPRESS },	/* from pcp-4.0.0 */
 	{ "compress_suffixes",	compress_suffix_list },		/* from pcp-4.0.1 */
+	{ "zstd_decompress",	ZSTD_DECOMPRESS },		/* from pcp-5.3.1 */
+	{ "lz4_decompress",	LZ4_DECOMPRESS },		/* from pcp-5.3.1 */
 };
 
 void
@@ -27,6 +27,11 @@ typedef struct {		/* one value in the expression tree */
     int		vlen;		/* from vlen of pmValueBlock for string and aggregates */
 } val_t;
 
+typedef struct {		/* one step in the evaluation of an expression */
+    struct node		*np;
+    int			up;		/* index of parent's step, -1 for the root */
+} step_t;
+
 typedef struct {		/* dynamic information for an expression node */
     pmID		pmid;
     int			numval;		/* length of ivlist[] */
@@ -38,6 +43,12 @@ typedef struct {		/* dynamic information for an expression node */
     int			last_numval;	/* length of last_ivlist[] */
     val_t		*last_ivlist;	/* values from previous fetch for delta() or rate() */
     struct timeval	last_stamp;	/* timestamp from previous fetch for rate() */
+    int			maxval;		/* allocated length of ivlist[] */
+    int			last_maxval;	/* allocated length of last_ivlist[] */
+    int			jsize;		/* slots in join[], 0 or a power of 2 */
+    int			*join;		/* inst -> 1 + operand ivlist[] index */
+    int			nstep;		/* length of plan[] */
+    step_t		*plan;		/* evaluation order, root node only */
 } info_t;
 
 typedef struct {			/* for instance filtering */
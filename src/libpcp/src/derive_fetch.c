@@ -26,6 +26,8 @@
 
 extern const int promote[6][6];
 
+static void build_plan(node_t *);
+
 static void
 get_pmids(node_t *np, int *cnt, pmID **list)
 {
@@ -86,6 +88,8 @@ __dmprefetch(__pmContext *ctxp, int numpmid, const pmID *pmidlist, pmID **newlis
 		if ((cp->mlist[i].flags & DM_BIND) == 0)
 		    __dmbind(PM_NOT_LOCKED, ctxp, i, 1);
 		if (cp->mlist[i].expr != NULL) {
+		    if (cp->mlist[i].expr->data.info->plan == NULL)
+			build_plan(cp->mlist[i].expr);
 		    get_pmids(cp->mlist[i].expr, &xtracnt, &xtralist);
 		    cp->fetch_has_dm = 1;
 		}
@@ -152,59 +156,136 @@ __dmprefetch(__pmContext *ctxp, int numpmid, const pmID *pmidlist, pmID **newlis
 }
 
 /*
- * Free the old ivlist[] (if any) ... may need to walk the list because
- * the pmAtomValues may have buffers attached in the type STRING,
- * type AGGREGATE* and type EVENT cases.
+ * Release the values in the old ivlist[] (if any) ... may need to walk
+ * the list because the pmAtomValues may have buffers attached in the
+ * type STRING, type AGGREGATE* and type EVENT cases.
+ * The ivlist[] buffer itself is kept for the next fetch, see need_ivlist().
  * Includes logic to save one history sample (for delta() and rate()).
  */
 static void
 free_ivlist(node_t *np)
 {
+    info_t	*ip = np->data.info;
+    val_t	*tmp;
+    int		max;
     int		i;
 
-    assert(np->data.info != NULL);
+    assert(ip != NULL);
 
     if (np->save_last) {
 	/*
-	 * saving history for delta() or rate() ... release previous
-	 * sample, and save this sample
+	 * saving history for delta() or rate() ... this sample becomes
+	 * the previous sample, and the buffer from the previous sample
+	 * is reused for the next one (no STRING, AGGREGATE or EVENT
+	 * types for delta() or rate(), so nothing to free)
 	 */
-	if (np->data.info->last_ivlist != NULL) {
-	    /*
-	     * no STRING, AGGREGATE or EVENT types for delta() or rate()
-	     * so simple free()
-	     */
-	    free(np->data.info->last_ivlist);
-	}
-	np->data.info->last_numval = np->data.info->numval;
-	np->data.info->last_ivlist = np->data.info->ivlist;
-	np->data.info->ivlist = NULL;
+	tmp = ip->last_ivlist;
+	max = ip->last_maxval;
+	ip->last_numval = ip->numval;
+	ip->last_ivlist = ip->ivlist;
+	ip->last_maxval = ip->maxval;
+	ip->ivlist = tmp;
+	ip->maxval = max;
     }
     else {
 	/* no history */
-	if (np->data.info->ivlist != NULL) {
+	if (ip->ivlist != NULL) {
 	    if (np->desc.type == PM_TYPE_STRING) {
-		for (i = 0; i < np->data.info->numval; i++) {
-		    if (np->data.info->ivlist[i].value.cp != NULL)
-			free(np->data.info->ivlist[i].value.cp);
+		for (i = 0; i < ip->numval; i++) {
+		    if (ip->ivlist[i].value.cp != NULL)
+			free(ip->ivlist[i].value.cp);
 		}
 	    }
 	    else if (np->desc.type == PM_TYPE_AGGREGATE ||
 		     np->desc.type == PM_TYPE_AGGREGATE_STATIC ||
 		     np->desc.type == PM_TYPE_EVENT ||
 		     np->desc.type == PM_TYPE_HIGHRES_EVENT) {
-		for (i = 0; i < np->data.info->numval; i++) {
-		    if (np->data.info->ivlist[i].value.vbp != NULL)
-			free(np->data.info->ivlist[i].value.vbp);
+		for (i = 0; i < ip->numval; i++) {
+		    if (ip->ivlist[i].value.vbp != NULL)
+			free(ip->ivlist[i].value.vbp);
 		}
 	    }
 	}
-	free(np->data.info->ivlist);
-	np->data.info->numval = 0;
-	np->data.info->ivlist = NULL;
+	ip->numval = 0;
+    }
+}
+
+/*
+ * Make sure ivlist[] has room for numval values.  Buffers are kept
+ * from one fetch to the next, and only ever grow.
+ */
+static void
+need_ivlist(node_t *np, int numval, const char *tag)
+{
+    info_t	*ip = np->data.info;
+    val_t	*tmp;
+
+    if (numval <= ip->maxval && ip->ivlist != NULL)
+	return;
+    if (numval < 1)
+	numval = 1;
+    if ((tmp = (val_t *)realloc(ip->ivlist, numval*sizeof(val_t))) == NULL) {
+	pmNoMem(tag, numval*sizeof(val_t), PM_FATAL_ERR);
+	/*NOTREACHED*/
+    }
+    ip->ivlist = tmp;
+    ip->maxval = numval;
+}
+
+/*
+ * Instance join index ... open addressing from an instance to its
+ * position in an operand's ivlist[], so matching the instances of
+ * two operands that are not in the same order is not O(n*m).
+ */
+#define JOIN_SLOT(inst, mask)	(((unsigned int)(inst) * 2654435761U) & (mask))
+
+static void
+build_join(info_t *ip, const val_t *list, int numval)
+{
+    int		size = 16;
+    int		mask;
+    int		i;
+    int		k;
+
+    while (size < 2 * numval)
+	size <<= 1;
+    if (size > ip->jsize) {
+	if (ip->join != NULL)
+	    free(ip->join);
+	if ((ip->join = (int *)malloc(size*sizeof(int))) == NULL) {
+	    pmNoMem("build_join: join", size*sizeof(int), PM_FATAL_ERR);
+	    /*NOTREACHED*/
+	}
+	ip->jsize = size;
+    }
+    else
+	size = ip->jsize;
+    memset(ip->join, 0, size*sizeof(int));
+    mask = size - 1;
+    for (i = 0; i < numval; i++) {
+	for (k = JOIN_SLOT(list[i].inst, mask); ip->join[k] != 0; k = (k + 1) & mask)
+	    ;
+	ip->join[k] = i + 1;
     }
 }
 
+/*
+ * Return the index of the first entry for inst in list[] (which was
+ * indexed with build_join()), else -1
+ */
+static int
+find_join(const info_t *ip, const val_t *list, int inst)
+{
+    int		mask = ip->jsize - 1;
+    int		k;
+
+    for (k = JOIN_SLOT(inst, mask); ip->join[k] != 0; k = (k + 1) & mask) {
+	if (list[ip->join[k] - 1].inst == inst)
+	    return ip->join[k] - 1;
+    }
+    return -1;
+}
+
 /*
  * Binary arithmetic.
  *
@@ -670,46 +751,43 @@ regex_inst_gc(pattern_t *pp)
 }
 
 /*
- * Walk an expression tree, filling in operand values from the
- * pmResult at the leaf nodes and propagating the computed values
- * towards the root node of the tree.
+ * count() ... special case, errors from the operand are mapped to a
+ * value of 0
  */
 static int
-eval_expr(__pmContext *ctxp, node_t *np, pmResult *rp, int level)
+count_error(node_t *np)
+{
+    if (np->data.info->ivlist == NULL) {
+	/* initialize ivlist[] for singular instance first time through */
+	if ((np->data.info->ivlist = (val_t *)malloc(sizeof(val_t))) == NULL) {
+	    pmNoMem("eval_expr: count ivlist", sizeof(val_t), PM_FATAL_ERR);
+	    /*NOTREACHED*/
+	}
+	np->data.info->ivlist[0].inst = PM_IN_NULL;
+    }
+    np->data.info->numval = 1;
+    np->data.info->ivlist[0].value.l = 0;
+    return 1;
+}
+
+/*
+ * Evaluate one node of an expression tree, filling in operand values
+ * from the pmResult at the leaf nodes, else computing the node's
+ * values from those already computed for its operands, see eval_plan().
+ */
+static int
+eval_expr(__pmContext *ctxp, node_t *np, pmResult *rp)
 {
     int		sts;
     int		i;
     int		j;
     int		k;
+    int		joined = 0;
     size_t	need;
     char	strbuf[20];
     pmTimeval	save_origin;
 
     assert(np != NULL);
-    if (np->left != NULL) {
-	sts = eval_expr(ctxp, np->left, rp, level+1);
-	if (sts < 0) {
-	    if (np->type == N_COUNT) {
-		/* count() ... special case, map errors to 0 */
-		if (np->data.info->ivlist == NULL) {
-		    /* initialize ivlist[] for singular instance first time through */
-		    if ((np->data.info->ivlist = (val_t *)malloc(sizeof(val_t))) == NULL) {
-			pmNoMem("eval_expr: count ivlist", sizeof(val_t), PM_FATAL_ERR);
-			/*NOTREACHED*/
-		    }
-		    np->data.info->ivlist[0].inst = PM_IN_NULL;
-		}
-		np->data.info->numval = 1;
-		np->data.info->ivlist[0].value.l = 0;
-		sts = 1;
-	    }
-	    return sts;
-	}
-    }
-    if (np->right != NULL) {
-	sts = eval_expr(ctxp, np->right, rp, level+1);
-	if (sts < 0) return sts;
-    }
 
     /* mostly, np->left is not NULL ... */
     assert (np->type == N_INTEGER || np->type == N_DOUBLE ||
@@ -768,10 +846,7 @@ eval_expr(__pmContext *ctxp, node_t *np, pmResult *rp, int level)
 	    np->data.info->numval = np->left->data.info->numval <= np->left->data.info->last_numval ? np->left->data.info->numval : np->left->data.info->last_numval;
 	    if (np->data.info->numval <= 0)
 		return np->data.info->numval;
-	    if ((np->data.info->ivlist = (val_t *)malloc(np->data.info->numval*sizeof(val_t))) == NULL) {
-		pmNoMem("eval_expr: delta()/rate() ivlist", np->data.info->numval*sizeof(val_t), PM_FATAL_ERR);
-		/*NOTREACHED*/
-	    }
+	    need_ivlist(np, np->data.info->numval, "eval_expr: delta()/rate() ivlist");
 	    /*
 	     * delta()
 	     * ivlist[k] = left->ivlist[i] - left->last_ivlist[j]
@@ -792,11 +867,12 @@ eval_expr(__pmContext *ctxp, node_t *np, pmResult *rp, int level)
 			    i, np->left->data.info->ivlist[i].inst,
 			    j, np->left->data.info->last_ivlist[j].inst);
 		    }
-		    for (j = 0; j < np->left->data.info->last_numval; j++) {
-			if (np->left->data.info->ivlist[i].inst == np->left->data.info->last_ivlist[j].inst)
-			    break;
+		    if (!joined) {
+			build_join(np->data.info, np->left->data.info->last_ivlist, np->left->data.info->last_numval);
+			joined = 1;
 		    }
-		    if (j == np->left->data.info->last_numval) {
+		    j = find_join(np->data.info, np->left->data.info->last_ivlist, np->left->data.info->ivlist[i].inst);
+		    if (j < 0) {
 			/* no match, skip this instance from this result */
 			continue;
 		    }
@@ -905,10 +981,7 @@ eval_expr(__pmContext *ctxp, node_t *np, pmResult *rp, int level)
 	    np->data.info->numval = np->left->data.info->numval;
 	    if (np->data.info->numval <= 0)
 		return np->data.info->numval;
-	    if ((np->data.info->ivlist = (val_t *)malloc(np->data.info->numval*sizeof(val_t))) == NULL) {
-		pmNoMem("eval_expr: N_NOT ivlist", np->data.info->numval*sizeof(val_t), PM_FATAL_ERR);
-		/*NOTREACHED*/
-	    }
+	    need_ivlist(np, np->data.info->numval, "eval_expr: N_NOT ivlist");
 	    /*
 	     * ivlist[i] = ! left->ivlist[i]
 	     */
@@ -943,10 +1016,7 @@ eval_expr(__pmContext *ctxp, node_t *np, pmResult *rp, int level)
 	    np->data.info->numval = np->left->data.info->numval;
 	    if (np->data.info->numval <= 0)
 		return np->data.info->numval;
-	    if ((np->data.info->ivlist = (val_t *)malloc(np->data.info->numval*sizeof(val_t))) == NULL) {
-		pmNoMem("eval_expr: N_NEG ivlist", np->data.info->numval*sizeof(val_t), PM_FATAL_ERR);
-		/*NOTREACHED*/
-	    }
+	    need_ivlist(np, np->data.info->numval, "eval_expr: N_NEG ivlist");
 	    /*
 	     * ivlist[i] = - left->ivlist[i]
 	     */
@@ -1013,10 +1083,7 @@ eval_expr(__pmContext *ctxp, node_t *np, pmResult *rp, int level)
 		if (np->right->right->data.info->numval > numval)
 		    numval = np->right->right->data.info->numval;
 		np->data.info->numval = numval;
-		if ((np->data.info->ivlist = (val_t *)malloc(numval*sizeof(val_t))) == NULL) {
-		    pmNoMem("eval_expr: N_QUEST ivlist", numval*sizeof(val_t), PM_FATAL_ERR);
-		    /*NOTREACHED*/
-		}
+		need_ivlist(np, numval, "eval_expr: N_QUEST ivlist");
 		/*
 		 * if guard, true and false operands are a mix of singular
 		 * values and values with an indom, need to use one of the
@@ -1142,10 +1209,7 @@ eval_expr(__pmContext *ctxp, node_t *np, pmResult *rp, int level)
 	    np->data.info->numval = np->left->data.info->numval;
 	    if (np->data.info->numval <= 0)
 		return np->data.info->numval;
-	    if ((np->data.info->ivlist = (val_t *)malloc(np->data.info->numval*sizeof(val_t))) == NULL) {
-		pmNoMem("eval_expr: N_RESCALE ivlist", np->data.info->numval*sizeof(val_t), PM_FATAL_ERR);
-		/*NOTREACHED*/
-	    }
+	    need_ivlist(np, np->data.info->numval, "eval_expr: N_RESCALE ivlist");
 	    /*
 	     * ivlist[i] = rescale(left->ivlist[i], right->desc.units)
 	     */
@@ -1387,10 +1451,7 @@ eval_expr(__pmContext *ctxp, node_t *np, pmResult *rp, int level)
 		    np->data.info->numval = rp->vset[j]->numval;
 		    if (np->data.info->numval <= 0)
 			return np->data.info->numval;
-		    if ((np->data.info->ivlist = (val_t *)malloc(np->data.info->numval*sizeof(val_t))) == NULL) {
-			pmNoMem("eval_expr: metric ivlist", np->data.info->numval*sizeof(val_t), PM_FATAL_ERR);
-			/*NOTREACHED*/
-		    }
+		    need_ivlist(np, np->data.info->numval, "eval_expr: metric ivlist");
 		    for (i = 0; i < np->data.info->numval; i++) {
 			np->data.info->ivlist[i].inst = rp->vset[j]->vlist[i].inst;
 			switch (np->desc.type) {
@@ -1482,8 +1543,11 @@ eval_expr(__pmContext *ctxp, node_t *np, pmResult *rp, int level)
 	    assert(np->right != NULL);
 	    np->data.info->last_stamp = np->data.info->stamp;
 	    np->data.info->stamp = rp->timestamp;
-	    if (np->left->data.pattern->ftype == F_REGEX)
+	    if (np->left->data.pattern->ftype == F_REGEX) {
 		free_ivlist(np);
+		/* at most one value for each of the right expr's values */
+		need_ivlist(np, np->right->data.info->numval, "eval_expr: PATTERN ivlist");
+	    }
 	    else
 		np->data.info->numval = 0;
 	    for (i = 0; i < np->right->data.info->numval; i++) {
@@ -1556,14 +1620,8 @@ eval_expr(__pmContext *ctxp, node_t *np, pmResult *rp, int level)
 			ip = (instctl_t *)hp->data;
 		    ip->used++;
 		    if (ip->match) {
-			val_t	*tmp_ivlist;
+			np->data.info->ivlist[np->data.info->numval] = np->right->data.info->ivlist[i];
 			np->data.info->numval++;
-			if ((tmp_ivlist = (val_t *)realloc(np->data.info->ivlist, np->data.info->numval*sizeof(val_t))) == NULL) {
-			    pmNoMem("eval_expr: PATTERN ivlist", np->data.info->numval*sizeof(val_t), PM_FATAL_ERR);
-			    /*NOTREACHED*/
-			}
-			np->data.info->ivlist = tmp_ivlist;
-			np->data.info->ivlist[np->data.info->numval-1] = np->right->data.info->ivlist[i];
 		    }
 		}
 		else {
@@ -1618,8 +1676,8 @@ eval_expr(__pmContext *ctxp, node_t *np, pmResult *rp, int level)
 	    /*
 	     * binary operator cases ... always have a left and right
 	     * operand and no errors (these are caught earlier when the
-	     * recursive call on each of the operands would may have
-	     * returned an error
+	     * evaluation of each of the operands would have returned
+	     * an error
 	     */
 	    assert(np->left != NULL);
 	    assert(np->right != NULL);
@@ -1652,10 +1710,7 @@ eval_expr(__pmContext *ctxp, node_t *np, pmResult *rp, int level)
 		else
 		    np->data.info->numval = np->right->data.info->numval;
 	    }
-	    if ((np->data.info->ivlist = (val_t *)malloc(np->data.info->numval*sizeof(val_t))) == NULL) {
-		pmNoMem("eval_expr: expr ivlist", np->data.info->numval*sizeof(val_t), PM_FATAL_ERR);
-		/*NOTREACHED*/
-	    }
+	    need_ivlist(np, np->data.info->numval, "eval_expr: expr ivlist");
 	    /*
 	     * ivlist[k] = left->ivlist[i] <op> right->ivlist[j]
 	     */
@@ -1680,11 +1735,12 @@ eval_expr(__pmContext *ctxp, node_t *np, pmResult *rp, int level)
 				i, np->left->data.info->ivlist[i].inst,
 				j, np->right->data.info->ivlist[j].inst);
 			}
-			for (j = 0; j < np->right->data.info->numval; j++) {
-			    if (np->left->data.info->ivlist[i].inst == np->right->data.info->ivlist[j].inst)
-				break;
+			if (!joined) {
+			    build_join(np->data.info, np->right->data.info->ivlist, np->right->data.info->numval);
+			    joined = 1;
 			}
-			if (j == np->right->data.info->numval) {
+			j = find_join(np->data.info, np->right->data.info->ivlist, np->left->data.info->ivlist[i].inst);
+			if (j < 0) {
 			    /*
 			     * no match, so next instance on left operand,
 			     * and reset to start from first instance of
@@ -1772,6 +1828,99 @@ eval_expr(__pmContext *ctxp, node_t *np, pmResult *rp, int level)
     /*NOTREACHED*/
 }
 
+
+/*
+ * Append the nodes of an expression tree to plan[] in the order they
+ * need to be evaluated (operands before operators), and return the
+ * index of np's step.
+ */
+static int
+fill_plan(step_t *plan, int *nstep, node_t *np)
+{
+    int		left = -1;
+    int		right = -1;
+    int		me;
+
+    if (np->left != NULL)
+	left = fill_plan(plan, nstep, np->left);
+    if (np->right != NULL)
+	right = fill_plan(plan, nstep, np->right);
+    me = (*nstep)++;
+    plan[me].np = np;
+    plan[me].up = -1;
+    if (left >= 0)
+	plan[left].up = me;
+    if (right >= 0)
+	plan[right].up = me;
+    return me;
+}
+
+static int
+count_nodes(node_t *np)
+{
+    if (np == NULL)
+	return 0;
+    return 1 + count_nodes(np->left) + count_nodes(np->right);
+}
+
+/*
+ * Flatten the expression tree for a derived metric into a plan that
+ * can be evaluated with a simple loop on each fetch, rather than
+ * walking the tree.  The plan hangs off the root node.
+ */
+static void
+build_plan(node_t *root)
+{
+    info_t	*ip = root->data.info;
+    int		n = count_nodes(root);
+
+    if ((ip->plan = (step_t *)malloc(n*sizeof(step_t))) == NULL) {
+	pmNoMem("build_plan: plan", n*sizeof(step_t), PM_FATAL_ERR);
+	/*NOTREACHED*/
+    }
+    ip->nstep = 0;
+    fill_plan(ip->plan, &ip->nstep, root);
+    assert(ip->nstep == n);
+}
+
+/*
+ * Evaluate a derived metric's expression, propagating the computed
+ * values from the leaf nodes towards the root node of the tree.
+ *
+ * An error from any node is the result for the whole expression,
+ * unless the node is within the operand of a count(), in which case
+ * the count() is 0 and evaluation continues after the count() node.
+ */
+static int
+eval_plan(__pmContext *ctxp, node_t *root, pmResult *rp)
+{
+    step_t	*plan;
+    int		nstep;
+    int		sts = 0;
+    int		k;
+    int		up;
+
+    if (root->data.info->plan == NULL)
+	build_plan(root);
+    plan = root->data.info->plan;
+    nstep = root->data.info->nstep;
+
+    for (k = 0; k < nstep; k++) {
+	if ((sts = eval_expr(ctxp, plan[k].np, rp)) >= 0)
+	    continue;
+	for (up = plan[k].up; up >= 0; k = up, up = plan[up].up) {
+	    if (plan[up].np->type == N_COUNT &&
+		plan[up].np->left == plan[k].np)
+		break;
+	}
+	if (up < 0)
+	    return sts;
+	sts = count_error(plan[up].np);
+	k = up;
+    }
+    return sts;
+}
+
 /*
  * Algorithm here is complicated by trying to re-write the pmResult.
  *
@@ -1850,7 +1999,7 @@ __dmpostfetch(__pmContext *ctxp, pmResult **result)
 			    valfmt = PM_VAL_INSITU;
 			else
 			    valfmt = PM_VAL_DPTR;
-			numval = eval_expr(ctxp, cp->mlist[m].expr, rp, 1);
+			numval = eval_plan(ctxp, cp->mlist[m].expr, rp);
     if (pmDebugOptions.derive && pmDebugOptions.appl2) {
 	int	k;
 	char	strbuf[20];
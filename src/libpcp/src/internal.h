@@ -26,6 +26,7 @@
 
 extern int __pmConvertTimeout(int) _PCP_HIDDEN;
 extern int __pmConnectWithFNDELAY(int, void *, __pmSockLen) _PCP_HIDDEN;
+extern int __pmSocketReadable(int, struct timeval *) _PCP_HIDDEN;
 
 extern int __pmPtrToHandle(__pmContext *) _PCP_HIDDEN;
 
@@ -410,6 +411,8 @@ extern void __pmArchCtlFree(__pmArchCtl *) _PCP_HIDDEN;
 extern int __pmLogChangeArchive(__pmContext *, int) _PCP_HIDDEN;
 extern int __pmLogChangeToNextArchive(__pmLogCtl **) _PCP_HIDDEN;
 extern int __pmLogChangeToPreviousArchive(__pmLogCtl **) _PCP_HIDDEN;
+extern int __pmLogLoadInDoms(__pmLogCtl *, __pmLogInDom *) _PCP_HIDDEN;
+extern void __pmLogResetMeta(__pmLogCtl *) _PCP_HIDDEN;
 
 /* DSO PMDA helpers */
 struct __pmDSO;			/* opaque, real definition in pmda.h */
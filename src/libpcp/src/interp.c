@@ -14,9 +14,8 @@
  *
  * Thread-safe notes:
  *
- * nr[] and nr_cache[] are diagnostic counters that are maintained with
- * non-atomic updates ... we've decided that it is acceptable for their
- * values to be subject to possible (but unlikely) missed updates
+ * the read cache, including its diagnostic counters, is per-context and
+ * protected by the context lock
  *
  * the one-trip initialization of ignore_mark_records and ignore_mark_gap
  * is not guarded as the same value would result from concurrent repeated
@@ -107,25 +106,329 @@ typedef struct pmidcntl {		/* metric control */
     __pmHashCtl		hc;		/* metric-instances */
 } pmidcntl_t;
 
-typedef struct {
+typedef struct cache {
+    struct cache *next;		/* LRU list, most recently used first */
+    struct cache *prev;
     pmResult	*rp;		/* cached pmResult from __pmLogRead */
     int		sts;		/* from __pmLogRead */
-    char	*c_name;	/* log name */
+    int		arch;		/* index into names[] of cachectl_t */
     int		vol;		/* log volume */
     long	head_posn;	/* posn in file before forwards __pmLogRead */
     long	tail_posn;	/* posn in file after forwards __pmLogRead */
     int		mode;		/* PM_MODE_FORW or PM_MODE_BACK */
-    int		used;		/* used count for LFU replacement */
+    size_t	size;		/* approximate memory used by this entry */
 } cache_t;
 
-#define NUMCACHE 4
+/*
+ * Per-context cache of records read from the archive, found by their
+ * position in the archive (either end, as records may be read in either
+ * direction) and bounded by memory use rather than a number of records.
+ * When records are being missed one after another in the same direction
+ * (replaying the archive), a growing window of records is read ahead.
+ */
+typedef struct {
+    cache_t	*first;		/* most recently used */
+    cache_t	*last;		/* least recently used, first to go */
+    __pmHashCtl	head_hc;	/* entries by vol and head_posn */
+    __pmHashCtl	tail_hc;	/* entries by vol and tail_posn */
+    size_t	size;		/* approximate memory used by all entries */
+    int		count;		/* number of entries */
+    char	**names;	/* archive names, for entries' arch */
+    int		nnames;
+    pmResult	*rp_nocache;	/* last record returned, but not cached */
+    long	seek_posn;	/* where ac_mfp should be, -1 if it is */
+    int		ra_mode;	/* direction of last miss */
+    int		ra_arch;	/* ... and archive */
+    int		ra_vol;		/* ... and volume */
+    long	ra_posn;	/* ... and posn after the last record read */
+    int		ra_window;	/* records read ahead after the last miss */
+    /*
+     * diagnostic counters ... nr_cache[] and nr[] are per fetch and
+     * indexed by PM_MODE_FORW (2) and PM_MODE_BACK (3), the others
+     * are for the life of the context
+     */
+    long	nr_cache[PM_MODE_BACK+1];
+    long	nr[PM_MODE_BACK+1];
+    long	hits;
+    long	misses;
+    long	readahead;
+    long	evicted;
+} cachectl_t;
+
+#define CACHE_KEY(vol, posn)	((unsigned int)(posn) ^ ((unsigned int)(vol) << 24))
+#define CACHE_SIZE	(1024*1024)	/* default memory bound, in bytes */
+#define CACHE_READAHEAD	16		/* max records read ahead after a miss */
+
+static long	cache_limit = -1;	/* from $PCP_INTERP_CACHE, else CACHE_SIZE */
+
+static void
+cache_init(void)
+{
+    char	*str;
+    char	*end;
+    double	limit;
+
+    PM_LOCK(__pmLock_extcall);
+    if (cache_limit < 0) {
+	/* one-trip initialization */
+	cache_limit = CACHE_SIZE;
+	str = getenv("PCP_INTERP_CACHE");	/* THREADSAFE */
+	if (str != NULL && str[0] != '\0') {
+	    limit = strtod(str, &end);
+	    if (*end == 'k' || *end == 'K') {
+		limit *= 1024;
+		end++;
+	    }
+	    else if (*end == 'm' || *end == 'M') {
+		limit *= 1024 * 1024;
+		end++;
+	    }
+	    else if (*end == 'g' || *end == 'G') {
+		limit *= 1024 * 1024 * 1024;
+		end++;
+	    }
+	    if (end == str || *end != '\0' || limit < 0 || limit > LONG_MAX)
+		/*
+		 * probably should use pmprintf(), but that takes us into
+		 * deadlock hell!
+		 */
+		fprintf(stderr, "%s: Warning: bad $PCP_INTERP_CACHE: \"%s\", using %ld bytes\n",
+			pmGetProgname(), str, cache_limit);
+	    else
+		cache_limit = (long)limit;
+	}
+    }
+    PM_UNLOCK(__pmLock_extcall);
+}
 
 /*
- * diagnostic counters ... indexed by PM_MODE_FORW (2) and
- * PM_MODE_BACK	(3), hence 4 elts for cached and non-cached reads
+ * Index of the current archive's name in names[], adding it if needed,
+ * so entries need not carry (and compare) a copy of the name.
  */
-static long	nr_cache[PM_MODE_BACK+1];
-static long	nr[PM_MODE_BACK+1];
+static int
+cache_arch(cachectl_t *ccp, const char *name)
+{
+    char	**names;
+    int		i;
+
+    for (i = 0; i < ccp->nnames; i++) {
+	if (strcmp(ccp->names[i], name) == 0)
+	    return i;
+    }
+    if ((names = (char **)realloc(ccp->names, (i + 1) * sizeof(char *))) == NULL)
+	return -ENOMEM;
+    ccp->names = names;
+    if ((names[i] = strdup(name)) == NULL)
+	return -ENOMEM;
+    ccp->nnames++;
+    return i;
+}
+
+/*
+ * A cache hit moves the logical position in the archive without reading
+ * it, and seeking a stdio stream costs a system call even within the
+ * buffer, so the seek is deferred (in seek_posn) until the stream is
+ * next read or the fetch is done.  Within __pmLogFetchInterp, the
+ * position is found and set with cache_tell() and cache_seek(), and
+ * cache_sync() is needed before reading ac_mfp other than via
+ * cache_read().
+ */
+static long
+cache_tell(__pmArchCtl *acp)
+{
+    cachectl_t	*ccp = (cachectl_t *)acp->ac_cache;
+
+    if (ccp != NULL && ccp->seek_posn >= 0)
+	return ccp->seek_posn;
+    return __pmFtell(acp->ac_mfp);
+}
+
+static void
+cache_seek(__pmArchCtl *acp, long posn)
+{
+    cachectl_t	*ccp = (cachectl_t *)acp->ac_cache;
+
+    if (ccp != NULL)
+	ccp->seek_posn = posn;
+    else
+	__pmFseek(acp->ac_mfp, posn, SEEK_SET);
+}
+
+static void
+cache_sync(__pmArchCtl *acp)
+{
+    cachectl_t	*ccp = (cachectl_t *)acp->ac_cache;
+
+    if (ccp != NULL && ccp->seek_posn >= 0) {
+	__pmFseek(acp->ac_mfp, ccp->seek_posn, SEEK_SET);
+	ccp->seek_posn = -1;
+    }
+}
+
+static cache_t *
+cache_find(cachectl_t *ccp, int arch, int vol, int mode, long posn)
+{
+    __pmHashNode	*hp;
+    cache_t		*cp;
+
+    hp = __pmHashSearch(CACHE_KEY(vol, posn),
+		mode == PM_MODE_FORW ? &ccp->head_hc : &ccp->tail_hc);
+    for ( ; hp != NULL; hp = hp->next) {
+	cp = (cache_t *)hp->data;
+	if (cp->vol == vol && cp->arch == arch &&
+	    (mode == PM_MODE_FORW ? cp->head_posn : cp->tail_posn) == posn)
+	    return cp;
+    }
+    return NULL;
+}
+
+/*
+ * move to the front of the LRU list
+ */
+static void
+cache_touch(cachectl_t *ccp, cache_t *cp)
+{
+    if (ccp->first == cp)
+	return;
+    cp->prev->next = cp->next;
+    if (cp->next != NULL)
+	cp->next->prev = cp->prev;
+    else
+	ccp->last = cp->prev;
+    cp->prev = NULL;
+    cp->next = ccp->first;
+    ccp->first->prev = cp;
+    ccp->first = cp;
+}
+
+static void
+cache_free(cachectl_t *ccp, cache_t *cp)
+{
+    __pmHashDel(CACHE_KEY(cp->vol, cp->head_posn), (void *)cp, &ccp->head_hc);
+    __pmHashDel(CACHE_KEY(cp->vol, cp->tail_posn), (void *)cp, &ccp->tail_hc);
+    if (cp->prev != NULL)
+	cp->prev->next = cp->next;
+    else
+	ccp->first = cp->next;
+    if (cp->next != NULL)
+	cp->next->prev = cp->prev;
+    else
+	ccp->last = cp->prev;
+    ccp->size -= cp->size;
+    ccp->count--;
+    if (cp->rp != NULL)
+	pmFreeResult(cp->rp);
+    free(cp);
+}
+
+/*
+ * Add a record just read, between head and tail in the current volume
+ * of archive arch, to the front of the LRU list.  On failure the record
+ * is not cached and NULL is returned, leaving rp to the caller.
+ */
+static cache_t *
+cache_add(cachectl_t *ccp, __pmArchCtl *acp, int arch, int mode, pmResult *rp,
+	int sts, long head, long tail)
+{
+    cache_t	*cp;
+
+    if ((cp = (cache_t *)malloc(sizeof(cache_t))) == NULL)
+	return NULL;
+    cp->rp = rp;
+    cp->arch = arch;
+    cp->sts = sts;
+    cp->vol = acp->ac_vol;
+    cp->head_posn = head;
+    cp->tail_posn = tail;
+    cp->mode = mode;
+    /* the decoded pmResult refers to a PDU buffer holding the record */
+    cp->size = sizeof(cache_t) + (tail - head) +
+		sizeof(pmResult) + rp->numpmid * sizeof(pmValueSet);
+    if (__pmHashAdd(CACHE_KEY(cp->vol, head), (void *)cp, &ccp->head_hc) < 0) {
+	free(cp);
+	return NULL;
+    }
+    if (__pmHashAdd(CACHE_KEY(cp->vol, tail), (void *)cp, &ccp->tail_hc) < 0) {
+	__pmHashDel(CACHE_KEY(cp->vol, head), (void *)cp, &ccp->head_hc);
+	free(cp);
+	return NULL;
+    }
+    cp->prev = NULL;
+    cp->next = ccp->first;
+    if (ccp->first != NULL)
+	ccp->first->prev = cp;
+    else
+	ccp->last = cp;
+    ccp->first = cp;
+    ccp->size += cp->size;
+    ccp->count++;
+    return cp;
+}
+
+/*
+ * Read up to n more records in this direction from the current volume
+ * (without switching volumes or archives) into the cache, stopping at
+ * a record already cached or once half the cache has been used.  The
+ * (deferred) file position is restored, and the position after the
+ * last record read is returned.
+ */
+static long
+cache_readahead(__pmContext *ctxp, cachectl_t *ccp, int arch, int mode, int n)
+{
+    __pmArchCtl	*acp = ctxp->c_archctl;
+    pmResult	*rp;
+    size_t	used = 0;
+    long	save;
+    long	posn;
+    long	next;
+    cache_t	*cp;
+
+    save = posn = __pmFtell(acp->ac_mfp);
+    assert(posn >= 0);
+    for ( ; n > 0 && used < (size_t)cache_limit / 2; n--) {
+	if (cache_find(ccp, arch, acp->ac_vol, mode, posn) != NULL)
+	    break;
+	if (__pmLogRead_ctx(ctxp, mode, acp->ac_mfp, &rp, PMLOGREAD_NEXT) < 0)
+	    break;
+	next = __pmFtell(acp->ac_mfp);
+	assert(next >= 0);
+	if (mode == PM_MODE_FORW)
+	    cp = cache_add(ccp, acp, arch, mode, rp, 0, posn, next);
+	else
+	    cp = cache_add(ccp, acp, arch, mode, rp, 0, next, posn);
+	if (cp == NULL) {
+	    pmFreeResult(rp);
+	    break;
+	}
+	used += cp->size;
+	ccp->nr[mode]++;
+	ccp->readahead++;
+	posn = next;
+    }
+    ccp->seek_posn = save;
+    return posn;
+}
+
+/*
+ * evict least recently used entries (except keep) to fit within the limit
+ */
+static void
+cache_trim(cachectl_t *ccp, cache_t *keep)
+{
+    cache_t	*cp;
+    cache_t	*prev;
+
+    for (cp = ccp->last; cp != NULL && ccp->size > (size_t)cache_limit; cp = prev) {
+	prev = cp->prev;
+	if (cp == keep)
+	    continue;
+	if (pmDebugOptions.log && pmDebugOptions.desperate)
+	    fprintf(stderr, "cache_read: evict vol=%d head=%ld tail=%ld\n",
+		cp->vol, (long)cp->head_posn, (long)cp->tail_posn);
+	cache_free(ccp, cp);
+	ccp->evicted++;
+    }
+}
 
 /*
  * called with the context lock held
@@ -135,13 +438,14 @@ cache_read(__pmContext *ctxp, int mode, pmResult **rp)
 {
     __pmArchCtl	*acp = ctxp->c_archctl;
     long	posn;
+    long	end;
     cache_t	*cp;
-    cache_t	*lfup;
-    cache_t	*cache;
-    char	*save_curlog_name;
+    cachectl_t	*ccp;
+    int		arch;
     int		sts;
     int		save_curvol;
     int		archive_changed;
+    int		window;
 
     /*
      * If the previous __pmLogRead generated a virtual MARK record and we have
@@ -153,23 +457,34 @@ cache_read(__pmContext *ctxp, int mode, pmResult **rp)
 	return sts;
     }
 
+    if (acp->ac_cache == NULL) {
+	/* cache initialization */
+	if (cache_limit < 0)
+	    cache_init();
+	acp->ac_cache = ccp = (cachectl_t *)calloc(1, sizeof(cachectl_t));
+	if (!ccp)
+	    return -ENOMEM;
+	ccp->seek_posn = -1;
+    }
+    else
+	ccp = acp->ac_cache;
+
     /* Look for a cache hit. */
     if (acp->ac_vol == acp->ac_curvol) {
-	posn = __pmFtell(acp->ac_mfp);
+	posn = cache_tell(acp);
 	assert(posn >= 0);
     }
     else
 	posn = 0;
 
-    if (acp->ac_cache == NULL) {
-	/* cache initialization */
-	acp->ac_cache = cache = (cache_t *)calloc(NUMCACHE, sizeof(cache_t));
-	if (!cache)
-	    return -ENOMEM;
-	acp->ac_cache_idx = 0;
+    /* the previous uncached record has been finished with */
+    if (ccp->rp_nocache != NULL) {
+	pmFreeResult(ccp->rp_nocache);
+	ccp->rp_nocache = NULL;
     }
-    else
-	cache = acp->ac_cache;
+
+    if ((arch = cache_arch(ccp, acp->ac_log->l_name)) < 0)
+	return arch;
 
     if (pmDebugOptions.log && pmDebugOptions.desperate) {
 	fprintf(stderr, "cache_read: fd=%d mode=%s vol=%d (curvol=%d) %s_posn=%ld ",
@@ -180,61 +495,47 @@ cache_read(__pmContext *ctxp, int mode, pmResult **rp)
 	    (long)posn);
     }
 
-    acp->ac_cache_idx = (acp->ac_cache_idx + 1) % NUMCACHE;
-    lfup = &cache[acp->ac_cache_idx];
-    for (cp = cache; cp < &cache[NUMCACHE]; cp++) {
-	if (cp->c_name != NULL && strcmp(cp->c_name, acp->ac_log->l_name) == 0 &&
-	    cp->vol == acp->ac_vol &&
-	    ((mode == PM_MODE_FORW && cp->head_posn == posn) ||
-	     (mode == PM_MODE_BACK && cp->tail_posn == posn)) &&
-	    cp->rp != NULL) {
-	    *rp = cp->rp;
-	    cp->used++;
-	    if (mode == PM_MODE_FORW)
-		__pmFseek(acp->ac_mfp, cp->tail_posn, SEEK_SET);
-	    else
-		__pmFseek(acp->ac_mfp, cp->head_posn, SEEK_SET);
-	    if (pmDebugOptions.log && pmDebugOptions.desperate) {
-		pmTimeval	tmp;
-		double		t_this;
-		tmp.tv_sec = (__int32_t)cp->rp->timestamp.tv_sec;
-		tmp.tv_usec = (__int32_t)cp->rp->timestamp.tv_usec;
-		t_this = __pmTimevalSub(&tmp, __pmLogStartTime(acp));
-		fprintf(stderr, "hit cache[%d] t=%.6f\n",
-		    (int)(cp - cache), t_this);
-		nr_cache[mode]++;
-	    }
-	    acp->ac_mark_done = 0;
-	    sts = cp->sts;
-	    return sts;
+    if ((cp = cache_find(ccp, arch, acp->ac_vol, mode, posn)) != NULL) {
+	*rp = cp->rp;
+	cache_touch(ccp, cp);
+	if (mode == PM_MODE_FORW)
+	    ccp->seek_posn = cp->tail_posn;
+	else
+	    ccp->seek_posn = cp->head_posn;
+	if (pmDebugOptions.log && pmDebugOptions.desperate) {
+	    pmTimeval	tmp;
+	    double	t_this;
+	    tmp.tv_sec = (__int32_t)cp->rp->timestamp.tv_sec;
+	    tmp.tv_usec = (__int32_t)cp->rp->timestamp.tv_usec;
+	    t_this = __pmTimevalSub(&tmp, __pmLogStartTime(acp));
+	    fprintf(stderr, "hit cache (%d entries) t=%.6f\n",
+		ccp->count, t_this);
 	}
+	ccp->nr_cache[mode]++;
+	ccp->hits++;
+	acp->ac_mark_done = 0;
+	sts = cp->sts;
+	return sts;
     }
 
     if (pmDebugOptions.log && pmDebugOptions.desperate)
 	fprintf(stderr, "miss\n");
-    nr[mode]++;
-
-    if (lfup->rp != NULL)
-	pmFreeResult(lfup->rp);
+    ccp->nr[mode]++;
+    ccp->misses++;
 
     /*
      * We need to know when we cross archive or volume boundaries.
      * The only way to know if the archive has changed is to check whether the
      * archive name has changed.
      */
-    if ((save_curlog_name = strdup(acp->ac_log->l_name)) == NULL) {
-	pmNoMem("__pmLogFetchInterp.save_curlog_name",
-		  strlen(acp->ac_log->l_name) + 1, PM_FATAL_ERR);
-    }
     save_curvol = acp->ac_curvol;
 
-    lfup->sts = __pmLogRead_ctx(ctxp, mode, NULL, &lfup->rp, PMLOGREAD_NEXT);
-    if (lfup->sts < 0)
-	lfup->rp = NULL;
-    *rp = lfup->rp;
+    cache_sync(acp);
+    sts = __pmLogRead_ctx(ctxp, mode, NULL, rp, PMLOGREAD_NEXT);
+    if (sts < 0)
+	*rp = NULL;
 
-    archive_changed = strcmp(save_curlog_name, acp->ac_log->l_name) != 0;
-    free(save_curlog_name);
+    archive_changed = strcmp(ccp->names[arch], acp->ac_log->l_name) != 0;
 
     /*
      * vol/arch switch since last time, or vol/arch switch or virtual mark
@@ -242,55 +543,56 @@ cache_read(__pmContext *ctxp, int mode, pmResult **rp)
      * new vol/arch, stdio stream and we don't know where we started from
      * ... don't cache
      */
-    if (posn == 0 || save_curvol != acp->ac_curvol || archive_changed ||
-	acp->ac_mark_done) {
-	if (lfup->c_name) {
-	    free(lfup->c_name);
-	    lfup->c_name = NULL;
-	}
+    cp = NULL;
+    if (sts >= 0 && posn != 0 && save_curvol == acp->ac_curvol &&
+	!archive_changed && !acp->ac_mark_done) {
+	end = __pmFtell(acp->ac_mfp);
+	assert(end >= 0);
+	if (mode == PM_MODE_FORW)
+	    cp = cache_add(ccp, acp, arch, mode, *rp, sts, posn, end);
+	else
+	    cp = cache_add(ccp, acp, arch, mode, *rp, sts, end, posn);
+    }
+    if (cp == NULL) {
+	/* keep until the next call, when the caller is done with it */
+	ccp->rp_nocache = *rp;
+	ccp->ra_window = 0;
 	if (pmDebugOptions.log && pmDebugOptions.desperate)
-	    fprintf(stderr, "cache_read: reload vol switch, mark cache[%d] unused\n",
-		(int)(lfup - cache));
+	    fprintf(stderr, "cache_read: reload vol switch, not cached\n");
+	return sts;
     }
-    else {
-	lfup->mode = mode;
-	lfup->vol = acp->ac_vol;
-	lfup->used = 1;
-	/* Try to avoid excessive copying/freeing of the archive name. */
-	if (lfup->c_name != NULL && strcmp(lfup->c_name, acp->ac_log->l_name) != 0) {
-	    free(lfup->c_name);
-	    lfup->c_name = NULL;
-	}
-	if (lfup->c_name == NULL) {
-	    if ((lfup->c_name = strdup(acp->ac_log->l_name)) == NULL) {
-		pmNoMem("__pmLogFetchInterp.l_name",
-			  strlen(acp->ac_log->l_name) + 1, PM_FATAL_ERR);
-	    }
-	}
-	if (mode == PM_MODE_FORW) {
-	    lfup->head_posn = posn;
-	    lfup->tail_posn = __pmFtell(acp->ac_mfp);
-	    assert(lfup->tail_posn >= 0);
-	}
+
+    /*
+     * If this miss follows on from the last one (sequential replay), read
+     * ahead, doubling the window each time up to CACHE_READAHEAD records.
+     */
+    if (ccp->ra_mode == mode && ccp->ra_arch == arch &&
+	ccp->ra_vol == acp->ac_vol && ccp->ra_posn == posn)
+	window = ccp->ra_window == 0 ? 1 : 2 * ccp->ra_window;
+    else
+	window = 0;
+    if (window > CACHE_READAHEAD)
+	window = CACHE_READAHEAD;
+    ccp->ra_mode = mode;
+    ccp->ra_arch = arch;
+    ccp->ra_vol = acp->ac_vol;
+    ccp->ra_window = window;
+    ccp->ra_posn = cache_readahead(ctxp, ccp, arch, mode, window);
+    cache_trim(ccp, cp);
+
+    if (pmDebugOptions.log && pmDebugOptions.desperate) {
+	fprintf(stderr, "cache_read: reload vol=%d (curvol=%d) head=%ld tail=%ld readahead=%d ",
+	    cp->vol, acp->ac_curvol,
+	    (long)cp->head_posn, (long)cp->tail_posn, window);
+	if (sts == 0)
+	    fprintf(stderr, "sts=%d\n", sts);
 	else {
-	    lfup->tail_posn = posn;
-	    lfup->head_posn = __pmFtell(acp->ac_mfp);
-	    assert(lfup->head_posn >= 0);
-	}
-	if (pmDebugOptions.log && pmDebugOptions.desperate) {
-	    fprintf(stderr, "cache_read: reload cache[%d] vol=%d (curvol=%d) head=%ld tail=%ld ",
-		(int)(lfup - cache), lfup->vol, acp->ac_curvol,
-		(long)lfup->head_posn, (long)lfup->tail_posn);
-	    if (lfup->sts == 0)
-		fprintf(stderr, "sts=%d\n", lfup->sts);
-	    else {
-		char	errmsg[PM_MAXERRMSGLEN];
-		fprintf(stderr, "sts=%s\n", pmErrStr_r(lfup->sts, errmsg, sizeof(errmsg)));
-	    }
+	    char	errmsg[PM_MAXERRMSGLEN];
+	    fprintf(stderr, "sts=%s\n", pmErrStr_r(sts, errmsg, sizeof(errmsg)));
 	}
     }
 
-    return lfup->sts;
+    return sts;
 }
 
 /*
@@ -480,6 +782,7 @@ update_bounds(__pmContext *ctxp, double t_req, pmResult *logrp, int do_mark, int
 	    long	save_offset = 0;
 
 	    /* Save the initial state. */
+	    cache_sync(ctxp->c_archctl);
 	    save_arch = ctxp->c_archctl->ac_cur_log;
 	    save_vol = ctxp->c_archctl->ac_vol;
 	    save_offset = ctxp->c_archctl->ac_offset;
@@ -838,7 +1141,7 @@ do_roll(__pmContext *ctxp, double t_req, int *seen_mark)
 	    if (pmDebugOptions.interp)
 		fprintf(stderr, "do_roll: forw to t=%.6f%s\n",
 		    t_this, logrp->numpmid == 0 ? " <mark>" : "");
-	    ctxp->c_archctl->ac_offset = __pmFtell(ctxp->c_archctl->ac_mfp);
+	    ctxp->c_archctl->ac_offset = cache_tell(ctxp->c_archctl);
 	    assert(ctxp->c_archctl->ac_offset >= 0);
 	    ctxp->c_archctl->ac_vol = ctxp->c_archctl->ac_curvol;
 	    sts = update_bounds(ctxp, t_req, logrp, UPD_MARK_FORW, NULL, seen_mark);
@@ -857,7 +1160,7 @@ do_roll(__pmContext *ctxp, double t_req, int *seen_mark)
 	    if (pmDebugOptions.interp)
 		fprintf(stderr, "do_roll: back to t=%.6f%s\n",
 		    t_this, logrp->numpmid == 0 ? " <mark>" : "");
-	    ctxp->c_archctl->ac_offset = __pmFtell(ctxp->c_archctl->ac_mfp);
+	    ctxp->c_archctl->ac_offset = cache_tell(ctxp->c_archctl);
 	    assert(ctxp->c_archctl->ac_offset >= 0);
 	    ctxp->c_archctl->ac_vol = ctxp->c_archctl->ac_curvol;
 	    sts = update_bounds(ctxp, t_req, logrp, UPD_MARK_BACK, NULL, seen_mark);
@@ -960,6 +1263,11 @@ time_caliper(__pmContext *ctxp, instcntl_t *icp)
 	    fprintf(stderr, "time_caliper: Botch: indom %s: l_hashindom __pmHashSearch failed\n", pmInDomStr_r(icp->metric->desc.indom, strbuf, sizeof(strbuf)));
 	    return;
 	}
+	if ((sts = __pmLogLoadInDoms(lcp, (__pmLogInDom *)jp->data)) < 0) {
+	    char	strbuf[20];
+	    fprintf(stderr, "time_caliper: Botch: indom %s: __pmLogLoadInDoms failed: %d\n", pmInDomStr_r(icp->metric->desc.indom, strbuf, sizeof(strbuf)), sts);
+	    return;
+	}
 	/*
 	 * only do the work of building the per-instance time limits
 	 * for big indoms ...
@@ -1048,8 +1356,8 @@ time_caliper(__pmContext *ctxp, instcntl_t *icp)
 #define NUIS_LAST_FORGET	6
 #define NUIS_LAST_TRIM		7
 
-int
-__pmLogFetchInterp(__pmContext *ctxp, int numpmid, pmID pmidlist[], pmResult **result)
+static int
+fetch_interp(__pmContext *ctxp, int numpmid, pmID pmidlist[], pmResult **result)
 {
     int		i;
     int		j;
@@ -1095,8 +1403,11 @@ __pmLogFetchInterp(__pmContext *ctxp, int numpmid, pmID pmidlist[], pmResult **r
 	    t_req, ctxp->c_archctl->ac_curvol,
 	    (long)ctxp->c_archctl->ac_offset, ctxp->c_archctl->ac_vol,
 	    ctxp->c_archctl->ac_serial);
-	nr_cache[PM_MODE_FORW] = nr[PM_MODE_FORW] = 0;
-	nr_cache[PM_MODE_BACK] = nr[PM_MODE_BACK] = 0;
+	if (ctxp->c_archctl->ac_cache != NULL) {
+	    cachectl_t	*ccp = (cachectl_t *)ctxp->c_archctl->ac_cache;
+	    ccp->nr_cache[PM_MODE_FORW] = ccp->nr[PM_MODE_FORW] = 0;
+	    ccp->nr_cache[PM_MODE_BACK] = ccp->nr[PM_MODE_BACK] = 0;
+	}
     }
 
     /*
@@ -1253,6 +1564,7 @@ __pmLogFetchInterp(__pmContext *ctxp, int numpmid, pmID pmidlist[], pmResult **r
 
     if (ctxp->c_archctl->ac_serial == 0) {
 	/* need gross positioning from temporal index */
+	cache_sync(ctxp->c_archctl);
 	__pmLogSetTime(ctxp);
 	ctxp->c_archctl->ac_offset = __pmFtell(ctxp->c_archctl->ac_mfp);
 	assert(ctxp->c_archctl->ac_offset >= 0);
@@ -1271,7 +1583,7 @@ __pmLogFetchInterp(__pmContext *ctxp, int numpmid, pmID pmidlist[], pmResult **r
 		if (t_this <= t_req) {
 		    break;
 		}
-		ctxp->c_archctl->ac_offset = __pmFtell(ctxp->c_archctl->ac_mfp);
+		ctxp->c_archctl->ac_offset = cache_tell(ctxp->c_archctl);
 		assert(ctxp->c_archctl->ac_offset >= 0);
 		ctxp->c_archctl->ac_vol = ctxp->c_archctl->ac_curvol;
 		sts = update_bounds(ctxp, t_req, logrp, UPD_MARK_NONE, NULL, NULL);
@@ -1288,7 +1600,7 @@ __pmLogFetchInterp(__pmContext *ctxp, int numpmid, pmID pmidlist[], pmResult **r
 		if (t_this > t_req) {
 		    break;
 		}
-		ctxp->c_archctl->ac_offset = __pmFtell(ctxp->c_archctl->ac_mfp);
+		ctxp->c_archctl->ac_offset = cache_tell(ctxp->c_archctl);
 		assert(ctxp->c_archctl->ac_offset >= 0);
 		ctxp->c_archctl->ac_vol = ctxp->c_archctl->ac_curvol;
 		sts = update_bounds(ctxp, t_req, logrp, UPD_MARK_NONE, NULL, NULL);
@@ -1313,7 +1625,7 @@ __pmLogFetchInterp(__pmContext *ctxp, int numpmid, pmID pmidlist[], pmResult **r
 
     /* get to the last remembered place */
     __pmLogChangeVol(ctxp->c_archctl, ctxp->c_archctl->ac_vol);
-    __pmFseek(ctxp->c_archctl->ac_mfp, ctxp->c_archctl->ac_offset, SEEK_SET);
+    cache_seek(ctxp->c_archctl, ctxp->c_archctl->ac_offset);
 
     seen_mark = 0;	/* interested in <mark> records seen from here on */
 
@@ -1398,7 +1710,7 @@ __pmLogFetchInterp(__pmContext *ctxp, int numpmid, pmID pmidlist[], pmResult **r
 	 * position ourselves, ... and search
 	 */
 	__pmLogChangeVol(ctxp->c_archctl, ctxp->c_archctl->ac_vol);
-	__pmFseek(ctxp->c_archctl->ac_mfp, ctxp->c_archctl->ac_offset, SEEK_SET);
+	cache_seek(ctxp->c_archctl, ctxp->c_archctl->ac_offset);
 	done = 0;
 
 	while (done < back) {
@@ -1422,7 +1734,7 @@ __pmLogFetchInterp(__pmContext *ctxp, int numpmid, pmID pmidlist[], pmResult **r
 	    t_this = __pmTimevalSub(&tmp, __pmLogStartTime(ctxp->c_archctl));
 	    if (ctxp->c_delta < 0 && t_this >= t_req) {
 		/* going backwards, and not up to t_req yet */
-		ctxp->c_archctl->ac_offset = __pmFtell(ctxp->c_archctl->ac_mfp);
+		ctxp->c_archctl->ac_offset = cache_tell(ctxp->c_archctl);
 		assert(ctxp->c_archctl->ac_offset >= 0);
 		ctxp->c_archctl->ac_vol = ctxp->c_archctl->ac_curvol;
 	    }
@@ -1543,7 +1855,7 @@ __pmLogFetchInterp(__pmContext *ctxp, int numpmid, pmID pmidlist[], pmResult **r
 	 * position ourselves ... and search
 	 */
 	__pmLogChangeVol(ctxp->c_archctl, ctxp->c_archctl->ac_vol);
-	__pmFseek(ctxp->c_archctl->ac_mfp, ctxp->c_archctl->ac_offset, SEEK_SET);
+	cache_seek(ctxp->c_archctl, ctxp->c_archctl->ac_offset);
 	done = 0;
 
 	while (done < forw) {
@@ -1567,7 +1879,7 @@ __pmLogFetchInterp(__pmContext *ctxp, int numpmid, pmID pmidlist[], pmResult **r
 	    t_this = __pmTimevalSub(&tmp, __pmLogStartTime(ctxp->c_archctl));
 	    if (ctxp->c_delta > 0 && t_this <= t_req) {
 		/* going forwards, and not up to t_req yet */
-		ctxp->c_archctl->ac_offset = __pmFtell(ctxp->c_archctl->ac_mfp);
+		ctxp->c_archctl->ac_offset = cache_tell(ctxp->c_archctl);
 		assert(ctxp->c_archctl->ac_offset >= 0);
 		ctxp->c_archctl->ac_vol = ctxp->c_archctl->ac_curvol;
 	    }
@@ -2136,15 +2448,16 @@ all_done:
 	ctxp->c_origin.tv_usec += 1000000;
     }
 
-    if (pmDebugOptions.interp) {
+    if (pmDebugOptions.interp && ctxp->c_archctl->ac_cache != NULL) {
+	cachectl_t	*ccp = (cachectl_t *)ctxp->c_archctl->ac_cache;
 	fprintf(stderr, "__pmLogFetchInterp: log reads: forward %ld",
-	    nr[PM_MODE_FORW]);
-	if (nr_cache[PM_MODE_FORW])
-	    fprintf(stderr, " (+%ld cached)", nr_cache[PM_MODE_FORW]);
+	    ccp->nr[PM_MODE_FORW]);
+	if (ccp->nr_cache[PM_MODE_FORW])
+	    fprintf(stderr, " (+%ld cached)", ccp->nr_cache[PM_MODE_FORW]);
 	fprintf(stderr, " backwards %ld",
-	    nr[PM_MODE_BACK]);
-	if (nr_cache[PM_MODE_BACK])
-	    fprintf(stderr, " (+%ld cached)", nr_cache[PM_MODE_BACK]);
+	    ccp->nr[PM_MODE_BACK]);
+	if (ccp->nr_cache[PM_MODE_BACK])
+	    fprintf(stderr, " (+%ld cached)", ccp->nr_cache[PM_MODE_BACK]);
 	fprintf(stderr, "\n");
     }
     if (pmDebugOptions.qa) {
@@ -2176,6 +2489,17 @@ bad_alloc:
 
 }
 
+int
+__pmLogFetchInterp(__pmContext *ctxp, int numpmid, pmID pmidlist[], pmResult **result)
+{
+    int		sts;
+
+    sts = fetch_interp(ctxp, numpmid, pmidlist, result);
+    /* leave ac_mfp where cache hits (if any) would have left it */
+    cache_sync(ctxp->c_archctl);
+    return sts;
+}
+
 void
 __pmLogResetInterp(__pmContext *ctxp)
 {
@@ -2315,26 +2639,36 @@ __pmFreeInterpData(__pmContext *ctxp)
 
     if (ctxp->c_archctl->ac_cache != NULL) {
 	/* read cache allocated, work to be done */
-	cache_t		*cache = (cache_t *)ctxp->c_archctl->ac_cache;
-	cache_t		*cp;
-
-	for (cp = cache; cp < &cache[NUMCACHE]; cp++) {
+	cachectl_t	*ccp = (cachectl_t *)ctxp->c_archctl->ac_cache;
+
+	if (pmDebugOptions.interp) {
+	    fprintf(stderr, "read cache: %ld hits %ld misses", ccp->hits, ccp->misses);
+	    if (ccp->hits + ccp->misses > 0)
+		fprintf(stderr, " (%.1f%% hit rate)",
+		    100.0 * ccp->hits / (ccp->hits + ccp->misses));
+	    fprintf(stderr, " %ld read ahead %ld evicted, %d entries %ld bytes (limit %ld)\n",
+		ccp->readahead, ccp->evicted, ccp->count, (long)ccp->size,
+		cache_limit);
+	}
+	while (ccp->first != NULL) {
 	    if (pmDebugOptions.log && pmDebugOptions.interp) {
 		fprintf(stderr, "read cache entry "
 			PRINTF_P_PFX "%p: c_name=%s rp="
 			PRINTF_P_PFX "%p\n",
-			cp, cp->c_name ? cp->c_name : "(none)",
-			cp->rp);
-	    }
-	    if (cp->c_name != NULL) {
-		free(cp->c_name);
-		cp->c_name = NULL;
+			ccp->first, ccp->names[ccp->first->arch], ccp->first->rp);
 	    }
-	    if (cp->rp != NULL) {
-		pmFreeResult(cp->rp);
-		cp->rp = NULL;
-	    }
-	    cp->used = 0;
+	    cache_free(ccp, ccp->first);
+	}
+	__pmHashClear(&ccp->head_hc);
+	__pmHashClear(&ccp->tail_hc);
+	if (ccp->rp_nocache != NULL) {
+	    pmFreeResult(ccp->rp_nocache);
+	    ccp->rp_nocache = NULL;
 	}
+	while (ccp->nnames > 0)
+	    free(ccp->names[--ccp->nnames]);
+	free(ccp->names);
+	ccp->names = NULL;
+	ccp->seek_posn = -1;
     }
 }
@@ -1,5 +1,5 @@
 /*
- * Copyright (c) 2017-2018,2020 Red Hat.
+ * Copyright (c) 2017-2018,2020-2021 Red Hat.
  * 
  * This library is free software; you can redistribute it and/or modify it
  * under the terms of the GNU Lesser General Public License as published
@@ -28,6 +28,12 @@ extern __pm_fops __pm_stdio;
 #if HAVE_TRANSPARENT_DECOMPRESSION && HAVE_LZMA_DECOMPRESSION
 extern __pm_fops __pm_xz;
 #endif
+#if HAVE_TRANSPARENT_DECOMPRESSION && HAVE_ZSTD_DECOMPRESSION
+extern __pm_fops __pm_zstd;
+#endif
+#if HAVE_TRANSPARENT_DECOMPRESSION && HAVE_LZ4_DECOMPRESSION
+extern __pm_fops __pm_lz4;
+#endif
 
 /*
  * Suffixes and associated compresssion application for compressed filenames.
@@ -39,25 +45,44 @@ extern __pm_fops __pm_xz;
 #define	USE_BZIP2	1
 #define USE_GZIP	2
 #define USE_XZ		3
+#define USE_ZSTD	4
+#define USE_LZ4		5
 
 #if HAVE_TRANSPARENT_DECOMPRESSION && HAVE_LZMA_DECOMPRESSION
 #define TRANSPARENT_XZ (&__pm_xz)
 #else
 #define TRANSPARENT_XZ NULL
 #endif
+#if HAVE_TRANSPARENT_DECOMPRESSION && HAVE_ZSTD_DECOMPRESSION
+#define TRANSPARENT_ZSTD (&__pm_zstd)
+#else
+#define TRANSPARENT_ZSTD NULL
+#endif
+#if HAVE_TRANSPARENT_DECOMPRESSION && HAVE_LZ4_DECOMPRESSION
+#define TRANSPARENT_LZ4 (&__pm_lz4)
+#else
+#define TRANSPARENT_LZ4 NULL
+#endif
 
+/*
+ * The block-compressed formats (zstd and lz4, see io_block.c) can be
+ * written as well as read by their handlers.
+ */
 static const struct {
     const char	*suffix;
     const int	appl;
     __pm_fops   *handler;
+    const int	writable;
 } compress_ctl[] = {
-    { ".xz",	USE_XZ,	 	TRANSPARENT_XZ },
-    { ".lzma",	USE_XZ,		NULL },
-    { ".bz2",	USE_BZIP2,	NULL },
-    { ".bz",	USE_BZIP2,	NULL },
-    { ".gz",	USE_GZIP,	NULL },
-    { ".Z",	USE_GZIP,	NULL },
-    { ".z",	USE_GZIP,	NULL },
+    { ".xz",	USE_XZ,	 	TRANSPARENT_XZ,		0 },
+    { ".lzma",	USE_XZ,		NULL,			0 },
+    { ".bz2",	USE_BZIP2,	NULL,			0 },
+    { ".bz",	USE_BZIP2,	NULL,			0 },
+    { ".gz",	USE_GZIP,	NULL,			0 },
+    { ".Z",	USE_GZIP,	NULL,			0 },
+    { ".z",	USE_GZIP,	NULL,			0 },
+    { ".zst",	USE_ZSTD,	TRANSPARENT_ZSTD,	1 },
+    { ".lz4",	USE_LZ4,	TRANSPARENT_LZ4,	1 },
 };
 static const int ncompress = sizeof(compress_ctl) / sizeof(compress_ctl[0]);
 
@@ -260,6 +285,14 @@ fopen_compress(const char *fname, int compress_ix)
 	cmd = "gzip";
 	arg = "-dc";
     }
+    else if (compress_ctl[compress_ix].appl == USE_ZSTD) {
+	cmd = "zstd";
+	arg = "-dc";
+    }
+    else if (compress_ctl[compress_ix].appl == USE_LZ4) {
+	cmd = "lz4";
+	arg = "-dc";
+    }
     else {
 	/* botch in compress_ctl[] ... should not happen */
 	if (pmDebugOptions.log) {
@@ -409,6 +442,8 @@ __pmAccess(const char *path, int amode)
 	    if (compress_ctl[compress_ix].appl == USE_BZIP2) use = "bzip2";
 	    else if (compress_ctl[compress_ix].appl == USE_GZIP) use = "gzip";
 	    else if (compress_ctl[compress_ix].appl == USE_XZ) use = "xz";
+	    else if (compress_ctl[compress_ix].appl == USE_ZSTD) use = "zstd";
+	    else if (compress_ctl[compress_ix].appl == USE_LZ4) use = "lz4";
 	    else use = "???";
 	    fprintf(stderr, "__pmAccess(\"%s\", \"%d\"): decompress: %s", path, amode, use);
 	    if (compress_ctl[compress_ix].handler != NULL)
@@ -429,7 +464,8 @@ __pmAccess(const char *path, int amode)
  * Open a PCP file with given mode and return a __pmFILE. An i/o
  * handler is automatically chosen based on filename suffix, e.g. .xz, .gz,
  * etc. The stdio pass-thru handler will be chosen for other files.
- * The stdio handler is the only handler currently supporting write operations.
+ * Apart from stdio, only the zstd and lz4 handlers support writing (for
+ * files named with the .zst or .lz4 suffix).
  * Return a valid __pmFILE pointer on success or NULL on failure.
  */
 __pmFILE *
@@ -458,6 +494,8 @@ __pmFopen(const char *path, const char *mode)
 	    if (compress_ctl[compress_ix].appl == USE_BZIP2) use = "bzip2";
 	    else if (compress_ctl[compress_ix].appl == USE_GZIP) use = "gzip";
 	    else if (compress_ctl[compress_ix].appl == USE_XZ) use = "xz";
+	    else if (compress_ctl[compress_ix].appl == USE_ZSTD) use = "zstd";
+	    else if (compress_ctl[compress_ix].appl == USE_LZ4) use = "lz4";
 	    else use = "???";
 	    fprintf(stderr, "__pmFopen(\"%s\", \"%s\"): decompress: %s", path, mode, use);
 	    if (compress_ctl[compress_ix].handler != NULL)
@@ -467,8 +505,16 @@ __pmFopen(const char *path, const char *mode)
     }
     if (compress_ix >= 0) {
 	if (mode[0] != 'r' || mode[1] != '\0') {
-	    /* We don't (yet) support opening compressed files for writing. */
-	    return NULL;
+	    /*
+	     * Only some handlers support writing, and only when the
+	     * compressed file was named explicitly by the caller.
+	     */
+	    if (!compress_ctl[compress_ix].writable ||
+		compress_ctl[compress_ix].handler == NULL ||
+		strcmp(path, tmpname) != 0) {
+		setoserror(EOPNOTSUPP);
+		return NULL;
+	    }
 	}
 
 	/* Use the compressed file name and select a handler. */
@@ -638,6 +684,8 @@ __pmStat(const char *path, struct stat *buf)
 	    if (compress_ctl[compress_ix].appl == USE_BZIP2) use = "bzip2";
 	    else if (compress_ctl[compress_ix].appl == USE_GZIP) use = "gzip";
 	    else if (compress_ctl[compress_ix].appl == USE_XZ) use = "xz";
+	    else if (compress_ctl[compress_ix].appl == USE_ZSTD) use = "zstd";
+	    else if (compress_ctl[compress_ix].appl == USE_LZ4) use = "lz4";
 	    else use = "???";
 	    fprintf(stderr, "__pmStat(\"%s\"): decompress: %s", path, use);
 	    if (compress_ctl[compress_ix].handler != NULL)
@@ -0,0 +1,623 @@
+/*
+ * Copyright (c) 2021 Red Hat.
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * Random access to block-compressed files - see io_block.h
+ *
+ * Reads locate the block containing the current (uncompressed) offset
+ * with a binary search of the index, and decompress it into the least
+ * recently used slot of a small cache unless it is already there.  Seeks
+ * just record the new offset, so the typical archive access pattern of
+ * seek then read touches the file only when a new block is needed.
+ *
+ * A file that is still being written may grow after it is opened; when
+ * a read reaches the end of the indexed blocks the file is scanned again
+ * for any blocks that have since been completed.
+ */
+
+#include "config.h"
+#if HAVE_ZSTD_DECOMPRESSION || HAVE_LZ4_DECOMPRESSION
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "pmapi.h"
+#include "libpcp.h"
+#include "io_block.h"
+
+int
+__pmBlockAdd(__pmBlockFile *bp, __uint64_t offset, __uint64_t csize, __uint64_t size)
+{
+    __pmBlockIndex	*ip;
+    size_t		need;
+    int			max;
+
+    if (size == 0)		/* empty frame, nothing to find here */
+	return 0;
+    if (bp->nindex == bp->maxindex) {
+	max = bp->maxindex ? bp->maxindex * 2 : 16;
+	need = max * sizeof(__pmBlockIndex);
+	if ((ip = (__pmBlockIndex *)realloc(bp->index, need)) == NULL) {
+	    pmNoMem("__pmBlockAdd", need, PM_RECOV_ERR);
+	    return -ENOMEM;
+	}
+	bp->index = ip;
+	bp->maxindex = max;
+    }
+    ip = &bp->index[bp->nindex++];
+    ip->offset = offset;
+    ip->csize = csize;
+    ip->start = bp->size;
+    ip->size = size;
+    bp->size += size;
+    return 0;
+}
+
+/*
+ * Buffer for compressed data, at least len bytes.
+ */
+char *
+__pmBlockBuffer(__pmBlockFile *bp, size_t len)
+{
+    char	*buf;
+
+    if (len > bp->cbufsize) {
+	if ((buf = (char *)realloc(bp->cbuf, len)) == NULL) {
+	    pmNoMem("__pmBlockBuffer", len, PM_RECOV_ERR);
+	    return NULL;
+	}
+	bp->cbuf = buf;
+	bp->cbufsize = len;
+    }
+    return bp->cbuf;
+}
+
+/*
+ * Evict the least recently used block and make room for a new most
+ * recently used block; the data buffer is kept for reuse.
+ */
+static __pmBlockData *
+cache_new(__pmBlockFile *bp)
+{
+    __pmBlockData	lru = bp->cache[PCP_BLOCK_CACHE - 1];
+
+    memmove(&bp->cache[1], &bp->cache[0],
+	    (PCP_BLOCK_CACHE - 1) * sizeof(__pmBlockData));
+    lru.size = 0;
+    bp->cache[0] = lru;
+    return &bp->cache[0];
+}
+
+/*
+ * Codecs that had to decompress the last block added to the index in
+ * order to discover its size hand over the data, which becomes the most
+ * recently used block so it is not decompressed a second time.
+ */
+void
+__pmBlockKeep(__pmBlockFile *bp, char *data, size_t size)
+{
+    __pmBlockData	*cp = cache_new(bp);
+
+    free(cp->data);
+    cp->data = data;
+    cp->alloc = size;
+    cp->start = bp->index[bp->nindex - 1].start;
+    cp->size = size;
+}
+
+/*
+ * Map the whole file for scanning.  Returns 0 with *mapp NULL if the
+ * file is empty.
+ */
+int
+__pmBlockMap(__pmBlockFile *bp, const unsigned char **mapp, size_t *lenp)
+{
+    struct stat		sbuf;
+
+    *mapp = NULL;
+    if (fstat(bp->fd, &sbuf) < 0)
+	return -oserror();
+    if ((*lenp = sbuf.st_size) == 0)
+	return 0;
+    if ((*mapp = __pmMemoryMap(bp->fd, *lenp, 0)) == NULL)
+	return -oserror();
+    return 0;
+}
+
+void
+__pmBlockUnmap(const unsigned char *map, size_t len)
+{
+    if (map != NULL)
+	__pmMemoryUnmap((void *)map, len);
+}
+
+/*
+ * Look for blocks appended to the file since it was last scanned.
+ * Returns 1 if more data was found.
+ */
+static int
+rescan(__pmBlockFile *bp)
+{
+    struct stat		sbuf;
+    __uint64_t		size = bp->size;
+
+    if (bp->complete || bp->writing)
+	return 0;
+    if (fstat(bp->fd, &sbuf) < 0 || (__uint64_t)sbuf.st_size <= bp->scanned)
+	return 0;
+    if (bp->codec->scan(bp) < 0)
+	return 0;
+    return bp->size > size;
+}
+
+static int
+read_block(__pmBlockFile *bp, const __pmBlockIndex *ip, __pmBlockData *cp)
+{
+    char	*src, *dst;
+    size_t	done;
+    ssize_t	bytes;
+
+    if ((src = __pmBlockBuffer(bp, ip->csize)) == NULL)
+	return -ENOMEM;
+    for (done = 0; done < ip->csize; done += bytes) {
+	bytes = pread(bp->fd, src + done, ip->csize - done, ip->offset + done);
+	if (bytes < 0 && oserror() == EINTR) {
+	    bytes = 0;
+	    continue;
+	}
+	if (bytes <= 0)
+	    return bytes < 0 ? -oserror() : -EIO;
+    }
+    if (ip->size > cp->alloc) {
+	if ((dst = (char *)realloc(cp->data, ip->size)) == NULL) {
+	    pmNoMem("read_block", ip->size, PM_RECOV_ERR);
+	    return -ENOMEM;
+	}
+	cp->data = dst;
+	cp->alloc = ip->size;
+    }
+    return bp->codec->decode(bp, ip, src, cp->data);
+}
+
+/*
+ * Find the cached block containing the current offset, decompressing
+ * it if need be, and make it the most recently used block.  Returns
+ * NULL at end of file or on error (setting bp->eof or bp->error).
+ */
+static __pmBlockData *
+reposition(__pmBlockFile *bp)
+{
+    __pmBlockData	*cp, hit;
+    __pmBlockIndex	*ip;
+    int			lo, hi, mid, slot;
+    int			sts;
+
+    for (slot = 0; slot < PCP_BLOCK_CACHE; slot++) {
+	cp = &bp->cache[slot];
+	if (cp->size == 0)
+	    continue;
+	if (bp->offset >= cp->start && bp->offset < cp->start + cp->size) {
+	    if (slot > 0) {
+		hit = *cp;
+		memmove(&bp->cache[1], &bp->cache[0], slot * sizeof(__pmBlockData));
+		bp->cache[0] = hit;
+	    }
+	    return &bp->cache[0];
+	}
+    }
+
+    if (bp->offset >= bp->size && !rescan(bp)) {
+	bp->eof = 1;
+	return NULL;
+    }
+
+    lo = 0;
+    hi = bp->nindex - 1;
+    while (lo < hi) {
+	mid = (lo + hi + 1) / 2;
+	if (bp->index[mid].start <= bp->offset)
+	    lo = mid;
+	else
+	    hi = mid - 1;
+    }
+    ip = &bp->index[lo];
+
+    cp = cache_new(bp);
+    if ((sts = read_block(bp, ip, cp)) < 0) {
+	if (pmDebugOptions.log)
+	    fprintf(stderr, "%s: block at offset %llu (%llu bytes): %s\n",
+		    bp->codec->name, (unsigned long long)ip->offset,
+		    (unsigned long long)ip->csize, pmErrStr(sts));
+	bp->error = 1;
+	setoserror(-sts);
+	return NULL;
+    }
+    cp->start = ip->start;
+    cp->size = ip->size;
+    return cp;
+}
+
+static void *
+block_init(__pmFILE *f, int fd, int writing, const __pmBlockCodec *codec)
+{
+    __pmBlockFile	*bp;
+    int			i, sts;
+
+    if ((bp = (__pmBlockFile *)calloc(1, sizeof(*bp))) == NULL) {
+	pmNoMem("__pmBlockOpen", sizeof(*bp), PM_RECOV_ERR);
+	return NULL;
+    }
+    bp->codec = codec;
+    bp->fd = fd;
+    bp->writing = writing;
+    bp->blocksize = PCP_BLOCK_SIZE;
+    if (!writing && (sts = codec->scan(bp)) < 0) {
+	if (pmDebugOptions.log)
+	    fprintf(stderr, "%s: scan failed: %s\n", codec->name, pmErrStr(sts));
+	if (codec->release)
+	    codec->release(bp);
+	for (i = 0; i < PCP_BLOCK_CACHE; i++)
+	    free(bp->cache[i].data);	/* perhaps kept by the scan */
+	free(bp->index);
+	free(bp->cbuf);
+	free(bp);
+	setoserror(-sts);
+	return NULL;
+    }
+    f->priv = bp;
+    return bp;
+}
+
+static int
+block_mode(const char *mode)
+{
+    if (strcmp(mode, "r") == 0)
+	return O_RDONLY;
+    if (strcmp(mode, "w") == 0)
+	return O_WRONLY | O_CREAT | O_TRUNC;
+    /* no support for update or append modes */
+    return -1;
+}
+
+void *
+__pmBlockOpen(__pmFILE *f, const char *path, const char *mode,
+		const __pmBlockCodec *codec)
+{
+    void	*priv;
+    int		flags, fd, sts;
+
+    if ((flags = block_mode(mode)) < 0) {
+	setoserror(EINVAL);
+	return NULL;
+    }
+    if ((fd = open(path, flags, 0666)) < 0)
+	return NULL;
+    if ((priv = block_init(f, fd, flags != O_RDONLY, codec)) == NULL) {
+	sts = oserror();
+	close(fd);
+	setoserror(sts);
+    }
+    return priv;
+}
+
+void *
+__pmBlockFdopen(__pmFILE *f, int fd, const char *mode, const __pmBlockCodec *codec)
+{
+    int		flags;
+
+    if ((flags = block_mode(mode)) < 0) {
+	setoserror(EINVAL);
+	return NULL;
+    }
+    return block_init(f, fd, flags != O_RDONLY, codec);
+}
+
+int
+__pmBlockSeek(__pmFILE *f, off_t offset, int whence)
+{
+    __pmBlockFile	*bp = (__pmBlockFile *)f->priv;
+    __int64_t		new_offset;
+
+    switch (whence) {
+    case SEEK_SET:
+	new_offset = offset;
+	break;
+    case SEEK_CUR:
+	new_offset = bp->offset + offset;
+	break;
+    case SEEK_END:
+	new_offset = bp->size + bp->wlen + offset;
+	break;
+    default:
+	setoserror(EINVAL);
+	return -1;
+    }
+    if (new_offset < 0 ||
+	(bp->writing && new_offset > bp->size + bp->wlen)) {
+	/* no holes in compressed data */
+	setoserror(EINVAL);
+	return -1;
+    }
+
+    /* don't actually seek to the requested offset now, just record it */
+    bp->offset = new_offset;
+    bp->eof = 0;
+    return 0;
+}
+
+off_t
+__pmBlockLseek(__pmFILE *f, off_t offset, int whence)
+{
+    if (__pmBlockSeek(f, offset, whence) < 0)
+	return -1;
+    return ((__pmBlockFile *)f->priv)->offset;
+}
+
+void
+__pmBlockRewind(__pmFILE *f)
+{
+    __pmBlockFile	*bp = (__pmBlockFile *)f->priv;
+
+    bp->offset = 0;
+    bp->eof = 0;
+}
+
+off_t
+__pmBlockTell(__pmFILE *f)
+{
+    return ((__pmBlockFile *)f->priv)->offset;
+}
+
+int
+__pmBlockGetc(__pmFILE *f)
+{
+    __pmBlockFile	*bp = (__pmBlockFile *)f->priv;
+    __pmBlockData	*cp = &bp->cache[0];
+    int			c;
+
+    if (bp->writing)
+	return EOF;
+    if (bp->offset < cp->start || bp->offset >= cp->start + cp->size) {
+	if ((cp = reposition(bp)) == NULL)
+	    return EOF;
+    }
+    c = (unsigned char)cp->data[bp->offset - cp->start];
+    bp->offset++;
+    return c;
+}
+
+size_t
+__pmBlockRead(void *ptr, size_t size, size_t nmemb, __pmFILE *f)
+{
+    __pmBlockFile	*bp = (__pmBlockFile *)f->priv;
+    __pmBlockData	*cp;
+    size_t		want, n, copied = 0;
+
+    if (bp->writing) {
+	bp->error = 1;
+	return 0;
+    }
+    if (size == 0)
+	return 0;
+    want = size * nmemb;
+    while (copied < want) {
+	if ((cp = reposition(bp)) == NULL)
+	    break;
+	n = cp->start + cp->size - bp->offset;
+	if (n > want - copied)
+	    n = want - copied;
+	memcpy((char *)ptr + copied, cp->data + (bp->offset - cp->start), n);
+	copied += n;
+	bp->offset += n;
+    }
+    return copied / size;
+}
+
+/*
+ * Compress and write out the first len bytes of buffered data as a new
+ * block.
+ */
+static int
+block_flush(__pmBlockFile *bp, size_t len)
+{
+    ssize_t	csize, bytes;
+    size_t	done;
+
+    if (len == 0)
+	return 0;
+    if ((csize = bp->codec->encode(bp, bp->wbuf, len)) < 0)
+	return csize;
+    for (done = 0; done < csize; done += bytes) {
+	if ((bytes = write(bp->fd, bp->cbuf + done, csize - done)) < 0) {
+	    if (oserror() == EINTR) {
+		bytes = 0;
+		continue;
+	    }
+	    return -oserror();
+	}
+    }
+    if (__pmBlockAdd(bp, bp->scanned, csize, len) < 0)
+	return -ENOMEM;
+    bp->scanned += csize;
+    bp->wlen -= len;
+    if (bp->wlen > 0)
+	memmove(bp->wbuf, bp->wbuf + len, bp->wlen);
+    return 0;
+}
+
+size_t
+__pmBlockWrite(void *ptr, size_t size, size_t nmemb, __pmFILE *f)
+{
+    __pmBlockFile	*bp = (__pmBlockFile *)f->priv;
+    size_t		want = size * nmemb;
+    size_t		pos, n, copied = 0;
+    int			sts;
+
+    if (!bp->writing || bp->error || bp->offset < bp->size) {
+	/* cannot rewrite data that has already been compressed */
+	bp->error = 1;
+	return 0;
+    }
+    if (bp->wbuf == NULL &&
+	(bp->wbuf = (char *)malloc(bp->blocksize)) == NULL) {
+	pmNoMem("__pmBlockWrite", bp->blocksize, PM_RECOV_ERR);
+	bp->error = 1;
+	return 0;
+    }
+    while (copied < want) {
+	/* usually appending, but may be rewriting buffered data */
+	pos = bp->offset - bp->size;
+	n = bp->blocksize - pos;
+	if (n > want - copied)
+	    n = want - copied;
+	memcpy(bp->wbuf + pos, (char *)ptr + copied, n);
+	if (pos + n > bp->wlen)
+	    bp->wlen = pos + n;
+	copied += n;
+	bp->offset += n;
+	if (bp->offset - bp->size == bp->blocksize &&
+	    (sts = block_flush(bp, bp->wlen)) < 0) {
+	    setoserror(-sts);
+	    bp->error = 1;
+	    break;
+	}
+    }
+    return size ? copied / size : 0;
+}
+
+/*
+ * Flushing ends the current block early, so everything written so far
+ * can be read back (by another process) - at some cost in compression
+ * if done often.  If the current position is within the buffered data
+ * (the archive code seeks back to the start of the last record before
+ * adding a temporal index entry for it) a block boundary is made there
+ * too, so a reader seeking to that position starts decompressing at the
+ * beginning of a block.
+ */
+int
+__pmBlockFlush(__pmFILE *f)
+{
+    __pmBlockFile	*bp = (__pmBlockFile *)f->priv;
+    int			sts = 0;
+
+    if (!bp->writing)
+	return 0;
+    if (bp->offset > bp->size && bp->offset < bp->size + bp->wlen)
+	sts = block_flush(bp, bp->offset - bp->size);
+    if (sts == 0)
+	sts = block_flush(bp, bp->wlen);
+    if (sts < 0) {
+	setoserror(-sts);
+	bp->error = 1;
+	return EOF;
+    }
+    return 0;
+}
+
+int
+__pmBlockFsync(__pmFILE *f)
+{
+    __pmBlockFile	*bp = (__pmBlockFile *)f->priv;
+
+    if (__pmBlockFlush(f) != 0)
+	return -1;
+    return fsync(bp->fd);
+}
+
+int
+__pmBlockFileno(__pmFILE *f)
+{
+    return ((__pmBlockFile *)f->priv)->fd;
+}
+
+int
+__pmBlockFstat(__pmFILE *f, struct stat *buf)
+{
+    __pmBlockFile	*bp = (__pmBlockFile *)f->priv;
+    int			sts;
+
+    /* what the caller really wants for st_size is the uncompressed size */
+    if ((sts = fstat(bp->fd, buf)) == 0) {
+	rescan(bp);
+	buf->st_size = bp->size + bp->wlen;
+    }
+    return sts;
+}
+
+int
+__pmBlockFeof(__pmFILE *f)
+{
+    return ((__pmBlockFile *)f->priv)->eof;
+}
+
+int
+__pmBlockFerror(__pmFILE *f)
+{
+    return ((__pmBlockFile *)f->priv)->error;
+}
+
+void
+__pmBlockClearerr(__pmFILE *f)
+{
+    __pmBlockFile	*bp = (__pmBlockFile *)f->priv;
+
+    bp->eof = bp->error = 0;
+}
+
+/*
+ * Only the size matters here, setting the block size for writing
+ * (before any data has been written).  Zero means keep the default,
+ * and all our i/o is effectively unbuffered as far as the caller is
+ * concerned, so _IONBF is no different.
+ */
+int
+__pmBlockSetvbuf(__pmFILE *f, char *buf, int mode, size_t size)
+{
+    __pmBlockFile	*bp = (__pmBlockFile *)f->priv;
+
+    if (size == 0 || !bp->writing)
+	return 0;
+    if (bp->wbuf != NULL || size > PCP_BLOCK_MAXSIZE) {
+	setoserror(EINVAL);
+	return -1;
+    }
+    bp->blocksize = size;
+    return 0;
+}
+
+int
+__pmBlockClose(__pmFILE *f)
+{
+    __pmBlockFile	*bp = (__pmBlockFile *)f->priv;
+    int			i, sts = 0;
+
+    if (bp->writing && !bp->error) {
+	if ((sts = block_flush(bp, bp->wlen)) == 0 && bp->codec->finish)
+	    sts = bp->codec->finish(bp);
+	if (sts < 0) {
+	    setoserror(-sts);
+	    sts = EOF;
+	}
+    }
+    if (close(bp->fd) < 0)
+	sts = EOF;
+    if (bp->codec->release)
+	bp->codec->release(bp);
+    for (i = 0; i < PCP_BLOCK_CACHE; i++)
+	free(bp->cache[i].data);
+    free(bp->index);
+    free(bp->cbuf);
+    free(bp->wbuf);
+    free(bp);
+    return sts;
+}
+#endif /* HAVE_ZSTD_DECOMPRESSION || HAVE_LZ4_DECOMPRESSION */
@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2021 Red Hat.
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ */
+#ifndef _LIBPCP_IO_BLOCK_H
+#define _LIBPCP_IO_BLOCK_H
+
+/*
+ * Block-compressed files, shared by the zstd and lz4 i/o handlers.
+ *
+ * A file is a sequence of independently compressed blocks (zstd or lz4
+ * frames).  An index maps each block's range of the uncompressed data
+ * to its location in the file, so a read at any offset decompresses
+ * only the block containing it, and recently used blocks are cached.
+ * When writing, data is buffered and compressed a block at a time.
+ */
+
+#include "compiler.h"
+
+#ifndef PCP_BLOCK_CACHE
+#define PCP_BLOCK_CACHE	4		/* uncompressed blocks cached */
+#endif
+#define PCP_BLOCK_SIZE	(1024*1024)	/* default block size when writing */
+#define PCP_BLOCK_MAXSIZE (256*1024*1024)	/* largest block we will write */
+
+typedef struct {
+    __uint64_t		offset;		/* offset of compressed block in file */
+    __uint64_t		csize;		/* size of compressed block */
+    __uint64_t		start;		/* offset of block in uncompressed data */
+    __uint64_t		size;		/* size of uncompressed block */
+} __pmBlockIndex;
+
+typedef struct {
+    __uint64_t		start;		/* uncompressed offset of data[0] */
+    __uint64_t		size;		/* valid bytes in data[] */
+    size_t		alloc;		/* allocated bytes in data[] */
+    char		*data;
+} __pmBlockData;
+
+struct __pmBlockFile;
+
+/*
+ * Compression format specific methods.
+ *
+ * scan - add the blocks found in the file from bp->scanned onwards to
+ *	the index with __pmBlockAdd, and advance bp->scanned past them;
+ *	a trailing partial block (a file still being written) is not an
+ *	error, it is simply left for a later scan
+ * decode - decompress the block described by the index entry from the
+ *	compressed data in src into dst (of the block's uncompressed size)
+ * encode - compress len bytes from src into the buffer returned by
+ *	__pmBlockBuffer, returning the compressed size or -errno
+ * finish - write any trailer needed to close the file (a seek table)
+ * release - free codec private data
+ */
+typedef struct {
+    const char		*name;
+    int			(*scan)(struct __pmBlockFile *);
+    int			(*decode)(struct __pmBlockFile *, const __pmBlockIndex *,
+				  const char *, char *);
+    ssize_t		(*encode)(struct __pmBlockFile *, const char *, size_t);
+    int			(*finish)(struct __pmBlockFile *);
+    void		(*release)(struct __pmBlockFile *);
+} __pmBlockCodec;
+
+typedef struct __pmBlockFile {
+    const __pmBlockCodec *codec;
+    int			fd;
+    int			writing;
+    int			complete;	/* index covers the whole file */
+    int			eof;
+    int			error;
+    __pmBlockIndex	*index;		/* ascending offset (and start) order */
+    int			nindex;
+    int			maxindex;
+    __uint64_t		size;		/* uncompressed size of indexed blocks */
+    __uint64_t		scanned;	/* file offset after last indexed block */
+    __uint64_t		offset;		/* current uncompressed position */
+    __pmBlockData	cache[PCP_BLOCK_CACHE];	/* most recently used first */
+    char		*cbuf;		/* compressed block buffer */
+    size_t		cbufsize;
+    char		*wbuf;		/* uncompressed data being written */
+    size_t		wlen;
+    size_t		blocksize;
+    void		*priv;		/* codec private data */
+} __pmBlockFile;
+
+/* helpers for the codecs */
+extern int __pmBlockAdd(__pmBlockFile *, __uint64_t, __uint64_t, __uint64_t) _PCP_HIDDEN;
+extern char *__pmBlockBuffer(__pmBlockFile *, size_t) _PCP_HIDDEN;
+extern void __pmBlockKeep(__pmBlockFile *, char *, size_t) _PCP_HIDDEN;
+extern int __pmBlockMap(__pmBlockFile *, const unsigned char **, size_t *) _PCP_HIDDEN;
+extern void __pmBlockUnmap(const unsigned char *, size_t) _PCP_HIDDEN;
+
+/* generic i/o handler methods */
+extern void *__pmBlockOpen(__pmFILE *, const char *, const char *,
+			const __pmBlockCodec *) _PCP_HIDDEN;
+extern void *__pmBlockFdopen(__pmFILE *, int, const char *,
+			const __pmBlockCodec *) _PCP_HIDDEN;
+extern int __pmBlockSeek(__pmFILE *, off_t, int) _PCP_HIDDEN;
+extern void __pmBlockRewind(__pmFILE *) _PCP_HIDDEN;
+extern off_t __pmBlockTell(__pmFILE *) _PCP_HIDDEN;
+extern int __pmBlockGetc(__pmFILE *) _PCP_HIDDEN;
+extern size_t __pmBlockRead(void *, size_t, size_t, __pmFILE *) _PCP_HIDDEN;
+extern size_t __pmBlockWrite(void *, size_t, size_t, __pmFILE *) _PCP_HIDDEN;
+extern int __pmBlockFlush(__pmFILE *) _PCP_HIDDEN;
+extern int __pmBlockFsync(__pmFILE *) _PCP_HIDDEN;
+extern int __pmBlockFileno(__pmFILE *) _PCP_HIDDEN;
+extern off_t __pmBlockLseek(__pmFILE *, off_t, int) _PCP_HIDDEN;
+extern int __pmBlockFstat(__pmFILE *, struct stat *) _PCP_HIDDEN;
+extern int __pmBlockFeof(__pmFILE *) _PCP_HIDDEN;
+extern int __pmBlockFerror(__pmFILE *) _PCP_HIDDEN;
+extern void __pmBlockClearerr(__pmFILE *) _PCP_HIDDEN;
+extern int __pmBlockSetvbuf(__pmFILE *, char *, int, size_t) _PCP_HIDDEN;
+extern int __pmBlockClose(__pmFILE *) _PCP_HIDDEN;
+
+#endif /* _LIBPCP_IO_BLOCK_H */
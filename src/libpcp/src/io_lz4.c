@@ -0,0 +1,289 @@
+/*
+ * Copyright (c) 2021 Red Hat.
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * lz4 compressed files, random access via io_block.c
+ *
+ * Files are written as a sequence of lz4 frames, each holding one block
+ * of data and recording its content size.  The lz4 frame format has no
+ * seek table, so the index is built by walking the frame and block
+ * headers; frames without a content size (the lz4 command does not
+ * usually record it) are decompressed once to find their size.
+ */
+
+#include "config.h"
+#if HAVE_LZ4_DECOMPRESSION
+#include <sys/types.h>
+#include <unistd.h>
+#include <lz4frame.h>
+#include "pmapi.h"
+#include "libpcp.h"
+#include "io_block.h"
+
+#define LZ4_MAGIC		0x184D2204
+#define SKIPPABLE_MAGIC		0x184D2A50	/* low 4 bits are user-defined */
+#define SKIPPABLE_MASK		0xFFFFFFF0
+#define SKIPPABLE_HEADER	8		/* magic, frame size */
+#define FLG_VERSION		0xC0		/* must be 01 */
+#define FLG_BLOCK_CHECKSUM	0x10
+#define FLG_CONTENT_SIZE	0x08
+#define FLG_CONTENT_CHECKSUM	0x04
+#define FLG_DICTID		0x01
+#define BLOCK_UNCOMPRESSED	0x80000000
+
+static unsigned int
+get_le32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+static LZ4F_dctx *
+lz4_dctx(__pmBlockFile *bp)
+{
+    LZ4F_dctx		*dctx;
+
+    if (bp->priv == NULL) {
+	if (LZ4F_isError(LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION)))
+	    return NULL;
+	bp->priv = dctx;
+    }
+    return (LZ4F_dctx *)bp->priv;
+}
+
+/*
+ * Decompress the frame at src (csize bytes) into dst, growing dst as
+ * required if its size is not known beforehand (*sizep is zero).
+ */
+static int
+lz4_frame(__pmBlockFile *bp, const char *src, size_t csize, char **dstp,
+		size_t *sizep, __uint64_t offset)
+{
+    LZ4F_dctx		*dctx;
+    char		*dst = *dstp, *data;
+    size_t		alloc = *sizep;
+    size_t		in = 0, out = 0;
+    size_t		slen, dlen, sts;
+    int			grow = (alloc == 0);
+
+    if ((dctx = lz4_dctx(bp)) == NULL)
+	return -ENOMEM;
+    LZ4F_resetDecompressionContext(dctx);
+    do {
+	if (grow && out == alloc) {
+	    alloc = alloc ? alloc * 2 : csize * 4;
+	    if ((data = (char *)realloc(dst, alloc)) == NULL) {
+		pmNoMem("lz4_frame", alloc, PM_RECOV_ERR);
+		return -ENOMEM;
+	    }
+	    *dstp = dst = data;
+	}
+	slen = csize - in;
+	dlen = alloc - out;
+	sts = LZ4F_decompress(dctx, dst + out, &dlen, src + in, &slen, NULL);
+	if (LZ4F_isError(sts)) {
+	    if (pmDebugOptions.log)
+		fprintf(stderr, "lz4_frame: frame at %llu: %s\n",
+			(unsigned long long)offset, LZ4F_getErrorName(sts));
+	    return -EIO;
+	}
+	in += slen;
+	out += dlen;
+    } while (sts != 0 && (slen != 0 || dlen != 0 || (grow && out == alloc)));
+
+    if (sts != 0 || (!grow && out != alloc)) {
+	if (pmDebugOptions.log)
+	    fprintf(stderr, "lz4_frame: frame at %llu: size mismatch\n",
+		    (unsigned long long)offset);
+	return -EIO;
+    }
+    *sizep = out;
+    return 0;
+}
+
+/*
+ * Size of the lz4 frame at p, 0 if incomplete or -1 if not lz4; and
+ * the content size, or -1 if not recorded in the header.
+ */
+static ssize_t
+lz4_framesize(const unsigned char *p, size_t avail, long long *sizep)
+{
+    unsigned int	flg, bsize;
+    size_t		pos;
+
+    if (avail < 7)
+	return 0;
+    flg = p[4];
+    if ((flg & FLG_VERSION) != 0x40)
+	return -1;
+    pos = 7;
+    *sizep = -1;
+    if (flg & FLG_CONTENT_SIZE) {
+	pos += 8;
+	if (avail >= 14)
+	    *sizep = (long long)get_le32(p + 6) | ((long long)get_le32(p + 10) << 32);
+    }
+    if (flg & FLG_DICTID)
+	pos += 4;
+    for (;;) {
+	if (pos + 4 > avail)
+	    return 0;
+	bsize = get_le32(p + pos);
+	pos += 4;
+	if (bsize == 0)
+	    break;	/* end mark */
+	pos += (bsize & ~BLOCK_UNCOMPRESSED);
+	if (flg & FLG_BLOCK_CHECKSUM)
+	    pos += 4;
+    }
+    if (flg & FLG_CONTENT_CHECKSUM)
+	pos += 4;
+    return pos <= avail ? pos : 0;
+}
+
+static int
+lz4_scan(__pmBlockFile *bp)
+{
+    const unsigned char	*map, *p;
+    long long		size;
+    size_t		len, avail, alloc;
+    ssize_t		csize;
+    __uint64_t		pos;
+    char		*data;
+    int			sts;
+
+    if ((sts = __pmBlockMap(bp, &map, &len)) < 0 || map == NULL)
+	return sts;
+    for (pos = bp->scanned; pos + 4 <= len; pos += csize) {
+	p = map + pos;
+	avail = len - pos;
+	if ((get_le32(p) & SKIPPABLE_MASK) == SKIPPABLE_MAGIC) {
+	    if (avail < SKIPPABLE_HEADER ||
+		(csize = SKIPPABLE_HEADER + (size_t)get_le32(p + 4)) > avail)
+		break;
+	    continue;
+	}
+	if (get_le32(p) != LZ4_MAGIC ||
+	    (csize = lz4_framesize(p, avail, &size)) < 0) {
+	    if (pmDebugOptions.log)
+		fprintf(stderr, "lz4_scan: no lz4 frame at %llu\n",
+			(unsigned long long)pos);
+	    if (pos == 0)
+		sts = -EINVAL;	/* not an lz4 file */
+	    break;
+	}
+	if (csize == 0)
+	    break;	/* partially written, pick it up in a later scan */
+	if (size >= 0) {
+	    if ((sts = __pmBlockAdd(bp, pos, csize, size)) < 0)
+		break;
+	    continue;
+	}
+	data = NULL;
+	alloc = 0;
+	if ((sts = lz4_frame(bp, (const char *)p, csize, &data, &alloc, pos)) < 0 ||
+	    (sts = __pmBlockAdd(bp, pos, csize, alloc)) < 0) {
+	    free(data);
+	    break;
+	}
+	if (alloc > 0)
+	    __pmBlockKeep(bp, data, alloc);
+	else
+	    free(data);
+    }
+    bp->scanned = pos;
+    __pmBlockUnmap(map, len);
+    return sts;
+}
+
+static int
+lz4_decode(__pmBlockFile *bp, const __pmBlockIndex *ip, const char *src, char *dst)
+{
+    size_t		size = ip->size;
+
+    return lz4_frame(bp, src, ip->csize, &dst, &size, ip->offset);
+}
+
+static ssize_t
+lz4_encode(__pmBlockFile *bp, const char *src, size_t len)
+{
+    LZ4F_preferences_t	prefs;
+    size_t		bound, sts;
+    char		*dst;
+
+    memset(&prefs, 0, sizeof(prefs));
+    prefs.frameInfo.blockSizeID = LZ4F_max1MB;
+    prefs.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+    prefs.frameInfo.contentSize = len;
+    bound = LZ4F_compressFrameBound(len, &prefs);
+    if ((dst = __pmBlockBuffer(bp, bound)) == NULL)
+	return -ENOMEM;
+    sts = LZ4F_compressFrame(dst, bound, src, len, &prefs);
+    if (LZ4F_isError(sts)) {
+	if (pmDebugOptions.log)
+	    fprintf(stderr, "lz4_encode: %s\n", LZ4F_getErrorName(sts));
+	return -EIO;
+    }
+    return sts;
+}
+
+static void
+lz4_release(__pmBlockFile *bp)
+{
+    if (bp->priv != NULL)
+	LZ4F_freeDecompressionContext((LZ4F_dctx *)bp->priv);
+}
+
+static const __pmBlockCodec lz4_codec = {
+    .name = "lz4",
+    .scan = lz4_scan,
+    .decode = lz4_decode,
+    .encode = lz4_encode,
+    .finish = NULL,
+    .release = lz4_release,
+};
+
+static void *
+lz4_open(__pmFILE *f, const char *path, const char *mode)
+{
+    return __pmBlockOpen(f, path, mode, &lz4_codec);
+}
+
+static void *
+lz4_fdopen(__pmFILE *f, int fd, const char *mode)
+{
+    return __pmBlockFdopen(f, fd, mode, &lz4_codec);
+}
+
+__pm_fops __pm_lz4 = {
+    /*
+     * lz4 compression and decompression
+     */
+    .__pmopen = lz4_open,
+    .__pmfdopen = lz4_fdopen,
+    .__pmseek = __pmBlockSeek,
+    .__pmrewind = __pmBlockRewind,
+    .__pmtell = __pmBlockTell,
+    .__pmfgetc = __pmBlockGetc,
+    .__pmread = __pmBlockRead,
+    .__pmwrite = __pmBlockWrite,
+    .__pmflush = __pmBlockFlush,
+    .__pmfsync = __pmBlockFsync,
+    .__pmfileno = __pmBlockFileno,
+    .__pmlseek = __pmBlockLseek,
+    .__pmfstat = __pmBlockFstat,
+    .__pmfeof = __pmBlockFeof,
+    .__pmferror = __pmBlockFerror,
+    .__pmclearerr = __pmBlockClearerr,
+    .__pmsetvbuf = __pmBlockSetvbuf,
+    .__pmclose = __pmBlockClose
+};
+#endif /* HAVE_LZ4_DECOMPRESSION */
@@ -803,6 +803,10 @@ xz_read(void *ptr, size_t size, size_t nmemb, __pmFILE *f)
     const char *p;
     size_t n;
     size_t copied;
+    size_t itemsize = size;
+
+    if (itemsize == 0)
+	return 0;
 
     /* Obtain the requested size in bytes. */
     size *= nmemb;
@@ -814,7 +818,7 @@ xz_read(void *ptr, size_t size, size_t nmemb, __pmFILE *f)
     while (size > 0) {
 	blk = reposition(xz);
 	if (blk == NULL)
-	    return 0; /* error */
+	    break; /* end of file or error, return what we have */
 
 	/* See how many bytes we can copy from the current block. */
 	p =  blk->data + blk->current_offset;
@@ -835,7 +839,7 @@ xz_read(void *ptr, size_t size, size_t nmemb, __pmFILE *f)
 	size -= n;
     }
 
-    return copied;
+    return copied / itemsize;
 }
 
 static size_t
@@ -0,0 +1,386 @@
+/*
+ * Copyright (c) 2021 Red Hat.
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * zstd compressed files, random access via io_block.c
+ *
+ * Files are written in the zstd seekable format: independent frames
+ * (each with its content size and checksum) followed by a seek table
+ * in a skippable frame, listing the compressed and uncompressed size of
+ * every frame.  Reading a file with a seek table needs just two reads
+ * to build the block index.  Otherwise - a file from the zstd command,
+ * or one still being written - the frame headers are walked instead.
+ */
+
+#include "config.h"
+#if HAVE_ZSTD_DECOMPRESSION
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zstd.h>
+#include <zstd_errors.h>
+#include "pmapi.h"
+#include "libpcp.h"
+#include "io_block.h"
+
+#define SKIPPABLE_MAGIC		0x184D2A50	/* low 4 bits are user-defined */
+#define SKIPPABLE_MASK		0xFFFFFFF0
+#define SKIPPABLE_HEADER	8		/* magic, frame size */
+#define SEEKTABLE_MAGIC		0x184D2A5E	/* skippable frame of seek table */
+#define SEEKABLE_MAGIC		0x8F92EAB1	/* in seek table footer */
+#define SEEKTABLE_FOOTER	9		/* frames, descriptor, magic */
+#define SEEKTABLE_CHECKSUM	0x80		/* descriptor: entries have checksum */
+#define SEEKTABLE_RESERVED	0x7C		/* descriptor: must be zero */
+
+typedef struct {
+    ZSTD_DCtx		*dctx;
+    ZSTD_CCtx		*cctx;
+} zstd_ctx;
+
+static unsigned int
+get_le32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+static void
+put_le32(unsigned char *p, unsigned int v)
+{
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+    p[2] = (v >> 16) & 0xff;
+    p[3] = (v >> 24) & 0xff;
+}
+
+static zstd_ctx *
+zstd_context(__pmBlockFile *bp)
+{
+    if (bp->priv == NULL &&
+	(bp->priv = calloc(1, sizeof(zstd_ctx))) == NULL)
+	pmNoMem("zstd_context", sizeof(zstd_ctx), PM_RECOV_ERR);
+    return (zstd_ctx *)bp->priv;
+}
+
+static ZSTD_DCtx *
+zstd_dctx(__pmBlockFile *bp)
+{
+    zstd_ctx	*ctx;
+
+    if ((ctx = zstd_context(bp)) == NULL)
+	return NULL;
+    if (ctx->dctx == NULL)
+	ctx->dctx = ZSTD_createDCtx();
+    return ctx->dctx;
+}
+
+/*
+ * Build the index from the seek table, if the file has one that
+ * accounts for everything before it.  Returns 1 if so.
+ */
+static int
+zstd_seektable(__pmBlockFile *bp)
+{
+    struct stat		sbuf;
+    unsigned char	footer[SEEKTABLE_FOOTER];
+    unsigned char	*table, *p;
+    __uint64_t		offset, tsize;
+    unsigned int	i, nframes, esize;
+    int			sts = 0;
+
+    if (fstat(bp->fd, &sbuf) < 0)
+	return -oserror();
+    if (sbuf.st_size < SKIPPABLE_HEADER + SEEKTABLE_FOOTER)
+	return 0;
+    if (pread(bp->fd, footer, sizeof(footer),
+		sbuf.st_size - SEEKTABLE_FOOTER) != sizeof(footer))
+	return 0;
+    if (get_le32(&footer[5]) != SEEKABLE_MAGIC ||
+	(footer[4] & SEEKTABLE_RESERVED) != 0)
+	return 0;
+    nframes = get_le32(&footer[0]);
+    esize = (footer[4] & SEEKTABLE_CHECKSUM) ? 12 : 8;
+    tsize = (__uint64_t)nframes * esize + SEEKTABLE_FOOTER;
+    if (tsize + SKIPPABLE_HEADER > (__uint64_t)sbuf.st_size)
+	return 0;
+
+    if ((table = (unsigned char *)malloc(tsize + SKIPPABLE_HEADER)) == NULL) {
+	pmNoMem("zstd_seektable", tsize + SKIPPABLE_HEADER, PM_RECOV_ERR);
+	return -ENOMEM;
+    }
+    offset = sbuf.st_size - tsize - SKIPPABLE_HEADER;
+    if (pread(bp->fd, table, tsize + SKIPPABLE_HEADER, offset) !=
+		(ssize_t)(tsize + SKIPPABLE_HEADER) ||
+	get_le32(&table[0]) != SEEKTABLE_MAGIC ||
+	get_le32(&table[4]) != tsize)
+	goto done;
+
+    for (i = 0, p = &table[SKIPPABLE_HEADER], offset = 0; i < nframes; i++) {
+	if ((sts = __pmBlockAdd(bp, offset, get_le32(p), get_le32(p + 4))) < 0)
+	    goto done;
+	offset += get_le32(p);
+	p += esize;
+    }
+    if (offset + tsize + SKIPPABLE_HEADER == (__uint64_t)sbuf.st_size) {
+	bp->scanned = sbuf.st_size;
+	bp->complete = 1;
+	sts = 1;
+    }
+    else {
+	/* the seek table does not describe this file, walk the frames */
+	if (pmDebugOptions.log)
+	    fprintf(stderr, "zstd_seektable: frames end at %llu, expected %llu\n",
+		    (unsigned long long)offset,
+		    (unsigned long long)(sbuf.st_size - tsize - SKIPPABLE_HEADER));
+	bp->nindex = 0;
+	bp->size = 0;
+    }
+
+done:
+    free(table);
+    return sts;
+}
+
+/*
+ * A frame without its content size in the header (written by a stream
+ * compressor) has to be decompressed to find out how big it is.
+ */
+static int
+zstd_count(__pmBlockFile *bp, const unsigned char *src, size_t csize,
+		__uint64_t offset)
+{
+    ZSTD_DCtx		*dctx;
+    ZSTD_inBuffer	in = { src, csize, 0 };
+    ZSTD_outBuffer	out = { NULL, 0, 0 };
+    size_t		sts;
+    char		*data;
+
+    if ((dctx = zstd_dctx(bp)) == NULL)
+	return -ENOMEM;
+    ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
+    do {
+	if (out.pos == out.size) {
+	    out.size = out.size ? out.size * 2 : csize * 4;
+	    if ((data = (char *)realloc(out.dst, out.size)) == NULL) {
+		pmNoMem("zstd_count", out.size, PM_RECOV_ERR);
+		free(out.dst);
+		return -ENOMEM;
+	    }
+	    out.dst = data;
+	}
+	sts = ZSTD_decompressStream(dctx, &out, &in);
+	if (ZSTD_isError(sts)) {
+	    if (pmDebugOptions.log)
+		fprintf(stderr, "zstd_count: frame at %llu: %s\n",
+			(unsigned long long)offset, ZSTD_getErrorName(sts));
+	    free(out.dst);
+	    return -EIO;
+	}
+    } while (sts != 0 && (in.pos < in.size || out.pos == out.size));
+
+    if (sts != 0 || __pmBlockAdd(bp, offset, csize, out.pos) < 0) {
+	free(out.dst);
+	return sts != 0 ? -EIO : -ENOMEM;
+    }
+    if (out.pos > 0)
+	__pmBlockKeep(bp, out.dst, out.pos);
+    else
+	free(out.dst);
+    return 0;
+}
+
+static int
+zstd_scan(__pmBlockFile *bp)
+{
+    const unsigned char	*map, *p;
+    unsigned long long	size;
+    size_t		len, avail, csize;
+    __uint64_t		pos;
+    int			sts;
+
+    if (bp->nindex == 0 && bp->scanned == 0 &&
+	(sts = zstd_seektable(bp)) != 0)
+	return sts < 0 ? sts : 0;
+
+    if ((sts = __pmBlockMap(bp, &map, &len)) < 0 || map == NULL)
+	return sts;
+    for (pos = bp->scanned; pos + 4 <= len; pos += csize) {
+	p = map + pos;
+	avail = len - pos;
+	if ((get_le32(p) & SKIPPABLE_MASK) == SKIPPABLE_MAGIC) {
+	    /* includes any seek table, which is of no use now */
+	    if (avail < SKIPPABLE_HEADER ||
+		(csize = SKIPPABLE_HEADER + (size_t)get_le32(p + 4)) > avail)
+		break;
+	    continue;
+	}
+	csize = ZSTD_findFrameCompressedSize(p, avail);
+	if (ZSTD_isError(csize)) {
+	    /* a partially written frame will be picked up by a later scan */
+	    if (ZSTD_getErrorCode(csize) == ZSTD_error_srcSize_wrong)
+		break;
+	    if (pmDebugOptions.log)
+		fprintf(stderr, "zstd_scan: frame at %llu: %s\n",
+			(unsigned long long)pos, ZSTD_getErrorName(csize));
+	    if (pos == 0)
+		sts = -EINVAL;	/* not a zstd file */
+	    break;
+	}
+	size = ZSTD_getFrameContentSize(p, avail);
+	if (size == ZSTD_CONTENTSIZE_ERROR) {
+	    sts = -EINVAL;
+	    break;
+	}
+	if (size == ZSTD_CONTENTSIZE_UNKNOWN)
+	    sts = zstd_count(bp, p, csize, pos);
+	else
+	    sts = __pmBlockAdd(bp, pos, csize, size);
+	if (sts < 0)
+	    break;
+    }
+    bp->scanned = pos;
+    __pmBlockUnmap(map, len);
+    return sts;
+}
+
+static int
+zstd_decode(__pmBlockFile *bp, const __pmBlockIndex *ip, const char *src, char *dst)
+{
+    ZSTD_DCtx		*dctx;
+    size_t		sts;
+
+    if ((dctx = zstd_dctx(bp)) == NULL)
+	return -ENOMEM;
+    sts = ZSTD_decompressDCtx(dctx, dst, ip->size, src, ip->csize);
+    if (ZSTD_isError(sts) || sts != ip->size) {
+	if (pmDebugOptions.log)
+	    fprintf(stderr, "zstd_decode: frame at %llu: %s\n",
+		    (unsigned long long)ip->offset, ZSTD_isError(sts) ?
+		    ZSTD_getErrorName(sts) : "size mismatch");
+	return -EIO;
+    }
+    return 0;
+}
+
+static ssize_t
+zstd_encode(__pmBlockFile *bp, const char *src, size_t len)
+{
+    zstd_ctx		*ctx;
+    size_t		bound = ZSTD_compressBound(len);
+    size_t		sts;
+    char		*dst;
+
+    if ((ctx = zstd_context(bp)) == NULL ||
+	(dst = __pmBlockBuffer(bp, bound)) == NULL)
+	return -ENOMEM;
+    if (ctx->cctx == NULL) {
+	if ((ctx->cctx = ZSTD_createCCtx()) == NULL)
+	    return -ENOMEM;
+	ZSTD_CCtx_setParameter(ctx->cctx, ZSTD_c_checksumFlag, 1);
+    }
+    sts = ZSTD_compress2(ctx->cctx, dst, bound, src, len);
+    if (ZSTD_isError(sts)) {
+	if (pmDebugOptions.log)
+	    fprintf(stderr, "zstd_encode: %s\n", ZSTD_getErrorName(sts));
+	return -EIO;
+    }
+    return sts;
+}
+
+/*
+ * Append the seek table, without per-frame checksums as each frame
+ * carries its own.
+ */
+static int
+zstd_finish(__pmBlockFile *bp)
+{
+    unsigned char	*table, *p;
+    size_t		tsize = (size_t)bp->nindex * 8 + SEEKTABLE_FOOTER;
+    size_t		len = tsize + SKIPPABLE_HEADER;
+    ssize_t		bytes;
+    int			i, sts = 0;
+
+    if ((table = (unsigned char *)malloc(len)) == NULL) {
+	pmNoMem("zstd_finish", len, PM_RECOV_ERR);
+	return -ENOMEM;
+    }
+    put_le32(&table[0], SEEKTABLE_MAGIC);
+    put_le32(&table[4], tsize);
+    for (i = 0, p = &table[SKIPPABLE_HEADER]; i < bp->nindex; i++, p += 8) {
+	put_le32(p, bp->index[i].csize);
+	put_le32(p + 4, bp->index[i].size);
+    }
+    put_le32(p, bp->nindex);
+    p[4] = 0;
+    put_le32(p + 5, SEEKABLE_MAGIC);
+    if ((bytes = write(bp->fd, table, len)) != (ssize_t)len)
+	sts = bytes < 0 ? -oserror() : -EIO;
+    free(table);
+    return sts;
+}
+
+static void
+zstd_release(__pmBlockFile *bp)
+{
+    zstd_ctx		*ctx = (zstd_ctx *)bp->priv;
+
+    if (ctx != NULL) {
+	ZSTD_freeDCtx(ctx->dctx);
+	ZSTD_freeCCtx(ctx->cctx);
+	free(ctx);
+    }
+}
+
+static const __pmBlockCodec zstd_codec = {
+    .name = "zstd",
+    .scan = zstd_scan,
+    .decode = zstd_decode,
+    .encode = zstd_encode,
+    .finish = zstd_finish,
+    .release = zstd_release,
+};
+
+static void *
+zstd_open(__pmFILE *f, const char *path, const char *mode)
+{
+    return __pmBlockOpen(f, path, mode, &zstd_codec);
+}
+
+static void *
+zstd_fdopen(__pmFILE *f, int fd, const char *mode)
+{
+    return __pmBlockFdopen(f, fd, mode, &zstd_codec);
+}
+
+__pm_fops __pm_zstd = {
+    /*
+     * zstd compression and decompression
+     */
+    .__pmopen = zstd_open,
+    .__pmfdopen = zstd_fdopen,
+    .__pmseek = __pmBlockSeek,
+    .__pmrewind = __pmBlockRewind,
+    .__pmtell = __pmBlockTell,
+    .__pmfgetc = __pmBlockGetc,
+    .__pmread = __pmBlockRead,
+    .__pmwrite = __pmBlockWrite,
+    .__pmflush = __pmBlockFlush,
+    .__pmfsync = __pmBlockFsync,
+    .__pmfileno = __pmBlockFileno,
+    .__pmlseek = __pmBlockLseek,
+    .__pmfstat = __pmBlockFstat,
+    .__pmfeof = __pmBlockFeof,
+    .__pmferror = __pmBlockFerror,
+    .__pmclearerr = __pmBlockClearerr,
+    .__pmsetvbuf = __pmBlockSetvbuf,
+    .__pmclose = __pmBlockClose
+};
+#endif /* HAVE_ZSTD_DECOMPRESSION */
@@ -23,6 +23,32 @@
 /* bytes for a length field in a header/trailer, or a string length field */
 #define LENSIZE	4
 
+/*
+ * Metadata index (<base>.mindex), one entry for each record in the
+ * metadata file, in order, after a header identifying the archive.
+ * All fields are in network byte order.
+ */
+#define MINDEX_MAGIC	0x504d4900
+#define MINDEX_VERSION	1
+
+typedef struct {
+    __int32_t	magic;		/* MINDEX_MAGIC | MINDEX_VERSION */
+    __int32_t	pid;		/* from the archive label */
+    pmTimeval	start;		/* ditto */
+    char	hostname[PM_LOG_MAXHOSTLEN];	/* ditto */
+} mindex_hdr_t;
+
+typedef struct {
+    __int32_t	type;		/* TYPE_DESC, TYPE_INDOM, ... */
+    __int32_t	len;		/* record length, from the header */
+    __int32_t	offset;		/* of the record in the metadata file */
+    pmTimeval	stamp;		/* TYPE_INDOM and TYPE_LABEL, else 0 */
+    __int32_t	ident;		/* pmid, indom or label/text ident */
+    __int32_t	subtype;	/* label or text type, numinst for indoms */
+} mindex_t;
+
+static int loadindom(__pmLogCtl *, __pmLogInDom *);
+
 static void
 StrTimeval(const pmTimeval *tp)
 {
@@ -113,6 +139,7 @@ PM_FAULT_POINT("libpcp/" __FILE__ ":1", PM_FAULT_ALLOC);
     idp->stamp = *tp;		/* struct assignment */
     idp->buf = indom_buf;
     idp->allinbuf = allinbuf;
+    idp->pending = 0;
     addinsts(idp, numinst, instlist, namelist);
 
     if (pmDebugOptions.logmeta) {
@@ -164,6 +191,11 @@ PM_FAULT_POINT("libpcp/" __FILE__ ":1", PM_FAULT_ALLOC);
 	    assert(sts == 0);
 	    idp_time = idp_prev; /* just before this time slot */
 	    do {
+		/* Not yet read from the metadata index? */
+		if ((sts = loadindom(lcp, idp_cached)) < 0) {
+		    free(idp);
+		    return sts;
+		}
 		/* Have we found a duplicate? */
 		if (pmDebugOptions.logmeta && pmDebugOptions.desperate) {
 		    char	strbuf[20];
@@ -262,6 +294,7 @@ PM_FAULT_POINT("libpcp/" __FILE__ ":13", PM_FAULT_ALLOC);
     idp->ident = ident;
     idp->nsets = nsets;
     idp->labelsets = labelsets;
+    idp->pending = 0;
 
     if (pmDebugOptions.logmeta) {
 	fprintf(stderr, "addlabel( ..., %u, %u, ", type, ident);
@@ -431,6 +464,57 @@ discard_dup_labelsets(__pmLogLabelSet *idp, const __pmLogLabelSet *idp_next)
     }
 }
 
+/*
+ * Check for duplicate label sets within the label sets for one type
+ * and ident, which are in reverse chronological order.
+ */
+static void
+discard_dup_labels(__pmHashNode *hptype)
+{
+    __pmLogLabelSet	*idp, *idp_prev, *idp_next;
+
+    idp_prev = NULL;
+    for (idp = (__pmLogLabelSet *)hptype->data; idp; idp = idp_next) {
+	idp_next = idp->next;
+	if (idp_next == NULL)
+	    break; /* done */
+
+	/*
+	 * idp and idp_next each hold sets of label sets. Since idp is
+	 * later in time, we want to discard any label sets within
+	 * idp which are the same as any label sets in idp_next.
+	 */
+	discard_dup_labelsets(idp, idp_next);
+	if (idp->nsets == 0) {
+	    /*
+	     * All label sets within idp were discarded.
+	     * unlink it and free it.
+	     */
+	    if (idp_prev)
+		idp_prev->next = idp_next;
+	    else
+		hptype->data = idp_next;
+	    free(idp->labelsets);
+	    free(idp);
+	}
+	else
+	    idp_prev = idp;
+    }
+}
+
+/*
+ * Are any of these label sets yet to be read via the metadata index?
+ */
+static int
+pendinglabels(const __pmLogLabelSet *idp)
+{
+    for ( ; idp != NULL; idp = idp->next) {
+	if (idp->pending)
+	    return 1;
+    }
+    return 0;
+}
+
 /*
  * Check for duplicate label sets. This is very common in multi-archive
  * contexts. Since label sets are timestamped, only identical ones
@@ -439,13 +523,13 @@ discard_dup_labelsets(__pmLogLabelSet *idp, const __pmLogLabelSet *idp_next)
  * addlabel() does not assume that label sets are added in chronological order
  * so we do this after all of the meta data for each individual archive
  * has been read. At this point we know that the label sets are stored in reverse
- * chronological order.
+ * chronological order.  Label sets still to be read via the metadata
+ * index are checked when they are read, see loadlabels().
  */
 static void
 check_dup_labels(const __pmArchCtl *acp)
 {
     __pmLogCtl		*lcp;
-    __pmLogLabelSet	*idp, *idp_prev, *idp_next;
     __pmHashCtl		*l_hashlabels;
     __pmHashCtl		*l_hashtype;
     __pmHashNode	*hplabels, *hptype;
@@ -460,33 +544,8 @@ check_dup_labels(const __pmArchCtl *acp)
 	    l_hashtype = (__pmHashCtl *)hplabels->data;
 	    for (ident = 0; ident < l_hashtype->hsize; ++ident) {
 		for (hptype = l_hashtype->hash[ident]; hptype; hptype = hptype->next) {
-		    idp_prev = NULL;
-		    for (idp = (__pmLogLabelSet *)hptype->data; idp; idp = idp_next) {
-			idp_next = idp->next;
-			if (idp_next == NULL)
-			    break; /* done */
-
-			/*
-			 * idp and idp_next each hold sets of label sets. Since idp is
-			 * later in time, we want to discard any label sets within
-			 * idp which are the same as any label sets in idp_next.
-			 */
-			discard_dup_labelsets(idp, idp_next);
-			if (idp->nsets == 0) {
-			    /*
-			     * All label sets within idp were discarded.
-			     * unlink it and free it.
-			     */
-			    if (idp_prev)
-				idp_prev->next = idp_next;
-			    else
-				hptype->data = idp_next;
-			    free(idp->labelsets);
-			    free(idp);
-			}
-			else
-			    idp_prev = idp;
-		    }
+		    if (!pendinglabels((__pmLogLabelSet *)hptype->data))
+			discard_dup_labels(hptype);
 		}
 	    }
 	}
@@ -632,460 +691,1201 @@ __pmLogAddLabelSets(__pmArchCtl *acp, const pmTimespec *when, unsigned int type,
 {
     pmTimeval		tv;
 
-    tv.tv_sec = when->tv_sec;
-    tv.tv_usec = when->tv_nsec / 1000;
-    return addlabel(acp, type, ident, nsets, labelsets, &tv);
+    tv.tv_sec = when->tv_sec;
+    tv.tv_usec = when->tv_nsec / 1000;
+    return addlabel(acp, type, ident, nsets, labelsets, &tv);
+}
+
+int
+__pmLogAddText(__pmArchCtl *acp, unsigned int ident, unsigned int type, const char *buffer)
+{
+    return addtext(acp, ident, type, buffer);
+}
+
+/*
+ * Return the error for a failed or short read from the metadata file.
+ */
+static int
+readerror(__pmFILE *f)
+{
+    if (__pmFerror(f)) {
+	__pmClearerr(f);
+	return -oserror();
+    }
+    return PM_ERR_LOGREC;
+}
+
+/*
+ * Read the header of the next metadata record.  Returns 1 for success,
+ * 0 at the end of the file, else an error code.
+ */
+static int
+readhdr(__pmFILE *f, __pmLogHdr *hp)
+{
+    int			n;
+
+    n = (int)__pmFread(hp, 1, sizeof(__pmLogHdr), f);
+
+    /* swab hdr */
+    hp->len = ntohl(hp->len);
+    hp->type = ntohl(hp->type);
+
+    if (n != sizeof(__pmLogHdr) || hp->len <= 0) {
+	if (__pmFeof(f)) {
+	    __pmClearerr(f);
+	    return 0;
+	}
+	if (pmDebugOptions.logmeta) {
+	    fprintf(stderr, "__pmLogLoadMeta: header read -> %d: expected: %d or len=%d\n",
+		    n, (int)sizeof(__pmLogHdr), hp->len);
+	}
+	return readerror(f);
+    }
+    if (pmDebugOptions.logmeta) {
+	fprintf(stderr, "__pmLogLoadMeta: record len=%d, type=%d @ offset=%d\n",
+	    hp->len, hp->type, (int)(__pmFtell(f) - sizeof(__pmLogHdr)));
+    }
+    return 1;
+}
+
+/*
+ * Read and check the trailer of a metadata record.
+ */
+static int
+readtrailer(__pmFILE *f, const __pmLogHdr *hp)
+{
+    int			check;
+    int			n;
+
+    n = (int)__pmFread(&check, 1, sizeof(check), f);
+    check = ntohl(check);
+    if (n != sizeof(check) || hp->len != check) {
+	if (pmDebugOptions.logmeta) {
+	    fprintf(stderr, "%s: trailer read -> %d or len=%d: "
+			    "expected %d @ offset=%d\n", "__pmLogLoadMeta",
+		    n, check, hp->len, (int)(__pmFtell(f) - sizeof(check)));
+	}
+	return readerror(f);
+    }
+    return 0;
+}
+
+/*
+ * Read the body of a metric descriptor record, adding the descriptor
+ * and the metric names to the archive.
+ */
+static int
+readdesc(__pmArchCtl *acp, __pmFILE *f)
+{
+    pmDesc		desc;
+    int			numnames;
+    int			i;
+    int			n;
+    int			len;
+    int			sts;
+    char		name[MAXPATHLEN];
+
+    if ((n = (int)__pmFread(&desc, 1, sizeof(pmDesc), f)) != sizeof(pmDesc)) {
+	if (pmDebugOptions.logmeta) {
+	    fprintf(stderr, "__pmLogLoadMeta: pmDesc read -> %d: expected: %d\n",
+		    n, (int)sizeof(pmDesc));
+	}
+	return readerror(f);
+    }
+
+    /* swab desc */
+    desc.type = ntohl(desc.type);
+    desc.sem = ntohl(desc.sem);
+    desc.indom = __ntohpmInDom(desc.indom);
+    desc.units = __ntohpmUnits(desc.units);
+    desc.pmid = __ntohpmID(desc.pmid);
+
+    if ((sts = __pmLogAddDesc(acp, &desc)) < 0)
+	return sts;
+
+    /* read in the names & store in PMNS tree ... */
+    if ((n = (int)__pmFread(&numnames, 1, sizeof(numnames), f)) != 
+	sizeof(numnames)) {
+	if (pmDebugOptions.logmeta) {
+	    fprintf(stderr, "%s: numnames read -> %d: expected: %d\n",
+		    "__pmLogLoadMeta", n, (int)sizeof(numnames));
+	}
+	return readerror(f);
+    }
+    /* swab numnames */
+    numnames = ntohl(numnames);
+
+    for (i = 0; i < numnames; i++) {
+	if ((n = (int)__pmFread(&len, 1, sizeof(len), f)) != 
+	    sizeof(len)) {
+	    if (pmDebugOptions.logmeta) {
+		fprintf(stderr, "%s: len name[%d] read -> %d: expected: %d\n",
+			"__pmLogLoadMeta", i, n, (int)sizeof(len));
+	    }
+	    return readerror(f);
+	}
+	/* swab len */
+	len = ntohl(len);
+
+	if ((n = (int)__pmFread(name, 1, len, f)) != len) {
+	    if (pmDebugOptions.logmeta) {
+		fprintf(stderr, "%s: name[%d] read -> %d: expected: %d\n",
+			"__pmLogLoadMeta", i, n, len);
+	    }
+	    return readerror(f);
+	}
+	name[len] = '\0';
+	if (pmDebugOptions.logmeta) {
+	    char	strbuf[20];
+	    fprintf(stderr, "%s: PMID: %s name: %s\n",
+		    "__pmLogLoadMeta",
+		    pmIDStr_r(desc.pmid, strbuf, sizeof(strbuf)), name);
+	}
+
+	/* Add the new PMNS node into this context */
+	if ((sts = __pmLogAddPMNSNode(acp, desc.pmid, name)) < 0)
+	    return sts;
+    }
+    return 0;
+}
+
+/*
+ * Read the body of an instance domain record.  If there are instances,
+ * *tbufp is the buffer (to be kept or freed by the caller, along with
+ * in->namelist unless *allinbuf is set), else it is NULL.
+ */
+static int
+readindom(__pmFILE *f, int rlen, pmTimespec *when, pmInResult *in,
+		int **tbufp, int *allinbuf)
+{
+    pmTimeval		*tv;
+    char		*namebase;
+    int			*tbuf, *stridx;
+    int			i, k, n;
+    int			sts;
+
+    *tbufp = NULL;
+    *allinbuf = 0;
+PM_FAULT_POINT("libpcp/" __FILE__ ":3", PM_FAULT_ALLOC);
+    if ((tbuf = (int *)malloc(rlen)) == NULL)
+	return -oserror();
+    if ((n = (int)__pmFread(tbuf, 1, rlen, f)) != rlen) {
+	if (pmDebugOptions.logmeta) {
+	    fprintf(stderr, "%s: indom read -> %d: expected: %d\n",
+		    "__pmLogLoadMeta", n, rlen);
+	}
+	sts = readerror(f);
+	free(tbuf);
+	return sts;
+    }
+
+    k = 0;
+    tv = (pmTimeval *)&tbuf[k];
+    when->tv_sec = ntohl(tv->tv_sec);
+    when->tv_nsec = ntohl(tv->tv_usec) * 1000;
+    k += sizeof(*tv)/sizeof(int);
+    in->indom = __ntohpmInDom((unsigned int)tbuf[k++]);
+    in->numinst = ntohl(tbuf[k++]);
+    in->instlist = NULL;
+    in->namelist = NULL;
+    if (in->numinst <= 0) {
+	/* no instances, or an error */
+	free(tbuf);
+	return 0;
+    }
+
+    in->instlist = &tbuf[k];
+    k += in->numinst;
+    stridx = &tbuf[k];
+#if defined(HAVE_32BIT_PTR)
+    in->namelist = (char **)stridx;
+    *allinbuf = 1; /* allocation is all in tbuf */
+#else
+    *allinbuf = 0; /* allocation for namelist + tbuf */
+    /* need to allocate to hold the pointers */
+PM_FAULT_POINT("libpcp/" __FILE__ ":4", PM_FAULT_ALLOC);
+    in->namelist = (char **)malloc(in->numinst * sizeof(char*));
+    if (in->namelist == NULL) {
+	sts = -oserror();
+	free(tbuf);
+	return sts;
+    }
+#endif
+    k += in->numinst;
+    namebase = (char *)&tbuf[k];
+    for (i = 0; i < in->numinst; i++) {
+	in->instlist[i] = ntohl(in->instlist[i]);
+	in->namelist[i] = &namebase[ntohl(stridx[i])];
+    }
+    *tbufp = tbuf;
+    return 0;
+}
+
+/*
+ * Read the body of a label record.
+ */
+static int
+readlabel(__pmFILE *f, int rlen, pmTimeval *stamp, int *typep, int *identp,
+		int *nsetsp, pmLabelSet **labelsetsp)
+{
+    char		*tbuf;
+    int			i, j, k, n;
+    int			nsets;
+    int			inst;
+    int			jsonlen;
+    int			nlabels;
+    int			sts;
+    pmLabelSet		*labelsets = NULL;
+
+PM_FAULT_POINT("libpcp/" __FILE__ ":11", PM_FAULT_ALLOC);
+    if ((tbuf = (char *)malloc(rlen)) == NULL)
+	return -oserror();
+    if ((n = (int)__pmFread(tbuf, 1, rlen, f)) != rlen) {
+	if (pmDebugOptions.logmeta) {
+	    fprintf(stderr, "%s: label read -> %d: expected: %d\n",
+		    "__pmLogLoadMeta", n, rlen);
+	}
+	sts = readerror(f);
+	free(tbuf);
+	return sts;
+    }
+
+    k = 0;
+    *stamp = *((pmTimeval *)&tbuf[k]);
+    stamp->tv_sec = ntohl(stamp->tv_sec);
+    stamp->tv_usec = ntohl(stamp->tv_usec);
+    k += sizeof(*stamp);
+
+    *typep = ntohl(*((unsigned int*)&tbuf[k]));
+    k += sizeof(*typep);
+
+    *identp = ntohl(*((unsigned int*)&tbuf[k]));
+    k += sizeof(*identp);
+
+    nsets = *((unsigned int *)&tbuf[k]);
+    nsets = ntohl(nsets);
+    k += sizeof(nsets);
+
+    if (nsets > 0 &&
+	(labelsets = (pmLabelSet *)calloc(nsets, sizeof(pmLabelSet))) == NULL) {
+	sts = -oserror();
+	free(tbuf);
+	return sts;
+    }
+
+    for (i = 0; i < nsets; i++) {
+	inst = *((unsigned int*)&tbuf[k]);
+	inst = ntohl(inst);
+	k += sizeof(inst);
+	labelsets[i].inst = inst;
+
+	jsonlen = ntohl(*((unsigned int*)&tbuf[k]));
+	k += sizeof(jsonlen);
+	labelsets[i].jsonlen = jsonlen;
+
+	if (jsonlen < 0 || jsonlen > PM_MAXLABELJSONLEN) {
+	    if (pmDebugOptions.logmeta)
+		fprintf(stderr, "%s: corrupted json in labelset. jsonlen=%d\n",
+				"__pmLogLoadMeta", jsonlen);
+	    free(labelsets);
+	    free(tbuf);
+	    return PM_ERR_LOGREC;
+	}
+
+	if ((labelsets[i].json = (char *)malloc(jsonlen+1)) == NULL) {
+	    sts = -oserror();
+	    free(labelsets);
+	    free(tbuf);
+	    return sts;
+	}
+
+	memcpy((void *)labelsets[i].json, (void *)&tbuf[k], jsonlen);
+	labelsets[i].json[jsonlen] = '\0';
+	k += jsonlen;
+
+	/* label nlabels */
+	nlabels = ntohl(*((unsigned int *)&tbuf[k]));
+	k += sizeof(nlabels);
+	labelsets[i].nlabels = nlabels;
+
+	if (nlabels > 0) { /* nlabels < 0 is an error code. skip it here */
+	    if (nlabels > PM_MAXLABELS || k + nlabels * sizeof(pmLabel) > rlen) {
+		/* corrupt archive metadata detected. GH #475 */
+		if (pmDebugOptions.logmeta)
+		    fprintf(stderr, "%s: corrupted labelset. nlabels=%d\n",
+				    "__pmLogLoadMeta", nlabels);
+		free(labelsets);
+		free(tbuf);
+		return PM_ERR_LOGREC;
+	    }
+
+	    if ((labelsets[i].labels = (pmLabel *)calloc(nlabels, sizeof(pmLabel))) == NULL) {
+		sts = -oserror();
+		free(labelsets);
+		free(tbuf);
+		return sts;
+	    }
+
+	    /* label pmLabels */
+	    for (j = 0; j < nlabels; j++) {
+		labelsets[i].labels[j] = *((pmLabel *)&tbuf[k]);
+		__ntohpmLabel(&labelsets[i].labels[j]);
+		k += sizeof(pmLabel);
+	    }
+	}
+    }
+    free(tbuf);
+
+    *nsetsp = nsets;
+    *labelsetsp = labelsets;
+    return 0;
+}
+
+/*
+ * Read the body of a help text record, adding the text to the archive.
+ * Text with a bad type or identifier is ignored.
+ */
+static int
+readtext(__pmArchCtl *acp, __pmFILE *f, int rlen)
+{
+    char		*tbuf;
+    int			type;
+    int			ident;
+    int			k, n;
+    int			sts;
+
+PM_FAULT_POINT("libpcp/" __FILE__ ":16", PM_FAULT_ALLOC);
+    if ((tbuf = (char *)malloc(rlen)) == NULL)
+	return -oserror();
+    if ((n = (int)__pmFread(tbuf, 1, rlen, f)) != rlen) {
+	if (pmDebugOptions.logmeta) {
+	    fprintf(stderr, "%s: text read -> %d: expected: %d\n",
+			    "__pmLogLoadMeta", n, rlen);
+	}
+	sts = readerror(f);
+	free(tbuf);
+	return sts;
+    }
+
+    k = 0;
+    type = ntohl(*((unsigned int *)&tbuf[k]));
+    k += sizeof(type);
+    if (!(type & (PM_TEXT_ONELINE|PM_TEXT_HELP))) {
+	if (pmDebugOptions.logmeta) {
+	    fprintf(stderr, "__pmLogLoadMeta: bad text type -> %x\n",
+		    type);
+	}
+	free(tbuf);
+	return 0;
+    }
+    else if (type & PM_TEXT_INDOM)
+	ident = __ntohpmInDom(*((unsigned int *)&tbuf[k]));
+    else if (type & PM_TEXT_PMID)
+	ident = __ntohpmID(*((unsigned int *)&tbuf[k]));
+    else {
+	if (pmDebugOptions.logmeta) {
+	    fprintf(stderr, "%s: bad text ident -> %x\n",
+			    "__pmLogLoadMeta", type);
+	}
+	free(tbuf);
+	return 0;
+    }
+    k += sizeof(ident);
+
+    sts = addtext(acp, ident, type, (char *)&tbuf[k]);
+    free(tbuf);
+    return sts;
+}
+
+/*
+ * Read the body and trailer of the metadata record with header *hp,
+ * adding its contents to the archive.
+ */
+static int
+readrecord(__pmArchCtl *acp, const __pmLogHdr *hp, int *numpmid)
+{
+    __pmFILE		*f = acp->ac_log->l_mdfp;
+    int			rlen;
+    int			sts = 0;
+
+    rlen = hp->len - (int)sizeof(__pmLogHdr) - (int)sizeof(int);
+    if (hp->type == TYPE_DESC) {
+	(*numpmid)++;
+	sts = readdesc(acp, f);
+    }
+    else if (hp->type == TYPE_INDOM) {
+	pmTimespec	when;
+	pmInResult	in;
+	int		*tbuf;
+	int		allinbuf;
+
+	if ((sts = readindom(f, rlen, &when, &in, &tbuf, &allinbuf)) == 0 &&
+	    in.numinst > 0) {
+	    if ((sts = __pmLogAddInDom(acp, &when, &in, tbuf, allinbuf)) < 0)
+		return sts;
+	    /* If this indom was a duplicate, then we need to free tbuf and
+	       namelist, as appropriate. */
+	    if (sts == PMLOGPUTINDOM_DUP) {
+		free(tbuf);
+		if (in.namelist != NULL && !allinbuf)
+		    free(in.namelist);
+	    }
+	}
+    }
+    else if (hp->type == TYPE_LABEL) {
+	pmTimeval	stamp;
+	pmLabelSet	*labelsets;
+	int		type;
+	int		ident;
+	int		nsets;
+
+	if ((sts = readlabel(f, rlen, &stamp, &type, &ident, &nsets, &labelsets)) == 0)
+	    sts = addlabel(acp, type, ident, nsets, labelsets, &stamp);
+    }
+    else if (hp->type == TYPE_TEXT)
+	sts = readtext(acp, f, rlen);
+    else
+	__pmFseek(f, (long)rlen, SEEK_CUR);
+    if (sts < 0)
+	return sts;
+
+    return readtrailer(f, hp);
+}
+
+/*
+ * Add an instance domain from the metadata index, to be read from the
+ * metadata file the first time it is needed.  If there is already an
+ * instance domain with the same time stamp, read this one now so that
+ * addindom() can filter out a duplicate.
+ */
+static int
+addpendingindom(__pmArchCtl *acp, pmInDom indom, const pmTimeval *tp,
+		__pm_off_t offset, int *numpmid)
+{
+    __pmLogCtl		*lcp = acp->ac_log;
+    __pmLogInDom	*idp, *idp_prev = NULL;
+    __pmLogInDom	*idp_cached;
+    __pmHashNode	*hp;
+    __pmLogHdr		h;
+    int			timecmp;
+    int			sts;
+
+    if ((hp = __pmHashSearch((unsigned int)indom, &lcp->l_hashindom)) != NULL) {
+	for (idp_cached = (__pmLogInDom *)hp->data; idp_cached; idp_cached = idp_cached->next) {
+	    if ((timecmp = __pmTimevalCmp(&idp_cached->stamp, tp)) < 0)
+		break;
+	    if (timecmp == 0) {
+		__pmFseek(lcp->l_mdfp, (long)offset, SEEK_SET);
+		if ((sts = readhdr(lcp->l_mdfp, &h)) <= 0 || h.type != TYPE_INDOM)
+		    return sts < 0 ? sts : PM_ERR_LOGREC;
+		return readrecord(acp, &h, numpmid);
+	    }
+	    idp_prev = idp_cached;
+	}
+    }
+
+PM_FAULT_POINT("libpcp/" __FILE__ ":1", PM_FAULT_ALLOC);
+    if ((idp = (__pmLogInDom *)calloc(1, sizeof(__pmLogInDom))) == NULL)
+	return -oserror();
+    idp->stamp = *tp;		/* struct assignment */
+    idp->pending = offset;
+
+    if (hp == NULL) {
+	idp->next = NULL;
+	if ((sts = __pmHashAdd((unsigned int)indom, (void *)idp, &lcp->l_hashindom)) < 0) {
+	    free(idp);
+	    return sts;
+	}
+    }
+    else if (idp_prev == NULL) {
+	idp->next = (__pmLogInDom *)hp->data;
+	hp->data = (void *)idp;
+    }
+    else {
+	idp->next = idp_prev->next;
+	idp_prev->next = idp;
+    }
+    return 0;
+}
+
+/*
+ * Add a label set record from the metadata index, to be read from the
+ * metadata file the first time labels of this type and ident are needed.
+ */
+static int
+addpendinglabel(__pmArchCtl *acp, unsigned int type, unsigned int ident,
+		const pmTimeval *tp, __pm_off_t offset)
+{
+    __pmLogCtl		*lcp = acp->ac_log;
+    __pmLogLabelSet	*idp, *idp_prev = NULL;
+    __pmLogLabelSet	*idp_cached;
+    __pmHashNode	*hp;
+    __pmHashCtl		*l_hashtype;
+    int			sts;
+
+PM_FAULT_POINT("libpcp/" __FILE__ ":13", PM_FAULT_ALLOC);
+    if ((idp = (__pmLogLabelSet *)calloc(1, sizeof(__pmLogLabelSet))) == NULL)
+	return -oserror();
+    idp->stamp = *tp;		/* struct assignment */
+    idp->type = type;
+    idp->ident = ident;
+    idp->pending = offset;
+
+    type &= ~(PM_LABEL_COMPOUND|PM_LABEL_OPTIONAL);
+    if (type == PM_LABEL_CONTEXT)
+	ident = PM_ID_NULL;
+
+    if ((hp = __pmHashSearch(type, &lcp->l_hashlabels)) == NULL) {
+	if ((l_hashtype = (__pmHashCtl *) calloc(1, sizeof(__pmHashCtl))) == NULL) {
+	    free(idp);
+	    return -oserror();
+	}
+	if ((sts = __pmHashAdd(type, (void *)l_hashtype, &lcp->l_hashlabels)) < 0) {
+	    free(l_hashtype);
+	    free(idp);
+	    return sts;
+	}
+    } else {
+	l_hashtype = (__pmHashCtl *)hp->data;
+    }
+
+    if ((hp = __pmHashSearch(ident, l_hashtype)) == NULL) {
+	idp->next = NULL;
+	if ((sts = __pmHashAdd(ident, (void *)idp, l_hashtype)) < 0) {
+	    free(idp);
+	    return sts;
+	}
+	return 0;
+    }
+
+    /* as for addlabel(), sorted by decreasing time stamp */
+    for (idp_cached = (__pmLogLabelSet *)hp->data; idp_cached; idp_cached = idp_cached->next) {
+	if (__pmTimevalCmp(&idp_cached->stamp, &idp->stamp) < 0)
+	    break;
+	idp_prev = idp_cached;
+    }
+    if (idp_prev == NULL) {
+	idp->next = (__pmLogLabelSet *)hp->data;
+	hp->data = (void *)idp;
+    }
+    else {
+	idp->next = idp_prev->next;
+	idp_prev->next = idp;
+    }
+    return 0;
+}
+
+/*
+ * Check that the header of the metadata index matches the archive label.
+ */
+static int
+checkmindex(const mindex_hdr_t *mhp, const __pmLogLabel *lp)
+{
+    if (ntohl(mhp->magic) != (MINDEX_MAGIC | MINDEX_VERSION))
+	return 0;
+    if (ntohl(mhp->pid) != lp->ill_pid)
+	return 0;
+    if (ntohl(mhp->start.tv_sec) != lp->ill_start.tv_sec ||
+	ntohl(mhp->start.tv_usec) != lp->ill_start.tv_usec)
+	return 0;
+    if (strncmp(mhp->hostname, lp->ill_hostname, PM_LOG_MAXHOSTLEN) != 0)
+	return 0;
+    return 1;
+}
+
+/*
+ * Use the metadata index (<base>.mindex), if there is one for this
+ * archive and it is no older than the metadata file.
+ *
+ * The index holds the offset, type and keys of each metadata record,
+ * in order.  Descriptors (and names) and help text are read from the
+ * metadata file now, but instance domains and label sets are only added
+ * as pending entries (with a time stamp and offset) and are read from
+ * the metadata file the first time they are needed.  For an archive
+ * with many instance domain changes, most of the metadata file need
+ * never be read.
+ *
+ * The index may cover only the leading records of the metadata file
+ * (e.g. pmlogger is still writing or an index entry could not be
+ * written), so on return *offset is the offset of the first record
+ * not covered by the index, from which the caller reads the rest of
+ * the metadata file as usual.  If the index turns out not to describe
+ * the metadata file, it is ignored and *offset is left alone.
+ */
+static int
+loadmindex(__pmArchCtl *acp, __pm_off_t *offset, int *numpmid)
+{
+    __pmLogCtl		*lcp = acp->ac_log;
+    __pmFILE		*f = lcp->l_mdfp;
+    __pmFILE		*mf;
+    __pmLogHdr		h;
+    mindex_hdr_t	hdr;
+    mindex_t		*list = NULL;
+    mindex_t		*ep;
+    struct stat		sbuf;
+    struct stat		msbuf;
+    char		path[MAXPATHLEN];
+    const char		*why = NULL;
+    __pm_off_t		next = *offset;
+    size_t		maxlist = 0;
+    size_t		numlist = 0;
+    size_t		i;
+    int			sts = 0;
+
+    pmsprintf(path, sizeof(path), "%s.mindex", lcp->l_name);
+    if ((mf = __pmFopen(path, "r")) == NULL)
+	return 0;
+
+    if (__pmFstat(f, &sbuf) < 0 || __pmFstat(mf, &msbuf) < 0)
+	why = "cannot stat";
+    else if (msbuf.st_mtime < sbuf.st_mtime)
+	why = "is older than the metadata";
+    else if (__pmFread(&hdr, 1, sizeof(hdr), mf) != sizeof(hdr) ||
+	     !checkmindex(&hdr, &lcp->l_label))
+	why = "does not match the archive label";
+    if (why != NULL)
+	goto done;
+
+    for ( ; ; ) {
+	if (numlist == maxlist) {
+	    mindex_t	*tmp;
+
+	    maxlist = maxlist ? maxlist * 2 : 1024;
+	    if ((tmp = (mindex_t *)realloc(list, maxlist * sizeof(mindex_t))) == NULL) {
+		sts = -oserror();
+		goto done;
+	    }
+	    list = tmp;
+	}
+	ep = &list[numlist];
+	if (__pmFread(ep, 1, sizeof(mindex_t), mf) != sizeof(mindex_t))
+	    break;
+	ep->type = ntohl(ep->type);
+	ep->len = ntohl(ep->len);
+	ep->offset = ntohl(ep->offset);
+	ep->stamp.tv_sec = ntohl(ep->stamp.tv_sec);
+	ep->stamp.tv_usec = ntohl(ep->stamp.tv_usec);
+	ep->ident = ntohl(ep->ident);
+	ep->subtype = ntohl(ep->subtype);
+	/* the index must describe consecutive records from the start */
+	if (ep->offset != next ||
+	    ep->len < (int)(sizeof(__pmLogHdr) + sizeof(int)))
+	    break;
+	next += ep->len;
+	numlist++;
+    }
+    if (numlist == 0) {
+	why = "is empty";
+	goto done;
+    }
+
+    /* and the last record it describes must be in the metadata file */
+    ep = &list[numlist-1];
+    __pmFseek(f, (long)ep->offset, SEEK_SET);
+    if (readhdr(f, &h) <= 0 || h.type != ep->type || h.len != ep->len) {
+	why = "does not match the metadata";
+	goto done;
+    }
+    __pmFseek(f, (long)(next - sizeof(int)), SEEK_SET);
+    if (readtrailer(f, &h) < 0) {
+	why = "does not match the metadata";
+	goto done;
+    }
+
+    if (pmDebugOptions.logmeta)
+	fprintf(stderr, "__pmLogLoadMeta: %s: %d records\n", path, (int)numlist);
+
+    for (i = 0; i < numlist; i++) {
+	ep = &list[i];
+	if (ep->type == TYPE_INDOM) {
+	    /* no instances, or an error, is not added to the archive */
+	    if (ep->subtype > 0 &&
+		(sts = addpendingindom(acp, ep->ident, &ep->stamp,
+					ep->offset, numpmid)) < 0)
+		break;
+	}
+	else if (ep->type == TYPE_LABEL) {
+	    if ((sts = addpendinglabel(acp, ep->subtype, ep->ident,
+					&ep->stamp, ep->offset)) < 0)
+		break;
+	}
+	else {
+	    if (__pmFtell(f) != ep->offset)
+		__pmFseek(f, (long)ep->offset, SEEK_SET);
+	    if ((sts = readhdr(f, &h)) <= 0 ||
+		h.type != ep->type || h.len != ep->len) {
+		if (sts >= 0)
+		    sts = PM_ERR_LOGREC;
+		break;
+	    }
+	    if ((sts = readrecord(acp, &h, numpmid)) < 0)
+		break;
+	}
+    }
+    if (sts == PM_ERR_LOGREC) {
+	/*
+	 * The metadata file may have been rewritten since the index was
+	 * (e.g. by pmlogrewrite within the same second) - discard all
+	 * that has been loaded, and read all of the metadata file instead
+	 * (which reports the error again if the metadata file is bad).
+	 */
+	why = "does not match the metadata";
+	__pmLogResetMeta(lcp);
+	*numpmid = 0;
+	sts = __pmNewPMNS(&lcp->l_pmns);
+    }
+    else if (sts == 0)
+	*offset = next;
+
+done:
+    if (why != NULL && pmDebugOptions.logmeta)
+	fprintf(stderr, "__pmLogLoadMeta: %s %s, ignored\n", path, why);
+    if (list != NULL)
+	free(list);
+    __pmFclose(mf);
+    return sts;
+}
+
+/*
+ * Load _all_ of the hashed pmDesc and __pmLogInDom structures from the metadata
+ * log file -- used at the initialization (NewContext) of an archive.
+ * Also load all the metric names from the metadata log file and create l_pmns,
+ * if it does not already exist.
+ *
+ * If there is a metadata index, instance domains and label sets are only
+ * found here, and are loaded later as they are needed (see loadmindex()).
+ */
+int
+__pmLogLoadMeta(__pmArchCtl *acp)
+{
+    __pmLogCtl		*lcp = acp->ac_log;
+    __pmFILE		*f = lcp->l_mdfp;
+    __pmLogHdr		h;
+    __pm_off_t		offset = sizeof(__pmLogLabel) + 2*sizeof(int);
+    int			numpmid = 0;
+    int			sts = 0;
+    
+    if (lcp->l_pmns == NULL) {
+	if ((sts = __pmNewPMNS(&(lcp->l_pmns))) < 0)
+	    goto end;
+    }
+
+    /*
+     * Not for multi-archive contexts, where the metadata file is closed
+     * when switching to another archive.
+     */
+    if (!lcp->l_multi && (sts = loadmindex(acp, &offset, &numpmid)) < 0)
+	goto end;
+
+    __pmFseek(f, (long)offset, SEEK_SET);
+    for ( ; ; ) {
+	if ((sts = readhdr(f, &h)) <= 0)
+	    break;
+	if ((sts = readrecord(acp, &h, &numpmid)) < 0)
+	    break;
+    }
+end:
+
+    /* Check for duplicate label sets. */
+    check_dup_labels(acp);
+    
+    __pmFseek(f, (long)(sizeof(__pmLogLabel) + 2*sizeof(int)), SEEK_SET);
+
+    if (sts == 0) {
+	if (numpmid == 0) {
+	    if (pmDebugOptions.logmeta) {
+		fprintf(stderr, "%s: no metrics found?\n", "__pmLogLoadMeta");
+	    }
+	    sts = PM_ERR_LOGREC;
+	}
+	else
+	    __pmFixPMNSHashTab(lcp->l_pmns, numpmid, 1);
+    }
+    return sts;
+}
+
+/*
+ * Read an instance domain added from the metadata index, the first
+ * time it is needed.
+ *
+ * The __pmLogCtl, and so l_mdfp and the stubs, may be shared by several
+ * contexts, so the seek, the read and the update of the stub are all
+ * done holding l_lock.
+ */
+static int
+loadindom(__pmLogCtl *lcp, __pmLogInDom *idp)
+{
+    __pmFILE		*f = lcp->l_mdfp;
+    __pmLogHdr		h;
+    pmTimespec		when;
+    pmInResult		in;
+    long		offset;
+    int			*tbuf;
+    int			allinbuf;
+    int			sts;
+
+    PM_LOCK(lcp->l_lock);
+    if (idp->pending == 0) {
+	PM_UNLOCK(lcp->l_lock);
+	return 0;
+    }
+
+    offset = __pmFtell(f);
+    __pmFseek(f, (long)idp->pending, SEEK_SET);
+    if ((sts = readhdr(f, &h)) <= 0 || h.type != TYPE_INDOM)
+	goto bad;
+    sts = readindom(f, h.len - (int)sizeof(__pmLogHdr) - (int)sizeof(int),
+		    &when, &in, &tbuf, &allinbuf);
+    if (sts < 0)
+	goto done;
+    if (in.numinst <= 0 || (sts = readtrailer(f, &h)) < 0 ||
+	when.tv_sec != idp->stamp.tv_sec ||
+	when.tv_nsec / 1000 != idp->stamp.tv_usec) {
+	if (in.numinst > 0) {
+	    free(tbuf);
+	    if (!allinbuf)
+		free(in.namelist);
+	}
+	goto bad;
+    }
+
+    idp->buf = tbuf;
+    idp->allinbuf = allinbuf;
+    addinsts(idp, in.numinst, in.instlist, in.namelist);
+    idp->pending = 0;
+    if (pmDebugOptions.logmeta) {
+	char    strbuf[20];
+	fprintf(stderr, "loadindom( ..., %s, ", pmInDomStr_r(in.indom, strbuf, sizeof(strbuf)));
+	StrTimeval(&idp->stamp);
+	fprintf(stderr, ", numinst=%d)\n", in.numinst);
+    }
+    sts = 0;
+    goto done;
+
+bad:
+    if (pmDebugOptions.logmeta)
+	fprintf(stderr, "loadindom: no indom record @ offset=%d\n", (int)idp->pending);
+    if (sts >= 0)
+	sts = PM_ERR_LOGREC;
+done:
+    __pmFseek(f, offset, SEEK_SET);
+    PM_UNLOCK(lcp->l_lock);
+    return sts;
+}
+
+/*
+ * Read any instance domains added from the metadata index in the list
+ * starting at idp, for callers that need all of the instance domains.
+ */
+int
+__pmLogLoadInDoms(__pmLogCtl *lcp, __pmLogInDom *idp)
+{
+    int			sts;
+
+    for ( ; idp != NULL; idp = idp->next) {
+	if ((sts = loadindom(lcp, idp)) < 0)
+	    return sts;
+    }
+    return 0;
+}
+
+/*
+ * Read a label set record added from the metadata index.  The caller
+ * holds l_lock, see loadlabels().
+ */
+static int
+loadlabel(__pmLogCtl *lcp, __pmLogLabelSet *idp)
+{
+    __pmFILE		*f = lcp->l_mdfp;
+    __pmLogHdr		h;
+    pmTimeval		stamp;
+    pmLabelSet		*labelsets;
+    long		offset;
+    int			type;
+    int			ident;
+    int			nsets;
+    int			sts;
+
+    if (idp->pending == 0)
+	return 0;
+
+    offset = __pmFtell(f);
+    __pmFseek(f, (long)idp->pending, SEEK_SET);
+    if ((sts = readhdr(f, &h)) <= 0 || h.type != TYPE_LABEL)
+	goto bad;
+    sts = readlabel(f, h.len - (int)sizeof(__pmLogHdr) - (int)sizeof(int),
+		    &stamp, &type, &ident, &nsets, &labelsets);
+    if (sts < 0)
+	goto done;
+    if ((sts = readtrailer(f, &h)) < 0 ||
+	type != idp->type || ident != idp->ident ||
+	__pmTimevalCmp(&stamp, &idp->stamp) != 0) {
+	if (nsets > 0)
+	    pmFreeLabelSets(labelsets, nsets);
+	goto bad;
+    }
+
+    idp->nsets = nsets;
+    idp->labelsets = labelsets;
+    idp->pending = 0;
+    if (pmDebugOptions.logmeta) {
+	fprintf(stderr, "loadlabel( ..., %u, %u, ", type, ident);
+	StrTimeval(&stamp);
+	fprintf(stderr, ", nsets=%d)\n", nsets);
+    }
+    sts = 0;
+    goto done;
+
+bad:
+    if (pmDebugOptions.logmeta)
+	fprintf(stderr, "loadlabel: no label record @ offset=%d\n", (int)idp->pending);
+    if (sts >= 0)
+	sts = PM_ERR_LOGREC;
+done:
+    __pmFseek(f, offset, SEEK_SET);
+    return sts;
 }
 
-int
-__pmLogAddText(__pmArchCtl *acp, unsigned int ident, unsigned int type, const char *buffer)
+/*
+ * Read all of the label set records added from the metadata index
+ * for one type and ident, then check for duplicates as would have
+ * been done by __pmLogLoadMeta().  This reads l_mdfp and rewrites
+ * the list, which may be shared by other contexts, so hold l_lock.
+ */
+static int
+loadlabels(__pmLogCtl *lcp, __pmHashNode *hp)
 {
-    return addtext(acp, ident, type, buffer);
+    __pmLogLabelSet	*idp;
+    int			sts = 0;
+
+    PM_LOCK(lcp->l_lock);
+    if (!pendinglabels((__pmLogLabelSet *)hp->data))
+	goto done;
+    for (idp = (__pmLogLabelSet *)hp->data; idp; idp = idp->next) {
+	if ((sts = loadlabel(lcp, idp)) < 0)
+	    goto done;
+    }
+    discard_dup_labels(hp);
+done:
+    PM_UNLOCK(lcp->l_lock);
+    return sts;
 }
 
 /*
- * Load _all_ of the hashed pmDesc and __pmLogInDom structures from the metadata
- * log file -- used at the initialization (NewContext) of an archive.
- * Also load all the metric names from the metadata log file and create l_pmns,
- * if it does not already exist.
+ * Read everything that has been deferred when the archive was opened
+ * with a metadata index, for tools that walk the hashed metadata
+ * directly rather than using the lookup routines.
  */
 int
-__pmLogLoadMeta(__pmArchCtl *acp)
+__pmLogLoadAllMeta(__pmArchCtl *acp)
 {
     __pmLogCtl		*lcp = acp->ac_log;
-    int			rlen;
-    int			check;
-    int			sts = 0;
-    __pmLogHdr		h;
-    __pmFILE		*f = lcp->l_mdfp;
-    int			numpmid = 0;
-    int			n;
-    int			numnames;
-    int			i;
-    int			len;
-    char		name[MAXPATHLEN];
-    
-    if (lcp->l_pmns == NULL) {
-	if ((sts = __pmNewPMNS(&(lcp->l_pmns))) < 0)
-	    goto end;
-    }
-
-    __pmFseek(f, (long)(sizeof(__pmLogLabel) + 2*sizeof(int)), SEEK_SET);
-    for ( ; ; ) {
-	n = (int)__pmFread(&h, 1, sizeof(__pmLogHdr), f);
-
-	/* swab hdr */
-	h.len = ntohl(h.len);
-	h.type = ntohl(h.type);
-
-	if (n != sizeof(__pmLogHdr) || h.len <= 0) {
-            if (__pmFeof(f)) {
-		__pmClearerr(f);
-                sts = 0;
-		goto end;
-            }
-	    if (pmDebugOptions.logmeta) {
-		fprintf(stderr, "__pmLogLoadMeta: header read -> %d: expected: %d or len=%d\n",
-			n, (int)sizeof(__pmLogHdr), h.len);
-	    }
-	    if (__pmFerror(f)) {
-		__pmClearerr(f);
-		sts = -oserror();
-	    }
-	    else
-		sts = PM_ERR_LOGREC;
-	    goto end;
-	}
-	if (pmDebugOptions.logmeta) {
-	    fprintf(stderr, "__pmLogLoadMeta: record len=%d, type=%d @ offset=%d\n",
-		h.len, h.type, (int)(__pmFtell(f) - sizeof(__pmLogHdr)));
-	}
-	rlen = h.len - (int)sizeof(__pmLogHdr) - (int)sizeof(int);
-	if (h.type == TYPE_DESC) {
-	    pmDesc		desc;
-
-	    numpmid++;
-	    if ((n = (int)__pmFread(&desc, 1, sizeof(pmDesc), f)) != sizeof(pmDesc)) {
-		if (pmDebugOptions.logmeta) {
-		    fprintf(stderr, "__pmLogLoadMeta: pmDesc read -> %d: expected: %d\n",
-			    n, (int)sizeof(pmDesc));
-		}
-		if (__pmFerror(f)) {
-		    __pmClearerr(f);
-		    sts = -oserror();
-		}
-		else
-		    sts = PM_ERR_LOGREC;
-		goto end;
-	    }
-
-	    /* swab desc */
-	    desc.type = ntohl(desc.type);
-	    desc.sem = ntohl(desc.sem);
-	    desc.indom = __ntohpmInDom(desc.indom);
-	    desc.units = __ntohpmUnits(desc.units);
-	    desc.pmid = __ntohpmID(desc.pmid);
-
-	    if ((sts = __pmLogAddDesc(acp, &desc)) < 0)
-		goto end;
-
-	    /* read in the names & store in PMNS tree ... */
-	    if ((n = (int)__pmFread(&numnames, 1, sizeof(numnames), f)) != 
-		sizeof(numnames)) {
-		if (pmDebugOptions.logmeta) {
-		    fprintf(stderr, "%s: numnames read -> %d: expected: %d\n",
-			    "__pmLogLoadMeta", n, (int)sizeof(numnames));
-		}
-		if (__pmFerror(f)) {
-		    __pmClearerr(f);
-		    sts = -oserror();
-		}
-		else
-		    sts = PM_ERR_LOGREC;
-		goto end;
-	    }
-	    else {
-		/* swab numnames */
-		numnames = ntohl(numnames);
-	    }
-
-	    for (i = 0; i < numnames; i++) {
-		if ((n = (int)__pmFread(&len, 1, sizeof(len), f)) != 
-		    sizeof(len)) {
-		    if (pmDebugOptions.logmeta) {
-			fprintf(stderr, "%s: len name[%d] read -> %d: expected: %d\n",
-				"__pmLogLoadMeta", i, n, (int)sizeof(len));
-		    }
-		    if (__pmFerror(f)) {
-			__pmClearerr(f);
-			sts = -oserror();
-		    }
-		    else
-			sts = PM_ERR_LOGREC;
-		    goto end;
-		}
-		else {
-		    /* swab len */
-		    len = ntohl(len);
-		}
-
-		if ((n = (int)__pmFread(name, 1, len, f)) != len) {
-		    if (pmDebugOptions.logmeta) {
-			fprintf(stderr, "%s: name[%d] read -> %d: expected: %d\n",
-				"__pmLogLoadMeta", i, n, len);
-		    }
-		    if (__pmFerror(f)) {
-			__pmClearerr(f);
-			sts = -oserror();
-		    }
-		    else
-			sts = PM_ERR_LOGREC;
-		    goto end;
-		}
-		name[len] = '\0';
-		if (pmDebugOptions.logmeta) {
-		    char	strbuf[20];
-		    fprintf(stderr, "%s: PMID: %s name: %s\n",
-			    "__pmLogLoadMeta",
-			    pmIDStr_r(desc.pmid, strbuf, sizeof(strbuf)), name);
-		}
+    __pmHashCtl		*l_hashtype;
+    __pmHashNode	*hp, *hptype;
+    int			i, j;
+    int			sts;
 
-		/* Add the new PMNS node into this context */
-		if ((sts = __pmLogAddPMNSNode(acp, desc.pmid, name)) < 0)
-		    goto end;
-	    }/*for*/
+    for (i = 0; i < lcp->l_hashindom.hsize; i++) {
+	for (hp = lcp->l_hashindom.hash[i]; hp != NULL; hp = hp->next) {
+	    if ((sts = __pmLogLoadInDoms(lcp, (__pmLogInDom *)hp->data)) < 0)
+		return sts;
 	}
-	else if (h.type == TYPE_INDOM) {
-	    pmTimeval		*tv;
-	    pmTimespec		when;
-	    pmInResult		in;
-	    char		*namebase;
-	    int			*tbuf, *stridx;
-	    int			i, k, allinbuf = 0;
-
-PM_FAULT_POINT("libpcp/" __FILE__ ":3", PM_FAULT_ALLOC);
-	    if ((tbuf = (int *)malloc(rlen)) == NULL) {
-		sts = -oserror();
-		goto end;
-	    }
-	    if ((n = (int)__pmFread(tbuf, 1, rlen, f)) != rlen) {
-		if (pmDebugOptions.logmeta) {
-		    fprintf(stderr, "%s: indom read -> %d: expected: %d\n",
-			    "__pmLogLoadMeta", n, rlen);
-		}
-		if (__pmFerror(f)) {
-		    __pmClearerr(f);
-		    sts = -oserror();
-		}
-		else
-		    sts = PM_ERR_LOGREC;
-		free(tbuf);
-		goto end;
-	    }
-
-	    k = 0;
-	    tv = (pmTimeval *)&tbuf[k];
-	    when.tv_sec = ntohl(tv->tv_sec);
-	    when.tv_nsec = ntohl(tv->tv_usec) * 1000;
-	    k += sizeof(*tv)/sizeof(int);
-	    in.indom = __ntohpmInDom((unsigned int)tbuf[k++]);
-	    in.numinst = ntohl(tbuf[k++]);
-	    if (in.numinst > 0) {
-		in.instlist = &tbuf[k];
-		k += in.numinst;
-		stridx = &tbuf[k];
-#if defined(HAVE_32BIT_PTR)
-		in.namelist = (char **)stridx;
-		allinbuf = 1; /* allocation is all in tbuf */
-#else
-		allinbuf = 0; /* allocation for namelist + tbuf */
-		/* need to allocate to hold the pointers */
-PM_FAULT_POINT("libpcp/" __FILE__ ":4", PM_FAULT_ALLOC);
-		in.namelist = (char **)malloc(in.numinst * sizeof(char*));
-		if (in.namelist == NULL) {
-		    sts = -oserror();
-		    free(tbuf);
-		    goto end;
-		}
-#endif
-		k += in.numinst;
-		namebase = (char *)&tbuf[k];
-	        for (i = 0; i < in.numinst; i++) {
-		    in.instlist[i] = ntohl(in.instlist[i]);
-	            in.namelist[i] = &namebase[ntohl(stridx[i])];
-		}
-		if ((sts = __pmLogAddInDom(acp, &when, &in, tbuf, allinbuf)) < 0)
-		    goto end;
-		/* If this indom was a duplicate, then we need to free tbuf and
-		   namelist, as appropriate. */
-		if (sts == PMLOGPUTINDOM_DUP) {
-		    free(tbuf);
-		    if (in.namelist != NULL && !allinbuf)
-			free(in.namelist);
+    }
+    for (i = 0; i < lcp->l_hashlabels.hsize; i++) {
+	for (hp = lcp->l_hashlabels.hash[i]; hp != NULL; hp = hp->next) {
+	    l_hashtype = (__pmHashCtl *)hp->data;
+	    for (j = 0; j < l_hashtype->hsize; j++) {
+		for (hptype = l_hashtype->hash[j]; hptype != NULL; hptype = hptype->next) {
+		    if ((sts = loadlabels(lcp, hptype)) < 0)
+			return sts;
 		}
 	    }
-	    else {
-		/* no instances, or an error */
-		free(tbuf);
-	    }
 	}
-	else if (h.type == TYPE_LABEL) {
-	    char		*tbuf;
-	    int			k;
-	    int			j;
-	    int			type;
-	    int			ident;
-	    int			nsets;
-	    int			inst;
-	    int			jsonlen;
-	    int			nlabels;
-	    pmTimeval		stamp;
-	    pmLabelSet		*labelsets = NULL;
-
-PM_FAULT_POINT("libpcp/" __FILE__ ":11", PM_FAULT_ALLOC);
-	    if ((tbuf = (char *)malloc(rlen)) == NULL) {
-		sts = -oserror();
-		goto end;
-	    }
-	    if ((n = (int)__pmFread(tbuf, 1, rlen, f)) != rlen) {
-		if (pmDebugOptions.logmeta) {
-		    fprintf(stderr, "%s: label read -> %d: expected: %d\n",
-			    "__pmLogLoadMeta", n, rlen);
-		}
-		if (__pmFerror(f)) {
-		    __pmClearerr(f);
-		    sts = -oserror();
-		}
-		else
-		    sts = PM_ERR_LOGREC;
-		free(tbuf);
-		goto end;
-	    }
-
-	    k = 0;
-	    stamp = *((pmTimeval *)&tbuf[k]);
-	    stamp.tv_sec = ntohl(stamp.tv_sec);
-	    stamp.tv_usec = ntohl(stamp.tv_usec);
-	    k += sizeof(stamp);
-
-	    type = ntohl(*((unsigned int*)&tbuf[k]));
-	    k += sizeof(type);
-
-	    ident = ntohl(*((unsigned int*)&tbuf[k]));
-	    k += sizeof(ident);
+    }
+    return 0;
+}
 
-	    nsets = *((unsigned int *)&tbuf[k]);
-	    nsets = ntohl(nsets);
-	    k += sizeof(nsets);
+/*
+ * Write the metadata index header, from the archive label.
+ */
+static int
+putmindexhdr(__pmFILE *f, const __pmLogLabel *lp)
+{
+    mindex_hdr_t	hdr;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = htonl(MINDEX_MAGIC | MINDEX_VERSION);
+    hdr.pid = htonl(lp->ill_pid);
+    hdr.start.tv_sec = htonl(lp->ill_start.tv_sec);
+    hdr.start.tv_usec = htonl(lp->ill_start.tv_usec);
+    strncpy(hdr.hostname, lp->ill_hostname, PM_LOG_MAXHOSTLEN);
+    hdr.hostname[PM_LOG_MAXHOSTLEN-1] = '\0';
+    if (__pmFwrite(&hdr, 1, sizeof(hdr), f) != sizeof(hdr))
+	return -oserror();
+    return 0;
+}
 
-	    if (nsets > 0 &&
-		(labelsets = (pmLabelSet *)calloc(nsets, sizeof(pmLabelSet))) == NULL) {
-		sts = -oserror();
-		free(tbuf);
-		goto end;
-	    }
+/*
+ * Write one metadata index entry.
+ */
+static int
+putmindex(__pmFILE *f, int type, int len, long offset, const pmTimeval *tp,
+		unsigned int ident, int subtype)
+{
+    mindex_t		entry;
+
+    entry.type = htonl(type);
+    entry.len = htonl(len);
+    entry.offset = htonl((int)offset);
+    entry.stamp.tv_sec = htonl(tp ? tp->tv_sec : 0);
+    entry.stamp.tv_usec = htonl(tp ? tp->tv_usec : 0);
+    entry.ident = htonl(ident);
+    entry.subtype = htonl(subtype);
+    if (__pmFwrite(&entry, 1, sizeof(entry), f) != sizeof(entry))
+	return -oserror();
+    return 0;
+}
 
-	    for (i = 0; i < nsets; i++) {
-		inst = *((unsigned int*)&tbuf[k]);
-		inst = ntohl(inst);
-		k += sizeof(inst);
-		labelsets[i].inst = inst;
+/*
+ * After a record has been written to the metadata file at offset,
+ * add it to the metadata index (if any) being written by pmlogger.
+ * The header is written with the first entry, once the archive label
+ * is complete.  If anything goes wrong, stop writing the index; what
+ * has been written is still a valid index for the leading records of
+ * the metadata file.
+ */
+static void
+logmindex(__pmLogCtl *lcp, int type, int len, long offset,
+		const pmTimeval *tp, unsigned int ident, int subtype)
+{
+    __pmFILE		*f = lcp->l_mifp;
+    int			sts = 0;
 
-		jsonlen = ntohl(*((unsigned int*)&tbuf[k]));
-		k += sizeof(jsonlen);
-		labelsets[i].jsonlen = jsonlen;
+    if (__pmFtell(f) == 0)
+	sts = putmindexhdr(f, &lcp->l_label);
+    if (sts == 0)
+	sts = putmindex(f, type, len, offset, tp, ident, subtype);
+    if (sts < 0) {
+	char	errmsg[PM_MAXERRMSGLEN];
 
-		if (jsonlen < 0 || jsonlen > PM_MAXLABELJSONLEN) {
-		    if (pmDebugOptions.logmeta)
-			fprintf(stderr, "%s: corrupted json in labelset. jsonlen=%d\n",
-					"__pmLogLoadMeta", jsonlen);
-		    sts = PM_ERR_LOGREC;
-		    free(labelsets);
-		    free(tbuf);
-		    goto end;
-		}
+	pmprintf("__pmLogPutMeta: metadata index write failed: %s\n",
+		pmErrStr_r(sts, errmsg, sizeof(errmsg)));
+	pmflush();
+	__pmFclose(f);
+	lcp->l_mifp = NULL;
+    }
+}
 
-		if ((labelsets[i].json = (char *)malloc(jsonlen+1)) == NULL) {
-		    sts = -oserror();
-		    free(labelsets);
-		    free(tbuf);
-		    goto end;
-		}
+/*
+ * Create the metadata index for an archive being written, for
+ * __pmLogPutDesc() et al to add entries to as records are written
+ * to the metadata file.
+ */
+int
+__pmLogCreateMetaIndex(const char *base, __pmArchCtl *acp)
+{
+    __pmLogCtl		*lcp = acp->ac_log;
+    char		fname[MAXPATHLEN];
+    __pmFILE		*f;
 
-		memcpy((void *)labelsets[i].json, (void *)&tbuf[k], jsonlen);
-		labelsets[i].json[jsonlen] = '\0';
-		k += jsonlen;
-
-		/* label nlabels */
-		nlabels = ntohl(*((unsigned int *)&tbuf[k]));
-		k += sizeof(nlabels);
-		labelsets[i].nlabels = nlabels;
-
-		if (nlabels > 0) { /* nlabels < 0 is an error code. skip it here */
-		    if (nlabels > PM_MAXLABELS || k + nlabels * sizeof(pmLabel) > rlen) {
-			/* corrupt archive metadata detected. GH #475 */
-			if (pmDebugOptions.logmeta)
-			    fprintf(stderr, "%s: corrupted labelset. nlabels=%d\n",
-					    "__pmLogLoadMeta", nlabels);
-			sts = PM_ERR_LOGREC;
-			free(labelsets);
-			free(tbuf);
-			goto end;
-		    }
+    pmsprintf(fname, sizeof(fname), "%s.mindex", base);
+    if ((f = __pmFopen(fname, "w")) == NULL)
+	return -oserror();
+    /* as for the other archive files, no buffering */
+    __pmSetvbuf(f, NULL, _IONBF, 0);
+    lcp->l_mifp = f;
+    return 0;
+}
 
-		    if ((labelsets[i].labels = (pmLabel *)calloc(nlabels, sizeof(pmLabel))) == NULL) {
-			sts = -oserror();
-			free(labelsets);
-			free(tbuf);
-			goto end;
-		    }
+/*
+ * Write a new metadata index for an archive opened for reading,
+ * from the records in its metadata file.  Returns the number of
+ * records indexed.
+ */
+int
+__pmLogWriteMetaIndex(__pmArchCtl *acp)
+{
+    __pmLogCtl		*lcp = acp->ac_log;
+    __pmFILE		*f = lcp->l_mdfp;
+    __pmFILE		*mf;
+    __pmLogHdr		h;
+    pmTimeval		stamp;
+    char		path[MAXPATHLEN];
+    char		tmppath[MAXPATHLEN];
+    __int32_t		buf[4];		/* leading fields of a record */
+    unsigned int	ident;
+    long		offset;
+    int			subtype;
+    int			count = 0;
+    int			rlen;
+    int			n;
+    int			sts;
 
-		    /* label pmLabels */
-		    for (j = 0; j < nlabels; j++) {
-			labelsets[i].labels[j] = *((pmLabel *)&tbuf[k]);
-			__ntohpmLabel(&labelsets[i].labels[j]);
-			k += sizeof(pmLabel);
-		    }
-		}
-	    }
-	    free(tbuf);
+    pmsprintf(path, sizeof(path), "%s.mindex", lcp->l_name);
+    pmsprintf(tmppath, sizeof(tmppath), "%s.mindex.new", lcp->l_name);
+    if ((mf = __pmFopen(tmppath, "w")) == NULL)
+	return -oserror();
+    if ((sts = putmindexhdr(mf, &lcp->l_label)) < 0)
+	goto done;
 
-	    if ((sts = addlabel(acp, type, ident, nsets, labelsets, &stamp)) < 0)
-		goto end;
+    offset = sizeof(__pmLogLabel) + 2*sizeof(int);
+    __pmFseek(f, offset, SEEK_SET);
+    for ( ; ; ) {
+	if ((sts = readhdr(f, &h)) <= 0)
+	    break;
+	rlen = h.len - (int)sizeof(__pmLogHdr) - (int)sizeof(int);
+	if (rlen < 0) {
+	    sts = PM_ERR_LOGREC;
+	    break;
 	}
-	else if (h.type == TYPE_TEXT) {
-	    char		*tbuf;
-	    int			type;
-	    int			ident;
-	    int			k;
-
-PM_FAULT_POINT("libpcp/" __FILE__ ":16", PM_FAULT_ALLOC);
-	    if ((tbuf = (char *)malloc(rlen)) == NULL) {
-		sts = -oserror();
-		goto end;
-	    }
-	    if ((n = (int)__pmFread(tbuf, 1, rlen, f)) != rlen) {
-		if (pmDebugOptions.logmeta) {
-		    fprintf(stderr, "%s: text read -> %d: expected: %d\n",
-				    "__pmLogLoadMeta", n, rlen);
-		}
-		if (__pmFerror(f)) {
-		    __pmClearerr(f);
-		    sts = -oserror();
-		}
-		else
-		    sts = PM_ERR_LOGREC;
-		free(tbuf);
-		goto end;
-	    }
+	memset(buf, 0, sizeof(buf));
+	n = rlen < (int)sizeof(buf) ? rlen : (int)sizeof(buf);
+	if (__pmFread(buf, 1, n, f) != n) {
+	    sts = readerror(f);
+	    break;
+	}
+	__pmFseek(f, (long)(rlen - n), SEEK_CUR);
+	if ((sts = readtrailer(f, &h)) < 0)
+	    break;
 
-	    k = 0;
-	    type = ntohl(*((unsigned int *)&tbuf[k]));
-	    k += sizeof(type);
-	    if (!(type & (PM_TEXT_ONELINE|PM_TEXT_HELP))) {
-		if (pmDebugOptions.logmeta) {
-		    fprintf(stderr, "__pmLogLoadMeta: bad text type -> %x\n",
-			    type);
-		}
-		free(tbuf);
-		continue;
+	/* the keys loadmindex() needs, see __pmLogPutDesc() et al */
+	stamp.tv_sec = stamp.tv_usec = 0;
+	ident = subtype = 0;
+	if (h.type == TYPE_DESC)
+	    ident = ntohl(buf[0]);		/* pmid */
+	else if (h.type == TYPE_INDOM || h.type == TYPE_LABEL) {
+	    stamp.tv_sec = ntohl(buf[0]);
+	    stamp.tv_usec = ntohl(buf[1]);
+	    if (h.type == TYPE_INDOM) {
+		ident = ntohl(buf[2]);
+		subtype = ntohl(buf[3]);	/* numinst */
 	    }
-	    else if (type & PM_TEXT_INDOM)
-		ident = __ntohpmInDom(*((unsigned int *)&tbuf[k]));
-	    else if (type & PM_TEXT_PMID)
-		ident = __ntohpmID(*((unsigned int *)&tbuf[k]));
 	    else {
-		if (pmDebugOptions.logmeta) {
-		    fprintf(stderr, "%s: bad text ident -> %x\n",
-				    "__pmLogLoadMeta", type);
-		}
-		free(tbuf);
-		continue;
+		subtype = ntohl(buf[2]);	/* label type */
+		ident = ntohl(buf[3]);
 	    }
-	    k += sizeof(ident);
-
-	    sts = addtext(acp, ident, type, (char *)&tbuf[k]);
-	    free(tbuf);
-	    if (sts < 0)
-		goto end;
 	}
-	else
-	    __pmFseek(f, (long)rlen, SEEK_CUR);
-	n = (int)__pmFread(&check, 1, sizeof(check), f);
-	check = ntohl(check);
-	if (n != sizeof(check) || h.len != check) {
-	    if (pmDebugOptions.logmeta) {
-		fprintf(stderr, "%s: trailer read -> %d or len=%d: "
-				"expected %d @ offset=%d\n", "__pmLogLoadMeta",
-			n, check, h.len, (int)(__pmFtell(f) - sizeof(check)));
-	    }
-	    if (__pmFerror(f)) {
-		__pmClearerr(f);
-		sts = -oserror();
-	    }
-	    else
-		sts = PM_ERR_LOGREC;
-	    goto end;
+	else if (h.type == TYPE_TEXT) {
+	    subtype = ntohl(buf[0]);		/* text type */
+	    ident = ntohl(buf[1]);
 	}
-    }/*for*/
-end:
+	if ((sts = putmindex(mf, h.type, h.len, offset, &stamp, ident, subtype)) < 0)
+	    break;
+	offset += h.len;
+	count++;
+    }
 
-    /* Check for duplicate label sets. */
-    check_dup_labels(acp);
-    
+done:
     __pmFseek(f, (long)(sizeof(__pmLogLabel) + 2*sizeof(int)), SEEK_SET);
-
-    if (sts == 0) {
-	if (numpmid == 0) {
-	    if (pmDebugOptions.logmeta) {
-		fprintf(stderr, "%s: no metrics found?\n", "__pmLogLoadMeta");
-	    }
-	    sts = PM_ERR_LOGREC;
-	}
-	else
-	    __pmFixPMNSHashTab(lcp->l_pmns, numpmid, 1);
+    if (__pmFclose(mf) != 0 && sts == 0)
+	sts = -oserror();
+    if (sts == 0 && rename(tmppath, path) < 0)
+	sts = -oserror();
+    if (sts < 0) {
+	unlink(tmppath);
+	return sts;
     }
-    return sts;
+    return count;
 }
 
 /*
@@ -1116,6 +1916,7 @@ __pmLogPutDesc(__pmArchCtl *acp, const pmDesc *dp, int numnames, char **names)
     __pmLogCtl		*lcp = acp->ac_log;
     __pmFILE		*f = lcp->l_mdfp;
     pmDesc		*tdp;
+    long		offset;
     int			olen;		/* length to write out */
     int			i, sts, len;
     typedef struct {			/* skeletal external record */
@@ -1166,6 +1967,7 @@ PM_FAULT_POINT("libpcp/" __FILE__ ":10", PM_FAULT_ALLOC);
 	out->numnames = out->hdr.len;
     }
 
+    offset = lcp->l_mifp ? __pmFtell(f) : 0;
     if ((sts = __pmFwrite(out, 1, len, f)) != len) {
 	char	strbuf[20];
 	char	errmsg[PM_MAXERRMSGLEN];
@@ -1179,6 +1981,8 @@ PM_FAULT_POINT("libpcp/" __FILE__ ":10", PM_FAULT_ALLOC);
     }
 
     free(out);
+    if (lcp->l_mifp)
+	logmindex(lcp, TYPE_DESC, len, offset, NULL, dp->pmid, 0);
 
     /*
      * need to make a copy of the pmDesc, and add this, since caller
@@ -1191,11 +1995,12 @@ PM_FAULT_POINT("libpcp/" __FILE__ ":5", PM_FAULT_ALLOC);
     return __pmHashAdd((int)dp->pmid, (void *)tdp, &lcp->l_hashpmid);
 }
 
-static __pmLogInDom *
-searchindom(__pmLogCtl *lcp, pmInDom indom, pmTimeval *tp)
+static int
+searchindom(__pmLogCtl *lcp, pmInDom indom, pmTimeval *tp, __pmLogInDom **idpp)
 {
     __pmHashNode	*hp;
     __pmLogInDom	*idp;
+    int			sts;
 
     if (pmDebugOptions.logmeta) {
 	char	strbuf[20];
@@ -1205,7 +2010,7 @@ searchindom(__pmLogCtl *lcp, pmInDom indom, pmTimeval *tp)
     }
 
     if ((hp = __pmHashSearch((unsigned int)indom, &lcp->l_hashindom)) == NULL)
-	return NULL;
+	return PM_ERR_INDOM_LOG;
 
     idp = (__pmLogInDom *)hp->data;
     if (tp != NULL) {
@@ -1224,15 +2029,19 @@ searchindom(__pmLogCtl *lcp, pmInDom indom, pmTimeval *tp)
 	    }
 	}
 	if (idp == NULL)
-	    return NULL;
+	    return PM_ERR_INDOM_LOG;
     }
 
+    if ((sts = loadindom(lcp, idp)) < 0)
+	return sts;
+
     if (pmDebugOptions.logmeta) {
 	fprintf(stderr, "success for indom @ ");
 	StrTimeval(&idp->stamp);
 	fputc('\n', stderr);
     }
-    return idp;
+    *idpp = idp;
+    return 0;
 }
 
 /*
@@ -1244,10 +2053,11 @@ int
 __pmLogGetInDom(__pmArchCtl *acp, pmInDom indom, pmTimeval *tp, int **instlist, char ***namelist)
 {
     __pmLogCtl		*lcp = acp->ac_log;
-    __pmLogInDom	*idp = searchindom(lcp, indom, tp);
+    __pmLogInDom	*idp;
+    int			sts;
 
-    if (idp == NULL)
-	return PM_ERR_INDOM_LOG;
+    if ((sts = searchindom(lcp, indom, tp, &idp)) < 0)
+	return sts;
 
     *instlist = idp->instlist;
     *namelist = idp->namelist;
@@ -1260,11 +2070,12 @@ __pmLogLookupInDom(__pmArchCtl *acp, pmInDom indom, pmTimeval *tp,
 		   const char *name)
 {
     __pmLogCtl		*lcp = acp->ac_log;
-    __pmLogInDom	*idp = searchindom(lcp, indom, tp);
+    __pmLogInDom	*idp;
     int			i;
+    int			sts;
 
-    if (idp == NULL)
-	return PM_ERR_INDOM_LOG;
+    if ((sts = searchindom(lcp, indom, tp, &idp)) < 0)
+	return sts;
 
     if (idp->numinst < 0)
 	return idp->numinst;
@@ -1293,11 +2104,12 @@ int
 __pmLogNameInDom(__pmArchCtl *acp, pmInDom indom, pmTimeval *tp, int inst, char **name)
 {
     __pmLogCtl		*lcp = acp->ac_log;
-    __pmLogInDom	*idp = searchindom(lcp, indom, tp);
+    __pmLogInDom	*idp;
     int			i;
+    int			sts;
 
-    if (idp == NULL)
-	return PM_ERR_INDOM_LOG;
+    if ((sts = searchindom(lcp, indom, tp, &idp)) < 0)
+	return sts;
 
     if (idp->numinst < 0)
 	return idp->numinst;
@@ -1324,6 +2136,7 @@ __pmLogLookupLabel(__pmArchCtl *acp, unsigned int type, unsigned int ident,
     __pmHashCtl		*label_hash;
     __pmHashNode	*hp;
     __pmLogLabelSet	*ls;
+    int			sts;
 
     type &= ~(PM_LABEL_COMPOUND|PM_LABEL_OPTIONAL);
     if (type == PM_LABEL_CONTEXT)
@@ -1336,6 +2149,9 @@ __pmLogLookupLabel(__pmArchCtl *acp, unsigned int type, unsigned int ident,
     if ((hp = __pmHashSearch(ident, label_hash)) == NULL)
 	return PM_ERR_NOLABELS;
 
+    if ((sts = loadlabels(lcp, hp)) < 0)
+	return sts;
+
     ls = (__pmLogLabelSet *)hp->data;
     if (tp != NULL) {
 	for ( ; ls != NULL; ls = ls->next) {
@@ -1355,6 +2171,7 @@ __pmLogPutLabel(__pmArchCtl *acp, unsigned int type, unsigned int ident,
 {
     __pmLogCtl		*lcp = acp->ac_log;
     char		*ptr;
+    long		offset;
     int			sts = 0;
     int			i, j, len;
     int			inst;
@@ -1430,6 +2247,7 @@ PM_FAULT_POINT("libpcp/" __FILE__ ":12", PM_FAULT_ALLOC);
 
     memmove((void *)ptr, &out->hdr.len, sizeof(out->hdr.len));
 
+    offset = lcp->l_mifp ? __pmFtell(lcp->l_mdfp) : 0;
     if ((sts = __pmFwrite(out, 1, len, lcp->l_mdfp)) != len) {
 	char	errmsg[PM_MAXERRMSGLEN];
 
@@ -1440,6 +2258,8 @@ PM_FAULT_POINT("libpcp/" __FILE__ ":12", PM_FAULT_ALLOC);
 	return -oserror();
     }
     free(out);
+    if (lcp->l_mifp)
+	logmindex(lcp, TYPE_LABEL, len, offset, tp, ident, type);
 
     return addlabel(acp, type, ident, nsets, labelsets, tp);
 }
@@ -1474,6 +2294,7 @@ __pmLogPutText(__pmArchCtl *acp, unsigned int ident, unsigned int type,
 {
     __pmLogCtl		*lcp = acp->ac_log;
     char		*ptr;
+    long		offset;
     int			sts, len, textlen;
     typedef struct {
 	__pmLogHdr	hdr;
@@ -1507,6 +2328,7 @@ PM_FAULT_POINT("libpcp/" __FILE__ ":14", PM_FAULT_ALLOC);
     ptr += textlen;
     memmove((void *)ptr, &out->hdr.len, sizeof(out->hdr.len));
 
+    offset = lcp->l_mifp ? __pmFtell(lcp->l_mdfp) : 0;
     if ((sts = __pmFwrite(out, 1, len, lcp->l_mdfp)) != len) {
 	char	errmsg[PM_MAXERRMSGLEN];
 
@@ -1517,6 +2339,8 @@ PM_FAULT_POINT("libpcp/" __FILE__ ":14", PM_FAULT_ALLOC);
 	return -oserror();
     }
     free(out);
+    if (lcp->l_mifp)
+	logmindex(lcp, TYPE_TEXT, len, offset, NULL, ident, type);
 
     if (!cached)
 	return 0;
@@ -1529,6 +2353,7 @@ __pmLogPutInDom(__pmArchCtl *acp, pmInDom indom, const pmTimeval *tp,
 {
     __pmLogCtl		*lcp = acp->ac_log;
     char		*str;
+    long		offset;
     int			sts = 0;
     int			i, len;
     int			*inst;
@@ -1575,6 +2400,7 @@ PM_FAULT_POINT("libpcp/" __FILE__ ":6", PM_FAULT_ALLOC);
     /* trailer length */
     memmove((void *)str, &out->hdr.len, sizeof(out->hdr.len));
 
+    offset = lcp->l_mifp ? __pmFtell(lcp->l_mdfp) : 0;
     if ((sts = __pmFwrite(out, 1, len, lcp->l_mdfp)) != len) {
 	char	strbuf[20];
 	char	errmsg[PM_MAXERRMSGLEN];
@@ -1586,6 +2412,8 @@ PM_FAULT_POINT("libpcp/" __FILE__ ":6", PM_FAULT_ALLOC);
 	return -oserror();
     }
     free(out);
+    if (lcp->l_mifp)
+	logmindex(lcp, TYPE_INDOM, len, offset, tp, indom, numinst);
 
     sts = addindom(lcp, indom, tp, numinst, instlist, namelist, NULL, 0);
     return sts;
@@ -1618,6 +2446,10 @@ pmLookupInDomArchive(pmInDom indom, const char *name)
 	}
 
 	for (idp = (__pmLogInDom *)hp->data; idp != NULL; idp = idp->next) {
+	    if ((n = loadindom(ctxp->c_archctl->ac_log, idp)) < 0) {
+		PM_UNLOCK(ctxp->c_lock);
+		return n;
+	    }
 	    /* full match */
 	    for (j = 0; j < idp->numinst; j++) {
 		if (strcmp(name, idp->namelist[j]) == 0) {
@@ -1672,6 +2504,10 @@ pmNameInDomArchive(pmInDom indom, int inst, char **name)
 	}
 
 	for (idp = (__pmLogInDom *)hp->data; idp != NULL; idp = idp->next) {
+	    if ((n = loadindom(ctxp->c_archctl->ac_log, idp)) < 0) {
+		PM_UNLOCK(ctxp->c_lock);
+		return n;
+	    }
 	    for (j = 0; j < idp->numinst; j++) {
 		if (idp->instlist[j] == inst) {
 		    if ((*name = strdup(idp->namelist[j])) == NULL)
@@ -1791,6 +2627,13 @@ pmGetInDomArchive_ctx(__pmContext *ctxp, pmInDom indom, int **instlist, char ***
 	return PM_ERR_INDOM_LOG;
     }
 
+    /* need all of the instance domains in the list */
+    if ((n = __pmLogLoadInDoms(ctxp->c_archctl->ac_log, (__pmLogInDom *)hp->data)) < 0) {
+	if (need_unlock)
+	    PM_UNLOCK(ctxp->c_lock);
+	return n;
+    }
+
     for (idp = (__pmLogInDom *)hp->data; idp != NULL; idp = idp->next) {
 	if (idp->numinst > HASH_THRESHOLD) {
 	    big_indom = 1;
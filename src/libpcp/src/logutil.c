@@ -436,8 +436,19 @@ __pmLogName(const char *base, int vol)
 
 __pmFILE *
 __pmLogNewFile(const char *base, int vol)
+{
+    return __pmLogNewFileCompress(base, vol, NULL);
+}
+
+/*
+ * As for __pmLogNewFile, but if suffix is not NULL the file is created
+ * with that compression suffix (e.g. ".zst") and written compressed.
+ */
+__pmFILE *
+__pmLogNewFileCompress(const char *base, int vol, const char *suffix)
 {
     char	fname[MAXPATHLEN];
+    char	*p;
     __pmFILE	*f;
     int		save_error;
 
@@ -450,6 +461,16 @@ __pmLogNewFile(const char *base, int vol)
 	setoserror(EEXIST);
 	return NULL;
     }
+    if (suffix != NULL) {
+	p = &fname[strlen(fname)];
+	pmsprintf(p, sizeof(fname) - (p - fname), "%s", suffix);
+	if (access(fname, R_OK) != -1) {
+	    pmprintf("__pmLogNewFile: \"%s\" already exists, not over-written\n", fname);
+	    pmflush();
+	    setoserror(EEXIST);
+	    return NULL;
+	}
+    }
 
     if ((f = __pmFopen(fname, "w")) == NULL) {
 	char	errmsg[PM_MAXERRMSGLEN];
@@ -528,10 +549,11 @@ __pmLogCreate(const char *host, const char *base, int log_version,
     lcp->l_hashlabels.nodes = lcp->l_hashlabels.hsize = 0;
     lcp->l_hashtext.nodes = lcp->l_hashtext.hsize = 0;
     lcp->l_tifp = lcp->l_mdfp = acp->ac_mfp = NULL;
+    lcp->l_mifp = NULL;
 
     if ((lcp->l_tifp = __pmLogNewFile(base, PM_LOG_VOL_TI)) != NULL) {
 	if ((lcp->l_mdfp = __pmLogNewFile(base, PM_LOG_VOL_META)) != NULL) {
-	    if ((acp->ac_mfp = __pmLogNewFile(base, 0)) != NULL) {
+	    if ((acp->ac_mfp = __pmLogNewFileCompress(base, 0, lcp->l_compress)) != NULL) {
 		char	tzbuf[PM_TZ_MAXLEN];
 		char	*tz;
                 int	sts;
@@ -786,6 +808,21 @@ logFreeMeta(__pmLogCtl *lcp)
 	logFreeHashText(&lcp->l_hashtext);
 }
 
+/*
+ * Discard all of the metadata loaded for an archive, so that it can be
+ * loaded again from the start of the metadata file.
+ */
+void
+__pmLogResetMeta(__pmLogCtl *lcp)
+{
+    logFreeMeta(lcp);
+    __pmHashInit(&lcp->l_hashpmid);
+    __pmHashInit(&lcp->l_hashindom);
+    __pmHashInit(&lcp->l_trimindom);
+    __pmHashInit(&lcp->l_hashlabels);
+    __pmHashInit(&lcp->l_hashtext);
+}
+
 /*
  * Close the log files.
  * Free up the space used by __pmLogCtl.
@@ -811,6 +848,10 @@ __pmLogClose(__pmArchCtl *acp)
 	__pmFclose(lcp->l_mdfp);
 	lcp->l_mdfp = NULL;
     }
+    if (lcp->l_mifp != NULL) {
+	__pmFclose(lcp->l_mifp);
+	lcp->l_mifp = NULL;
+    }
     if (acp->ac_mfp != NULL) {
 	__pmResetIPC(__pmFileno(acp->ac_mfp));
 	__pmFclose(acp->ac_mfp);
@@ -916,6 +957,7 @@ __pmLogLoadLabel(__pmArchCtl *acp, const char *name)
 
     lcp->l_minvol = -1;
     lcp->l_tifp = lcp->l_mdfp = acp->ac_mfp = NULL;
+    lcp->l_mifp = NULL;
     lcp->l_ti = NULL;
     lcp->l_numseen = 0; lcp->l_seen = NULL;
 
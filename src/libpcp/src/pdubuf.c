@@ -17,6 +17,19 @@
  * To avoid buffer trampling, on success __pmFindPDUBuf() now returns
  * a pinned PDU buffer.  It is the caller's responsibility to unpin the
  * PDU buffer when safe to do so.
+ *
+ * Buffers up to SLAB_MAXBUF bytes are carved from size-class slabs.
+ * Each slab is SLAB_SIZE bytes and SLAB_SIZE aligned, so the slab for
+ * any address is found by masking the address and probing slab_tab[],
+ * whose entries are set and cleared atomically.  Pinning and unpinning
+ * these buffers is then lock-free (an atomic update of the pin count),
+ * and when a buffer is no longer pinned it is kept for reuse, first in a
+ * small per-thread cache and then on its slab's free list.  Once every
+ * buffer of a slab is back on its free list the slab is empty, and at
+ * most SLAB_EMPTY_MAX empty slabs (over all size classes) are kept, the
+ * rest are freed.  Only the free lists and
+ * slab creation and removal need the pdubuf_lock.  Larger buffers are
+ * malloc'd and tracked in a tsearch(3) tree.
  */
 
 #include "pmapi.h"
@@ -31,11 +44,17 @@ typedef struct bufctl
     int		bc_pincnt;
     int		bc_size;
     char	*bc_buf;
+    struct bufctl *bc_next;	/* free list link, slab buffers only */
     /* The actual buffer happens to follow this struct. */
 } bufctl_t;
 
-/* Protected by the pdubuf_lock mutex. */
+/*
+ * Protected by the pdubuf_lock mutex, except that tree_count is also
+ * read without the lock (so is updated atomically where possible).
+ */
 static void *buf_tree;
+static int  tree_count;		/* nodes in buf_tree */
+static int  slab_count;		/* slabs in slab_tab[] */
 
 #ifdef PM_MULTI_THREAD
 static pthread_mutex_t	pdubuf_lock = PTHREAD_MUTEX_INITIALIZER;
@@ -54,6 +73,368 @@ __pmIsPdubufLock(void *lock)
 }
 #endif
 
+#if defined(PM_MULTI_THREAD) && defined(HAVE___THREAD) && \
+    defined(HAVE_POSIX_MEMALIGN) && defined(__GNUC__)
+#define PDUBUF_SLAB 1
+#endif
+
+#ifdef PDUBUF_SLAB
+#define SLAB_SHIFT	18			/* 256Kbyte slabs */
+#define SLAB_SIZE	(1 << SLAB_SHIFT)
+#define SLAB_NCLASS	9			/* size classes ... */
+#define SLAB_MINBUF	128			/* ... from 128 bytes */
+#define SLAB_MAXBUF	(SLAB_MINBUF << (SLAB_NCLASS - 1)) /* to 32Kbytes */
+#define SLAB_HASH	4096			/* slab_tab[] size, power of 2 */
+#define SLAB_MAX	(SLAB_HASH / 2)		/* limit, keeps slab_tab[] sparse */
+#define SLAB_EMPTY_MAX	2			/* empty slabs kept for reuse */
+#define TCACHE_MAX	8			/* per-thread buffers per class */
+#define SLAB_DELETED	((slab_t *)1)		/* slab_tab[] entry of a freed slab */
+
+typedef struct slab
+{
+    int		sl_class;	/* size class index */
+    int		sl_bufsize;	/* bytes per buffer, including bufctl_t */
+    int		sl_nbufs;	/* number of buffers in the slab */
+    int		sl_used;	/* number of buffers handed out so far */
+    char	*sl_first;	/* first buffer */
+    bufctl_t	*sl_free;	/* unpinned buffers returned to this slab */
+    int		sl_nfree;	/* number of buffers on sl_free */
+    struct slab	*sl_prev;	/* slabs of this class with free buffers */
+    struct slab	*sl_next;
+    /* The buffers follow this struct. */
+} slab_t;
+
+/*
+ * Set and cleared atomically, so may be searched without the lock.  A
+ * freed slab leaves SLAB_DELETED behind so that probe sequences passing
+ * through its entry are not cut short.
+ */
+static slab_t	*slab_tab[SLAB_HASH];
+
+/* Protected by the pdubuf_lock mutex. */
+static int	slab_tabused;			/* non-NULL slab_tab[] entries */
+static slab_t	*slab_current[SLAB_NCLASS];	/* slab with unused buffers */
+static slab_t	*slab_partial[SLAB_NCLASS];	/* slabs with free buffers */
+static int	slab_empty;			/* slabs with every buffer free */
+
+/* Per-thread, no locking needed. */
+static __thread struct {
+    int		registered;
+    int		count[SLAB_NCLASS];
+    bufctl_t	*buf[SLAB_NCLASS][TCACHE_MAX];
+} tcache;
+
+/* Set once, by slab_init() via pthread_once(). */
+static pthread_key_t	tcache_key;
+static pthread_once_t	slab_once = PTHREAD_ONCE_INIT;
+static int		slab_state;		/* off (0) or on (1) */
+
+static unsigned int
+slab_hash(uintptr_t base)
+{
+    base >>= SLAB_SHIFT;
+    return (unsigned int)(base ^ (base >> 12)) & (SLAB_HASH - 1);
+}
+
+/*
+ * Find the slab containing handle, if any.
+ */
+static slab_t *
+slab_lookup(const void *handle)
+{
+    uintptr_t	base = (uintptr_t)handle & ~((uintptr_t)SLAB_SIZE - 1);
+    unsigned int	i = slab_hash(base);
+    slab_t	*sp;
+
+    while ((sp = __atomic_load_n(&slab_tab[i], __ATOMIC_ACQUIRE)) != NULL) {
+	if ((uintptr_t)sp == base)
+	    return sp;
+	i = (i + 1) & (SLAB_HASH - 1);
+    }
+    return NULL;
+}
+
+/*
+ * Find the buffer within a slab containing handle, if any.
+ */
+static bufctl_t *
+slab_bufctl(slab_t *sp, const void *handle)
+{
+    bufctl_t	*pcp;
+    long	offset = (const char *)handle - sp->sl_first;
+    int		i;
+
+    if (offset < 0)
+	return NULL;
+    i = (int)(offset / sp->sl_bufsize);
+    if (i >= __atomic_load_n(&sp->sl_used, __ATOMIC_ACQUIRE))
+	return NULL;
+    pcp = (bufctl_t *)(sp->sl_first + (long)i * sp->sl_bufsize);
+    if ((const char *)handle < pcp->bc_buf)
+	return NULL;
+    return pcp;
+}
+
+/* Called with pdubuf_lock held. */
+static slab_t *
+slab_new(int class)
+{
+    slab_t	*sp;
+    void	*mem;
+    unsigned int	i;
+
+    if (slab_count >= SLAB_MAX)
+	return NULL;
+    if (posix_memalign(&mem, SLAB_SIZE, SLAB_SIZE) != 0)
+	return NULL;
+    sp = (slab_t *)mem;
+    sp->sl_class = class;
+    sp->sl_bufsize = (int)sizeof(bufctl_t) + (SLAB_MINBUF << class);
+    sp->sl_first = (char *)mem + ((sizeof(slab_t) + 15) & ~15);
+    sp->sl_nbufs = (int)(((char *)mem + SLAB_SIZE - sp->sl_first) / sp->sl_bufsize);
+    sp->sl_used = 0;
+    sp->sl_free = NULL;
+    sp->sl_nfree = 0;
+    sp->sl_prev = sp->sl_next = NULL;
+
+    for (i = slab_hash((uintptr_t)sp);
+	 slab_tab[i] != NULL && slab_tab[i] != SLAB_DELETED;
+	 i = (i + 1) & (SLAB_HASH - 1))
+	;
+    if (slab_tab[i] == NULL) {
+	/* keep some entries NULL, so that probe sequences end */
+	if (slab_tabused >= SLAB_HASH - SLAB_HASH / 4) {
+	    free(mem);
+	    return NULL;
+	}
+	slab_tabused++;
+    }
+    __atomic_store_n(&slab_tab[i], sp, __ATOMIC_RELEASE);
+    slab_count++;
+    return sp;
+}
+
+/*
+ * Free an empty slab.  No buffer in the slab is pinned or cached by any
+ * thread, so the only unlocked accesses left are slab_lookup() calls
+ * for addresses that are not PDU buffers, and those only compare the
+ * slab_tab[] entry.  Called with pdubuf_lock held.
+ */
+static void
+slab_free(slab_t *sp)
+{
+    unsigned int	i;
+
+    for (i = slab_hash((uintptr_t)sp); slab_tab[i] != sp; i = (i + 1) & (SLAB_HASH - 1))
+	;
+    __atomic_store_n(&slab_tab[i], SLAB_DELETED, __ATOMIC_RELEASE);
+    slab_count--;
+    if (slab_current[sp->sl_class] == sp)
+	slab_current[sp->sl_class] = NULL;
+    if (sp->sl_prev != NULL)
+	sp->sl_prev->sl_next = sp->sl_next;
+    else
+	slab_partial[sp->sl_class] = sp->sl_next;
+    if (sp->sl_next != NULL)
+	sp->sl_next->sl_prev = sp->sl_prev;
+    free(sp);
+}
+
+/*
+ * Return an unpinned buffer to its slab's free list, freeing the slab
+ * if it is now empty and SLAB_EMPTY_MAX empty slabs are already kept
+ * (a few are, so a steady load does not keep freeing and allocating
+ * slabs).  Called with pdubuf_lock held.
+ */
+static void
+slab_put(bufctl_t *pcp)
+{
+    slab_t	*sp = (slab_t *)((uintptr_t)pcp & ~((uintptr_t)SLAB_SIZE - 1));
+    int		class = sp->sl_class;
+
+    pcp->bc_next = sp->sl_free;
+    sp->sl_free = pcp;
+    if (sp->sl_nfree++ == 0) {
+	sp->sl_prev = NULL;
+	if ((sp->sl_next = slab_partial[class]) != NULL)
+	    sp->sl_next->sl_prev = sp;
+	slab_partial[class] = sp;
+    }
+    if (sp->sl_nfree == sp->sl_nbufs) {
+	if (slab_empty >= SLAB_EMPTY_MAX)
+	    slab_free(sp);
+	else
+	    slab_empty++;
+    }
+}
+
+/*
+ * Take an unpinned buffer from a slab of this class, if there is one.
+ * Called with pdubuf_lock held.
+ */
+static bufctl_t *
+slab_get(int class)
+{
+    slab_t	*sp;
+    bufctl_t	*pcp;
+
+    if ((sp = slab_partial[class]) == NULL)
+	return NULL;
+    if (sp->sl_nfree == sp->sl_nbufs)
+	slab_empty--;
+    pcp = sp->sl_free;
+    sp->sl_free = pcp->bc_next;
+    if (--sp->sl_nfree == 0) {
+	if ((slab_partial[class] = sp->sl_next) != NULL)
+	    sp->sl_next->sl_prev = NULL;
+	sp->sl_next = NULL;
+    }
+    return pcp;
+}
+
+/*
+ * Return all of this thread's cached buffers to the free lists,
+ * at thread exit.
+ */
+static void
+tcache_flush(void *arg)
+{
+    bufctl_t	*pcp;
+    int		class;
+
+    (void)arg;
+    PM_LOCK(pdubuf_lock);
+    for (class = 0; class < SLAB_NCLASS; class++) {
+	while (tcache.count[class] > 0) {
+	    pcp = tcache.buf[class][--tcache.count[class]];
+	    slab_put(pcp);
+	}
+    }
+    PM_UNLOCK(pdubuf_lock);
+    tcache.registered = 0;
+}
+
+static void
+slab_init(void)
+{
+    char	*val;
+
+    val = getenv("PCP_PDUBUF_SLAB");	/* THREADSAFE */
+    if (val != NULL && strcmp(val, "0") == 0)
+	return;
+    if (pthread_key_create(&tcache_key, tcache_flush) == 0)
+	slab_state = 1;
+}
+
+static int
+slab_enabled(void)
+{
+    pthread_once(&slab_once, slab_init);
+    if (unlikely(!tcache.registered) && slab_state) {
+	/* non-NULL value, so that tcache_flush is called at thread exit */
+	pthread_setspecific(tcache_key, &tcache);
+	tcache.registered = 1;
+    }
+    return slab_state;
+}
+
+static bufctl_t *
+slab_alloc(int need)
+{
+    bufctl_t	*pcp;
+    slab_t	*sp;
+    int		class;
+    int		n;
+
+    if (need > SLAB_MAXBUF || !slab_enabled())
+	return NULL;
+    for (class = 0; (SLAB_MINBUF << class) < need; class++)
+	;
+
+    if ((n = tcache.count[class]) == 0) {
+	/* refill half of this thread's cache from the free list or slab */
+	PM_LOCK(pdubuf_lock);
+	while (n < TCACHE_MAX / 2) {
+	    if ((pcp = slab_get(class)) == NULL) {
+		if ((sp = slab_current[class]) == NULL ||
+		    sp->sl_used == sp->sl_nbufs) {
+		    if ((sp = slab_new(class)) == NULL)
+			break;
+		    slab_current[class] = sp;
+		}
+		pcp = (bufctl_t *)(sp->sl_first + (long)sp->sl_used * sp->sl_bufsize);
+		pcp->bc_pincnt = 0;
+		pcp->bc_size = SLAB_MINBUF << class;
+		pcp->bc_buf = ((char *)pcp) + sizeof(*pcp);
+		pcp->bc_next = NULL;
+		__atomic_store_n(&sp->sl_used, sp->sl_used + 1, __ATOMIC_RELEASE);
+	    }
+	    tcache.buf[class][n++] = pcp;
+	}
+	PM_UNLOCK(pdubuf_lock);
+	if ((tcache.count[class] = n) == 0)
+	    return NULL;	/* out of slabs, fall back to malloc */
+    }
+
+    pcp = tcache.buf[class][--tcache.count[class]];
+    __atomic_store_n(&pcp->bc_pincnt, 1, __ATOMIC_RELEASE);
+    return pcp;
+}
+
+static void
+slab_release(slab_t *sp, bufctl_t *pcp)
+{
+    int		class = sp->sl_class;
+    int		i;
+
+    if (tcache.count[class] == TCACHE_MAX) {
+	/* cache is full, return the older half to the free list */
+	PM_LOCK(pdubuf_lock);
+	for (i = 0; i < TCACHE_MAX / 2; i++)
+	    slab_put(tcache.buf[class][i]);
+	PM_UNLOCK(pdubuf_lock);
+	memmove(&tcache.buf[class][0], &tcache.buf[class][TCACHE_MAX / 2],
+		(TCACHE_MAX / 2) * sizeof(bufctl_t *));
+	tcache.count[class] = TCACHE_MAX / 2;
+    }
+    tcache.buf[class][tcache.count[class]++] = pcp;
+    if (unlikely(!tcache.registered))
+	slab_enabled();
+}
+
+/*
+ * Visit every slab buffer that has been handed out, pinned or not.
+ * Called with pdubuf_lock held, so no slab is freed meanwhile.
+ */
+static void
+slab_walk(void (*func)(const bufctl_t *))
+{
+    slab_t	*sp;
+    int		i, j, used;
+
+    for (i = 0; i < SLAB_HASH; i++) {
+	sp = __atomic_load_n(&slab_tab[i], __ATOMIC_ACQUIRE);
+	if (sp == NULL || sp == SLAB_DELETED)
+	    continue;
+	used = __atomic_load_n(&sp->sl_used, __ATOMIC_ACQUIRE);
+	for (j = 0; j < used; j++)
+	    func((bufctl_t *)(sp->sl_first + (long)j * sp->sl_bufsize));
+    }
+}
+#endif /* PDUBUF_SLAB */
+
+/* Called with pdubuf_lock held. */
+static inline void
+tree_count_add(int n)
+{
+#ifdef PDUBUF_SLAB
+    /* also read without the lock in __pmUnpinPDUBuf() */
+    __atomic_add_fetch(&tree_count, n, __ATOMIC_RELEASE);
+#else
+    tree_count += n;
+#endif
+}
+
 static void
 pdubufdump1(const void *nodep, const VISIT which, const int depth)
 {
@@ -65,16 +446,32 @@ pdubufdump1(const void *nodep, const VISIT which, const int depth)
 		pcp->bc_pincnt);
 }
 
+#ifdef PDUBUF_SLAB
+static void
+slabdump1(const bufctl_t *pcp)
+{
+    int		pincnt = __atomic_load_n(&pcp->bc_pincnt, __ATOMIC_RELAXED);
+
+    if (pincnt > 0)
+	fprintf(stderr, " " PRINTF_P_PFX "%p...%p[%d](%d)",
+		pcp->bc_buf, &pcp->bc_buf[pcp->bc_size - 1], pcp->bc_size,
+		pincnt);
+}
+#endif
+
 static void
 pdubufdump(void)
 {
     /*
-     * There is no longer a pdubuf free list, ergo no
-     * fprintf(stderr, "   free pdubuf[size]:\n");
+     * Unpinned slab buffers are kept for reuse, but are not reported;
+     * see __pmCountPDUBuf() for the free buffer counts.
      */
     PM_LOCK(pdubuf_lock);
-    if (buf_tree != NULL) {
+    if (buf_tree != NULL || slab_count > 0) {
 	fprintf(stderr, "   pinned pdubuf[size](pincnt):");
+#ifdef PDUBUF_SLAB
+	slab_walk(&slabdump1);
+#endif
 	/* THREADSAFE - no locks acquired in pdubufdump1() */
 	twalk(buf_tree, &pdubufdump1);
 	fprintf(stderr, "\n");
@@ -112,6 +509,11 @@ __pmFindPDUBuf(int need)
 	return NULL;
     }
 
+#ifdef PDUBUF_SLAB
+    if ((pcp = slab_alloc(need)) != NULL)
+	goto done;
+#endif
+
     if ((pcp = (bufctl_t *)malloc(sizeof(*pcp) + need)) == NULL) {
 	return NULL;
     }
@@ -119,6 +521,7 @@ __pmFindPDUBuf(int need)
     pcp->bc_pincnt = 1;
     pcp->bc_size = need;
     pcp->bc_buf = ((char *)pcp) + sizeof(*pcp);
+    pcp->bc_next = NULL;
 
     PM_LOCK(pdubuf_lock);
     /* Insert the node in the tree. */
@@ -129,8 +532,12 @@ __pmFindPDUBuf(int need)
 	free(pcp);
 	return NULL;
     }
+    tree_count_add(1);
     PM_UNLOCK(pdubuf_lock);
 
+#ifdef PDUBUF_SLAB
+done:
+#endif
     if (unlikely(pmDebugOptions.pdubuf)) {
 	fprintf(stderr, "__pmFindPDUBuf(%d) -> " PRINTF_P_PFX "%p\n",
 		need, pcp->bc_buf);
@@ -145,8 +552,27 @@ __pmPinPDUBuf(void *handle)
 {
     bufctl_t	*pcp, pcp_search;
     void	*bcp;
+#ifdef PDUBUF_SLAB
+    slab_t	*sp;
+    int		pincnt;
+#endif
 
     assert(((__psint_t)handle % sizeof(int)) == 0);
+
+#ifdef PDUBUF_SLAB
+    if ((sp = slab_lookup(handle)) != NULL) {
+	if ((pcp = slab_bufctl(sp, handle)) == NULL ||
+	    __atomic_load_n(&pcp->bc_pincnt, __ATOMIC_ACQUIRE) <= 0)
+	    goto notfound;
+	pincnt = __atomic_add_fetch(&pcp->bc_pincnt, 1, __ATOMIC_ACQ_REL);
+	if (unlikely(pmDebugOptions.pdubuf))
+	    fprintf(stderr, "__pmPinPDUBuf(" PRINTF_P_PFX "%p) -> pdubuf="
+			PRINTF_P_PFX "%p, pincnt=%d\n", handle,
+		    pcp->bc_buf, pincnt);
+	return;
+    }
+#endif
+
     /*
      * Initialize a dummy bufctl_t to use only as search key;
      * only its bc_buf & bc_size fields need to be set, as that's
@@ -169,6 +595,9 @@ __pmPinPDUBuf(void *handle)
 	pcp->bc_pincnt++;
     } else {
 	PM_UNLOCK(pdubuf_lock);
+#ifdef PDUBUF_SLAB
+notfound:
+#endif
 	pmNotifyErr(LOG_WARNING, "__pmPinPDUBuf: " PRINTF_P_PFX "%p not in pool!", handle);
 	if (pmDebugOptions.pdubuf)
 	    pdubufdump();
@@ -188,8 +617,37 @@ __pmUnpinPDUBuf(void *handle)
 {
     bufctl_t	*pcp, pcp_search;
     void	*bcp;
+#ifdef PDUBUF_SLAB
+    slab_t	*sp;
+    int		pincnt;
+#endif
 
     assert(((__psint_t)handle % sizeof(int)) == 0);
+
+#ifdef PDUBUF_SLAB
+    if ((sp = slab_lookup(handle)) != NULL) {
+	if ((pcp = slab_bufctl(sp, handle)) == NULL ||
+	    __atomic_load_n(&pcp->bc_pincnt, __ATOMIC_ACQUIRE) <= 0)
+	    goto notfound;
+	pincnt = __atomic_sub_fetch(&pcp->bc_pincnt, 1, __ATOMIC_ACQ_REL);
+	if (unlikely(pmDebugOptions.pdubuf))
+	    fprintf(stderr, "__pmUnpinPDUBuf(" PRINTF_P_PFX "%p) -> pdubuf="
+			PRINTF_P_PFX "%p, pincnt=%d\n", handle,
+		    pcp->bc_buf, pincnt);
+	if (pincnt == 0)
+	    slab_release(sp, pcp);
+	return 1;
+    }
+
+    /*
+     * Not a slab buffer, so either in the tree or not a PDU buffer at
+     * all - the latter is common (see __pmFreeResultValueSets) and
+     * needs no lock if the tree is empty.
+     */
+    if (__atomic_load_n(&tree_count, __ATOMIC_ACQUIRE) == 0)
+	goto notfound;
+#endif
+
     PM_LOCK(pdubuf_lock);
 
     /*
@@ -210,6 +668,9 @@ __pmUnpinPDUBuf(void *handle)
 	pcp = *(bufctl_t **)bcp;
     } else {
 	PM_UNLOCK(pdubuf_lock);
+#ifdef PDUBUF_SLAB
+notfound:
+#endif
 	if (pmDebugOptions.pdubuf) {
 	    fprintf(stderr, "__pmUnpinPDUBuf(" PRINTF_P_PFX "%p) -> fails\n",
 		    handle);
@@ -229,6 +690,7 @@ __pmUnpinPDUBuf(void *handle)
     if (likely(--pcp->bc_pincnt == 0)) {
 	/* THREADSAFE - no locks acquired in bufctl_t_compare() */
 	tdelete(pcp, &buf_tree, &bufctl_t_compare);
+	tree_count_add(-1);
 	PM_UNLOCK(pdubuf_lock);
 	free(pcp);
     }
@@ -245,6 +707,7 @@ __pmUnpinPDUBuf(void *handle)
  */
 static int	pdu_bufcnt_need;
 static unsigned	pdu_bufcnt;
+static unsigned	pdu_buffree;
 
 static void
 pdubufcount(const void *nodep, const VISIT which, const int depth)
@@ -256,6 +719,26 @@ pdubufcount(const void *nodep, const VISIT which, const int depth)
 	    pdu_bufcnt++;
 }
 
+#ifdef PDUBUF_SLAB
+static void
+slabcount(const bufctl_t *pcp)
+{
+    if (pcp->bc_size < pdu_bufcnt_need)
+	return;
+    if (__atomic_load_n(&pcp->bc_pincnt, __ATOMIC_RELAXED) > 0)
+	pdu_bufcnt++;
+    else
+	pdu_buffree++;
+}
+#endif
+
+/*
+ * Count the buffers of at least need bytes: alloc is the number pinned
+ * (in use), free the number kept for reuse.  Only slab buffers are kept
+ * once unpinned (those in per-thread caches, on slab free lists or in
+ * empty slabs), so free is always 0 for larger buffers and when slabs
+ * are disabled.
+ */
 void
 __pmCountPDUBuf(int need, int *alloc, int *free)
 {
@@ -263,11 +746,15 @@ __pmCountPDUBuf(int need, int *alloc, int *free)
 
     pdu_bufcnt_need = need;
     pdu_bufcnt = 0;
+    pdu_buffree = 0;
+#ifdef PDUBUF_SLAB
+    /* THREADSAFE - no locks acquired in slabcount() */
+    slab_walk(&slabcount);
+#endif
     /* THREADSAFE - no locks acquired in pdubufcount() */
     twalk(buf_tree, &pdubufcount);
     *alloc = pdu_bufcnt;
-
-    *free = 0;			/* We don't retain freed nodes. */
+    *free = pdu_buffree;
 
     PM_UNLOCK(pdubuf_lock);
 }
@@ -48,6 +48,39 @@
 #define PMID_MASK	0x7fffffff	/* 31 bits of PMID */
 #define MARK_BIT	0x80000000	/* mark bit */
 
+/*
+ * Compiled PMNS image, written by pmnsmerge -b as <pmnsfile>.bin and
+ * mapped read-only in place of parsing the ASCII PMNS, provided the
+ * ASCII file has not changed since the image was compiled.
+ * Host byte order, a header, then the nodes in pre-order (root first)
+ * and then the names.
+ */
+#define IMAGE_MAGIC	0x504d4e53	/* "PMNS" */
+#define IMAGE_VERSION	1
+#define IMAGE_DUPS	0x1		/* some PMID has more than one name */
+#define IMAGE_HASHED	0x1		/* node is in the PMID hash table */
+
+typedef struct {
+    __uint32_t	magic;
+    __uint32_t	version;
+    __uint32_t	flags;
+    __uint32_t	numnode;	/* number of nodes */
+    __uint32_t	htabsize;	/* hash table size */
+    __uint32_t	strsize;	/* bytes of names after the nodes */
+    __int64_t	size;		/* size of ASCII PMNS file compiled */
+    __int64_t	sec;		/* and its modification time */
+    __int64_t	nsec;
+} image_hdr_t;
+
+typedef struct {
+    __uint32_t	parent;		/* 1 + node index, or 0 for none */
+    __uint32_t	first;		/* ditto */
+    __uint32_t	next;		/* ditto */
+    __uint32_t	name;		/* offset into the names */
+    __uint32_t	pmid;
+    __uint32_t	flags;
+} image_node_t;
+
 /*
  * conditional controls
  */
@@ -102,6 +135,11 @@ static int                      useExtPMNS = 0;
    archive).  It is not generally modified after being loaded. */
 static __pmnsTree *main_pmns;
 
+/* The compiled PMNS image main_pmns was loaded from, if any - its
+   nodes are then one array, with names pointing into the image. */
+static char *main_image;
+static size_t main_imagelen;
+
 
 /* == 1 if PMNS loaded and __pmExportPMNS has been called */
 static int export;
@@ -1060,10 +1098,9 @@ __pmNewPMNS(__pmnsTree **pmns)
  *
  * So no lock/unlock operations here.
  */
-int
-__pmFixPMNSHashTab(__pmnsTree *tree, int numpmid, int dupok)
+static int
+hashsize(int numpmid)
 {
-    int		sts;
     int		htabsize = numpmid/5;
 
     /*
@@ -1073,6 +1110,15 @@ __pmFixPMNSHashTab(__pmnsTree *tree, int numpmid, int dupok)
     if (htabsize % 2 == 0) htabsize++;
     if (htabsize % 3 == 0) htabsize += 2;
     if (htabsize % 5 == 0) htabsize += 2;
+    return htabsize;
+}
+
+int
+__pmFixPMNSHashTab(__pmnsTree *tree, int numpmid, int dupok)
+{
+    int		sts;
+    int		htabsize = hashsize(numpmid);
+
     tree->htabsize = htabsize;
     tree->htab = (__pmnsNode **)calloc(htabsize, sizeof(__pmnsNode *));
     if (tree->htab == NULL) {
@@ -1465,10 +1511,350 @@ pmapi_return:
     return sts;
 }
 
+static void
+stat_mtime(const struct stat *sbp, __int64_t *sec, __int64_t *nsec)
+{
+#if defined(HAVE_ST_MTIME_WITH_E)
+    *sec = sbp->st_mtime;
+    *nsec = 0;
+#elif defined(HAVE_ST_MTIME_WITH_SPEC)
+    *sec = sbp->st_mtimespec.tv_sec;
+    *nsec = sbp->st_mtimespec.tv_nsec;
+#else
+    *sec = sbp->st_mtim.tv_sec;
+    *nsec = sbp->st_mtim.tv_nsec;
+#endif
+}
+
+/*
+ * Map the compiled image for the PMNS file fname (described by sbp)
+ * and build main_pmns from it.  The nodes are one array with the
+ * names pointing into the read-only image, and the hash table is
+ * filled without any checking or searching, so this is a single pass
+ * over the nodes in place of cpp, lexing and building the tree.
+ *
+ * Returns 0 if the image was used, else < 0 and the caller should
+ * load the ASCII PMNS.
+ */
+static int
+loadimage(const struct stat *sbp, int dupok)
+{
+    char		path[MAXPATHLEN];
+    struct stat		statbuf;
+    const image_hdr_t	*hdr;
+    const image_node_t	*list;
+    const char		*why = NULL;
+    __pmnsTree		*tree = NULL;
+    __pmnsNode		*nodes = NULL;
+    __pmnsNode		*np;
+    char		*image;
+    char		*names;
+    size_t		len;
+    __int64_t		sec;
+    __int64_t		nsec;
+    __uint32_t		i;
+    __uint32_t		k;
+    int			fd;
+    int			sts;
+
+    PM_ASSERT_IS_LOCKED(pmns_lock);
+
+    pmsprintf(path, sizeof(path), "%s.bin", fname);
+    if ((fd = open(path, O_RDONLY)) < 0)
+	return -oserror();
+    if (fstat(fd, &statbuf) < 0 || statbuf.st_size < (off_t)sizeof(image_hdr_t)) {
+	close(fd);
+	return PM_ERR_PMNS;
+    }
+    len = statbuf.st_size;
+    image = __pmMemoryMap(fd, len, 0);
+    close(fd);
+    if (image == NULL)
+	return -oserror();
+
+    hdr = (const image_hdr_t *)image;
+    list = (const image_node_t *)&hdr[1];
+    stat_mtime(sbp, &sec, &nsec);
+    if (hdr->magic != IMAGE_MAGIC || hdr->version != IMAGE_VERSION)
+	why = "not a compiled PMNS";
+    else if (hdr->size != sbp->st_size || hdr->sec != sec || hdr->nsec != nsec)
+	why = "compiled from a different version of the PMNS";
+    else if (hdr->numnode == 0 || hdr->htabsize == 0 ||
+	     hdr->numnode > len / sizeof(image_node_t) ||
+	     len != sizeof(*hdr) + hdr->numnode * sizeof(image_node_t) + hdr->strsize ||
+	     image[len-1] != '\0')
+	why = "corrupted";
+    else if ((hdr->flags & IMAGE_DUPS) && dupok == NO_DUPS)
+	/* let the ASCII PMNS report the duplicates */
+	why = "duplicate PMIDs";
+    if (why != NULL) {
+	sts = PM_ERR_PMNS;
+	goto fail;
+    }
+    names = (char *)&list[hdr->numnode];
+
+    if ((tree = (__pmnsTree *)malloc(sizeof(*tree))) == NULL ||
+	(nodes = (__pmnsNode *)malloc(hdr->numnode * sizeof(*nodes))) == NULL ||
+	(tree->htab = (__pmnsNode **)calloc(hdr->htabsize, sizeof(__pmnsNode *))) == NULL) {
+	sts = -oserror();
+	why = "out of memory";
+	goto fail;
+    }
+    for (i = 0; i < hdr->numnode; i++) {
+	if (list[i].parent > hdr->numnode || list[i].first > hdr->numnode ||
+	    list[i].next > hdr->numnode || list[i].name >= hdr->strsize) {
+	    free(tree->htab);
+	    sts = PM_ERR_PMNS;
+	    why = "corrupted";
+	    goto fail;
+	}
+	np = &nodes[i];
+	np->parent = list[i].parent ? &nodes[list[i].parent-1] : NULL;
+	np->first = list[i].first ? &nodes[list[i].first-1] : NULL;
+	np->next = list[i].next ? &nodes[list[i].next-1] : NULL;
+	np->hash = NULL;
+	np->name = &names[list[i].name];
+	np->pmid = list[i].pmid;
+    }
+    /* same order of insertion as backlink(), so same hash chains */
+    for (i = 0; i < hdr->numnode; i++) {
+	if (list[i].flags & IMAGE_HASHED) {
+	    np = &nodes[i];
+	    k = (np->pmid & PMID_MASK) % hdr->htabsize;
+	    np->hash = tree->htab[k];
+	    tree->htab[k] = np;
+	}
+    }
+    tree->root = nodes;
+    tree->htabsize = hdr->htabsize;
+    tree->mark_state = 0;
+    main_pmns = tree;
+    main_image = image;
+    main_imagelen = len;
+
+    if (pmDebugOptions.pmns)
+	fprintf(stderr, "Loaded compiled PMNS %s, %u nodes\n", path, hdr->numnode);
+    return 0;
+
+fail:
+    if (pmDebugOptions.pmns)
+	fprintf(stderr, "loadimage: %s: %s, ignored\n", path, why);
+    if (nodes != NULL)
+	free(nodes);
+    if (tree != NULL)
+	free(tree);
+    __pmMemoryUnmap(image, len);
+    return sts;
+}
+
+/*
+ * Copy of the tree below np, with each node and name malloc'd
+ * separately as for an ASCII PMNS.
+ */
+static __pmnsNode *
+copynode(const __pmnsNode *np, __pmnsNode *parent, int *numnode)
+{
+    __pmnsNode	*cp;
+    __pmnsNode	*xp;
+    __pmnsNode	*last = NULL;
+    __pmnsNode	*child;
+
+    if ((cp = (__pmnsNode *)malloc(sizeof(*cp))) == NULL ||
+	(cp->name = strdup(np->name)) == NULL) {
+	pmNoMem("copynode", sizeof(*cp) + strlen(np->name) + 1, PM_FATAL_ERR);
+	/*NOTREACHED*/
+    }
+    (*numnode)++;
+    cp->parent = parent;
+    cp->first = cp->next = cp->hash = NULL;
+    /* non-leaf nodes have no PMID, whatever the mark bits say */
+    cp->pmid = np->first != NULL ? PM_ID_NULL : np->pmid;
+    for (xp = np->first; xp != NULL; xp = xp->next) {
+	child = copynode(xp, cp, numnode);
+	if (last == NULL)
+	    cp->first = child;
+	else
+	    last->next = child;
+	last = child;
+    }
+    return cp;
+}
+
+/*
+ * Replace the nodes of a PMNS loaded from a compiled image with
+ * separately malloc'd ones, for callers that change the tree.
+ */
+static void
+unmap_pmns(__pmnsTree *tree)
+{
+    __pmnsNode	*root;
+    int		numnode = 0;
+
+    PM_ASSERT_IS_LOCKED(pmns_lock);
+
+    mark_all(tree, 0);
+    root = copynode(tree->root, NULL, &numnode);
+    free(tree->htab);
+    free(tree->root);
+    __pmMemoryUnmap(main_image, main_imagelen);
+    main_image = NULL;
+    main_imagelen = 0;
+    tree->root = root;
+    tree->htab = NULL;
+    tree->mark_state = UNKNOWN_MARK_STATE;
+    if (__pmFixPMNSHashTab(tree, numnode, DUPS_OK) < 0) {
+	pmNoMem("unmap_pmns", tree->htabsize * sizeof(__pmnsNode *), PM_FATAL_ERR);
+	/*NOTREACHED*/
+    }
+}
+
+/*
+ * Add the subtree below np to the image nodes and names, in pre-order.
+ * Returns the index of np's node.
+ */
+static int
+fillimage(__pmnsTree *tree, __pmnsNode *np, int parent, image_node_t *list,
+	int *numnode, char *names, __uint32_t *strsize, __uint32_t *flags)
+{
+    __pmnsNode	*xp;
+    size_t	len = strlen(np->name) + 1;
+    int		me = (*numnode)++;
+    int		prev = -1;
+    int		child;
+    int		dup = 0;
+
+    list[me].parent = parent + 1;
+    list[me].first = 0;
+    list[me].next = 0;
+    list[me].name = *strsize;
+    list[me].pmid = np->pmid;
+    list[me].flags = 0;
+    memcpy(&names[*strsize], np->name, len);
+    *strsize += len;
+
+    for (xp = tree->htab[(np->pmid & PMID_MASK) % tree->htabsize]; xp != NULL; xp = xp->hash) {
+	if (xp == np)
+	    list[me].flags |= IMAGE_HASHED;
+	else if (xp->pmid == np->pmid && !IS_DYNAMIC_ROOT(xp->pmid))
+	    dup = 1;
+    }
+    if ((list[me].flags & IMAGE_HASHED) && dup)
+	*flags |= IMAGE_DUPS;
+
+    for (xp = np->first; xp != NULL; xp = xp->next) {
+	child = fillimage(tree, xp, me, list, numnode, names, strsize, flags);
+	if (prev < 0)
+	    list[me].first = child + 1;
+	else
+	    list[prev].next = child + 1;
+	prev = child;
+    }
+    return me;
+}
+
+static void
+countnodes(const __pmnsNode *np, int *numnode, size_t *strsize)
+{
+    for ( ; np != NULL; np = np->next) {
+	(*numnode)++;
+	*strsize += strlen(np->name) + 1;
+	countnodes(np->first, numnode, strsize);
+    }
+}
+
+/*
+ * Write a compiled image of the loaded PMNS, which must have been
+ * loaded from filename (and not changed since), to filename.bin
+ */
+int
+__pmWritePMNSImage(const char *filename)
+{
+    image_hdr_t		hdr;
+    image_node_t	*list = NULL;
+    char		*names = NULL;
+    char		path[MAXPATHLEN];
+    char		tmppath[MAXPATHLEN];
+    struct stat		statbuf;
+    FILE		*f;
+    size_t		strsize = 0;
+    int			numnode = 0;
+    int			sts;
+    ctx_ctl_t		ctx_ctl = { NULL, 0, 0 };
+
+    if (__pmHasPMNSFileChanged(filename))
+	return PM_ERR_NOPMNS;
+
+    lock_ctx_and_pmns(NULL, &ctx_ctl);
+
+    if (main_pmns == NULL || main_pmns->htabsize == 0 ||
+	stat(fname, &statbuf) < 0) {
+	sts = PM_ERR_NOPMNS;
+	goto pmapi_return;
+    }
+
+    /* leaf PMIDs without mark bits, as for the hash chains */
+    mark_all(main_pmns, 0);
+    countnodes(main_pmns->root, &numnode, &strsize);
+    if ((list = (image_node_t *)malloc(numnode * sizeof(*list))) == NULL ||
+	(names = (char *)malloc(strsize)) == NULL) {
+	sts = -oserror();
+	goto pmapi_return;
+    }
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = IMAGE_MAGIC;
+    hdr.version = IMAGE_VERSION;
+    hdr.htabsize = main_pmns->htabsize;
+    hdr.size = statbuf.st_size;
+    stat_mtime(&statbuf, &hdr.sec, &hdr.nsec);
+    numnode = 0;
+    fillimage(main_pmns, main_pmns->root, -1, list, &numnode, names,
+		&hdr.strsize, &hdr.flags);
+    hdr.numnode = numnode;
+
+    /* write a new file and rename, so readers never see a partial image */
+    pmsprintf(path, sizeof(path), "%s.bin", fname);
+    pmsprintf(tmppath, sizeof(tmppath), "%s.bin.new", fname);
+    if ((f = fopen(tmppath, "w")) == NULL) {
+	sts = -oserror();
+	goto pmapi_return;
+    }
+    if (fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+	fwrite(list, sizeof(*list), numnode, f) != numnode ||
+	fwrite(names, 1, hdr.strsize, f) != hdr.strsize) {
+	sts = -oserror();
+	fclose(f);
+	unlink(tmppath);
+	goto pmapi_return;
+    }
+    if (fclose(f) != 0 || rename(tmppath, path) < 0) {
+	sts = -oserror();
+	unlink(tmppath);
+	goto pmapi_return;
+    }
+    if (pmDebugOptions.pmns)
+	fprintf(stderr, "__pmWritePMNSImage: %s, %d nodes\n", path, numnode);
+    sts = 0;
+
+pmapi_return:
+
+    if (list != NULL)
+	free(list);
+    if (names != NULL)
+	free(names);
+    if (ctx_ctl.need_pmns_unlock)
+	PM_UNLOCK(pmns_lock);
+    if (ctx_ctl.need_ctx_unlock)
+	PM_UNLOCK(ctx_ctl.ctxp->c_lock);
+
+    return sts;
+}
+
 static int
 load(const char *filename, int dupok, int use_cpp)
 {
     const char	*f;
+    struct stat	statbuf;
+    int		havestat = 0;
     int 	i = 0;
 
     PM_ASSERT_IS_LOCKED(pmns_lock);
@@ -1499,19 +1885,16 @@ load(const char *filename, int dupok, int use_cpp)
 		filename, dupok, use_cpp, i, fname);
 
     /* Note size and modification time of pmns file */
-    {
-	struct stat statbuf;
-
-	if (stat(fname, &statbuf) == 0) {
-	    last_size = statbuf.st_size;
+    if (stat(fname, &statbuf) == 0) {
+	havestat = 1;
+	last_size = statbuf.st_size;
 #if defined(HAVE_ST_MTIME_WITH_E)
-	    last_mtim = statbuf.st_mtime; /* possible struct assignment */
+	last_mtim = statbuf.st_mtime; /* possible struct assignment */
 #elif defined(HAVE_ST_MTIME_WITH_SPEC)
-	    last_mtim = statbuf.st_mtimespec; /* possible struct assignment */
+	last_mtim = statbuf.st_mtimespec; /* possible struct assignment */
 #else
-	    last_mtim = statbuf.st_mtim; /* possible struct assignment */
+	last_mtim = statbuf.st_mtim; /* possible struct assignment */
 #endif
-	}
     }
 
     /*
@@ -1523,8 +1906,11 @@ load(const char *filename, int dupok, int use_cpp)
 	use_cpp = NO_CPP;
 
     /*
-     * load ASCII PMNS
+     * use the compiled image if there is one for this version of
+     * the PMNS file, else load ASCII PMNS
      */
+    if (havestat && loadimage(&statbuf, dupok) == 0)
+	return 0;
     return loadascii(dupok, use_cpp);
 }
 
@@ -1539,6 +1925,8 @@ __pmExportPMNS(void)
     lock_ctx_and_pmns(NULL, &ctx_ctl);
 
     export = 1;
+    if (main_pmns != NULL && main_image != NULL)
+	unmap_pmns(main_pmns);
 
     if (ctx_ctl.need_pmns_unlock)
 	PM_UNLOCK(pmns_lock);
@@ -1656,7 +2044,15 @@ __pmFreePMNS(__pmnsTree *pmns)
 {
     if (pmns != NULL) {
 	free(pmns->htab);
-	FreeTraversePMNS(pmns->root);
+	if (pmns == main_pmns && main_image != NULL) {
+	    /* one array of nodes, names are in the image */
+	    free(pmns->root);
+	    __pmMemoryUnmap(main_image, main_imagelen);
+	    main_image = NULL;
+	    main_imagelen = 0;
+	}
+	else
+	    FreeTraversePMNS(pmns->root);
 	free(pmns);
     }
 }
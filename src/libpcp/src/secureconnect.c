@@ -1613,13 +1613,10 @@ int
 __pmSocketReady(int fd, struct timeval *timeout)
 {
     __pmSecureSocket socket;
-    __pmFdSet onefd;
 
     if (__pmDataIPC(fd, &socket) == 0 && socket.sslFd)
         if (SSL_DataPending(socket.sslFd))
 	    return 1;	/* proceed without blocking */
 
-    FD_ZERO(&onefd);
-    FD_SET(fd, &onefd);
-    return select(fd+1, &onefd, NULL, NULL, timeout);
+    return __pmSocketReadable(fd, timeout);
 }
@@ -31,6 +31,8 @@ struct mmv_registry {
     __uint32_t		ninstances;
     mmv_label_t *	labels;
     __uint32_t		nlabels;
+    int *		stripes;	/* items of striped metrics */
+    __uint32_t		nstripes;
     __uint32_t		version;
     const char *	file;
     __uint32_t		cluster;
@@ -128,6 +130,345 @@ mmv_generation(void)
     return (((__uint64_t)gen1 << 32) | (__uint64_t)gen2);
 }
 
+/*
+ * Process-local index of the values in each mapping, so looking up a
+ * value by metric and instance name does not need a scan of the whole
+ * values section.  The API only passes the mapping address around, so
+ * indexes are found by address; there is usually just the one.
+ *
+ * An index is built when the mapping is started and not changed after
+ * that, so lookups read it without any lock.  Each slot holds the
+ * address of a mapping and its index - the address is stored last on
+ * adding, and cleared first on dropping, and lookups only follow the
+ * index of a slot with their own address.  So a mapping being stopped
+ * in one thread never affects lookups in another mapping.  The lock
+ * only serialises adding and dropping.
+ */
+typedef struct mmv_index {
+    __pmHashCtl		metrics;	/* first value of each metric */
+    __pmHashCtl		values;		/* values of metrics with indoms */
+} mmv_index_t;
+
+typedef struct mmv_index_slot {
+    void		*addr;
+    mmv_index_t		*index;
+} mmv_index_slot_t;
+
+#define MMV_INDEX_SLOTS	16	/* mappings after this are scanned */
+
+#ifdef PM_MULTI_THREAD
+static pthread_mutex_t	index_lock = PTHREAD_MUTEX_INITIALIZER;
+#else
+static void		*index_lock;
+#endif
+static mmv_index_slot_t	indexes[MMV_INDEX_SLOTS];
+static int		nindexes;	/* slots in use, upper bound */
+
+#define MMV_HASH_INIT	2166136261U
+#define MMV_INDEX_MIN	32	/* fewer values are quicker to scan */
+
+/* FNV-1a, continuing from the hash of the metric name for instances */
+static unsigned int
+mmv_hash(const char *name, unsigned int hash)
+{
+    const unsigned char *p;
+
+    for (p = (const unsigned char *)name; *p != '\0'; p++)
+	hash = (hash ^ *p) * 16777619U;
+    return hash;
+}
+
+static const char *
+mmv_value_metric(void *addr, int version, const mmv_disk_value_t *v,
+		__int32_t *indom)
+{
+    if (version == MMV_VERSION1) {
+	mmv_disk_metric_t *m = (mmv_disk_metric_t *)
+					((char *)addr + v->metric);
+	*indom = m->indom;
+	return m->name;
+    } else {
+	mmv_disk_metric2_t *m = (mmv_disk_metric2_t *)
+					((char *)addr + v->metric);
+	*indom = m->indom;
+	return ((mmv_disk_string_t *)((char *)addr + m->name))->payload;
+    }
+}
+
+static const char *
+mmv_value_instance(void *addr, int version, const mmv_disk_value_t *v)
+{
+    if (version == MMV_VERSION1) {
+	mmv_disk_instance_t *in = (mmv_disk_instance_t *)
+					((char *)addr + v->instance);
+	return in->external;
+    } else {
+	mmv_disk_instance2_t *in = (mmv_disk_instance2_t *)
+					((char *)addr + v->instance);
+	return ((mmv_disk_string_t *)((char *)addr + in->external))->payload;
+    }
+}
+
+static void
+mmv_index_free(mmv_index_t *ip)
+{
+    __pmHashClear(&ip->metrics);
+    __pmHashClear(&ip->values);
+    free(ip);
+}
+
+/*
+ * Build the index for a newly initialised mapping.  Failure is not
+ * fatal, lookups fall back to scanning the values section.
+ */
+static void
+mmv_index_add(void *addr, mmv_disk_value_t *v, int nvalues, int version)
+{
+    mmv_index_t *ip;
+    __pmHashNode *hp;
+    const char *name;
+    unsigned int key = 0;
+    __uint64_t metric = 0;
+    __int32_t indom = 0, dup;
+    int i, sts = 0;
+
+    if (nvalues < MMV_INDEX_MIN)
+	return;
+    if ((ip = (mmv_index_t *)calloc(1, sizeof(*ip))) == NULL)
+	return;
+    __pmHashInit(&ip->metrics);
+    __pmHashInit(&ip->values);
+
+    for (i = 0; i < nvalues && sts >= 0; i++) {
+	if (i == 0 || v[i].metric != metric) {
+	    /* values for each metric are adjacent, first one is indexed */
+	    metric = v[i].metric;
+	    name = mmv_value_metric(addr, version, &v[i], &indom);
+	    key = mmv_hash(name, MMV_HASH_INIT);
+	    for (hp = __pmHashSearch(key, &ip->metrics); hp; hp = hp->next) {
+		if (strcmp(mmv_value_metric(addr, version, hp->data, &dup),
+			   name) == 0)
+		    break;
+	    }
+	    if (hp != NULL) {
+		/* duplicate name, a scan would always find the first */
+		metric = 0;
+		continue;
+	    }
+	    if ((sts = __pmHashAdd(key, &v[i], &ip->metrics)) < 0)
+		break;
+	}
+	if (metric == 0 || mmv_singular(indom))
+	    continue;
+	name = mmv_value_instance(addr, version, &v[i]);
+	sts = __pmHashAdd(mmv_hash(name, key), &v[i], &ip->values);
+    }
+    if (sts < 0) {
+	mmv_index_free(ip);
+	return;
+    }
+
+    PM_LOCK(index_lock);
+    for (i = 0; i < MMV_INDEX_SLOTS; i++)
+	if (indexes[i].addr == NULL)
+	    break;
+    if (i == MMV_INDEX_SLOTS) {
+	PM_UNLOCK(index_lock);
+	mmv_index_free(ip);
+	return;
+    }
+    indexes[i].index = ip;
+    __atomic_store_n(&indexes[i].addr, addr, __ATOMIC_RELEASE);
+    if (i >= nindexes)
+	__atomic_store_n(&nindexes, i + 1, __ATOMIC_RELEASE);
+    PM_UNLOCK(index_lock);
+}
+
+static void
+mmv_index_drop(void *addr)
+{
+    mmv_index_t *ip;
+    int i;
+
+    PM_LOCK(index_lock);
+    for (i = 0; i < nindexes; i++) {
+	if (indexes[i].addr == addr) {
+	    __atomic_store_n(&indexes[i].addr, NULL, __ATOMIC_RELEASE);
+	    ip = indexes[i].index;
+	    indexes[i].index = NULL;
+	    mmv_index_free(ip);
+	    break;
+	}
+    }
+    PM_UNLOCK(index_lock);
+}
+
+/*
+ * Indexed lookup, with the same result as a scan of the values: the
+ * metric's only value if it has no indom, else the value of the named
+ * instance.  Returns zero if the mapping has no index.
+ */
+static int
+mmv_index_lookup(void *addr, int version, const char *metric,
+		const char *inst, pmAtomValue **avp)
+{
+    mmv_index_t *ip = NULL;
+    mmv_disk_value_t *v = NULL, *iv;
+    __pmHashNode *hp;
+    unsigned int key;
+    __int32_t indom = 0;
+    int i, n;
+
+    n = __atomic_load_n(&nindexes, __ATOMIC_ACQUIRE);
+    for (i = 0; i < n; i++) {
+	if (__atomic_load_n(&indexes[i].addr, __ATOMIC_ACQUIRE) == addr) {
+	    ip = indexes[i].index;
+	    break;
+	}
+    }
+    if (ip == NULL)
+	return 0;
+
+    *avp = NULL;
+    key = mmv_hash(metric, MMV_HASH_INIT);
+    for (hp = __pmHashSearch(key, &ip->metrics); hp; hp = hp->next) {
+	v = (mmv_disk_value_t *)hp->data;
+	if (strcmp(mmv_value_metric(addr, version, v, &indom), metric) == 0)
+	    break;
+    }
+    if (hp != NULL && mmv_singular(indom))
+	*avp = &v->value;
+    else if (hp != NULL && inst != NULL) {
+	key = mmv_hash(inst, key);
+	for (hp = __pmHashSearch(key, &ip->values); hp; hp = hp->next) {
+	    iv = (mmv_disk_value_t *)hp->data;
+	    if (iv->metric == v->metric &&
+		strcmp(mmv_value_instance(addr, version, iv), inst) == 0) {
+		*avp = &iv->value;
+		break;
+	    }
+	}
+    }
+    return 1;
+}
+
+/*
+ * Striped values are updated in one of several stripes (one per CPU)
+ * and summed by readers.  Each thread is given a stripe round-robin the
+ * first time it needs one, so with no more threads than CPUs no two
+ * threads update the same cache lines.  The updates are atomic anyway,
+ * so threads (or processes) sharing a stripe are still counted right.
+ */
+#define MMV_STRIPES_MAX		256
+#define MMV_STRIPE_ROUNDUP(n)	\
+	(((n) + MMV_STRIPE_ALIGN - 1) & ~((__uint64_t)MMV_STRIPE_ALIGN - 1))
+
+#if defined(PM_MULTI_THREAD) && defined(HAVE___THREAD)
+static __thread unsigned int	stripe_id;	/* zero until first used */
+static unsigned int		stripe_next;
+
+static unsigned int
+mmv_stripe_id(void)
+{
+    if (stripe_id == 0)
+	stripe_id = __atomic_add_fetch(&stripe_next, 1, __ATOMIC_RELAXED);
+    return stripe_id - 1;
+}
+#else
+#define mmv_stripe_id()		0
+#endif
+
+static int
+mmv_stripes_count(void)
+{
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (ncpus < 1)
+	return 1;
+    if (ncpus > MMV_STRIPES_MAX)
+	return MMV_STRIPES_MAX;
+    return (int)ncpus;
+}
+
+/* this thread's slot for a value with stripes, or NULL for none */
+static pmAtomValue *
+mmv_stripe_slot(void *addr, mmv_disk_value_t *v)
+{
+    mmv_disk_header_t *hdr = (mmv_disk_header_t *)addr;
+    mmv_disk_toc_t *toc;
+    mmv_disk_stripes_t *sp;
+    int i;
+
+    if (v->extra == 0 || hdr->version != MMV_VERSION3)
+	return NULL;
+    toc = (mmv_disk_toc_t *)((char *)addr + sizeof(mmv_disk_header_t));
+    for (i = 0; i < hdr->tocs; i++) {
+	if (toc[i].type != MMV_TOC_STRIPES)
+	    continue;
+	sp = (mmv_disk_stripes_t *)((char *)addr + toc[i].offset);
+	return (pmAtomValue *)((char *)addr + v->extra +
+			(mmv_stripe_id() % sp->count) * sp->size);
+    }
+    return NULL;
+}
+
+/* zero a striped value's slot in every stripe (before it is set) */
+static void
+mmv_stripes_clear(void *addr, mmv_disk_value_t *v)
+{
+    mmv_disk_header_t *hdr = (mmv_disk_header_t *)addr;
+    mmv_disk_toc_t *toc;
+    mmv_disk_stripes_t *sp;
+    pmAtomValue *slot;
+    int i, j;
+
+    if (v->extra == 0 || hdr->version != MMV_VERSION3)
+	return;
+    toc = (mmv_disk_toc_t *)((char *)addr + sizeof(mmv_disk_header_t));
+    for (i = 0; i < hdr->tocs; i++) {
+	if (toc[i].type != MMV_TOC_STRIPES)
+	    continue;
+	sp = (mmv_disk_stripes_t *)((char *)addr + toc[i].offset);
+	for (j = 0; j < sp->count; j++) {
+	    slot = (pmAtomValue *)((char *)addr + v->extra + j * sp->size);
+	    __atomic_store_n(&slot->ull, 0, __ATOMIC_RELAXED);
+	}
+    }
+}
+
+/*
+ * Floating point values are updated with compare-exchange on their bits.
+ */
+static void
+mmv_add_float(pmAtomValue *av, float inc)
+{
+    __uint32_t old, new;
+    float f;
+
+    old = __atomic_load_n(&av->ul, __ATOMIC_RELAXED);
+    do {
+	memcpy(&f, &old, sizeof(f));
+	f += inc;
+	memcpy(&new, &f, sizeof(new));
+    } while (!__atomic_compare_exchange_n(&av->ul, &old, new, 1,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+static void
+mmv_add_double(pmAtomValue *av, double inc)
+{
+    __uint64_t old, new;
+    double d;
+
+    old = __atomic_load_n(&av->ull, __ATOMIC_RELAXED);
+    do {
+	memcpy(&d, &old, sizeof(d));
+	d += inc;
+	memcpy(&new, &d, sizeof(new));
+    } while (!__atomic_compare_exchange_n(&av->ull, &old, new, 1,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
 static void * 
 mmv_init(const char *fname, int version,
 		int cluster, mmv_stats_flags_t fl,
@@ -135,7 +476,8 @@ mmv_init(const char *fname, int version,
 		const mmv_indom_t *in1, int nindom1,
 		const mmv_metric2_t *st2, int nmetric2,
 		const mmv_indom2_t *in2, int nindom2,
-		const mmv_label_t *lb, int nlabels)
+		const mmv_label_t *lb, int nlabels,
+		const int *striped, int nstripes)
 {
     mmv_disk_instance2_t *inlist2;
     mmv_disk_instance_t *inlist1;
@@ -145,6 +487,7 @@ mmv_init(const char *fname, int version,
     mmv_disk_indom_t *domlist;
     mmv_disk_value_t *vlist;
     mmv_disk_label_t *lblist;
+    mmv_disk_stripes_t *stripes;
     mmv_disk_header_t *hdr;
     mmv_disk_toc_t *toc;
     const mmv_indom_t *mi1;
@@ -155,6 +498,9 @@ mmv_init(const char *fname, int version,
     __uint64_t values_offset;		/* anchor start of values section */
     __uint64_t strings_offset;		/* anchor start of any/all strings */
     __uint64_t labels_offset;		/* anchor start of any/all labels */
+    __uint64_t stripes_offset = 0;	/* anchor start of any stripes */
+    __uint64_t slots_offset = 0;	/* anchor start of the first stripe */
+    __uint64_t stripe_size = 0;		/* bytes from one stripe to the next */
     void *addr;
     size_t size;
     __uint64_t offset;
@@ -162,6 +508,7 @@ mmv_init(const char *fname, int version,
     int ninstances = 0;
     int nstrings = 0;
     int nvalues = 0;
+    int nslots = 0;
 
     for (i = 0; i < nindom1; i++) {
 	ninstances += in1[i].count;
@@ -210,15 +557,21 @@ mmv_init(const char *fname, int version,
 	    if (st2[i].type == MMV_TYPE_STRING)
 		nstrings += mi2->count;
 	    nvalues += mi2->count;
+	    if (striped && striped[i])
+		nslots += mi2->count;
 	} else {
 	    if (st2[i].type == MMV_TYPE_STRING)
 		nstrings++;
 	    nvalues++;
+	    if (striped && striped[i])
+		nslots++;
 	}
     }
+    if (version != MMV_VERSION3 || nstripes < 1)
+	nslots = 0;
     
     /* TOC follows header, with enough entries to hold */
-    /* indoms, instances, metrics, values, strings, and labels */
+    /* indoms, instances, metrics, values, strings, labels and stripes */
     size = sizeof(mmv_disk_toc_t) * 2;
     if (nindom1 || nindom2)
 	size += sizeof(mmv_disk_toc_t) * 2;
@@ -227,6 +580,8 @@ mmv_init(const char *fname, int version,
     if (nlabels) {
 	size += sizeof(mmv_disk_toc_t) * 1;
     }
+    if (nslots)
+	size += sizeof(mmv_disk_toc_t) * 1;
     indoms_offset = sizeof(mmv_disk_header_t) + size;
 
     /* Following the indom definitions are the actual instances */
@@ -274,6 +629,19 @@ mmv_init(const char *fname, int version,
     /* End of file follows all of the actual strings */
     size = labels_offset + nlabels * sizeof(mmv_disk_label_t);
 
+    /*
+     * Unless there are striped values, which follow the labels with
+     * each stripe on its own cache lines, so that writers updating
+     * different stripes do not contend for them.
+     */
+    if (nslots) {
+	stripes_offset = MMV_STRIPE_ROUNDUP(size);
+	slots_offset = MMV_STRIPE_ROUNDUP(stripes_offset +
+					  sizeof(mmv_disk_stripes_t));
+	stripe_size = MMV_STRIPE_ROUNDUP(nslots * sizeof(pmAtomValue));
+	size = slots_offset + nstripes * stripe_size;
+    }
+
     if ((addr = mmv_mapping_init(fname, size)) == NULL)
 	return NULL;
 
@@ -300,6 +668,8 @@ mmv_init(const char *fname, int version,
 	hdr->tocs += 1;
     if (nlabels)
 	hdr->tocs += 1;    
+    if (nslots)
+	hdr->tocs += 1;
     hdr->flags = fl;
     hdr->cluster = cluster;
     hdr->process = (__int32_t)getpid();
@@ -337,6 +707,12 @@ mmv_init(const char *fname, int version,
 	toc[tocidx].offset = labels_offset;
 	tocidx++;
     }
+    if (nslots) {
+	toc[tocidx].type = MMV_TOC_STRIPES;
+	toc[tocidx].count = 1;
+	toc[tocidx].offset = stripes_offset;
+	tocidx++;
+    }
 
     /* Indom section */
     domlist = (mmv_disk_indom_t *)((char *)addr + indoms_offset);
@@ -617,9 +993,33 @@ mmv_init(const char *fname, int version,
 	memcpy(lblist[i].payload, lb[i].payload, MMV_LABELMAX);
     }
 
+    /* Stripes section - and the slot of each striped value within it */
+    if (nslots) {
+	stripes = (mmv_disk_stripes_t *)((char *)addr + stripes_offset);
+	stripes->count = nstripes;
+	stripes->slots = nslots;
+	stripes->size = stripe_size;
+	stripes->offset = slots_offset;
+
+	offset = slots_offset;
+	for (i = j = 0; i < nmetric2; i++) {
+	    if (mmv_singular(st2[i].indom))
+		k = 1;
+	    else
+		k = mmv_lookup_indom2(st2[i].indom, in2, nindom2)->count;
+	    for (; k > 0; k--, j++) {
+		if (!striped[i])
+		    continue;
+		vlist[j].extra = offset;
+		offset += sizeof(pmAtomValue);
+	    }
+	}
+    }
+
     /* Complete - unlock the header, PMDA can read now */
     hdr->g2 = hdr->g1;
 
+    mmv_index_add(addr, vlist, nvalues, version);
     return addr;
 }
 
@@ -688,7 +1088,7 @@ mmv_stats_init(const char *fname,
 
     return mmv_init(fname, version, cluster, flags,
 		    st, nmetrics, in, nindoms, 
-		    NULL, 0, NULL, 0, NULL, 0);
+		    NULL, 0, NULL, 0, NULL, 0, NULL, 0);
 }
 
 static int
@@ -772,7 +1172,8 @@ mmv_stats2_init(const char *fname,
 	return NULL;
 
     return mmv_init(fname, version, cluster, flags,
-		    NULL, 0, NULL, 0, st, nmetrics, in, nindoms, NULL, 0);
+		    NULL, 0, NULL, 0, st, nmetrics, in, nindoms, NULL, 0,
+		    NULL, 0);
 }
 
 mmv_registry_t *
@@ -1189,10 +1590,60 @@ mmv_stats_add_instance_label(mmv_registry_t *registry, int serial, int instid,
     return 0;
 }
 
+/*
+ * Give all values of a numeric metric per-CPU stripes, so that many
+ * threads can update them without contending for the same cache line.
+ */
+int
+mmv_stats_add_metric_stripes(mmv_registry_t *registry, int item)
+{
+    mmv_metric2_t * metric = NULL;
+    int * stripes;
+    size_t bytes;
+    int i;
+
+    if (registry == NULL) {
+	setoserror(EFAULT);
+	return -1;
+    }
+    for (i = 0; i < registry->nmetrics; i++) {
+	if (registry->metrics[i].item == item) {
+	    metric = &registry->metrics[i];
+	    break;
+	}
+    }
+    if (metric == NULL) {
+	setoserror(ESRCH);
+	return -1;
+    }
+    if (metric->type == MMV_TYPE_STRING || metric->type == MMV_TYPE_ELAPSED ||
+	metric->type == MMV_TYPE_NOSUPPORT) {
+	setoserror(EINVAL);
+	return -1;
+    }
+    for (i = 0; i < registry->nstripes; i++)
+	if (registry->stripes[i] == item)
+	    return 0;
+
+    bytes = (registry->nstripes + 1) * sizeof(int);
+    stripes = (int *) realloc(registry->stripes, bytes);
+    if (stripes == NULL) {
+	setoserror(ENOMEM);
+	return -1;
+    }
+
+    registry->version = MMV_VERSION3;
+    registry->stripes = stripes;
+    registry->stripes[registry->nstripes] = item;
+    registry->nstripes++;
+    return 0;
+}
+
 void *
 mmv_stats_start(mmv_registry_t *registry) 
 {
-    int version;
+    int *striped = NULL;
+    int i, j, version;
 
     if ((version = mmv_check2(registry->metrics, registry->nmetrics,
 				registry->indoms, registry->nindoms)) < 0)
@@ -1201,12 +1652,27 @@ mmv_stats_start(mmv_registry_t *registry)
     if (registry->version != MMV_VERSION3)
 	registry->version = version;
 
+    if (registry->nstripes) {
+	striped = (int *)calloc(registry->nmetrics, sizeof(int));
+	if (striped == NULL) {
+	    setoserror(ENOMEM);
+	    return NULL;
+	}
+	for (i = 0; i < registry->nmetrics; i++)
+	    for (j = 0; j < registry->nstripes; j++)
+		if (registry->metrics[i].item == registry->stripes[j])
+		    striped[i] = 1;
+    }
+
     registry->addr = mmv_init(registry->file,
 				registry->version, registry->cluster,
 				registry->flags, NULL, 0, NULL, 0, 
 				registry->metrics, registry->nmetrics, 
 				registry->indoms, registry->nindoms,
-				registry->labels, registry->nlabels);
+				registry->labels, registry->nlabels,
+				striped, striped ? mmv_stripes_count() : 0);
+    if (striped)
+	free(striped);
     return registry->addr;
 }
 
@@ -1231,8 +1697,10 @@ mmv_stats_stop(const char *fname, void *addr)
 	unlink(path);
     if (fd >= 0)
 	close(fd);
-    if (addr)
+    if (addr) {
+	mmv_index_drop(addr);
 	__pmMemoryUnmap(addr, sbuf.st_size);
+    }
 }
 
 void
@@ -1251,6 +1719,8 @@ mmv_stats_free(mmv_registry_t *registry)
 	free(registry->metrics);
     if (registry->labels)
 	free(registry->labels);
+    if (registry->stripes)
+	free(registry->stripes);
 
     mmv_stats_stop(registry->file, registry->addr);
     memset(registry, 0, sizeof(mmv_registry_t));
@@ -1328,10 +1798,13 @@ mmv_lookup_value_desc(void *addr, const char *metric, const char *inst)
 {
     if (addr != NULL && metric != NULL) {
 	int i;
+	pmAtomValue *av;
 	mmv_disk_header_t *hdr = (mmv_disk_header_t *)addr;
 	mmv_disk_toc_t *toc = (mmv_disk_toc_t *)
 			((char *)addr + sizeof(mmv_disk_header_t));
 
+	if (mmv_index_lookup(addr, hdr->version, metric, inst, &av))
+	    return av;
 	if (hdr->version == MMV_VERSION1) {
 	    for (i = 0; i < hdr->tocs; i++)
 		if (toc[i].type == MMV_TOC_VALUES)
@@ -1351,6 +1824,8 @@ mmv_inc_value(void *addr, pmAtomValue *av, double inc)
     if (av != NULL && addr != NULL) {
 	mmv_disk_header_t *hdr = (mmv_disk_header_t *)addr;
 	mmv_disk_value_t *v = (mmv_disk_value_t *)av;
+	pmAtomValue *slot;
+	__int64_t start;
 	int type;
 
 	if (hdr->version == MMV_VERSION1) {
@@ -1362,31 +1837,35 @@ mmv_inc_value(void *addr, pmAtomValue *av, double inc)
 					((char *)addr + v->metric);
 	    type = m->type;
 	}
+	/* other threads and processes may be updating this value too */
+	if (type != MMV_TYPE_ELAPSED && (slot = mmv_stripe_slot(addr, v)))
+	    av = slot;
 	switch (type) {
 	case MMV_TYPE_I32:
-	    v->value.l += (__int32_t)inc;
+	    __atomic_fetch_add(&av->l, (__int32_t)inc, __ATOMIC_RELAXED);
 	    break;
 	case MMV_TYPE_U32:
-	    v->value.ul += (__uint32_t)inc;
+	    __atomic_fetch_add(&av->ul, (__uint32_t)inc, __ATOMIC_RELAXED);
 	    break;
 	case MMV_TYPE_I64:
-	    v->value.ll += (__int64_t)inc;
+	    __atomic_fetch_add(&av->ll, (__int64_t)inc, __ATOMIC_RELAXED);
 	    break;
 	case MMV_TYPE_U64:
-	    v->value.ull += (__uint64_t)inc;
+	    __atomic_fetch_add(&av->ull, (__uint64_t)inc, __ATOMIC_RELAXED);
 	    break;
 	case MMV_TYPE_FLOAT:
-	    v->value.f += (float)inc;
+	    mmv_add_float(av, (float)inc);
 	    break;
 	case MMV_TYPE_DOUBLE:
-	    v->value.d += inc;
+	    mmv_add_double(av, inc);
 	    break;
 	case MMV_TYPE_ELAPSED:
 	    if (inc < 0)
-		v->extra = (__int64_t)inc;
+		__atomic_store_n(&v->extra, (__int64_t)inc, __ATOMIC_RELAXED);
 	    else {
-		v->value.ll += v->extra + (__int64_t)inc;
-		v->extra = 0;
+		start = __atomic_exchange_n(&v->extra, 0, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&v->value.ll, start + (__int64_t)inc,
+				__ATOMIC_RELAXED);
 	    }
 	    break;
 	default:
@@ -1401,6 +1880,7 @@ mmv_set_value(void *addr, pmAtomValue *av, double val)
     if (av != NULL && addr != NULL) {
 	mmv_disk_header_t *hdr = (mmv_disk_header_t *)addr;
 	mmv_disk_value_t *v = (mmv_disk_value_t *)av;
+	pmAtomValue bits;
 	int type;
 
 	if (hdr->version == MMV_VERSION1) {
@@ -1412,28 +1892,37 @@ mmv_set_value(void *addr, pmAtomValue *av, double val)
 					((char *)addr + v->metric);
 	    type = m->type;
 	}
+	/*
+	 * Increments made in the stripes before this are replaced by val,
+	 * so discard them first - any made from now on are kept, and
+	 * counted on top of val.
+	 */
+	if (type >= MMV_TYPE_I32 && type <= MMV_TYPE_DOUBLE)
+	    mmv_stripes_clear(addr, v);
 	switch (type) {
 	case MMV_TYPE_I32:
-	    v->value.l = (__int32_t)val;
+	    __atomic_store_n(&v->value.l, (__int32_t)val, __ATOMIC_RELAXED);
 	    break;
 	case MMV_TYPE_U32:
-	    v->value.ul = (__uint32_t)val;
+	    __atomic_store_n(&v->value.ul, (__uint32_t)val, __ATOMIC_RELAXED);
 	    break;
 	case MMV_TYPE_I64:
-	    v->value.ll = (__int64_t)val;
+	    __atomic_store_n(&v->value.ll, (__int64_t)val, __ATOMIC_RELAXED);
 	    break;
 	case MMV_TYPE_U64:
-	    v->value.ull = (__uint64_t)val;
+	    __atomic_store_n(&v->value.ull, (__uint64_t)val, __ATOMIC_RELAXED);
 	    break;
 	case MMV_TYPE_FLOAT:
-	    v->value.f = (float)val;
+	    bits.f = (float)val;
+	    __atomic_store_n(&v->value.ul, bits.ul, __ATOMIC_RELAXED);
 	    break;
 	case MMV_TYPE_DOUBLE:
-	    v->value.d = val;
+	    bits.d = val;
+	    __atomic_store_n(&v->value.ull, bits.ull, __ATOMIC_RELAXED);
 	    break;
 	case MMV_TYPE_ELAPSED:
-	    v->value.ll = (__int64_t)val;
-	    v->extra = 0;
+	    __atomic_store_n(&v->value.ll, (__int64_t)val, __ATOMIC_RELAXED);
+	    __atomic_store_n(&v->extra, 0, __ATOMIC_RELAXED);
 	    break;
 	default:
 	    break;
@@ -25,6 +25,7 @@ PMCD_DATA int	pmcd_seqnum = 1;	/* PMDA start/restart count */
 PMCD_DATA int	pmcd_hi_openfds = -1;   /* Highest open pmcd file descriptor */
 PMCD_DATA int	pmcd_done;		/* flag from pmcd pmda */
 PMCD_DATA int	pmcd_timeout = 5;	/* Timeout for hung agents */
+PMCD_DATA int	pmcd_coalesce;		/* Fetch coalescing window (msec) */
 
 PMCD_DATA int	nAgents;		/* Number of active agents */
 PMCD_DATA AgentInfo *agent;		/* Array of agent info structs */
@@ -0,0 +1,516 @@
+/*
+ * Copyright (c) 2021 Red Hat.
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ */
+#include "pmapi.h"
+#include "util.h"
+#include "pmwebapi.h"
+#include "cache.h"
+
+#define CACHE_SIZE	(64 * 1024 * 1024)	/* default memory limit */
+
+static dict		*cachemap;		/* key: seriesCacheEntry */
+static seriesCacheEntry	*cachehead;		/* most recently used */
+static seriesCacheEntry	*cachetail;		/* least recently used */
+static size_t		cachesize;		/* memory limit, in bytes */
+static unsigned int	cachettl;		/* entry lifetime, in seconds */
+static unsigned int	cacheloads;		/* loads completed, any thread */
+static size_t		cachebytes;		/* memory currently in use */
+static unsigned int	cacheentries;
+
+static void		*cachemmv;
+static pmAtomValue	*cachemetrics[NUM_CACHE_METRICS];
+
+void
+seriesCacheInit(struct dict *config)
+{
+    sds			option;
+    char		*endnum;
+    unsigned long long	size = CACHE_SIZE;
+    unsigned long	ttl = CACHE_TTL_SECS;
+    static int		setup;
+
+    if (setup)
+	return;
+    setup = 1;
+
+    if ((option = pmIniFileLookup(config, "pmseries", "query.cache.size"))) {
+	size = strtoull(option, &endnum, 10);
+	if (*endnum != '\0')
+	    size = CACHE_SIZE;
+    }
+    if ((option = pmIniFileLookup(config, "pmseries", "query.cache.ttl"))) {
+	ttl = strtoul(option, &endnum, 10);
+	if (*endnum != '\0')
+	    ttl = CACHE_TTL_SECS;
+    }
+    cachettl = ttl;
+    if ((cachesize = size) > 0)
+	cachemap = dictCreate(&sdsKeyDictCallBacks, "querycache");
+}
+
+int
+seriesCacheEnabled(void)
+{
+    return cachemap != NULL;
+}
+
+/*
+ * A load of samples has completed (called from any thread) - these may
+ * fall within time windows already settled, which must be checked for
+ * newer samples again by the next query.
+ */
+void
+seriesCacheLoaded(void)
+{
+    __atomic_add_fetch(&cacheloads, 1, __ATOMIC_RELAXED);
+}
+
+void
+seriesCacheCount(int metric)
+{
+    if (cachemmv && cachemetrics[metric])
+	mmv_inc_value(cachemmv, cachemetrics[metric], 1);
+}
+
+static void
+seriesCacheUsage(void)
+{
+    if (cachemmv && cachemetrics[CACHE_ENTRIES])
+	mmv_set_value(cachemmv, cachemetrics[CACHE_ENTRIES], cacheentries);
+    if (cachemmv && cachemetrics[CACHE_BYTES])
+	mmv_set_value(cachemmv, cachemetrics[CACHE_BYTES], cachebytes);
+}
+
+void
+seriesCacheMetrics(mmv_registry_t *registry)
+{
+    static const struct {
+	const char	*name;
+	mmv_metric_sem_t sem;
+	pmUnits		units;
+	const char	*help;
+    } metrics[NUM_CACHE_METRICS] = {
+	[CACHE_HITS] = { "query.cache.hits", MMV_SEM_COUNTER,
+		MMV_UNITS(0,0,1,0,0,PM_COUNT_ONE),
+		"Series value queries answered from the query cache alone" },
+	[CACHE_EXTENDS] = { "query.cache.extends", MMV_SEM_COUNTER,
+		MMV_UNITS(0,0,1,0,0,PM_COUNT_ONE),
+		"Cached series value queries fetching only newer samples" },
+	[CACHE_MISSES] = { "query.cache.misses", MMV_SEM_COUNTER,
+		MMV_UNITS(0,0,1,0,0,PM_COUNT_ONE),
+		"Series value queries fetching all samples in the window" },
+	[CACHE_EVICTIONS] = { "query.cache.evictions", MMV_SEM_COUNTER,
+		MMV_UNITS(0,0,1,0,0,PM_COUNT_ONE),
+		"Query cache entries evicted to keep within query.cache.size" },
+	[CACHE_ENTRIES] = { "query.cache.entries", MMV_SEM_INSTANT,
+		MMV_UNITS(0,0,1,0,0,PM_COUNT_ONE),
+		"Series time windows currently held in the query cache" },
+	[CACHE_BYTES] = { "query.cache.bytes", MMV_SEM_INSTANT,
+		MMV_UNITS(1,0,0,PM_SPACE_BYTE,0,0),
+		"Memory used by series samples held in the query cache" },
+    };
+    pmInDom		noindom = MMV_INDOM_NULL;
+    int			i;
+
+    if (registry == NULL || cachemap == NULL || cachemmv != NULL)
+	return;
+
+    for (i = 0; i < NUM_CACHE_METRICS; i++)
+	mmv_stats_add_metric(registry, metrics[i].name, i + 1,
+		MMV_TYPE_U64, metrics[i].sem, metrics[i].units, noindom,
+		metrics[i].help, NULL);
+
+    if ((cachemmv = mmv_stats_start(registry)) == NULL)
+	return;
+    for (i = 0; i < NUM_CACHE_METRICS; i++)
+	cachemetrics[i] = mmv_lookup_value_desc(cachemmv, metrics[i].name, NULL);
+}
+
+static void
+seriesCacheUnlink(seriesCacheEntry *entry)
+{
+    if (entry->prev)
+	entry->prev->next = entry->next;
+    else
+	cachehead = entry->next;
+    if (entry->next)
+	entry->next->prev = entry->prev;
+    else
+	cachetail = entry->prev;
+    entry->prev = entry->next = NULL;
+}
+
+static void
+seriesCachePush(seriesCacheEntry *entry)
+{
+    entry->prev = NULL;
+    if ((entry->next = cachehead) != NULL)
+	cachehead->prev = entry;
+    else
+	cachetail = entry;
+    cachehead = entry;
+}
+
+static void
+seriesCacheFree(seriesCacheEntry *entry)
+{
+    unsigned int	i;
+
+    for (i = 0; i < entry->nsamples; i++)
+	freeReplyObject(entry->samples[i]);
+    free(entry->samples);
+    sdsfree(entry->key);
+    free(entry);
+}
+
+/* remove an entry from the cache, freeing it once no longer in use */
+static void
+seriesCacheRemove(seriesCacheEntry *entry)
+{
+    if (entry->evicted)
+	return;
+    entry->evicted = 1;
+    dictDelete(cachemap, entry->key);
+    seriesCacheUnlink(entry);
+    cachebytes -= entry->bytes;
+    cacheentries--;
+    seriesCacheUsage();
+    if (entry->refcount == 0)
+	seriesCacheFree(entry);
+}
+
+void
+seriesCacheClose(void)
+{
+    seriesCacheEntry	*entry;
+
+    if (cachemap == NULL)
+	return;
+    while ((entry = cachehead) != NULL) {
+	entry->refcount = 0;
+	seriesCacheRemove(entry);
+    }
+    dictRelease(cachemap);
+    cachemap = NULL;
+    memset(cachemetrics, 0, sizeof(cachemetrics));
+    cachemmv = NULL;
+}
+
+/* find the cached samples for a query, marking them in use */
+seriesCacheEntry *
+seriesCacheLookup(sds key)
+{
+    seriesCacheEntry	*entry;
+    dictEntry		*de;
+    unsigned int	loads;
+
+    if (cachemap == NULL || (de = dictFind(cachemap, key)) == NULL)
+	return NULL;
+    entry = (seriesCacheEntry *)dictGetVal(de);
+    if (cachettl && time(NULL) - entry->created >= cachettl) {
+	/* samples may have been loaded into the window, or expired */
+	seriesCacheRemove(entry);
+	return NULL;
+    }
+    loads = __atomic_load_n(&cacheloads, __ATOMIC_RELAXED);
+    if (entry->loads != loads) {
+	memset(&entry->settled, 0, sizeof(entry->settled));
+	entry->loads = loads;
+    }
+    if (entry != cachehead) {
+	seriesCacheUnlink(entry);
+	seriesCachePush(entry);
+    }
+    entry->refcount++;
+    return entry;
+}
+
+/* create (or replace) the cached samples for a query, marked in use */
+seriesCacheEntry *
+seriesCacheCreate(sds key)
+{
+    seriesCacheEntry	*entry;
+    dictEntry		*de;
+
+    if (cachemap == NULL)
+	return NULL;
+    if ((de = dictFind(cachemap, key)) != NULL)
+	seriesCacheRemove((seriesCacheEntry *)dictGetVal(de));
+    if ((entry = calloc(1, sizeof(seriesCacheEntry))) == NULL)
+	return NULL;
+    entry->key = sdsdup(key);
+    if (dictAdd(cachemap, key, entry) != DICT_OK) {
+	sdsfree(entry->key);
+	free(entry);
+	return NULL;
+    }
+    seriesCachePush(entry);
+    entry->refcount = 1;
+    entry->loads = __atomic_load_n(&cacheloads, __ATOMIC_RELAXED);
+    entry->created = time(NULL);
+    cacheentries++;
+    seriesCacheUsage();
+    return entry;
+}
+
+/* a query is finished with these samples - keep within memory limit */
+void
+seriesCacheRelease(seriesCacheEntry *entry)
+{
+    seriesCacheEntry	*victim;
+
+    if (--entry->refcount == 0 && entry->evicted) {
+	seriesCacheFree(entry);
+	return;
+    }
+    while (cachebytes > cachesize && (victim = cachetail) != NULL) {
+	seriesCacheRemove(victim);
+	seriesCacheCount(CACHE_EVICTIONS);
+    }
+}
+
+/* samples cannot be used (e.g. an unexpected Redis reply) */
+void
+seriesCacheDrop(seriesCacheEntry *entry)
+{
+    seriesCacheRemove(entry);
+    seriesCacheRelease(entry);
+}
+
+void
+seriesStreamIDTime(struct timeval *stamp, seriesStreamID *id)
+{
+    /* as per timeval_stream_str(), sub-millisecond part is sequence */
+    id->ms = ((__uint64_t)stamp->tv_sec) * 1000 + stamp->tv_usec / 1000;
+    id->seq = stamp->tv_usec % 1000;
+}
+
+int
+seriesStreamIDCompare(seriesStreamID *a, seriesStreamID *b)
+{
+    if (a->ms != b->ms)
+	return a->ms < b->ms ? -1 : 1;
+    if (a->seq != b->seq)
+	return a->seq < b->seq ? -1 : 1;
+    return 0;
+}
+
+static int
+seriesStreamIDParse(redisReply *sample, seriesStreamID *id)
+{
+    redisReply		*reply;
+    char		*endnum;
+
+    if (sample->type != REDIS_REPLY_ARRAY || sample->elements < 2)
+	return -EPROTO;
+    reply = sample->element[0];
+    if (reply->type != REDIS_REPLY_STRING)
+	return -EPROTO;
+    id->ms = strtoull(reply->str, &endnum, 10);
+    if (*endnum != '-')
+	return -EPROTO;
+    id->seq = strtoull(endnum + 1, &endnum, 10);
+    if (*endnum != '\0')
+	return -EPROTO;
+    return 0;
+}
+
+static seriesStreamID *
+seriesCacheSampleID(redisReply *sample)
+{
+    /* a parsed copy of the ID follows each cached sample array */
+    return (seriesStreamID *)(sample->element + sample->elements);
+}
+
+seriesStreamID *
+seriesCacheLast(seriesCacheEntry *entry)
+{
+    if (entry->nsamples == 0)
+	return NULL;
+    return seriesCacheSampleID(entry->samples[entry->nsamples - 1]);
+}
+
+static redisReply *
+seriesCacheCopy(redisReply *reply, size_t extra, size_t *bytes)
+{
+    redisReply		*copy;
+    size_t		i;
+
+    if ((copy = calloc(1, sizeof(redisReply))) == NULL)
+	return NULL;
+    *bytes += sizeof(redisReply);
+    copy->type = reply->type;
+    copy->integer = reply->integer;
+    copy->dval = reply->dval;
+
+    switch (reply->type) {
+    case REDIS_REPLY_ARRAY:
+    case REDIS_REPLY_MAP:
+    case REDIS_REPLY_SET:
+	/* allocated as one block with 'extra' trailing bytes available */
+	if ((copy->element = calloc(1, reply->elements * sizeof(redisReply *) +
+					extra)) == NULL)
+	    break;
+	*bytes += reply->elements * sizeof(redisReply *) + extra;
+	for (i = 0; i < reply->elements; i++) {
+	    if ((copy->element[i] = seriesCacheCopy(reply->element[i],
+						0, bytes)) == NULL)
+		break;
+	    copy->elements++;
+	}
+	if (copy->elements == reply->elements)
+	    return copy;
+	break;
+
+    case REDIS_REPLY_ERROR:
+    case REDIS_REPLY_STATUS:
+    case REDIS_REPLY_STRING:
+    case REDIS_REPLY_DOUBLE:
+	if (reply->str == NULL)
+	    return copy;
+	if ((copy->str = malloc(reply->len + 1)) == NULL)
+	    break;
+	memcpy(copy->str, reply->str, reply->len + 1);
+	copy->len = reply->len;
+	*bytes += reply->len + 1;
+	return copy;
+
+    default:
+	return copy;
+    }
+    freeReplyObject(copy);
+    return NULL;
+}
+
+/*
+ * Add copies of the samples in a Redis X[REV]RANGE reply (in reverse
+ * time order if 'reverse') that are newer than those already cached.
+ */
+int
+seriesCacheAppend(seriesCacheEntry *entry, size_t nsamples,
+		redisReply **samples, int reverse)
+{
+    seriesStreamID	id, *last;
+    redisReply		**array, *sample;
+    size_t		i, bytes = 0;
+    unsigned int	count;
+
+    if ((count = entry->nsamples + nsamples) > entry->maxsamples) {
+	if ((array = realloc(entry->samples, count * sizeof(redisReply *))) == NULL)
+	    return -ENOMEM;
+	entry->samples = array;
+	entry->maxsamples = count;
+    }
+    for (i = 0; i < nsamples; i++) {
+	sample = samples[reverse ? nsamples - i - 1 : i];
+	if (seriesStreamIDParse(sample, &id) < 0)
+	    return -EPROTO;
+	if ((last = seriesCacheLast(entry)) != NULL &&
+	    seriesStreamIDCompare(&id, last) <= 0)
+	    continue;	/* already cached, by a concurrent query */
+	if ((sample = seriesCacheCopy(sample, sizeof(id), &bytes)) == NULL)
+	    return -ENOMEM;
+	*seriesCacheSampleID(sample) = id;
+	entry->samples[entry->nsamples++] = sample;
+    }
+    entry->bytes += bytes;
+    if (!entry->evicted) {
+	cachebytes += bytes;
+	seriesCacheUsage();
+    }
+    return 0;
+}
+
+static size_t
+seriesCacheBytes(redisReply *reply, size_t extra)
+{
+    size_t		i, bytes = sizeof(redisReply);
+
+    switch (reply->type) {
+    case REDIS_REPLY_ARRAY:
+    case REDIS_REPLY_MAP:
+    case REDIS_REPLY_SET:
+	bytes += reply->elements * sizeof(redisReply *) + extra;
+	for (i = 0; i < reply->elements; i++)
+	    bytes += seriesCacheBytes(reply->element[i], 0);
+	break;
+    case REDIS_REPLY_ERROR:
+    case REDIS_REPLY_STATUS:
+    case REDIS_REPLY_STRING:
+    case REDIS_REPLY_DOUBLE:
+	if (reply->str)
+	    bytes += reply->len + 1;
+	break;
+    default:
+	break;
+    }
+    return bytes;
+}
+
+/* free the oldest 'count' samples */
+static void
+seriesCacheDiscard(seriesCacheEntry *entry, unsigned int count)
+{
+    size_t		bytes = 0;
+    unsigned int	i;
+
+    if (count == 0)
+	return;
+    for (i = 0; i < count; i++) {
+	bytes += seriesCacheBytes(entry->samples[i], sizeof(seriesStreamID));
+	freeReplyObject(entry->samples[i]);
+    }
+    entry->nsamples -= count;
+    memmove(entry->samples, entry->samples + count,
+		entry->nsamples * sizeof(redisReply *));
+    entry->bytes -= bytes;
+    if (!entry->evicted) {
+	cachebytes -= bytes;
+	seriesCacheUsage();
+    }
+}
+
+/* a (relative) time window has moved on - forget the older samples */
+void
+seriesCacheTrim(seriesCacheEntry *entry, seriesStreamID *start)
+{
+    unsigned int	count = 0;
+
+    while (count < entry->nsamples &&
+	   seriesStreamIDCompare(seriesCacheSampleID(entry->samples[count]),
+				start) < 0)
+	count++;
+    seriesCacheDiscard(entry, count);
+    entry->start = *start;
+}
+
+/* keep only the most recent 'count' samples */
+void
+seriesCacheTrimCount(seriesCacheEntry *entry, unsigned int count)
+{
+    if (entry->nsamples > count)
+	seriesCacheDiscard(entry, entry->nsamples - count);
+}
+
+/* number of (oldest) cached samples up to the end of a time window */
+unsigned int
+seriesCacheRange(seriesCacheEntry *entry, seriesStreamID *end)
+{
+    unsigned int	count = entry->nsamples;
+
+    while (count > 0 &&
+	   seriesStreamIDCompare(seriesCacheSampleID(entry->samples[count-1]),
+				end) > 0)
+	count--;
+    return count;
+}
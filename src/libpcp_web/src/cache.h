@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2021 Red Hat.
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ */
+#ifndef SERIES_CACHE_H
+#define SERIES_CACHE_H
+
+#include <mmv_stats.h>
+#include "sds.h"
+#include "dict.h"
+#include "redis.h"
+
+/*
+ * Query cache - the samples of a time series returned by Redis for
+ * a query time window, kept (up to a memory limit) so that the same
+ * query repeated later need only fetch samples newer than these.
+ */
+/*
+ * Samples may still arrive for a short time after their timestamp -
+ * a time window ending more than this long ago is considered settled
+ * and once cached, is answered without any further Redis requests.
+ */
+#define CACHE_SETTLE_SECS	60
+
+/*
+ * Samples may also be loaded into a settled window later on, from
+ * archives by another process (pmseries --load), or the stream may
+ * expire - entries are dropped after this long (query.cache.ttl),
+ * and fetched again in full.  Loads in this process (/series/load)
+ * unsettle all entries as soon as they complete.
+ */
+#define CACHE_TTL_SECS		600
+
+typedef struct seriesStreamID {
+    __uint64_t		ms;		/* milliseconds since the epoch */
+    __uint64_t		seq;		/* sub-millisecond sequence */
+} seriesStreamID;
+
+typedef struct seriesCacheEntry {
+    sds			key;		/* series and time window spec */
+    struct seriesCacheEntry *prev;	/* most recently used */
+    struct seriesCacheEntry *next;	/* least recently used */
+    unsigned int	refcount;	/* queries using these samples */
+    unsigned int	evicted : 1;	/* freed after last query done */
+    unsigned int	nsamples;
+    unsigned int	maxsamples;
+    redisReply		**samples;	/* [ID, [instance, value ...]] */
+    seriesStreamID	start;		/* time window samples begin at */
+    seriesStreamID	settled;	/* no more samples due up to here */
+    unsigned int	loads;		/* loads completed when settled */
+    time_t		created;	/* when first fetched from Redis */
+    size_t		bytes;		/* memory used by the samples */
+} seriesCacheEntry;
+
+enum {
+    CACHE_HITS,		/* queries answered without any Redis request */
+    CACHE_EXTENDS,	/* queries fetching only the newest samples */
+    CACHE_MISSES,	/* queries fetching all samples in the window */
+    CACHE_EVICTIONS,	/* entries removed to keep within memory limit */
+    CACHE_ENTRIES,	/* entries currently cached */
+    CACHE_BYTES,	/* memory currently used by cached samples */
+    NUM_CACHE_METRICS
+};
+
+extern void seriesCacheInit(struct dict *);
+extern void seriesCacheMetrics(mmv_registry_t *);
+extern void seriesCacheClose(void);
+extern int seriesCacheEnabled(void);
+extern void seriesCacheCount(int);
+extern void seriesCacheLoaded(void);
+
+extern seriesCacheEntry *seriesCacheLookup(sds);
+extern seriesCacheEntry *seriesCacheCreate(sds);
+extern void seriesCacheRelease(seriesCacheEntry *);
+extern void seriesCacheDrop(seriesCacheEntry *);
+
+extern int seriesCacheAppend(seriesCacheEntry *, size_t, redisReply **, int);
+extern void seriesCacheTrim(seriesCacheEntry *, seriesStreamID *);
+extern void seriesCacheTrimCount(seriesCacheEntry *, unsigned int);
+extern unsigned int seriesCacheRange(seriesCacheEntry *, seriesStreamID *);
+
+extern void seriesStreamIDTime(struct timeval *, seriesStreamID *);
+extern int seriesStreamIDCompare(seriesStreamID *, seriesStreamID *);
+extern seriesStreamID *seriesCacheLast(seriesCacheEntry *);
+
+#endif	/* SERIES_CACHE_H */
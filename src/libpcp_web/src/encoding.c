@@ -105,3 +105,257 @@ unicode_encode(const char *p, size_t length)
     }
     return sdscatlen(s, "\"", 1);
 }
+
+/*
+ * Packed sample values - one header (format, type, flags) then for
+ * each instance an optional 20 byte identifier and the value itself.
+ * Integers are stored as zig-zag varints of the difference from the
+ * previous instance value, doubles (and floats, widened) as the bytes
+ * of the XOR with the previous value that are not zero on either end
+ * after a control byte giving the leading and trailing zero byte counts,
+ * and strings as a varint length followed by the string contents.
+ */
+int
+packed_values_type(int type)
+{
+    switch (type) {
+    case PM_TYPE_32:
+    case PM_TYPE_U32:
+    case PM_TYPE_64:
+    case PM_TYPE_U64:
+    case PM_TYPE_FLOAT:
+    case PM_TYPE_DOUBLE:
+    case PM_TYPE_STRING:
+    case PM_TYPE_AGGREGATE:
+    case PM_TYPE_AGGREGATE_STATIC:
+	return 1;
+    default:
+	break;
+    }
+    return 0;
+}
+
+static sds
+packed_varint(sds s, __uint64_t value)
+{
+    unsigned char	buf[10];
+    int			n = 0;
+
+    while (value >= 0x80) {
+	buf[n++] = (unsigned char)(value | 0x80);
+	value >>= 7;
+    }
+    buf[n++] = (unsigned char)value;
+    return sdscatlen(s, buf, n);
+}
+
+static int
+unpacked_varint(packed_cursor_t *cursor, __uint64_t *value)
+{
+    __uint64_t		result = 0;
+    unsigned int	shift;
+
+    for (shift = 0; shift < 64; shift += 7) {
+	if (cursor->next >= cursor->end)
+	    return -1;
+	result |= (__uint64_t)(*cursor->next & 0x7f) << shift;
+	if ((*cursor->next++ & 0x80) == 0) {
+	    *value = result;
+	    return 0;
+	}
+    }
+    return -1;
+}
+
+static __uint64_t
+double_bits(double value)
+{
+    __uint64_t		bits;
+
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+void
+packed_values_init(packed_values_t *packed, int type, int instances)
+{
+    unsigned char	header[3];
+
+    header[0] = PACKED_FORMAT;
+    header[1] = (unsigned char)type;
+    header[2] = instances ? PACKED_INSTS : 0;
+    packed->buffer = sdsnewlen(header, sizeof(header));
+    packed->type = type;
+    packed->previous = 0;
+}
+
+void
+packed_values_append(packed_values_t *packed, const unsigned char *inst,
+		pmAtomValue *avp)
+{
+    unsigned char	buf[8];
+    __uint64_t		value, delta;
+    int			lead, trail, n;
+    sds			s = packed->buffer;
+
+    if (inst)
+	s = sdscatlen(s, inst, PACKED_INSTLEN);
+
+    switch (packed->type) {
+    case PM_TYPE_32:
+	value = (__uint64_t)(__int64_t)avp->l;
+	goto integer;
+    case PM_TYPE_U32:
+	value = avp->ul;
+	goto integer;
+    case PM_TYPE_64:
+	value = (__uint64_t)avp->ll;
+	goto integer;
+    case PM_TYPE_U64:
+	value = avp->ull;
+    integer:
+	delta = value - packed->previous;
+	packed->previous = value;
+	/* zig-zag encode so small negative differences stay small */
+	s = packed_varint(s, (delta << 1) ^ (__uint64_t)((__int64_t)delta >> 63));
+	break;
+
+    case PM_TYPE_FLOAT:
+	value = double_bits((double)avp->f);
+	goto floating;
+    case PM_TYPE_DOUBLE:
+	value = double_bits(avp->d);
+    floating:
+	delta = value ^ packed->previous;
+	packed->previous = value;
+	if (delta == 0) {
+	    buf[0] = 8 << 4;
+	    s = sdscatlen(s, buf, 1);
+	    break;
+	}
+	for (lead = 0; (delta >> (56 - lead * 8)) == 0; lead++)
+	    ;
+	for (trail = 0; ((delta >> (trail * 8)) & 0xff) == 0; trail++)
+	    ;
+	buf[0] = (lead << 4) | trail;
+	s = sdscatlen(s, buf, 1);
+	for (n = 0; n < 8 - lead - trail; n++)
+	    buf[n] = (unsigned char)(delta >> ((7 - lead - n) * 8));
+	s = sdscatlen(s, buf, n);
+	break;
+
+    default:	/* string or aggregate */
+	n = avp->cp ? sdslen(avp->cp) : 0;
+	s = packed_varint(s, n);
+	if (n)
+	    s = sdscatlen(s, avp->cp, n);
+	break;
+    }
+    packed->buffer = s;
+}
+
+int
+packed_values_cursor(packed_cursor_t *cursor, const char *buffer, size_t length)
+{
+    const unsigned char	*p = (const unsigned char *)buffer;
+
+    if (length < 3 || p[0] != PACKED_FORMAT || !packed_values_type(p[1]))
+	return -1;
+    cursor->type = p[1];
+    cursor->flags = p[2];
+    cursor->next = p + 3;
+    cursor->end = p + length;
+    cursor->previous = 0;
+    return 0;
+}
+
+/*
+ * Extract the next instance identifier and value (formatted the same
+ * way as for unpacked streams); returns 1 for each value, 0 at the end
+ * or -1 if the packed buffer is malformed.
+ */
+int
+packed_values_next(packed_cursor_t *cursor, sds *inst, sds *data)
+{
+    __uint64_t		value, delta;
+    double		d;
+    int			lead, trail, n;
+
+    if (cursor->next >= cursor->end)
+	return 0;
+
+    if (cursor->flags & PACKED_INSTS) {
+	if (cursor->end - cursor->next < PACKED_INSTLEN)
+	    return -1;
+	*inst = sdscpylen(*inst, (const char *)cursor->next, PACKED_INSTLEN);
+	cursor->next += PACKED_INSTLEN;
+    } else {
+	sdsclear(*inst);
+    }
+
+    sdsclear(*data);
+    switch (cursor->type) {
+    case PM_TYPE_32:
+    case PM_TYPE_U32:
+    case PM_TYPE_64:
+    case PM_TYPE_U64:
+	if (unpacked_varint(cursor, &delta) < 0)
+	    return -1;
+	delta = (delta >> 1) ^ (~(delta & 1) + 1);
+	value = cursor->previous + delta;
+	cursor->previous = value;
+	if (cursor->type == PM_TYPE_32)
+	    *data = sdscatfmt(*data, "%i", (int)(__int32_t)value);
+	else if (cursor->type == PM_TYPE_U32)
+	    *data = sdscatfmt(*data, "%u", (unsigned int)value);
+	else if (cursor->type == PM_TYPE_64)
+	    *data = sdscatfmt(*data, "%I", (__int64_t)value);
+	else
+	    *data = sdscatfmt(*data, "%U", value);
+	break;
+
+    case PM_TYPE_FLOAT:
+    case PM_TYPE_DOUBLE:
+	if (cursor->next >= cursor->end)
+	    return -1;
+	lead = *cursor->next >> 4;
+	trail = *cursor->next++ & 0xf;
+	if (lead + trail > 8 || cursor->end - cursor->next < 8 - lead - trail)
+	    return -1;
+	for (delta = 0, n = 0; n < 8 - lead - trail; n++)
+	    delta |= (__uint64_t)*cursor->next++ << ((7 - lead - n) * 8);
+	value = cursor->previous ^ delta;
+	cursor->previous = value;
+	memcpy(&d, &value, sizeof(d));
+	*data = sdscatprintf(*data, "%e", d);
+	break;
+
+    default:	/* string or aggregate */
+	if (unpacked_varint(cursor, &value) < 0 ||
+	    value > (__uint64_t)(cursor->end - cursor->next))
+	    return -1;
+	*data = sdscpylen(*data, (const char *)cursor->next, value);
+	cursor->next += value;
+	break;
+    }
+    return 1;
+}
+
+/* number of values in a packed buffer, or -1 if it is malformed */
+int
+packed_values_count(const char *buffer, size_t length)
+{
+    packed_cursor_t	cursor;
+    sds			inst, data;
+    int			sts, count = 0;
+
+    if (packed_values_cursor(&cursor, buffer, length) < 0)
+	return -1;
+    inst = sdsempty();
+    data = sdsempty();
+    while ((sts = packed_values_next(&cursor, &inst, &data)) > 0)
+	count++;
+    sdsfree(inst);
+    sdsfree(data);
+    return sts < 0 ? -1 : count;
+}
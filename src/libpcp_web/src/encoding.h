@@ -14,6 +14,7 @@
 #ifndef ENCODING_H
 #define ENCODING_H
 
+#include "pmapi.h"
 #include "sds.h"
 
 extern sds base64_decode(const char *, size_t);
@@ -21,4 +22,36 @@ extern sds base64_encode(const char *, size_t);
 
 extern sds unicode_encode(const char *, size_t);
 
+/*
+ * Compact binary encoding of the instance values of one metric sample,
+ * stored as a single field of a series stream entry (schema v3).
+ */
+#define PACKED_FIELD		"~"
+#define PACKED_FIELD_LEN	(sizeof(PACKED_FIELD)-1)
+#define PACKED_FORMAT		1
+#define PACKED_INSTS		(1<<0)	/* SHA1 instance identifiers */
+#define PACKED_INSTLEN		20
+
+typedef struct packed_values {
+    sds			buffer;
+    int			type;		/* PMAPI type of all values */
+    __uint64_t		previous;	/* last value (or double) bits */
+} packed_values_t;
+
+typedef struct packed_cursor {
+    const unsigned char	*next;
+    const unsigned char	*end;
+    int			type;
+    int			flags;
+    __uint64_t		previous;
+} packed_cursor_t;
+
+extern int packed_values_type(int);
+extern void packed_values_init(packed_values_t *, int, int);
+extern void packed_values_append(packed_values_t *, const unsigned char *,
+		pmAtomValue *);
+extern int packed_values_cursor(packed_cursor_t *, const char *, size_t);
+extern int packed_values_next(packed_cursor_t *, sds *, sds *);
+extern int packed_values_count(const char *, size_t);
+
 #endif /* ENCODING_H */
@@ -15,9 +15,12 @@
 #include <limits.h>
 #include <assert.h>
 #include <ctype.h>
+#include <pthread.h>
+#include <dirent.h>
 #include "encoding.h"
 #include "discover.h"
 #include "schema.h"
+#include "cache.h"
 #include "util.h"
 
 void initSeriesLoadBaton(seriesLoadBaton *, void *, pmSeriesFlags, 
@@ -28,6 +31,11 @@ void initSeriesGetContext(seriesGetContext *, void *);
 void freeSeriesGetContext(seriesGetContext *, int);
 
 static void server_cache_window(void *);
+static void series_load_end_phase(void *);
+static int series_load_worker_metric(struct seriesLoadWorker *, pmID);
+static redisSlots *series_load_worker_slots(struct seriesLoadWorker *);
+static void series_load_worker_done(struct seriesLoadWorker *,
+		unsigned long long, unsigned int, int);
 
 /* cache information about this metric source (host/archive) */
 static void
@@ -44,6 +52,19 @@ server_cache_metric(seriesLoadBaton *baton,
     redis_series_metric(baton->slots, metric, timestamp, meta, data, baton);
 }
 
+/* start and finish a batch of values sampled at the same time */
+static void
+server_cache_batch(seriesLoadBaton *baton, sds timestamp)
+{
+    redis_series_batch(baton->slots, timestamp, baton);
+}
+
+static void
+server_cache_batched(seriesLoadBaton *baton)
+{
+    redis_series_batched(baton->slots, baton);
+}
+
 /* cache a mark record (discontinuity) for metrics from this source */
 static void
 server_cache_mark(seriesLoadBaton *baton, sds timestamp, int data)
@@ -453,6 +474,8 @@ series_cache_update(seriesLoadBaton *baton, struct dict *exclude)
     }
 
     pmSortInstances(result);
+    if (write_data)
+	server_cache_batch(baton, timestamp);
 
     for (i = 0; i < result->numpmid; i++) {
 	vsp = result->vset[i];
@@ -468,6 +491,11 @@ series_cache_update(seriesLoadBaton *baton, struct dict *exclude)
 	if (exclude && (dictFind(exclude, &vsp->pmid)) != NULL)
 	    continue;
 
+	/* check if metric is loaded by this worker (parallel loading) */
+	if (baton->worker &&
+	    !series_load_worker_metric(baton->worker, vsp->pmid))
+	    continue;
+
 	write_meta = write_inst = 0;
 
 	/* check if pmid already in hash list */
@@ -497,6 +525,8 @@ series_cache_update(seriesLoadBaton *baton, struct dict *exclude)
 	/* initiate writes to backend caching servers (Redis) */
 	server_cache_metric(baton, metric, timestamp, write_meta, write_data);
     }
+    if (write_data)
+	server_cache_batched(baton);
 
 out:
     sdsfree(timestamp);
@@ -814,9 +844,12 @@ doneSeriesGetContext(seriesGetContext *context, const char *caller)
 	sds		msg;
 
 	if (context->error == PM_ERR_EOL) {
-	    infofmt(msg, "processed %llu archive records from %s",
+	    /* parallel load workers report their progress when done */
+	    if (baton->worker == NULL) {
+		infofmt(msg, "processed %llu archive records from %s",
 			context->count, context->context.name.sds);
-	    batoninfo(baton, PMLOG_INFO, msg);
+		batoninfo(baton, PMLOG_INFO, msg);
+	    }
 	    context->error = 0;
 	} else {
 	    infofmt(msg, "fetch failed: %s",
@@ -905,6 +938,10 @@ connect_redis_source_service(seriesLoadBaton *baton)
     /* attempt to re-use existing slots connections */
     if (data == NULL) {
 	baton->error = -ENOMEM;
+    } else if (baton->worker) {
+	/* each worker of a parallel load has its own connections */
+	baton->slots = series_load_worker_slots(baton->worker);
+	series_load_end_phase(baton);
     } else if (data->slots) {
 	baton->slots = data->slots;
 	series_load_end_phase(baton);
@@ -952,10 +989,20 @@ initSeriesLoadBaton(seriesLoadBaton *baton, void *module, pmSeriesFlags flags,
 void
 freeSeriesLoadBaton(seriesLoadBaton *baton)
 {
+    struct seriesLoadWorker *worker = baton->worker;
+    unsigned long long	count = baton->pmapi.count;
+    unsigned int	metrics = 0;
+    int			error = baton->error;
+
     seriesBatonCheckMagic(baton, MAGIC_LOAD, "freeSeriesLoadBaton");
 
-    if (baton->done)
+    /* workers of a parallel load complete together, after the last */
+    if (baton->done && worker == NULL)
 	baton->done(baton->error, baton->userdata);
+    if (worker && baton->pmapi.context.pmids)
+	metrics = dictSize(baton->pmapi.context.pmids);
+    if (count && !(baton->flags & PM_SERIES_FLAG_METADATA))
+	seriesCacheLoaded();
 
     freeSeriesGetContext(&baton->pmapi, 0);
     dictRelease(baton->errors);
@@ -964,6 +1011,9 @@ freeSeriesLoadBaton(seriesLoadBaton *baton)
 
     memset(baton, 0, sizeof(*baton));
     free(baton);
+
+    if (worker)
+	series_load_worker_done(worker, count, metrics, error);
 }
 
 void
@@ -978,27 +1028,35 @@ seriesLoadBatonContext(seriesLoadBaton *baton)
     return &baton->pmapi.context;
 }
 
-int
-series_load(pmSeriesSettings *settings,
+static seriesLoadBaton *
+series_load_baton(pmSeriesSettings *settings,
 	node_t *root, timing_t *timing, pmSeriesFlags flags, void *arg)
 {
     seriesLoadBaton	*baton;
     seriesModuleData	*data = getSeriesModuleData(&settings->module);
-    sds			msg;
-    int			i;
 
     if (data == NULL)
-	return -ENOMEM;
+	return NULL;
     if ((baton = (seriesLoadBaton *)calloc(1, sizeof(seriesLoadBaton))) == NULL)
-	return -ENOMEM;
+	return NULL;
     initSeriesLoadBaton(baton, &settings->module, flags | PM_SERIES_FLAG_TEXT,
 			settings->module.on_info, settings->callbacks.on_done,
 			data->slots, arg);
     initSeriesGetContext(&baton->pmapi, baton);
+    baton->pmapi.context.context = -1;
     baton->timing = *timing;
 
     /* initial setup (non-blocking) */
     load_prepare_source(baton, root, 0);
+    return baton;
+}
+
+static int
+series_load_start(seriesLoadBaton *baton)
+{
+    sds			msg;
+    int			i;
+
     if (baton->pmapi.context.type) {
 	set_source_origin(&baton->pmapi.context);
     } else {
@@ -1024,6 +1082,535 @@ series_load(pmSeriesSettings *settings,
     return 0;
 }
 
+/*
+ * Parallel loading - a load from archives is shared out between a pool
+ * of worker threads, each running the usual load path with its own
+ * PMAPI context, event loop and Redis connections.  Every stream must
+ * have exactly one writer, appending in time order, so:
+ *
+ * - a directory holding archives of several hosts is shared out by
+ *   archive, one context per archive.  The archives of one host feed
+ *   the same streams, so a worker takes all of them, oldest first.
+ *   Only those of different hosts are loaded concurrently - the time
+ *   windows of one host are never split between workers.
+ *
+ * - otherwise (one archive, or archives of a single host) the metrics
+ *   are shared out by PMID.  Every worker still reads every archive
+ *   record, so this spreads the decoding and writing of values but
+ *   does not reduce the read cost.
+ *
+ * The main event loop is notified as workers finish and completes the
+ * load after the last one.
+ */
+#define LOAD_WORKERS	64	/* upper limit on worker threads */
+
+#ifdef HAVE_LIBUV
+
+typedef struct seriesLoadArchive {
+    sds			path;		/* archive name, without suffix */
+    sds			host;		/* from the archive label */
+    struct timeval	start;
+} seriesLoadArchive;
+
+typedef struct seriesLoadWorker {
+    struct seriesLoadWorkers *workers;
+    unsigned int	id;		/* worker number, from zero */
+    unsigned int	archive;	/* archive being loaded, if any */
+    pthread_t		thread;
+    uv_loop_t		events;		/* event loop of this worker */
+    redisSlots		*slots;		/* Redis connections of worker */
+    seriesLoadBaton	*baton;
+    struct timeval	started;
+    unsigned long long	records;	/* archive records processed */
+    unsigned int	metrics;	/* metrics loaded by worker */
+    int			error;
+} seriesLoadWorker;
+
+typedef struct seriesLoadWorkers {
+    pthread_mutex_t	lock;
+    uv_async_t		finished;	/* signals a worker finishing */
+    unsigned int	nworkers;
+    unsigned int	nfinished;
+    int			search;		/* text search in Redis */
+    seriesLoadWorker	*worker;
+    pmSeriesSettings	*settings;
+    node_t		*root;
+    timing_t		timing;
+    pmSeriesFlags	flags;
+    void		*arg;
+    seriesLoadArchive	*archives;	/* sorted by host, then start */
+    unsigned int	narchives;	/* zero when sharing out PMIDs */
+    unsigned int	next;		/* next archive not yet taken */
+    struct timeval	started;
+} seriesLoadWorkers;
+
+static int
+series_load_archive_compare(const void *a, const void *b)
+{
+    seriesLoadArchive	*ap = (seriesLoadArchive *)a;
+    seriesLoadArchive	*bp = (seriesLoadArchive *)b;
+    double		delta;
+    int			sts;
+
+    if ((sts = strcmp(ap->host, bp->host)) != 0)
+	return sts;
+    delta = pmtimevalSub(&ap->start, &bp->start);
+    return delta < 0 ? -1 : (delta > 0 ? 1 : 0);
+}
+
+/*
+ * Find the archives in a directory, in the same way as a multi-archive
+ * context, with the host and start time of each from its label.
+ * Returns the number of distinct hosts, zero if not a directory.
+ */
+static unsigned int
+series_load_archives(seriesLoadWorkers *workers, const char *dir)
+{
+    pmSeriesModule	*module = &workers->settings->module;
+    seriesLoadArchive	*archives = NULL, *ap;
+    struct dirent	*dp;
+    pmLogLabel		label;
+    unsigned int	i, count = 0, hosts = 0;
+    char		errmsg[PM_MAXERRMSGLEN];
+    DIR			*dirp;
+    sds			path, msg;
+    int			sts, ctx, handle;
+
+    if ((dirp = opendir(dir)) == NULL)
+	return 0;
+
+    ctx = pmWhichContext();	/* restored after reading labels */
+    while ((dp = readdir(dirp)) != NULL) {
+	if (__pmLogBaseName(dp->d_name) == NULL ||
+	    strcmp(dp->d_name + strlen(dp->d_name) + 1, "meta") != 0)
+	    continue;
+	path = sdscatfmt(sdsempty(), "%s/%s", dir, dp->d_name);
+	if ((sts = handle = pmNewContext(PM_CONTEXT_ARCHIVE, path)) >= 0) {
+	    sts = pmGetArchiveLabel(&label);
+	    pmDestroyContext(handle);
+	}
+	if (sts < 0) {
+	    infofmt(msg, "skipping archive \"%s\": %s", path,
+			pmErrStr_r(sts, errmsg, sizeof(errmsg)));
+	    moduleinfo(module, PMLOG_WARNING, msg, workers->arg);
+	    sdsfree(path);
+	    continue;
+	}
+	if ((ap = realloc(archives, (count + 1) * sizeof(*ap))) == NULL) {
+	    sdsfree(path);
+	    break;
+	}
+	archives = ap;
+	ap = &archives[count++];
+	ap->path = path;
+	ap->host = sdsnew(label.ll_hostname);
+	ap->start = label.ll_start;
+    }
+    closedir(dirp);
+    if (ctx >= 0)
+	pmUseContext(ctx);
+
+    if (count)
+	qsort(archives, count, sizeof(*archives), series_load_archive_compare);
+    for (i = 0; i < count; i++)
+	if (i == 0 || strcmp(archives[i].host, archives[i-1].host) != 0)
+	    hosts++;
+    workers->archives = archives;
+    workers->narchives = count;
+    return hosts;
+}
+
+static int
+series_load_worker_metric(seriesLoadWorker *worker, pmID pmid)
+{
+    seriesLoadWorkers	*workers = worker->workers;
+
+    if (workers->narchives)	/* sharing out archives, loads all metrics */
+	return 1;
+    return (pmid % workers->nworkers) == worker->id;
+}
+
+static redisSlots *
+series_load_worker_slots(seriesLoadWorker *worker)
+{
+    return worker->slots;
+}
+
+/*
+ * Begin loading the next archive of a worker - the next one from the
+ * same host if any, else the first archive of a host not yet taken by
+ * any worker.  Returns zero when no archives are left.
+ */
+static int
+series_load_worker_next(seriesLoadWorker *worker)
+{
+    seriesLoadWorkers	*workers = worker->workers;
+    seriesLoadArchive	*archives = workers->archives;
+    seriesLoadBaton	*baton;
+    unsigned int	i = worker->archive + 1;
+
+    if (worker->archive >= workers->narchives || i >= workers->narchives ||
+	strcmp(archives[i].host, archives[worker->archive].host) != 0) {
+	pthread_mutex_lock(&workers->lock);
+	i = workers->next;
+	while (workers->next < workers->narchives &&
+	       strcmp(archives[workers->next].host, archives[i].host) == 0)
+	    workers->next++;
+	pthread_mutex_unlock(&workers->lock);
+	if (i >= workers->narchives)
+	    return 0;
+    }
+    worker->archive = i;
+
+    if ((baton = series_load_baton(workers->settings, workers->root,
+			&workers->timing, workers->flags, workers->arg)) == NULL) {
+	worker->error = -ENOMEM;
+	return 0;
+    }
+    baton->worker = worker;
+    baton->pmapi.context.name.sds =
+		sdscpy(baton->pmapi.context.name.sds, archives[i].path);
+    worker->baton = baton;
+    pmtimevalNow(&worker->started);
+    series_load_start(baton);	/* on failure, frees the baton */
+    return 1;
+}
+
+/* Redis connections of a worker are established, begin loading */
+static void
+series_load_worker_start(void *arg)
+{
+    seriesLoadWorker	*worker = (seriesLoadWorker *)arg;
+
+    if (worker->workers->narchives == 0) {
+	pmtimevalNow(&worker->started);
+	series_load_start(worker->baton);	/* on failure, frees baton */
+    } else if (series_load_worker_next(worker) == 0) {
+	uv_stop(&worker->events);
+    }
+}
+
+/*
+ * Loading by a worker has completed - move on to its next archive, if
+ * any, else stop its event loop, where the Redis connections are then
+ * closed, from outside of any callbacks.
+ */
+static void
+series_load_worker_done(seriesLoadWorker *worker, unsigned long long records,
+		unsigned int metrics, int error)
+{
+    seriesLoadWorkers	*workers = worker->workers;
+    pmSeriesModule	*module = &workers->settings->module;
+    struct timeval	now;
+    double		elapsed;
+    sds			msg, source = sdsempty();
+
+    if (workers->narchives)
+	source = sdscatfmt(source, " of %S",
+			workers->archives[worker->archive].path);
+    pmtimevalNow(&now);
+    elapsed = pmtimevalSub(&now, &worker->started);
+    infofmt(msg, "worker %u/%u: loaded %u metrics from %llu archive records%s"
+		" in %.2f sec (%.1f records/sec)", worker->id + 1,
+		workers->nworkers, metrics, records, source, elapsed,
+		elapsed > 0 ? records / elapsed : 0.0);
+    moduleinfo(module, PMLOG_INFO, msg, workers->arg);
+    sdsfree(source);
+
+    worker->records += records;
+    worker->metrics += metrics;
+    if (worker->error == 0)
+	worker->error = error;
+    worker->baton = NULL;
+    if (workers->narchives == 0 || series_load_worker_next(worker) == 0)
+	uv_stop(&worker->events);
+}
+
+static void *
+series_load_worker(void *arg)
+{
+    seriesLoadWorker	*worker = (seriesLoadWorker *)arg;
+    seriesLoadWorkers	*workers = worker->workers;
+
+    /* wait until all workers have been started, sharing out the load */
+    pthread_mutex_lock(&workers->lock);
+    pthread_mutex_unlock(&workers->lock);
+
+    if (worker->slots) {
+	uv_run(&worker->events, UV_RUN_DEFAULT);
+	redisSlotsFree(worker->slots);
+	worker->slots = NULL;
+	/* complete closing of the Redis connections */
+	uv_run(&worker->events, UV_RUN_DEFAULT);
+    } else if (workers->narchives) {
+	/* no Redis connection, archives are left for the other workers */
+	worker->error = -ENOTCONN;
+    }
+    if (worker->baton) {	/* never started, no Redis connection */
+	worker->baton->error = -ENOTCONN;
+	freeSeriesLoadBaton(worker->baton);
+    }
+    uv_loop_close(&worker->events);
+
+    /* main thread frees workers once all are finished, under the lock */
+    pthread_mutex_lock(&workers->lock);
+    workers->nfinished++;
+    uv_async_send(&workers->finished);
+    pthread_mutex_unlock(&workers->lock);
+    return NULL;
+}
+
+static void
+series_load_archives_free(seriesLoadWorkers *workers)
+{
+    unsigned int	i;
+
+    for (i = 0; i < workers->narchives; i++) {
+	sdsfree(workers->archives[i].path);
+	sdsfree(workers->archives[i].host);
+    }
+    free(workers->archives);
+    workers->archives = NULL;
+    workers->narchives = 0;
+}
+
+static void
+series_load_workers_release(seriesLoadWorkers *workers)
+{
+    series_load_archives_free(workers);
+    pthread_mutex_destroy(&workers->lock);
+    free(workers->worker);
+    free(workers);
+}
+
+static void
+series_load_workers_free(uv_handle_t *handle)
+{
+    series_load_workers_release((seriesLoadWorkers *)handle->data);
+}
+
+/*
+ * Main event loop notification of workers finishing - after the last
+ * one, report throughput and complete the load.
+ */
+static void
+series_load_workers_finished(uv_async_t *handle)
+{
+    seriesLoadWorkers	*workers = (seriesLoadWorkers *)handle->data;
+    pmSeriesSettings	*settings = workers->settings;
+    seriesLoadWorker	*worker;
+    struct timeval	now;
+    unsigned long long	records = 0;
+    unsigned int	i, metrics = 0, nfinished;
+    double		elapsed;
+    int			error = 0;
+    sds			msg;
+
+    pthread_mutex_lock(&workers->lock);
+    nfinished = workers->nfinished;
+    pthread_mutex_unlock(&workers->lock);
+    if (nfinished < workers->nworkers)
+	return;
+
+    for (i = 0; i < workers->nworkers; i++) {
+	worker = &workers->worker[i];
+	if (workers->narchives)
+	    records += worker->records;
+	else if (records < worker->records)
+	    records = worker->records;	/* each reads every record */
+	metrics += worker->metrics;
+	if (error == 0)
+	    error = worker->error;
+    }
+    pmtimevalNow(&now);
+    elapsed = pmtimevalSub(&now, &workers->started);
+    if (workers->narchives)
+	infofmt(msg, "loaded %u archives, %u metrics from %llu archive records"
+		" with %u workers in %.2f sec (%.1f records/sec)",
+		workers->narchives, metrics, records, workers->nworkers,
+		elapsed, elapsed > 0 ? records / elapsed : 0.0);
+    else
+	infofmt(msg, "loaded %u metrics from %llu archive records with %u"
+		" workers in %.2f sec (%.1f records/sec)", metrics, records,
+		workers->nworkers, elapsed, elapsed > 0 ? records / elapsed : 0.0);
+    moduleinfo(&settings->module, PMLOG_INFO, msg, workers->arg);
+
+    uv_close((uv_handle_t *)handle, series_load_workers_free);
+    if (settings->callbacks.on_done)
+	settings->callbacks.on_done(error, workers->arg);
+}
+
+/*
+ * Setup for loading in parallel, if more than one worker has been
+ * configured and the load is from archives; returns NULL if the load
+ * should proceed serially instead.
+ */
+static seriesLoadWorkers *
+series_load_workers(pmSeriesSettings *settings, seriesLoadBaton *baton,
+		node_t *root, timing_t *timing, pmSeriesFlags flags, void *arg)
+{
+    seriesModuleData	*data = getSeriesModuleData(&settings->module);
+    seriesLoadWorkers	*workers;
+    seriesLoadWorker	*worker;
+    pthread_attr_t	attr;
+    context_t		*cp = &baton->pmapi.context;
+    unsigned int	i, nworkers, nhosts;
+    sds			option, msg;
+    int			sts;
+
+    if (cp->type != PM_CONTEXT_ARCHIVE || data->events == NULL ||
+	(option = pmIniFileLookup(data->config, "pmseries", "load.workers")) == NULL ||
+	(nworkers = strtoul(option, NULL, 10)) <= 1)
+	return NULL;
+    if (nworkers > LOAD_WORKERS)
+	nworkers = LOAD_WORKERS;
+
+    if ((workers = calloc(1, sizeof(seriesLoadWorkers))) == NULL)
+	return NULL;
+    workers->settings = settings;
+    workers->root = root;
+    workers->timing = *timing;
+    workers->flags = flags;
+    workers->arg = arg;
+    workers->search = data->slots ? data->slots->search : 0;
+    pthread_mutex_init(&workers->lock, NULL);
+
+    /* archives of several hosts are shared out, else the metrics */
+    if ((nhosts = series_load_archives(workers, cp->name.sds)) > 1) {
+	if (nworkers > nhosts)
+	    nworkers = nhosts;
+    } else {
+	series_load_archives_free(workers);
+    }
+
+    if ((workers->worker = calloc(nworkers, sizeof(seriesLoadWorker))) == NULL) {
+	series_load_workers_release(workers);
+	return NULL;
+    }
+
+    for (i = 0; i < nworkers; i++) {
+	worker = &workers->worker[i];
+	worker->workers = workers;
+	worker->id = i;
+	worker->archive = workers->narchives;
+	if (workers->narchives == 0) {
+	    if ((worker->baton = series_load_baton(settings, root, timing,
+					flags, arg)) == NULL)
+		break;
+	    worker->baton->worker = worker;
+	}
+	uv_loop_init(&worker->events);
+    }
+    nworkers = i;
+
+    /* workers wait on the lock until all are connected to Redis */
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_mutex_lock(&workers->lock);
+    for (i = 0; i < nworkers; i++) {
+	worker = &workers->worker[i];
+	if ((sts = pthread_create(&worker->thread, &attr,
+				series_load_worker, worker)) != 0) {
+	    infofmt(msg, "cannot create load worker: %s", strerror(sts));
+	    moduleinfo(&settings->module, PMLOG_WARNING, msg, arg);
+	    break;
+	}
+    }
+    workers->nworkers = i;
+    pthread_attr_destroy(&attr);
+    for (; i < nworkers; i++) {
+	worker = &workers->worker[i];
+	if (worker->baton) {
+	    worker->baton->worker = NULL;
+	    worker->baton->done = NULL;
+	    freeSeriesLoadBaton(worker->baton);
+	}
+	uv_loop_close(&worker->events);
+    }
+
+    if (workers->nworkers == 0) {
+	pthread_mutex_unlock(&workers->lock);
+	series_load_workers_release(workers);
+	return NULL;
+    }
+
+    /*
+     * Connect to Redis from here, on each worker event loop before it
+     * runs - schema version and search setup are already done by the
+     * main connection.  Loading begins once the connections are ready.
+     */
+    for (i = 0; i < workers->nworkers; i++) {
+	worker = &workers->worker[i];
+	worker->slots = redisSlotsConnect(data->config, 0,
+			settings->module.on_info, series_load_worker_start,
+			arg, &worker->events, (void *)worker);
+	if (worker->slots)
+	    worker->slots->search = workers->search;
+    }
+    pmtimevalNow(&workers->started);
+    uv_async_init(data->events, &workers->finished,
+		series_load_workers_finished);
+    workers->finished.data = workers;
+
+    if (workers->narchives)
+	infofmt(msg, "loading %u archives of %u hosts from %s with %u workers",
+		workers->narchives, nhosts, cp->name.sds, workers->nworkers);
+    else
+	infofmt(msg, "loading %s with %u workers",
+		cp->name.sds, workers->nworkers);
+    moduleinfo(&settings->module, PMLOG_INFO, msg, arg);
+    pthread_mutex_unlock(&workers->lock);
+    return workers;
+}
+#else	/* parallel loading needs worker event loops */
+typedef void seriesLoadWorkers;
+
+static int
+series_load_worker_metric(struct seriesLoadWorker *worker, pmID pmid)
+{
+    return 1;
+}
+
+static redisSlots *
+series_load_worker_slots(struct seriesLoadWorker *worker)
+{
+    return NULL;
+}
+
+static void
+series_load_worker_done(struct seriesLoadWorker *worker,
+		unsigned long long records, unsigned int metrics, int error)
+{
+}
+
+static seriesLoadWorkers *
+series_load_workers(pmSeriesSettings *settings, seriesLoadBaton *baton,
+		node_t *root, timing_t *timing, pmSeriesFlags flags, void *arg)
+{
+    return NULL;
+}
+#endif
+
+int
+series_load(pmSeriesSettings *settings,
+	node_t *root, timing_t *timing, pmSeriesFlags flags, void *arg)
+{
+    seriesLoadBaton	*baton;
+    seriesLoadWorkers	*workers;
+
+    if ((baton = series_load_baton(settings, root, timing, flags, arg)) == NULL)
+	return -ENOMEM;
+
+    workers = series_load_workers(settings, baton, root, timing, flags, arg);
+    if (workers != NULL) {
+	/* this baton was only needed to find the source for the workers */
+	baton->done = NULL;
+	freeSeriesLoadBaton(baton);
+	return 0;
+    }
+    return series_load_start(baton);
+}
+
 static void
 series_source_persist(void *arg)
 {
@@ -135,6 +135,7 @@ typedef struct metric {
     unsigned int	updated : 1;	/* last sample returned success */
     unsigned int	cached : 1;	/* metadata written into cache */
     int			error;		/* a PMAPI negative error code */
+    time_t		expire;		/* next stream EXPIRE refresh due */
     union {
 	pmAtomValue	atom;		/* singleton value (PM_IN_NULL) */
 	valuelist_t	*vlist;		/* instance values and metadata */
@@ -22,6 +22,8 @@
 #include "libpcp.h"
 #include "slots.h"
 #include "maps.h"
+#include "cache.h"
+#include "encoding.h"
 #include <math.h>
 #include <fnmatch.h>
 
@@ -424,36 +426,124 @@ extract_sha1(seriesQueryBaton *baton, pmSID series,
 }
 
 /*
- * Report a timeseries result - timestamps and (instance) values
+ * Iterate over the instance:value pairs of one stream entry, expanding
+ * any packed field (schema v3) into the individual values it holds.
  */
+typedef struct seriesEntryValues {
+    int			next;		/* next instance:value pair */
+    int			nelements;
+    redisReply		**elements;
+    int			packed;		/* expanding a packed field */
+    packed_cursor_t	cursor;
+} seriesEntryValues;
+
 static int
-series_instance_reply(seriesQueryBaton *baton, sds series,
-	pmSeriesValue *value, int nelements, redisReply **elements)
+is_packed_field(redisReply *reply)
 {
-    char		hashbuf[42];
-    sds			inst;
-    int			i, sts = 0;
+    return reply->type == REDIS_REPLY_STRING &&
+	   reply->len == PACKED_FIELD_LEN &&
+	   strncmp(reply->str, PACKED_FIELD, PACKED_FIELD_LEN) == 0;
+}
 
-    for (i = 0; i < nelements; i += 2) {
-	inst = value->series;
-	if (extract_string(baton, series, elements[i], &inst, "series") < 0) {
-	    sts = -EPROTO;
-	    continue;
+/* returns 1 for each value, 0 at the end, or a negative error code */
+static int
+series_entry_value(seriesQueryBaton *baton, sds series,
+		seriesEntryValues *entry, sds *inst, sds *data)
+{
+    redisReply		*reply;
+    sds			msg;
+    int			i, sts;
+
+    if (entry->packed) {
+	if ((sts = packed_values_next(&entry->cursor, inst, data)) > 0)
+	    return sts;
+	entry->packed = 0;
+	if (sts < 0) {
+	    infofmt(msg, "malformed packed values in series %s", series);
+	    batoninfo(baton, PMLOG_RESPONSE, msg);
+	    return -EPROTO;
 	}
-	if (sdslen(inst) == 0) {	/* no InDom, use series */
-	    inst = sdscpylen(inst, series, 40);
-	} else if (sdslen(inst) == 20) {
-	    pmwebapi_hash_str((const unsigned char *)inst, hashbuf, sizeof(hashbuf));
-	    inst = sdscpylen(inst, hashbuf, 40);
-	} else {
-	    /* TODO: propagate errors and mark records - separate callbacks? */
-	    continue;
+    }
+
+    if ((i = entry->next) + 1 >= entry->nelements)
+	return 0;
+    entry->next += 2;
+
+    if (is_packed_field(entry->elements[i])) {
+	reply = entry->elements[i+1];
+	if (reply->type != REDIS_REPLY_STRING ||
+	    packed_values_cursor(&entry->cursor, reply->str, reply->len) < 0) {
+	    infofmt(msg, "malformed packed values in series %s", series);
+	    batoninfo(baton, PMLOG_RESPONSE, msg);
+	    return -EPROTO;
 	}
-	value->series = inst;
+	entry->packed = 1;
+	return series_entry_value(baton, series, entry, inst, data);
+    }
+    if (extract_string(baton, series, entry->elements[i], inst, "series") < 0 ||
+	extract_string(baton, series, entry->elements[i+1], data, "value") < 0)
+	return -EPROTO;
+    return 1;
+}
 
-	if (extract_string(baton, series, elements[i+1], &value->data, "value") < 0)
-	    sts = -EPROTO;
-	else
+static void
+series_entry_values(seriesEntryValues *entry, int nelements, redisReply **elements)
+{
+    memset(entry, 0, sizeof(*entry));
+    entry->nelements = nelements;
+    entry->elements = elements;
+}
+
+/* number of values in a stream entry, counting those in packed fields */
+static int
+series_entry_count(int nelements, redisReply **elements)
+{
+    int			i, n, count = 0;
+
+    for (i = 0; i + 1 < nelements; i += 2) {
+	if (!is_packed_field(elements[i]))
+	    count++;
+	else if (elements[i+1]->type == REDIS_REPLY_STRING &&
+	    (n = packed_values_count(elements[i+1]->str, elements[i+1]->len)) > 0)
+	    count += n;
+    }
+    return count;
+}
+
+/* map an instance identifier from a stream into series form */
+static int
+series_entry_instance(sds series, sds *inst)
+{
+    char		hashbuf[42];
+
+    if (sdslen(*inst) == 0) {	/* no InDom, use series */
+	*inst = sdscpylen(*inst, series, 40);
+    } else if (sdslen(*inst) == 20) {
+	pmwebapi_hash_str((const unsigned char *)*inst, hashbuf, sizeof(hashbuf));
+	*inst = sdscpylen(*inst, hashbuf, 40);
+    } else {
+	/* TODO: propagate errors and mark records - separate callbacks? */
+	return 0;
+    }
+    return 1;
+}
+
+/*
+ * Report a timeseries result - timestamps and (instance) values
+ */
+static int
+series_instance_reply(seriesQueryBaton *baton, sds series,
+	pmSeriesValue *value, int nelements, redisReply **elements)
+{
+    seriesEntryValues	entry;
+    int			n, sts = 0;
+
+    series_entry_values(&entry, nelements, elements);
+    while ((n = series_entry_value(baton, series, &entry,
+				&value->series, &value->data)) != 0) {
+	if (n < 0)
+	    sts = n;
+	else if (series_entry_instance(series, &value->series))
 	    baton->callbacks->on_value(series, value, baton->userdata);
     }
     return sts;
@@ -1591,15 +1681,114 @@ series_value_count_only(timing_t *tp)
     return tp->count;
 }
 
+/*
+ * Samples of one series in a query time window are requested through
+ * the query cache, where enabled.  Samples cached for the same series
+ * and time window specification (e.g. a dashboard panel refreshing
+ * "the last hour") are reused - only newer samples are requested from
+ * Redis, if any are needed at all - then the cached samples within the
+ * window are passed to the reply callback as though Redis returned them.
+ */
+typedef struct seriesValuesRequest {
+    seriesQueryBaton	*baton;
+    seriesCacheEntry	*entry;
+    seriesStreamID	start;		/* requested time window */
+    seriesStreamID	end;
+    unsigned int	count;		/* most recent samples only */
+    unsigned int	settled;	/* window ended in the past */
+    redisAsyncCallBack	*callback;	/* the usual reply callback */
+    void		*arg;
+} seriesValuesRequest;
+
+static sds
+series_values_cache_key(sds series, timing_t *tp, unsigned int count)
+{
+    pmSeriesTimeWindow	*window = &tp->window;
+    sds			key = sdsdup(series);
+
+    if (count)
+	return sdscatfmt(key, " count:%u", count);
+    if (window->start)
+	key = sdscatfmt(key, " start:%S", window->start);
+    if (window->end)
+	key = sdscatfmt(key, " end:%S", window->end);
+    if (window->range)
+	key = sdscatfmt(key, " range:%S", window->range);
+    return key;
+}
+
 static void
-series_prepare_time(seriesQueryBaton *baton, series_set_t *result)
+series_values_cached(seriesValuesRequest *request, redisAsyncContext *c)
+{
+    seriesCacheEntry	*entry = request->entry;
+    redisReply		reply = { .type = REDIS_REPLY_ARRAY };
+    redisReply		**samples = NULL;
+    unsigned int	i, count;
+
+    if (request->count) {
+	/* most recent sample first, as for XREVRANGE */
+	seriesCacheTrimCount(entry, request->count);
+	count = entry->nsamples;
+	if (count && (samples = malloc(count * sizeof(redisReply *))) == NULL) {
+	    request->baton->error = -ENOMEM;
+	    count = 0;
+	}
+	for (i = 0; i < count; i++)
+	    samples[i] = entry->samples[count - i - 1];
+	reply.element = samples;
+    } else {
+	seriesCacheTrim(entry, &request->start);
+	count = seriesCacheRange(entry, &request->end);
+	reply.element = entry->samples;
+    }
+    reply.elements = count;
+    request->callback(c, &reply, NULL, request->arg);
+
+    free(samples);
+    seriesCacheRelease(entry);
+    free(request);
+}
+
+static void
+series_values_request_reply(
+	redisAsyncContext *c, redisReply *reply, const sds cmd, void *arg)
 {
-    timing_t		*tp = &baton->u.query.timing;
-    unsigned char	*series = result->series;
-    seriesGetSID	*sid;
+    seriesValuesRequest	*request = (seriesValuesRequest *)arg;
+    seriesQueryBaton	*baton = request->baton;
+    int			sts;
+
+    seriesBatonCheckMagic(baton, MAGIC_QUERY, "series_values_request_reply");
+    sts = redisSlotsRedirect(baton->slots, reply, baton->info, baton->userdata,
+			     cmd, series_values_request_reply, arg);
+    if (sts > 0)
+	return;	/* short-circuit as command was re-submitted */
+
+    if (UNLIKELY(reply == NULL || reply->type != REDIS_REPLY_ARRAY) ||
+	seriesCacheAppend(request->entry, reply->elements, reply->element,
+			request->count != 0) < 0) {
+	/* not cached - usual callback reports any errors (after redirect) */
+	seriesCacheDrop(request->entry);
+	request->callback(c, sts == 0 ? NULL : reply, NULL, request->arg);
+	free(request);
+    } else {
+	if (request->settled &&
+	    seriesStreamIDCompare(&request->end, &request->entry->settled) > 0)
+	    request->entry->settled = request->end;
+	series_values_cached(request, c);
+    }
+}
+
+static void
+series_values_request(seriesQueryBaton *baton, sds series, timing_t *tp,
+		redisAsyncCallBack *callback, void *arg)
+{
+    seriesValuesRequest	*request = NULL;
+    seriesCacheEntry	*entry;
+    seriesStreamID	*last;
+    struct timeval	now;
     char		buffer[64], revbuf[64];
-    sds			start, end, key, cmd;
-    unsigned int	i, revlen = 0, reverse = 0;
+    sds			start, end, name, key, cmd;
+    unsigned int	revlen = 0, reverse = 0;
 
     /* if only 'count' is requested, work back from most recent value */
     if ((reverse = series_value_count_only(tp)) != 0) {
@@ -1609,9 +1798,6 @@ series_prepare_time(seriesQueryBaton *baton, series_set_t *result)
 	start = sdsnew(timeval_stream_str(&tp->start, buffer, sizeof(buffer)));
     }
 
-    if (pmDebugOptions.series)
-	fprintf(stderr, "START: %s\n", start);
-
     if (reverse)
 	end = sdsnew("-");
     else if (tp->end.tv_sec)
@@ -1619,8 +1805,99 @@ series_prepare_time(seriesQueryBaton *baton, series_set_t *result)
     else
 	end = sdsnew("+");	/* "+" means "no end" - to the most recent */
 
+    if (seriesCacheEnabled() &&
+	(request = calloc(1, sizeof(seriesValuesRequest))) != NULL) {
+	request->baton = baton;
+	request->count = reverse;
+	request->callback = callback;
+	request->arg = arg;
+	seriesStreamIDTime(&tp->start, &request->start);
+	if (tp->end.tv_sec) {
+	    seriesStreamIDTime(&tp->end, &request->end);
+	    gettimeofday(&now, NULL);
+	    request->settled = (tp->end.tv_sec + CACHE_SETTLE_SECS < now.tv_sec);
+	} else {
+	    request->end.ms = request->end.seq = UINT64_MAX;
+	}
+
+	name = series_values_cache_key(series, tp, reverse);
+	if ((entry = seriesCacheLookup(name)) != NULL &&
+	    (reverse || seriesStreamIDCompare(&request->start, &entry->start) >= 0)) {
+	    request->entry = entry;
+	    last = seriesCacheLast(entry);
+	    if (!reverse &&
+		(seriesStreamIDCompare(&request->end, &entry->settled) <= 0 ||
+		(last && seriesStreamIDCompare(last, &request->end) >= 0))) {
+		/* no more samples can arrive within this time window */
+		seriesCacheCount(CACHE_HITS);
+		series_values_cached(request, NULL);
+		sdsfree(name);
+		sdsfree(start);
+		sdsfree(end);
+		return;
+	    }
+	    /* request only the samples newer than those cached */
+	    seriesCacheCount(CACHE_EXTENDS);
+	    if (last) {
+		pmsprintf(buffer, sizeof(buffer), "%" FMT_UINT64 "-%" FMT_UINT64,
+			last->ms, last->seq + 1);
+		if (reverse)
+		    end = sdscpy(end, buffer);
+		else
+		    start = sdscpy(start, buffer);
+	    }
+	} else {
+	    if (entry)
+		seriesCacheRelease(entry);
+	    if ((entry = seriesCacheCreate(name)) != NULL) {
+		seriesCacheCount(CACHE_MISSES);
+		entry->start = request->start;
+		request->entry = entry;
+	    } else {
+		free(request);
+		request = NULL;
+	    }
+	}
+	sdsfree(name);
+    }
+
     if (pmDebugOptions.series)
-	fprintf(stderr, "END: %s\n", end);
+	fprintf(stderr, "START: %s\nEND: %s\n", start, end);
+
+    key = sdscatfmt(sdsempty(), "pcp:values:series:%S", series);
+
+    /* X[REV]RANGE key t1 t2 [count N] */
+    if (reverse) {
+	cmd = redis_command(6);
+	cmd = redis_param_str(cmd, XREVRANGE, XREVRANGE_LEN);
+    } else {
+	cmd = redis_command(4);
+	cmd = redis_param_str(cmd, XRANGE, XRANGE_LEN);
+    }
+    cmd = redis_param_sds(cmd, key);
+    cmd = redis_param_sds(cmd, start);
+    cmd = redis_param_sds(cmd, end);
+    if (reverse) {
+	cmd = redis_param_str(cmd, "COUNT", sizeof("COUNT")-1);
+	cmd = redis_param_str(cmd, revbuf, revlen);
+    }
+    if (request)
+	redisSlotsRequest(baton->slots, XRANGE, key, cmd,
+				series_values_request_reply, request);
+    else
+	redisSlotsRequest(baton->slots, XRANGE, key, cmd, callback, arg);
+    sdsfree(start);
+    sdsfree(end);
+}
+
+static void
+series_prepare_time(seriesQueryBaton *baton, series_set_t *result)
+{
+    timing_t		*tp = &baton->u.query.timing;
+    unsigned char	*series = result->series;
+    seriesGetSID	*sid;
+    char		buffer[64];
+    unsigned int	i;
 
     /*
      * Query cache for the time series range (groups of instance:value
@@ -1633,28 +1910,9 @@ series_prepare_time(seriesQueryBaton *baton, series_set_t *result)
 	initSeriesGetSID(sid, buffer, 1, baton);
 	seriesBatonReference(baton, "series_prepare_time");
 
-	key = sdscatfmt(sdsempty(), "pcp:values:series:%S", sid->name);
-
-	/* X[REV]RANGE key t1 t2 [count N] */
-	if (reverse) {
-	    cmd = redis_command(6);
-	    cmd = redis_param_str(cmd, XREVRANGE, XREVRANGE_LEN);
-	} else {
-	    cmd = redis_command(4);
-	    cmd = redis_param_str(cmd, XRANGE, XRANGE_LEN);
-	}
-	cmd = redis_param_sds(cmd, key);
-	cmd = redis_param_sds(cmd, start);
-	cmd = redis_param_sds(cmd, end);
-	if (reverse) {
-	    cmd = redis_param_str(cmd, "COUNT", sizeof("COUNT")-1);
-	    cmd = redis_param_str(cmd, revbuf, revlen);
-	}
-	redisSlotsRequest(baton->slots, XRANGE, key, cmd,
-				series_prepare_time_reply, sid);
+	series_values_request(baton, sid->name, tp,
+			series_prepare_time_reply, sid);
     }
-    sdsfree(start);
-    sdsfree(end);
 }
 
 static void
@@ -1782,34 +2040,19 @@ series_query_expr(void *arg)
 
 static int
 series_instance_store_to_node(seriesQueryBaton *baton, sds series,
-	pmSeriesValue *value, int nelements, redisReply **elements, node_t *np, int idx_sample)
+	pmSeriesValue *value, int nelements, redisReply **elements, node_t *np,
+	int idx_series, int idx_sample)
 {
-    char		hashbuf[42];
-    sds			inst;
-    int			i, sts = 0;
+    seriesEntryValues	entry;
+    int			n, sts = 0;
     int			idx_instance = 0;
-    int			idx_series = np->value_set.num_series;
-
-    for (i = 0; i < nelements; i += 2) {
-	inst = value->series;
-	if (extract_string(baton, series, elements[i], &inst, "series") < 0) {
-	    sts = -EPROTO;
-	    continue;
-	}
-	if (sdslen(inst) == 0) {	/* no InDom, use series */
-	    inst = sdscpylen(inst, series, 40);
-	} else if (sdslen(inst) == 20) {
-	    pmwebapi_hash_str((const unsigned char *)inst, hashbuf, sizeof(hashbuf));
-	    inst = sdscpylen(inst, hashbuf, 40);
-	} else {
-	    /* TODO: propagate errors and mark records - separate callbacks? */
-	    continue;
-	}
-	value->series = inst;
 
-	if (extract_string(baton, series, elements[i+1], &value->data, "value") < 0)
-	    sts = -EPROTO;
-	else {
+    series_entry_values(&entry, nelements, elements);
+    while ((n = series_entry_value(baton, series, &entry,
+				&value->series, &value->data)) != 0) {
+	if (n < 0)
+	    sts = n;
+	else if (series_entry_instance(series, &value->series)) {
 	    /* update value instance */
 	    pmSeriesValue *valinst = &np->value_set.series_values[idx_series].series_sample[idx_sample].series_instance[idx_instance];
 
@@ -1826,13 +2069,12 @@ series_instance_store_to_node(seriesQueryBaton *baton, sds series,
 /* Do something like memcpy */
 static void
 series_values_store_to_node(seriesQueryBaton *baton, sds series,
-		int nsamples, redisReply **samples, node_t *np)
+		int nsamples, redisReply **samples, node_t *np, int idx_series)
 {
     seriesSampling	sampling = {0};
     redisReply		*reply, *sample, **elements;
     timing_t		*tp = &baton->u.query.timing;
-    int			i, sts, next, nelements;
-    int			idx_series = np->value_set.num_series;
+    int			i, sts, next, nelements, ninstances;
     int			idx_sample = 0;
     sds			msg, save_timestamp;
 
@@ -1922,14 +2164,16 @@ series_values_store_to_node(seriesQueryBaton *baton, sds series,
 	    break;
 	
 	idx_sample = i;
-	np->value_set.series_values[idx_series].series_sample[idx_sample].num_instances = reply->elements/2;
+	ninstances = series_entry_count(reply->elements, reply->element);
+	np->value_set.series_values[idx_series].series_sample[idx_sample].num_instances = ninstances;
 	if ((np->value_set.series_values[idx_series].series_sample[idx_sample].series_instance =
-		(pmSeriesValue *)calloc(reply->elements/2, sizeof(pmSeriesValue))) == NULL) {
+		(pmSeriesValue *)calloc(ninstances, sizeof(pmSeriesValue))) == NULL) {
 	    /* TODO: error report here */
 	    baton->error = -ENOMEM;
 	}
 	if ((sts = series_instance_store_to_node(baton, series, &sampling.value,
-				reply->elements, reply->element, np, idx_sample)) < 0) {
+				reply->elements, reply->element, np,
+				idx_series, idx_sample)) < 0) {
 	    baton->error = sts;
 	    goto last_sample;
 	}
@@ -2161,17 +2405,18 @@ static void
 series_node_prepare_time_reply(
 	redisAsyncContext *c, redisReply *reply, const sds cmd, void *arg)
 {
-    node_t			*np = (node_t *)arg;
+    series_sample_set_t		*set = (series_sample_set_t *)arg;
+    node_t			*np = set->node;
     seriesQueryBaton		*baton = (seriesQueryBaton *)np->baton;
+    seriesGetSID		*sid = set->sid;
     sds				msg;
-    int				sts, idx = np->value_set.num_series;
-    seriesGetSID		*sid = np->value_set.series_values[idx].sid;
-
-    /* 
-     * Got an reply contains series values which need to be saved into the corresponding 
-     * node, but when this callback function be called, we need the information of SID of the
-     * series. Here we can not access SID unless store SIDs in node. That's why I add **SID into
-     * struct node_t in query.h
+    int				sts, idx = set - np->value_set.series_values;
+
+    /*
+     * Got a reply containing series values which need to be saved into
+     * the corresponding node - each sample set refers back to its node,
+     * as replies (e.g. from the query cache, or from different Redis
+     * cluster nodes) do not necessarily arrive in request order.
      */
     seriesBatonCheckMagic(sid, MAGIC_SID, "series_node_prepare_time_reply");
     seriesBatonCheckMagic(baton, MAGIC_QUERY, "series_node_prepare_time_reply");
@@ -2201,7 +2446,7 @@ series_node_prepare_time_reply(
 	series_node_get_desc(baton, sid->name, &np->value_set.series_values[idx]);
 	series_node_get_metric_name(baton, sid, &np->value_set.series_values[idx]);
 	
-	series_values_store_to_node(baton, sid->name, reply->elements, reply->element, np);
+	series_values_store_to_node(baton, sid->name, reply->elements, reply->element, np, idx);
 	np->value_set.num_series++;
     }
     series_query_end_phase(baton);
@@ -2213,38 +2458,16 @@ series_node_prepare_time(seriesQueryBaton *baton, series_set_t *query_series_set
     timing_t			*tp = &np->time;
     unsigned char		*series = query_series_set->series;
     seriesGetSID		*sid;
-    char			buffer[64], revbuf[64];
-    sds				start, end, key, cmd;
-    unsigned int		i, revlen = 0, reverse = 0;
+    char			buffer[64];
+    unsigned int		i;
     int				nseries = query_series_set->nseries;
 
-    /* if only 'count' is requested, work back from most recent value */
-    if ((reverse = series_value_count_only(tp)) != 0) {
-	revlen = pmsprintf(revbuf, sizeof(revbuf), "%u", reverse);
-	start = sdsnew("+");
-    } else {
-	start = sdsnew(timeval_stream_str(&tp->start, buffer, sizeof(buffer)));
-    }
-
-    if (pmDebugOptions.series)
-	fprintf(stderr, "START: %s\n", start);
-
-    if (reverse)
-	end = sdsnew("-");
-    else if (tp->end.tv_sec)
-	end = sdsnew(timeval_stream_str(&tp->end, buffer, sizeof(buffer)));
-    else
-	end = sdsnew("+");	/* "+" means "no end" - to the most recent */
-
-    if (pmDebugOptions.series)
-	fprintf(stderr, "END: %s\n", end);
-    
-
     /* calloc nseries samples store space */
     if ((np->value_set.series_values =
     	(series_sample_set_t *)calloc(nseries, sizeof(series_sample_set_t))) == NULL) {
 	/* TODO: error report here */
 	baton->error = -ENOMEM;
+	return;
     }
 
     /*
@@ -2258,32 +2481,14 @@ series_node_prepare_time(seriesQueryBaton *baton, series_set_t *query_series_set
 	initSeriesGetSID(sid, buffer, 1, baton);
 	seriesBatonReference(baton, "series_prepare_time");
 
-	key = sdscatfmt(sdsempty(), "pcp:values:series:%S", sid->name);
-
-	/* X[REV]RANGE key t1 t2 [count N] */
-	if (reverse) {
-	    cmd = redis_command(6);
-	    cmd = redis_param_str(cmd, XREVRANGE, XREVRANGE_LEN);
-	} else {
-	    cmd = redis_command(4);
-	    cmd = redis_param_str(cmd, XRANGE, XRANGE_LEN);
-	}
-	cmd = redis_param_sds(cmd, key);
-	cmd = redis_param_sds(cmd, start);
-	cmd = redis_param_sds(cmd, end);
-	if (reverse) {
-	    cmd = redis_param_str(cmd, "COUNT", sizeof("COUNT")-1);
-	    cmd = redis_param_str(cmd, revbuf, revlen);
-	}
 	np->value_set.series_values[i].baton = baton;
 	np->value_set.series_values[i].sid = sid;
+	np->value_set.series_values[i].node = np;
 	/* Note: np->series_set.num_series is not equal to nseries in this function */
-	redisSlotsRequest(baton->slots, XRANGE, key, cmd,
-				series_node_prepare_time_reply, np);
-	
+	series_values_request(baton, sid->name, tp,
+			series_node_prepare_time_reply,
+			&np->value_set.series_values[i]);
     }
-    sdsfree(start);
-    sdsfree(end);
 }
 
 /* 
@@ -2550,6 +2755,142 @@ series_rate_check(pmSeriesDesc desc)
     return 0;
 }
 
+/*
+ * Columnar form of the values of one series, used by the functions.
+ * Each value string is decoded once into a contiguous array - doubles
+ * for floating point types (or when any numeric value will do), 64-bit
+ * integers otherwise - with the instance values of sample j found at
+ * offsets[j] up to offsets[j+1].  The functions are then simple loops
+ * over plain arrays, which compilers readily vectorize.
+ */
+typedef struct series_column {
+    int			type;		/* PM_TYPE_* of the decoded values */
+    unsigned int	num_samples;
+    unsigned int	count;		/* total values, over all samples */
+    unsigned int	*offsets;	/* num_samples+1 indices into values */
+    double		*d;		/* floating point values, or ... */
+    __int64_t		*ll;		/* ... integer values (u64 as bits) */
+} series_column_t;
+
+static void
+series_column_free(series_column_t *column)
+{
+    free(column->offsets);
+    free(column->d);
+    free(column->ll);
+    memset(column, 0, sizeof(*column));
+}
+
+/*
+ * Decode all values of a series as the given type.  When lenient, any
+ * value that is not numeric becomes zero (strtod(3) semantics, as used
+ * by rate, sum, etc), otherwise PM_ERR_CONV is returned for it.
+ */
+static int
+series_column_decode(series_sample_set_t *set, int type, int lenient,
+		series_column_t *column)
+{
+    series_instance_set_t	*sample;
+    unsigned int		i, j, k, count = 0;
+    const char			*str;
+    char			*end;
+
+    memset(column, 0, sizeof(*column));
+    column->type = type;
+    if (set->num_samples <= 0)
+	return 0;
+    column->num_samples = set->num_samples;
+    if ((column->offsets = malloc((column->num_samples + 1) * sizeof(unsigned int))) == NULL)
+	return -ENOMEM;
+    for (j = 0; j < column->num_samples; j++) {
+	column->offsets[j] = count;
+	count += set->series_sample[j].num_instances;
+    }
+    column->offsets[j] = column->count = count;
+
+    if (type == PM_TYPE_FLOAT || type == PM_TYPE_DOUBLE)
+	column->d = malloc((count ? count : 1) * sizeof(double));
+    else
+	column->ll = malloc((count ? count : 1) * sizeof(__int64_t));
+    if (column->d == NULL && column->ll == NULL) {
+	series_column_free(column);
+	return -ENOMEM;
+    }
+
+    for (i = j = 0; j < column->num_samples; j++) {
+	sample = &set->series_sample[j];
+	for (k = 0; k < sample->num_instances; k++, i++) {
+	    str = sample->series_instance[k].data;
+	    switch (type) {
+	    case PM_TYPE_32:
+		column->ll[i] = (__int32_t)strtol(str, &end, 10);
+		break;
+	    case PM_TYPE_U32:
+		column->ll[i] = (__uint32_t)strtoul(str, &end, 10);
+		break;
+	    case PM_TYPE_64:
+		column->ll[i] = strtoll(str, &end, 10);
+		break;
+	    case PM_TYPE_U64:
+		column->ll[i] = (__int64_t)strtoull(str, &end, 10);
+		break;
+	    case PM_TYPE_FLOAT:
+		column->d[i] = strtof(str, &end);
+		break;
+	    case PM_TYPE_DOUBLE:
+	    default:
+		column->d[i] = strtod(str, &end);
+		break;
+	    }
+	    if (end == str && !lenient) {
+		series_column_free(column);
+		return PM_ERR_CONV;
+	    }
+	}
+    }
+    return 0;
+}
+
+/*
+ * Convert the values of an integer column to double precision.
+ */
+static int
+series_column_double(series_column_t *column)
+{
+    unsigned int	n;
+    double		*d;
+
+    if (column->d)
+	return 0;
+    if ((d = malloc((column->count ? column->count : 1) * sizeof(double))) == NULL)
+	return -ENOMEM;
+    switch (column->type) {
+    case PM_TYPE_U64:
+	for (n = 0; n < column->count; n++)
+	    d[n] = (__uint64_t)column->ll[n];
+	break;
+    default:
+	for (n = 0; n < column->count; n++)
+	    d[n] = column->ll[n];
+	break;
+    }
+    free(column->ll);
+    column->ll = NULL;
+    column->d = d;
+    column->type = PM_TYPE_DOUBLE;
+    return 0;
+}
+
+static void
+series_column_nomem(seriesQueryBaton *baton, sds series)
+{
+    sds			msg;
+
+    infofmt(msg, "out of memory decoding values of series %s\n", series);
+    batoninfo(baton, PMLOG_ERROR, msg);
+    baton->error = -ENOMEM;
+}
+
 /*
  * Compute rate between samples for each metric.
  * The number of samples in result is one less than the original samples. 
@@ -2558,9 +2899,11 @@ static void
 series_calculate_rate(node_t *np)
 {
     seriesQueryBaton	*baton = (seriesQueryBaton *)np->baton;
-    pmSeriesValue	s_pmval, t_pmval;
+    series_sample_set_t	*set;
+    series_instance_set_t *prev, *next;
+    series_column_t	column;
     unsigned int	n_instances, n_samples, i, j, k;
-    double		s_data, t_data, mult;
+    double		*s_data, *t_data, *rate, mult;
     char		str[256];
     sds			msg, expr;
     int			sts;
@@ -2568,191 +2911,176 @@ series_calculate_rate(node_t *np)
 
     np->value_set = np->left->value_set;
     for (i = 0; i < np->value_set.num_series; i++) {
-	n_samples = np->value_set.series_values[i].num_samples;
-	if (series_rate_check(np->value_set.series_values[i].series_desc) == 0) {
+	set = &np->value_set.series_values[i];
+	n_samples = set->num_samples;
+	if (series_rate_check(set->series_desc) == 0) {
 	    if (n_samples > 0) {
-		n_instances = np->value_set.series_values[i].series_sample[0].num_instances;
+		n_instances = set->series_sample[0].num_instances;
+	    }
+	    rate = (double *)calloc(n_samples > 0 ? n_instances + 1 : 1, sizeof(double));
+	    if (series_column_decode(set, PM_TYPE_DOUBLE, 1, &column) < 0 ||
+		rate == NULL) {
+		series_column_free(&column);
+		free(rate);
+		series_column_nomem(baton, set->sid->name);
+		set->num_samples = -n_samples;
+		continue;
 	    }
 	    for (j = 1; j < n_samples; j++) {
-		if (np->value_set.series_values[i].series_sample[j].num_instances != n_instances) {
+		prev = &set->series_sample[j-1];
+		next = &set->series_sample[j];
+		if (next->num_instances != n_instances ||
+		    prev->num_instances < n_instances) {
 		    if (pmDebugOptions.query && pmDebugOptions.desperate)
 			fprintf(stderr, "Error: number of instances in each sample are not equal %d != %d.\n",
-				np->value_set.series_values[i].series_sample[j].num_instances, n_instances);
+				next->num_instances, n_instances);
 		    continue;
 		}
+
+		/* compute rate/sec from delta value and delta timestamp */
+		t_data = &column.d[column.offsets[j-1]];
+		s_data = &column.d[column.offsets[j]];
+		for (k = 0; k < n_instances; k++)
+		    rate[k] = (t_data[k] - s_data[k]) /
+			pmTimespec_delta(&prev->series_instance[k].ts,
+					 &next->series_instance[k].ts);
+
 		for (k = 0; k < n_instances; k++) {
-		    t_pmval = np->value_set.series_values[i].series_sample[j-1].series_instance[k];
-		    s_pmval = np->value_set.series_values[i].series_sample[j].series_instance[k];
-		    if (strcmp(s_pmval.series, t_pmval.series) != 0) {
+		    if (pmDebugOptions.query &&
+			strcmp(next->series_instance[k].series,
+			       prev->series_instance[k].series) != 0) {
 			/* TODO: two SIDs of the instances' names between samples are different, report error. */
-			if (pmDebugOptions.query) {
-			    fprintf(stderr, "TODO: two SIDs of the instances' names between samples are different, report error.");
-			    fprintf(stderr, "%s %s\n", s_pmval.series, t_pmval.series);
-			}
+			fprintf(stderr, "TODO: two SIDs of the instances' names between samples are different, report error.");
+			fprintf(stderr, "%s %s\n", next->series_instance[k].series,
+				prev->series_instance[k].series);
 		    }
-
-		    /* compute rate/sec from delta value and delta timestamp */
-		    s_data = strtod(s_pmval.data, NULL);
-		    t_data = strtod(t_pmval.data, NULL);
-		    pmsprintf(str, sizeof(str), "%.6lf", (t_data - s_data) / pmTimespec_delta(&t_pmval.ts, &s_pmval.ts));
-
-		    sdsfree(np->value_set.series_values[i].series_sample[j-1].series_instance[k].data);
-		    sdsfree(np->value_set.series_values[i].series_sample[j-1].series_instance[k].timestamp);
-		    np->value_set.series_values[i].series_sample[j-1].series_instance[k].data = sdsnew(str);
-		    np->value_set.series_values[i].series_sample[j-1].series_instance[k].timestamp =
-		    	sdsnew(np->value_set.series_values[i].series_sample[j].series_instance[k].timestamp);
-		    np->value_set.series_values[i].series_sample[j-1].series_instance[k].ts =
-		    	np->value_set.series_values[i].series_sample[j].series_instance[k].ts;
+		    pmsprintf(str, sizeof(str), "%.6lf", rate[k]);
+		    prev->series_instance[k].data =
+			sdscpy(prev->series_instance[k].data, str);
+		    prev->series_instance[k].timestamp =
+			sdscpy(prev->series_instance[k].timestamp,
+				next->series_instance[k].timestamp);
+		    prev->series_instance[k].ts = next->series_instance[k].ts;
 		}
 		if (j == n_samples-1) {
 		    /* Free the last sample */
 		    for (k = 0; k < n_instances; k++) {
-			sdsfree(np->value_set.series_values[i].series_sample[j].series_instance[k].timestamp);
-			sdsfree(np->value_set.series_values[i].series_sample[j].series_instance[k].series);
-			sdsfree(np->value_set.series_values[i].series_sample[j].series_instance[k].data);
+			sdsfree(next->series_instance[k].timestamp);
+			sdsfree(next->series_instance[k].series);
+			sdsfree(next->series_instance[k].data);
 		    }
-		    np->value_set.series_values[i].num_samples -= 1;
+		    set->num_samples -= 1;
 		}
 	    }
+	    series_column_free(&column);
+	    free(rate);
 	} else {
 	    expr = series_expr_canonical(np->left, i);
 	    infofmt(msg, "Can't rate convert '%s', counter semantics required\n", expr);
 	    sdsfree(expr);
 	    batoninfo(baton, PMLOG_ERROR, msg);
 	    baton->error = -EPROTO;
-	    np->value_set.series_values[i].num_samples = -n_samples;
+	    set->num_samples = -n_samples;
 	}
-	sdsfree(np->value_set.series_values[i].series_desc.type);
-	sdsfree(np->value_set.series_values[i].series_desc.semantics);
-	if ((sts = pmParseUnitsStr(
-			np->value_set.series_values[i].series_desc.units,
+	sdsfree(set->series_desc.type);
+	sdsfree(set->series_desc.semantics);
+	if ((sts = pmParseUnitsStr(set->series_desc.units,
 			&units, &mult, &msg)) < 0) {
 	    free(msg);
 	}
-	sdsfree(np->value_set.series_values[i].series_desc.units);
+	sdsfree(set->series_desc.units);
 	units.dimTime -= 1;
 	units.scaleTime = PM_TIME_SEC;
-	np->value_set.series_values[i].series_desc.type = sdsnew("double");
-	np->value_set.series_values[i].series_desc.semantics = sdsnew("instant");
-	np->value_set.series_values[i].series_desc.units = sdsnew(pmUnitsStr(&units));
+	set->series_desc.type = sdsnew("double");
+	set->series_desc.semantics = sdsnew("instant");
+	set->series_desc.units = sdsnew(pmUnitsStr(&units));
     }
 }
 
 /*
- * Compare and pick the maximal instance value(s) among samples for each metric.
+ * Compare and pick the maximal (N_MAX) or minimal (N_MIN) instance
+ * value(s) among samples for each metric.
  */
 static void
-series_calculate_max(node_t *np)
+series_calculate_extreme(node_t *np, nodetype_t func)
 {
     seriesQueryBaton	*baton = (seriesQueryBaton *)np->baton;
+    series_sample_set_t	*set;
+    series_column_t	column;
+    pmSeriesValue	*value, *pick;
     unsigned int	n_series, n_samples, n_instances, i, j, k;
-    double		max_data, data;
-    int			max_pointer;
+    unsigned int	*pointer;
+    double		*extreme, *data;
     sds			msg;
 
+    assert(func == N_MAX || func == N_MIN);
+
     n_series = np->left->value_set.num_series;
     np->value_set.num_series = n_series;
     np->value_set.series_values = (series_sample_set_t *)calloc(n_series, sizeof(series_sample_set_t));
     for (i = 0; i < n_series; i++) {
-	n_samples = np->left->value_set.series_values[i].num_samples;
+	set = &np->left->value_set.series_values[i];
+	n_samples = set->num_samples;
 	if (n_samples > 0) {
 	    np->value_set.series_values[i].num_samples = 1;
 	    np->value_set.series_values[i].series_sample = (series_instance_set_t *)calloc(1, sizeof(series_instance_set_t));
-	    n_instances = np->left->value_set.series_values[i].series_sample[0].num_instances;
+	    n_instances = set->series_sample[0].num_instances;
 	    np->value_set.series_values[i].series_sample[0].num_instances = n_instances;
 	    np->value_set.series_values[i].series_sample[0].series_instance = (pmSeriesValue *)calloc(n_instances, sizeof(pmSeriesValue));
-	    for (k = 0; k < n_instances; k++) {
-		max_pointer = 0;
-		max_data = atof(np->left->value_set.series_values[i].series_sample[0].series_instance[k].data);
-		for (j = 1; j < n_samples; j++) {
-		    if (np->left->value_set.series_values[i].series_sample[j].num_instances != n_instances) {
-			if (pmDebugOptions.query && pmDebugOptions.desperate) {
-			    infofmt(msg, "number of instances in each sample are not equal\n");
-			    batoninfo(baton, PMLOG_ERROR, msg);
+	    extreme = (double *)calloc(n_instances + 1, sizeof(double));
+	    pointer = (unsigned int *)calloc(n_instances + 1, sizeof(unsigned int));
+	    memset(&column, 0, sizeof(column));
+	    if (extreme == NULL || pointer == NULL ||
+		series_column_decode(set, PM_TYPE_DOUBLE, 1, &column) < 0) {
+		series_column_nomem(baton, set->sid->name);
+		np->value_set.series_values[i].series_sample[0].num_instances = 0;
+		n_samples = n_instances = 0;
+	    }
+	    if (n_instances > 0)
+		memcpy(extreme, column.d, n_instances * sizeof(double));
+	    for (j = 1; j < n_samples; j++) {
+		if (set->series_sample[j].num_instances != n_instances) {
+		    if (pmDebugOptions.query && pmDebugOptions.desperate) {
+			infofmt(msg, "number of instances in each sample are not equal\n");
+			batoninfo(baton, PMLOG_ERROR, msg);
+		    }
+		    continue;
+		}
+		data = &column.d[column.offsets[j]];
+		if (func == N_MAX) {
+		    for (k = 0; k < n_instances; k++) {
+			if (extreme[k] < data[k]) {
+			    extreme[k] = data[k];
+			    pointer[k] = j;
 			}
-			continue;
 		    }
-		    data = atof(np->left->value_set.series_values[i].series_sample[j].series_instance[k].data);
-		    if (max_data < data) {
-			max_data = data;
-			max_pointer = j;
+		} else {
+		    for (k = 0; k < n_instances; k++) {
+			if (extreme[k] > data[k]) {
+			    extreme[k] = data[k];
+			    pointer[k] = j;
+			}
 		    }
 		}
-		np->value_set.series_values[i].series_sample[0].series_instance[k].timestamp = 
-			sdsnew(np->left->value_set.series_values[i].series_sample[max_pointer].series_instance[k].timestamp);
-		np->value_set.series_values[i].series_sample[0].series_instance[k].series = 
-			sdsnew(np->left->value_set.series_values[i].series_sample[max_pointer].series_instance[k].series);
-		np->value_set.series_values[i].series_sample[0].series_instance[k].data = 
-			sdsnew(np->left->value_set.series_values[i].series_sample[max_pointer].series_instance[k].data);
-		np->value_set.series_values[i].series_sample[0].series_instance[k].ts = 
-			np->left->value_set.series_values[i].series_sample[max_pointer].series_instance[k].ts;
 	    }
+	    for (k = 0; k < n_instances; k++) {
+		value = &np->value_set.series_values[i].series_sample[0].series_instance[k];
+		pick = &set->series_sample[pointer[k]].series_instance[k];
+		value->timestamp = sdsnew(pick->timestamp);
+		value->series = sdsnew(pick->series);
+		value->data = sdsnew(pick->data);
+		value->ts = pick->ts;
+	    }
+	    series_column_free(&column);
+	    free(extreme);
+	    free(pointer);
 	} else {
 	    np->value_set.series_values[i].num_samples = 0;
 	}
 	np->value_set.series_values[i].sid = (seriesGetSID *)calloc(1, sizeof(seriesGetSID));
-	np->value_set.series_values[i].sid->name = sdsnew(np->left->value_set.series_values[i].sid->name);
-	np->value_set.series_values[i].baton = np->left->value_set.series_values[i].baton;
-	np->value_set.series_values[i].series_desc = np->left->value_set.series_values[i].series_desc;
-    }
-}
-
-/*
- * Compare and pick the minimal instance value(s) among samples for each metric.
- */
-static void
-series_calculate_min(node_t *np)
-{
-    seriesQueryBaton	*baton = (seriesQueryBaton *)np->baton;
-    unsigned int	n_series, n_samples, n_instances, i, j, k;
-    double		min_data, data;
-    int			min_pointer;
-    sds			msg;
-
-    n_series = np->left->value_set.num_series;
-    np->value_set.num_series = n_series;
-    np->value_set.series_values = (series_sample_set_t *)calloc(n_series, sizeof(series_sample_set_t));
-    for (i = 0; i < n_series; i++) {
-	n_samples = np->left->value_set.series_values[i].num_samples;
-	if (n_samples > 0) {
-	    np->value_set.series_values[i].num_samples = 1;
-	    np->value_set.series_values[i].series_sample = (series_instance_set_t *)calloc(1, sizeof(series_instance_set_t));
-	    n_instances = np->left->value_set.series_values[i].series_sample[0].num_instances;
-	    np->value_set.series_values[i].series_sample[0].num_instances = n_instances;
-	    np->value_set.series_values[i].series_sample[0].series_instance = (pmSeriesValue *)calloc(n_instances, sizeof(pmSeriesValue));
-	    for (k = 0; k < n_instances; k++) {
-		min_pointer = 0;
-		min_data = atof(np->left->value_set.series_values[i].series_sample[0].series_instance[k].data);
-		for (j = 1; j < n_samples; j++) {
-		    if (np->left->value_set.series_values[i].series_sample[j].num_instances != n_instances) {
-			if (pmDebugOptions.query && pmDebugOptions.desperate) {
-			    infofmt(msg, "number of instances in each sample are not equal\n");
-			    batoninfo(baton, PMLOG_ERROR, msg);
-			}
-			continue;
-		    }
-		    data = atof(np->left->value_set.series_values[i].series_sample[j].series_instance[k].data);
-		    if (min_data > data) {
-			min_data = data;
-			min_pointer = j;
-		    }
-		}
-		np->value_set.series_values[i].series_sample[0].series_instance[k].timestamp = 
-			sdsnew(np->left->value_set.series_values[i].series_sample[min_pointer].series_instance[k].timestamp);
-		np->value_set.series_values[i].series_sample[0].series_instance[k].series = 
-			sdsnew(np->left->value_set.series_values[i].series_sample[min_pointer].series_instance[k].series);
-		np->value_set.series_values[i].series_sample[0].series_instance[k].data = 
-			sdsnew(np->left->value_set.series_values[i].series_sample[min_pointer].series_instance[k].data);
-		np->value_set.series_values[i].series_sample[0].series_instance[k].ts = 
-			np->left->value_set.series_values[i].series_sample[min_pointer].series_instance[k].ts;
-	    }
-	} else {
-	    np->value_set.series_values[i].num_samples = 0;
-	}
-	np->value_set.series_values[i].sid = (seriesGetSID *)calloc(1, sizeof(seriesGetSID));
-	np->value_set.series_values[i].sid->name = sdsnew(np->left->value_set.series_values[i].sid->name);
-	np->value_set.series_values[i].baton = np->left->value_set.series_values[i].baton;
-	np->value_set.series_values[i].series_desc = np->left->value_set.series_values[i].series_desc;
+	np->value_set.series_values[i].sid->name = sdsnew(set->sid->name);
+	np->value_set.series_values[i].baton = set->baton;
+	np->value_set.series_values[i].series_desc = set->series_desc;
     }
 }
 
@@ -2844,6 +3172,69 @@ series_pmAtomValue_conv_str(int type, char *str, pmAtomValue *val, int max_len)
     return 0;
 }
 
+/*
+ * Format value n of a column as the given type into the data string
+ * of a sample value, converting exactly as pmAtomStr(3) does.
+ */
+static int
+series_column_encode(series_column_t *column, unsigned int n, int type,
+		pmSeriesValue *value)
+{
+    pmAtomValue		val;
+    char		str_val[256];
+    int			str_len;
+
+    switch (type) {
+    case PM_TYPE_32:
+	val.l = (__int32_t)column->ll[n];
+	break;
+    case PM_TYPE_U32:
+	val.ul = (__uint32_t)column->ll[n];
+	break;
+    case PM_TYPE_64:
+	val.ll = column->ll[n];
+	break;
+    case PM_TYPE_U64:
+	val.ull = (__uint64_t)column->ll[n];
+	break;
+    case PM_TYPE_FLOAT:
+	val.f = (float)column->d[n];
+	break;
+    case PM_TYPE_DOUBLE:
+	val.d = column->d[n];
+	break;
+    default:
+	break;
+    }
+    if ((str_len = series_pmAtomValue_conv_str(type, str_val, &val, sizeof(str_val))) == 0)
+	return PM_ERR_CONV;
+    value->data = sdscpylen(value->data, str_val, str_len);
+    return 0;
+}
+
+/*
+ * Store all values of a column back into the (in-place) sample set,
+ * stopping at the first value that cannot be represented as a number.
+ */
+static int
+series_column_encode_all(series_column_t *column, int type,
+		series_sample_set_t *set)
+{
+    series_instance_set_t	*sample;
+    unsigned int		j, k, n;
+    int				sts;
+
+    for (n = j = 0; j < column->num_samples; j++) {
+	sample = &set->series_sample[j];
+	for (k = 0; k < sample->num_instances; k++, n++) {
+	    if ((sts = series_column_encode(column, n, type,
+				&sample->series_instance[k])) < 0)
+		return sts;
+	}
+    }
+    return 0;
+}
+
 /* 
  * The left child node of L_RESCALE should contains a set of time
  * series values.  And the right child node should be L_SCALE, which
@@ -2856,134 +3247,70 @@ static void
 series_calculate_rescale(node_t *np)
 {
     seriesQueryBaton	*baton = (seriesQueryBaton *)np->baton;
-    double		mult;
+    series_sample_set_t	*set;
+    series_column_t	column;
+    double		mult, scale;
     pmUnits		iunit;
-    char		*errmsg, str_val[256];
+    char		*errmsg;
     pmAtomValue		ival, oval;
-    int			type, sts, str_len, i, j, k;
+    unsigned int	n;
+    int			type, sts, i;
     sds			msg;
 
     np->value_set = np->left->value_set;
     for (i = 0; i < np->value_set.num_series; i++) {
-	if (pmParseUnitsStr(np->value_set.series_values[i].series_desc.units, &iunit, &mult, &errmsg) < 0) {
-	    infofmt(msg, "Units string of %s parse error, %s\n", np->value_set.series_values[i].sid->name, errmsg);
+	set = &np->value_set.series_values[i];
+	if (pmParseUnitsStr(set->series_desc.units, &iunit, &mult, &errmsg) < 0) {
+	    infofmt(msg, "Units string of %s parse error, %s\n", set->sid->name, errmsg);
 	    batoninfo(baton, PMLOG_ERROR, msg);
 	    baton->error = -EPROTO;
-	    np->value_set.series_values[i].num_samples = -np->value_set.series_values[i].num_samples;
+	    set->num_samples = -set->num_samples;
 	    free(errmsg);
 	    return;
 	}
 	if (compare_pmUnits_dim(&iunit, &np->right->meta.units) != 0) {
 	    infofmt(msg, "Dimensions of units mismatch, for series %s the units is %s\n", 
-		np->value_set.series_values[i].sid->name, np->value_set.series_values[i].series_desc.units);
+		set->sid->name, set->series_desc.units);
 	    batoninfo(baton, PMLOG_ERROR, msg);
 	    baton->error = -EPROTO;
-	    np->value_set.series_values[i].num_samples = -np->value_set.series_values[i].num_samples;
+	    set->num_samples = -set->num_samples;
 	    return;
 	}
-	if ((type = series_extract_type(np->value_set.series_values[i].series_desc.type)) == PM_TYPE_UNKNOWN) {
+	if ((type = series_extract_type(set->series_desc.type)) == PM_TYPE_UNKNOWN) {
 	    infofmt(msg, "Series values' Type extract fail, unsupported type\n");
 	    batoninfo(baton, PMLOG_ERROR, msg);
 	    baton->error = -EPROTO;
-	    np->value_set.series_values[i].num_samples = -np->value_set.series_values[i].num_samples;
+	    set->num_samples = -set->num_samples;
 	    return;
 	}
 	type = PM_TYPE_DOUBLE;
-	for (j = 0; j < np->value_set.series_values[i].num_samples; j++) {
-	    for (k = 0; k < np->value_set.series_values[i].series_sample[j].num_instances; k++) {
-		if (series_extract_value(type, 
-			np->value_set.series_values[i].series_sample[j].series_instance[k].data, &ival) != 0 ) {
-		    /* TODO: error report for extracting values from string fail */
-		    fprintf(stderr, "Extract values from string fail\n");
-		    return;
-		}
-		if ((sts = pmConvScale(type, &ival, &iunit, &oval, &np->right->meta.units)) != 0) {
-		    /* TODO: rescale error report */
-		    fprintf(stderr, "rescale error\n");
-		    return;
-		}
-		if ((str_len = series_pmAtomValue_conv_str(type, str_val, &oval, sizeof(str_val))) == 0)
-		    return;
-		sdsfree(np->value_set.series_values[i].series_sample[j].series_instance[k].data);
-		np->value_set.series_values[i].series_sample[j].series_instance[k].data = sdsnewlen(str_val, str_len);
-	    }
-	}
-	sdsfree(np->value_set.series_values[i].series_desc.units);
-	np->value_set.series_values[i].series_desc.units = sdsnew(pmUnitsStr(&np->right->meta.units));
-    }
-}
-
-static int
-series_abs_pmAtomValue(int type, pmAtomValue *val)
-{
-    int		sts = 0;
-
-    switch (type) {
-    case PM_TYPE_32:
-	if (val->l < 0)
-	    val->l = -val->l;
-	break;
-    case PM_TYPE_64:
-	if (val->ll < 0)
-	    val->ll = val->ll;
-	break;
-    case PM_TYPE_U32:
-    case PM_TYPE_U64:
-	/* No need to change value */
-	break;
-    case PM_TYPE_FLOAT:
-	if (val->f < 0)
-	    val->f = -val->f;
-	break;
-    case PM_TYPE_DOUBLE:
-	if (val->d < 0)
-	    val->d = -val->d;
-	break;
-    default:
-	/* Unsupported type */
-	sts = -1;
-	break;
-    }
-    return sts;
-}
-
-static void
-series_calculate_abs(node_t *np)
-{
-    seriesQueryBaton	*baton = (seriesQueryBaton *)np->baton;
-    pmAtomValue		val;
-    int			type, sts, str_len, i, j, k;
-    char		str_val[256];
-    sds			msg;
-
-    np->value_set = np->left->value_set;
-    for (i = 0; i < np->value_set.num_series; i++) {
-	if ((type = series_extract_type(np->value_set.series_values[i].series_desc.type)) == PM_TYPE_UNKNOWN) {
-	    infofmt(msg, "Series values' Type extract fail, unsupported type\n");
-	    batoninfo(baton, PMLOG_ERROR, msg);
-	    baton->error = -EPROTO;
-	    np->value_set.series_values[i].num_samples = -np->value_set.series_values[i].num_samples;
+	if ((sts = series_column_decode(set, type, 0, &column)) < 0) {
+	    if (sts == -ENOMEM)
+		series_column_nomem(baton, set->sid->name);
+	    else
+		/* TODO: error report for extracting values from string fail */
+		fprintf(stderr, "Extract values from string fail\n");
 	    return;
-	}	
-	for (j = 0; j < np->value_set.series_values[i].num_samples; j++) {
-	    for (k = 0; k < np->value_set.series_values[i].series_sample[j].num_instances; k++) {
-		if (series_extract_value(type, 
-			np->value_set.series_values[i].series_sample[j].series_instance[k].data, &val) != 0 ) {
-		    /* TODO: error report for extracting values from string fail */
-		    fprintf(stderr, "Extract values from string fail\n");
-		    return;
-		}
-		if ((sts = series_abs_pmAtomValue(type, &val)) != 0) {
-		    /* TODO: unsupported type */
-		    fprintf(stderr, "Unsupport type to take abs()\n");
-		    return;
-		}
-		if ((str_len = series_pmAtomValue_conv_str(type, str_val, &val, sizeof(str_val))) == 0)
-		    return;
-		sdsfree(np->value_set.series_values[i].series_sample[j].series_instance[k].data);
-		np->value_set.series_values[i].series_sample[j].series_instance[k].data = sdsnewlen(str_val, str_len);
+	}
+	if (column.count > 0) {
+	    /* conversion of doubles is a single multiply, so find the factor */
+	    ival.d = 1.0;
+	    if ((sts = pmConvScale(type, &ival, &iunit, &oval, &np->right->meta.units)) != 0) {
+		/* TODO: rescale error report */
+		fprintf(stderr, "rescale error\n");
+		series_column_free(&column);
+		return;
 	    }
+	    scale = oval.d;
+	    for (n = 0; n < column.count; n++)
+		column.d[n] *= scale;
+	    sts = series_column_encode_all(&column, type, set);
 	}
+	series_column_free(&column);
+	if (sts < 0)
+	    return;
+	sdsfree(set->series_desc.units);
+	set->series_desc.units = sdsnew(pmUnitsStr(&np->right->meta.units));
     }
 }
 
@@ -2994,8 +3321,11 @@ static void
 series_calculate_statistical(node_t *np, nodetype_t func)
 {
     seriesQueryBaton	*baton = (seriesQueryBaton *)np->baton;
+    series_sample_set_t	*set;
+    series_column_t	column;
+    pmSeriesValue	*value, *first;
     unsigned int	n_series, n_samples, n_instances, i, j, k;
-    double		sum_data, data;
+    double		*sum_data, *data;
     char		sum_data_str[64];
     sds			msg;
 
@@ -3005,53 +3335,62 @@ series_calculate_statistical(node_t *np, nodetype_t func)
     np->value_set.num_series = n_series;
     np->value_set.series_values = (series_sample_set_t *)calloc(n_series, sizeof(series_sample_set_t));
     for (i = 0; i < n_series; i++) {
-	n_samples = np->left->value_set.series_values[i].num_samples;
+	set = &np->left->value_set.series_values[i];
+	n_samples = set->num_samples;
 	if (n_samples > 0) {
 	    np->value_set.series_values[i].num_samples = 1;
 	    np->value_set.series_values[i].series_sample = (series_instance_set_t *)calloc(1, sizeof(series_instance_set_t));
-	    n_instances = np->left->value_set.series_values[i].series_sample[0].num_instances;
+	    n_instances = set->series_sample[0].num_instances;
 	    np->value_set.series_values[i].series_sample[0].num_instances = n_instances;
 	    np->value_set.series_values[i].series_sample[0].series_instance = (pmSeriesValue *)calloc(n_instances, sizeof(pmSeriesValue));
-	    for (k = 0; k < n_instances; k++) {
-		sum_data = 0.0;
-		for (j = 0; j < n_samples; j++) {
-		    if (np->left->value_set.series_values[i].series_sample[j].num_instances != n_instances) {
-			if (pmDebugOptions.query && pmDebugOptions.desperate) {
-			    infofmt(msg, "number of instances in each sample are not equal\n");
-			    batoninfo(baton, PMLOG_ERROR, msg);
-			}
-			continue;
+	    sum_data = (double *)calloc(n_instances + 1, sizeof(double));
+	    memset(&column, 0, sizeof(column));
+	    if (sum_data == NULL ||
+		series_column_decode(set, PM_TYPE_DOUBLE, 1, &column) < 0) {
+		series_column_nomem(baton, set->sid->name);
+		np->value_set.series_values[i].series_sample[0].num_instances = 0;
+		n_samples = n_instances = 0;
+	    }
+	    for (j = 0; j < n_samples; j++) {
+		if (set->series_sample[j].num_instances != n_instances) {
+		    if (pmDebugOptions.query && pmDebugOptions.desperate) {
+			infofmt(msg, "number of instances in each sample are not equal\n");
+			batoninfo(baton, PMLOG_ERROR, msg);
 		    }
-		    data = strtod(np->left->value_set.series_values[i].series_sample[j].series_instance[k].data, NULL);
-		    sum_data += data;
+		    continue;
 		}
-		np->value_set.series_values[i].series_sample[0].series_instance[k].timestamp = 
-			sdsnew(np->left->value_set.series_values[i].series_sample[0].series_instance[k].timestamp);
-		np->value_set.series_values[i].series_sample[0].series_instance[k].series = 
-			sdsnew(np->left->value_set.series_values[i].series_sample[0].series_instance[k].series);
+		data = &column.d[column.offsets[j]];
+		for (k = 0; k < n_instances; k++)
+		    sum_data[k] += data[k];
+	    }
+	    for (k = 0; k < n_instances; k++) {
+		value = &np->value_set.series_values[i].series_sample[0].series_instance[k];
+		first = &set->series_sample[0].series_instance[k];
+		value->timestamp = sdsnew(first->timestamp);
+		value->series = sdsnew(first->series);
 		switch (func) {
 		case N_SUM:
-		    pmsprintf(sum_data_str, sizeof(sum_data_str), "%le", sum_data);
+		    pmsprintf(sum_data_str, sizeof(sum_data_str), "%le", sum_data[k]);
 		    break;
 		case N_AVG:
-		    pmsprintf(sum_data_str, sizeof(sum_data_str), "%le", sum_data / n_samples);
+		    pmsprintf(sum_data_str, sizeof(sum_data_str), "%le", sum_data[k] / n_samples);
 		    break;
 		default:
 		    /* .. TODO any other statistical functions such as stddev, variance, mode, median etc */
 		    break;
 		}
-
-		np->value_set.series_values[i].series_sample[0].series_instance[k].data = sdsnew(sum_data_str);
-		np->value_set.series_values[i].series_sample[0].series_instance[k].ts = 
-			np->left->value_set.series_values[i].series_sample[0].series_instance[k].ts;
+		value->data = sdsnew(sum_data_str);
+		value->ts = first->ts;
 	    }
+	    series_column_free(&column);
+	    free(sum_data);
 	} else {
 	    np->value_set.series_values[i].num_samples = 0;
 	}
 	np->value_set.series_values[i].sid = (seriesGetSID *)calloc(1, sizeof(seriesGetSID));
-	np->value_set.series_values[i].sid->name = sdsnew(np->left->value_set.series_values[i].sid->name);
-	np->value_set.series_values[i].baton = np->left->value_set.series_values[i].baton;
-	np->value_set.series_values[i].series_desc = np->left->value_set.series_values[i].series_desc;
+	np->value_set.series_values[i].sid->name = sdsnew(set->sid->name);
+	np->value_set.series_values[i].baton = set->baton;
+	np->value_set.series_values[i].series_desc = set->series_desc;
 
 	/* statistical result values are type double, but maybe this depends on the function and args */
 	sdsfree(np->value_set.series_values[i].series_desc.type);
@@ -3059,319 +3398,103 @@ series_calculate_statistical(node_t *np, nodetype_t func)
     }
 }
 
-static int
-series_floor_pmAtomValue(int type, pmAtomValue *val)
-{
-    int			sts = 0;
-
-    switch (type) {
-    case PM_TYPE_32:
-    case PM_TYPE_U32:
-    case PM_TYPE_64:
-    case PM_TYPE_U64:
-	/* No change */
-	break;
-    case PM_TYPE_FLOAT:
-	val->f = floorf(val->f);
-	break;
-    case PM_TYPE_DOUBLE:
-	val->d = floor(val->d);
-	break;
-    default:
-	/* Unsupported type */
-	sts = -1;
-	break;
-    }
-
-    return sts;
-}
-
-static void
-series_calculate_floor(node_t *np)
-{
-    seriesQueryBaton	*baton = (seriesQueryBaton *)np->baton;
-    pmAtomValue		val;
-    int			type, sts, str_len, i, j, k;
-    char		str_val[256];
-    sds			msg;
-
-    np->value_set = np->left->value_set;
-    for (i = 0; i < np->value_set.num_series; i++) {
-	if ((type = series_extract_type(np->value_set.series_values[i].series_desc.type)) == PM_TYPE_UNKNOWN) {
-	    infofmt(msg, "Series values' Type extract fail, unsupported type\n");
-	    batoninfo(baton, PMLOG_ERROR, msg);
-	    baton->error = -EPROTO;
-	    np->value_set.series_values[i].num_samples = -np->value_set.series_values[i].num_samples;
-	    return;
-	}	
-	for (j = 0; j < np->value_set.series_values[i].num_samples; j++) {
-	    for (k = 0; k < np->value_set.series_values[i].series_sample[j].num_instances; k++) {
-		if (series_extract_value(type, 
-			np->value_set.series_values[i].series_sample[j].series_instance[k].data, &val) != 0 ) {
-		    /* TODO: error report for extracting values from string fail */
-		    fprintf(stderr, "Extract values from string fail\n");
-		    return;
-		}
-		if ((sts = series_floor_pmAtomValue(type, &val)) != 0) {
-		    /* TODO: unsupported type */
-		    fprintf(stderr, "Unsupport type to take abs()\n");
-		    return;
-		}
-		if ((str_len = series_pmAtomValue_conv_str(type, str_val, &val, sizeof(str_val))) == 0)
-		    return;
-		sdsfree(np->value_set.series_values[i].series_sample[j].series_instance[k].data);
-		np->value_set.series_values[i].series_sample[j].series_instance[k].data = sdsnewlen(str_val, str_len);
-	    }
-	}
-    }
-}
-
-static int
-series_log_pmAtomValue(int itype, int *otype, pmAtomValue *val, int is_natural_log, double base)
-{
-    int			sts = 0;
-    double		res;
-
-    switch (itype) {
-    case PM_TYPE_32:
-	res = val->l;
-	break;
-    case PM_TYPE_U32:
-	res = val->ul;
-	break;
-    case PM_TYPE_64:
-	res = val->ll;
-	break;
-    case PM_TYPE_U64:
-	res = val->ull;
-	break;
-    case PM_TYPE_FLOAT:
-	res = val->f;
-	break;
-    case PM_TYPE_DOUBLE:
-	res = val->d;
-	break;
-    default:
-	/* Unsupported type */
-	sts = -1;
-	break;
-    }
-
-    if (sts == 0) {
-	*otype = PM_TYPE_DOUBLE;
-	if (is_natural_log == 1)
-	    val->d = log(res);
-	else
-	    val->d = log(res)/log(base);
-    }
-
-    return sts;
-}
-
 /*
- * Return the logarithm of x to base b (log_b^x).
+ * Element-wise functions - abs, floor, round, sqrt and log (log_b^x,
+ * with the base b from the right node, else natural logarithm).  The
+ * values keep their type, except for sqrt and log which are double.
  */
 static void
-series_calculate_log(node_t *np)
+series_calculate_elementwise(node_t *np, nodetype_t func)
 {
     seriesQueryBaton	*baton = (seriesQueryBaton *)np->baton;
-    double		base;
-    pmAtomValue		val;
-    int			i, j, k, itype, otype=PM_TYPE_UNKNOWN;
-    int			sts, str_len, is_natural_log;
-    char		str_val[256];
+    series_sample_set_t	*set;
+    series_column_t	column;
+    unsigned int	n;
+    double		base, logbase = 1.0, *d;
+    __int64_t		*ll;
+    int			i, itype, otype, sts;
     sds			msg;
 
-
-    if (np->right != NULL) {
+    if (func == N_LOG && np->right != NULL) {
 	sscanf(np->right->value, "%lf", &base);
-	is_natural_log = 0;
-    } else {
-	is_natural_log = 1;
+	logbase = log(base);
     }
     np->value_set = np->left->value_set;
     for (i = 0; i < np->value_set.num_series; i++) {
-	if ((itype = series_extract_type(np->value_set.series_values[i].series_desc.type)) == PM_TYPE_UNKNOWN) {
+	set = &np->value_set.series_values[i];
+	if ((itype = series_extract_type(set->series_desc.type)) == PM_TYPE_UNKNOWN) {
 	    infofmt(msg, "Series values' Type extract fail, unsupported type\n");
 	    batoninfo(baton, PMLOG_ERROR, msg);
 	    baton->error = -EPROTO;
-	    np->value_set.series_values[i].num_samples = -np->value_set.series_values[i].num_samples;
+	    set->num_samples = -set->num_samples;
 	    return;
 	}
-	for (j = 0; j < np->value_set.series_values[i].num_samples; j++) {
-	    for (k = 0; k < np->value_set.series_values[i].series_sample[j].num_instances; k++) {
-		if (series_extract_value(itype, 
-			np->value_set.series_values[i].series_sample[j].series_instance[k].data, &val) != 0 ) {
-		    /* TODO: error report for extracting values from string fail */
-		    fprintf(stderr, "Extract values from string fail\n");
-		    return;
-		}
-		if ((sts = series_log_pmAtomValue(itype, &otype, &val, is_natural_log, base)) != 0) {
-		    /* TODO: unsupported type */
-		    fprintf(stderr, "Unsupport type to take log()\n");
-		    return;
-		}
-		if ((str_len = series_pmAtomValue_conv_str(otype, str_val, &val, sizeof(str_val))) == 0)
-		    return;
-		sdsfree(np->value_set.series_values[i].series_sample[j].series_instance[k].data);
-		np->value_set.series_values[i].series_sample[j].series_instance[k].data = sdsnewlen(str_val, str_len);
-	    }
+	if ((sts = series_column_decode(set, itype, 0, &column)) < 0) {
+	    if (sts == -ENOMEM)
+		series_column_nomem(baton, set->sid->name);
+	    else
+		/* TODO: error report for extracting values from string fail */
+		fprintf(stderr, "Extract values from string fail\n");
+	    return;
 	}
-	sdsfree(np->value_set.series_values[i].series_desc.type);
-	np->value_set.series_values[i].series_desc.type = sdsnew(pmTypeStr(otype));
-    }
-}
-
-static int
-series_sqrt_pmAtomValue(int itype, int *otype, pmAtomValue *val)
-{
-    int			sts = 0;
-    double		res;
-
-    switch (itype) {
-    case PM_TYPE_32:
-	*otype = PM_TYPE_DOUBLE;
-	res = val->l;
-	val->d = sqrt(res);
-	break;
-    case PM_TYPE_U32:
-	*otype = PM_TYPE_DOUBLE;
-	res = val->ul;
-	val->d = sqrt(res);
-	break;
-    case PM_TYPE_64:
-	*otype = PM_TYPE_DOUBLE;
-	res = val->ll;
-	val->d = sqrt(res);
-	break;
-    case PM_TYPE_U64:
-	*otype = PM_TYPE_DOUBLE;
-	res = val->ull;
-	val->d = sqrt(res);
-	break;
-    case PM_TYPE_FLOAT:
-	*otype = PM_TYPE_DOUBLE;
-	res = val->f;
-	val->d = sqrt(res);
-	break;
-    case PM_TYPE_DOUBLE:
-	val->d = sqrt(val->d);
-	break;
-    default:
-	/* Unsupported type */
-	sts = -1;
-	break;
-    }
-    return sts;
-}
-
-static void
-series_calculate_sqrt(node_t *np)
-{
-    seriesQueryBaton	*baton = (seriesQueryBaton *)np->baton;
-    pmAtomValue		val;
-    int			i, j, k, itype, otype=PM_TYPE_UNKNOWN;
-    int			sts, str_len;
-    char		str_val[256];
-    sds			msg;
+	otype = itype;
+	d = column.d;
+	ll = column.ll;
 
-    np->value_set = np->left->value_set;
-    for (i = 0; i < np->value_set.num_series; i++) {
-	if ((itype = series_extract_type(np->value_set.series_values[i].series_desc.type)) == PM_TYPE_UNKNOWN) {
-	    infofmt(msg, "Series values' Type extract fail, unsupported type\n");
-	    batoninfo(baton, PMLOG_ERROR, msg);
-	    baton->error = -EPROTO;
-	    np->value_set.series_values[i].num_samples = -np->value_set.series_values[i].num_samples;
-	    return;
-	}	
-	for (j = 0; j < np->value_set.series_values[i].num_samples; j++) {
-	    for (k = 0; k < np->value_set.series_values[i].series_sample[j].num_instances; k++) {
-		if (series_extract_value(itype, 
-			np->value_set.series_values[i].series_sample[j].series_instance[k].data, &val) != 0 ) {
-		    /* TODO: error report for extracting values from string fail */
-		    fprintf(stderr, "Extract values from string fail\n");
-		    return;
-		}
-		if ((sts = series_sqrt_pmAtomValue(itype, &otype, &val)) != 0) {
-		    /* TODO: unsupported type */
-		    fprintf(stderr, "Unsupport type to take sqrt()\n");
-		    return;
-		}
-		if ((str_len = series_pmAtomValue_conv_str(otype, str_val, &val, sizeof(str_val))) == 0)
-		    return;
-		sdsfree(np->value_set.series_values[i].series_sample[j].series_instance[k].data);
-		np->value_set.series_values[i].series_sample[j].series_instance[k].data = sdsnewlen(str_val, str_len);
+	switch (func) {
+	case N_ABS:
+	    if (d) {
+		for (n = 0; n < column.count; n++)
+		    d[n] = d[n] < 0 ? -d[n] : d[n];
+	    } else if (itype == PM_TYPE_32 || itype == PM_TYPE_64) {
+		for (n = 0; n < column.count; n++)
+		    ll[n] = ll[n] < 0 ? -ll[n] : ll[n];
+	    }
+	    break;
+	case N_FLOOR:	/* integer values are unchanged */
+	    if (d) {
+		for (n = 0; n < column.count; n++)
+		    d[n] = floor(d[n]);
+	    }
+	    break;
+	case N_ROUND:	/* integer values are unchanged */
+	    if (d) {
+		for (n = 0; n < column.count; n++)
+		    d[n] = round(d[n]);
 	    }
+	    break;
+	case N_SQRT:
+	case N_LOG:
+	    otype = PM_TYPE_DOUBLE;
+	    if (series_column_double(&column) < 0) {
+		series_column_free(&column);
+		series_column_nomem(baton, set->sid->name);
+		return;
+	    }
+	    d = column.d;
+	    if (func == N_SQRT) {
+		for (n = 0; n < column.count; n++)
+		    d[n] = sqrt(d[n]);
+	    } else if (np->right == NULL) {
+		for (n = 0; n < column.count; n++)
+		    d[n] = log(d[n]);
+	    } else {
+		for (n = 0; n < column.count; n++)
+		    d[n] = log(d[n]) / logbase;
+	    }
+	    break;
+	default:
+	    break;
 	}
-	sdsfree(np->value_set.series_values[i].series_desc.type);
-	np->value_set.series_values[i].series_desc.type = sdsnew(pmTypeStr(otype));
-    }
-}
 
-static int
-series_round_pmAtomValue(int type, pmAtomValue *val)
-{
-    int			sts = 0;
-
-    switch (type) {
-    case PM_TYPE_32:
-    case PM_TYPE_U32:
-    case PM_TYPE_64:
-    case PM_TYPE_U64:
-	/* No change */
-	break;
-    case PM_TYPE_FLOAT:
-	val->f = roundf(val->f);
-	break;
-    case PM_TYPE_DOUBLE:
-	val->d = round(val->f);
-	break;
-    default:
-	/* Unsupported type */
-	sts = -1;
-	break;
-    }
-    return sts;
-}
-
-static void
-series_calculate_round(node_t *np)
-{
-    seriesQueryBaton	*baton = (seriesQueryBaton *)np->baton;
-    pmAtomValue		val;
-    int			i, j, k, type, sts, str_len;
-    char		str_val[256];
-    sds			msg;
-
-    np->value_set = np->left->value_set;
-    for (i = 0; i < np->value_set.num_series; i++) {
-	if ((type = series_extract_type(np->value_set.series_values[i].series_desc.type)) == PM_TYPE_UNKNOWN) {
-	    infofmt(msg, "Series values' Type extract fail, unsupported type\n");
-	    batoninfo(baton, PMLOG_ERROR, msg);
-	    baton->error = -EPROTO;
-	    np->value_set.series_values[i].num_samples = -np->value_set.series_values[i].num_samples;
+	sts = series_column_encode_all(&column, otype, set);
+	series_column_free(&column);
+	if (sts < 0)
 	    return;
+	if (func == N_SQRT || func == N_LOG) {
+	    sdsfree(set->series_desc.type);
+	    set->series_desc.type = sdsnew(pmTypeStr(otype));
 	}
-	for (j = 0; j < np->value_set.series_values[i].num_samples; j++) {
-	    for (k = 0; k < np->value_set.series_values[i].series_sample[j].num_instances; k++) {
-		if (series_extract_value(type, 
-			np->value_set.series_values[i].series_sample[j].series_instance[k].data, &val) != 0 ) {
-		    /* TODO: error report for extracting values from string fail */
-		    fprintf(stderr, "Extract values from string fail\n");
-		    return;
-		}
-		if ((sts = series_round_pmAtomValue(type, &val)) != 0) {
-		    /* TODO: unsupported type */
-		    fprintf(stderr, "Unsupport type to take abs()\n");
-		    return;
-		}
-		if ((str_len = series_pmAtomValue_conv_str(type, str_val, &val, sizeof(str_val))) == 0)
-		    return;
-		sdsfree(np->value_set.series_values[i].series_sample[j].series_instance[k].data);
-		np->value_set.series_values[i].series_sample[j].series_instance[k].data = sdsnewlen(str_val, str_len);
-	    }
-	}
-	
     }
 }
 
@@ -3957,11 +4080,11 @@ series_calculate(seriesQueryBaton *baton, node_t *np, int level)
 	    sts = N_RATE;
 	    break;
 	case N_MAX:
-	    series_calculate_max(np);
+	    series_calculate_extreme(np, N_MAX);
 	    sts = N_MAX;
 	    break;
 	case N_MIN:
-	    series_calculate_min(np);
+	    series_calculate_extreme(np, N_MIN);
 	    sts = N_MIN;
 	    break;
 	case N_RESCALE:
@@ -3969,23 +4092,23 @@ series_calculate(seriesQueryBaton *baton, node_t *np, int level)
 	    sts = N_RESCALE;
 	    break;
 	case N_ABS:
-	    series_calculate_abs(np);
+	    series_calculate_elementwise(np, N_ABS);
 	    sts = N_ABS;
 	    break;
 	case N_FLOOR:
-	    series_calculate_floor(np);
+	    series_calculate_elementwise(np, N_FLOOR);
 	    sts = N_FLOOR;
 	    break;
 	case N_LOG:
-	    series_calculate_log(np);
+	    series_calculate_elementwise(np, N_LOG);
 	    sts = N_LOG;
 	    break;
 	case N_SQRT:
-	    series_calculate_sqrt(np);
+	    series_calculate_elementwise(np, N_SQRT);
 	    sts = N_SQRT;
 	    break;
 	case N_ROUND:
-	    series_calculate_round(np);
+	    series_calculate_elementwise(np, N_ROUND);
 	    sts = N_ROUND;
 	    break;
 	case N_PLUS:
@@ -114,6 +114,7 @@ typedef struct series_instance_set {
 
 typedef struct series_sample_set {
     seriesGetSID		*sid;
+    struct node			*node;		/* node holding this set */
     sds				metric_name;
     pmSeriesDesc		series_desc;
     void			*baton;
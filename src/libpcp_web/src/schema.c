@@ -12,6 +12,7 @@
  * License for more details.
  */
 #include <assert.h>
+#include <pthread.h>
 #include "pmapi.h"
 #include "pmda.h"
 #include "search.h"
@@ -19,15 +20,18 @@
 #include "discover.h"
 #include "util.h"
 #include "sha1.h"
+#include "encoding.h"
+#include "cache.h"
 
-#define STRINGIFY(s)	#s
-#define TO_STRING(s)	STRINGIFY(s)
-#define SERIES_VERSION	2
+#define SERIES_VERSION	3	/* packed stream values */
+#define SERIES_VERSION_MIN 2	/* oldest schema still understood */
 #define SERVER_VERSION	5
 
 extern sds		cursorcount;
 static sds		maxstreamlen;
 static sds		streamexpire;
+static time_t		streamrefresh;
+static int		streampacked;
 
 typedef struct redisScript {
     sds			hash;
@@ -37,6 +41,9 @@ typedef struct redisScript {
 static redisScript	*scripts;
 static int		nscripts;
 
+/* string maps are shared by parallel load workers */
+static pthread_mutex_t	maplock = PTHREAD_MUTEX_INITIALIZER;
+
 static void
 redisScriptsInit(void)
 {
@@ -217,7 +224,9 @@ redisGetMap(redisSlots *slots, redisMap *mapping, unsigned char *hash, sds mapSt
     pmwebapi_string_hash(hash, mapStr, sdslen(mapStr));
     mapKey = sdsnewlen(hash, 20);
 
+    pthread_mutex_lock(&maplock);
     if ((entry = redisMapLookup(mapping, mapKey)) != NULL) {
+	pthread_mutex_unlock(&maplock);
 	sdsfree(mapKey);
 	on_done(arg);
     } else {
@@ -231,8 +240,10 @@ redisGetMap(redisSlots *slots, redisMap *mapping, unsigned char *hash, sds mapSt
 	    initRedisMapBaton(baton, slots, mapping, mapKey, mapStr,
 			    on_done, on_info, userdata, arg);
 	    redisMapInsert(mapping, mapKey, sdsdup(mapStr));
+	    pthread_mutex_unlock(&maplock);
 	    redisMapRequest(baton, mapping, mapKey, mapStr);
 	} else {
+	    pthread_mutex_unlock(&maplock);
 	    on_done(arg);
 	}
     }
@@ -996,24 +1007,56 @@ check_instances:
     }
 }
 
+/*
+ * Values for all metrics in one sample (timestamp) are streamed as
+ * a batch of XADD commands sharing a single baton, which is freed
+ * once the last reply for the batch has arrived.
+ */
 typedef struct redisStreamBaton {
     seriesBatonMagic	header;
     redisSlots		*slots;
     sds			stamp;
-    char		hash[40+1];
+    unsigned int	count;		/* XADD commands in this batch */
     redisInfoCallBack   info;
     void		*userdata;
     void		*arg;
 } redisStreamBaton;
 
+/* series stream ingest instrumentation (MMV metrics) */
+enum {
+    STREAM_SAMPLES,
+    STREAM_XADDS,
+    STREAM_VALUES,
+    STREAM_ERRORS,
+    STREAM_EXPIRES,
+    STREAM_EXPIRES_SKIPPED,
+    STREAM_BATCH,
+    NUM_STREAM_METRICS
+};
+static void		*streammap;
+static pmAtomValue	*streammetrics[NUM_STREAM_METRICS];
+
+static void
+streamMetricAdd(int metric, unsigned int count)
+{
+    if (streammap && streammetrics[metric])
+	mmv_inc_value(streammap, streammetrics[metric], count);
+}
+
+static void
+streamMetricSet(int metric, unsigned int value)
+{
+    if (streammap && streammetrics[metric])
+	mmv_set_value(streammap, streammetrics[metric], value);
+}
+
 static void
 initRedisStreamBaton(redisStreamBaton *baton, redisSlots *slots,
-		sds stamp, const char *hash, seriesLoadBaton *load)
+		sds stamp, seriesLoadBaton *load)
 {
     initSeriesBatonMagic(baton, MAGIC_STREAM);
     baton->slots = slots;
     baton->stamp = sdsdup(stamp);
-    memcpy(baton->hash, hash, sizeof(baton->hash));
     baton->info = load->info;
     baton->userdata = load->userdata;
     baton->arg = load;
@@ -1026,6 +1069,9 @@ doneRedisStreamBaton(redisStreamBaton *baton)
 
     seriesBatonCheckMagic(baton, MAGIC_STREAM, "doneRedisStreamBaton");
     seriesBatonCheckMagic(load, MAGIC_LOAD, "doneRedisStreamBaton");
+    if (seriesBatonDereference(baton, "doneRedisStreamBaton") == 0)
+	return;
+    sdsfree(baton->stamp);
     memset(baton, 0, sizeof(*baton));
     free(baton);
 
@@ -1089,11 +1135,56 @@ append:
     return series_stream_append(cmd, name, value);
 }
 
+/*
+ * Append all instance values of a metric as a single field holding
+ * the compact binary (packed) encoding, rather than a field per value.
+ */
+static sds
+series_stream_packed(sds cmd, metric_t *metric, unsigned int *values)
+{
+    packed_values_t	packed;
+    instance_t		*inst;
+    value_t		*v;
+    int			i;
+
+    if (metric->desc.indom == PM_INDOM_NULL || metric->u.vlist == NULL) {
+	packed_values_init(&packed, metric->desc.type, 0);
+	packed_values_append(&packed, NULL, &metric->u.atom);
+	*values += 1;
+    } else {
+	packed_values_init(&packed, metric->desc.type, 1);
+	for (i = 0; i < metric->u.vlist->listcount; i++) {
+	    v = &metric->u.vlist->value[i];
+	    if ((inst = dictFetchValue(metric->indom->insts, &v->inst)) == NULL)
+		continue;
+	    packed_values_append(&packed, inst->name.hash, &v->atom);
+	    *values += 1;
+	}
+    }
+    return series_stream_append(cmd,
+		sdsnewlen(PACKED_FIELD, PACKED_FIELD_LEN), packed.buffer);
+}
+
+/* extract the series identifier from the key of a stream command */
+static const char *
+redis_series_stream_hash(const sds cmd, char *hash, size_t length)
+{
+    static const char	prefix[] = "pcp:values:series:";
+    const char		*key;
+
+    if ((key = strstr(cmd, prefix)) == NULL)
+	return "?";
+    key += sizeof(prefix) - 1;
+    pmsprintf(hash, length, "%.*s", 40, key);
+    return hash;
+}
+
 static void
 redis_series_stream_callback(
 	redisAsyncContext *c, redisReply *reply, const sds cmd, void *arg)
 {
     redisStreamBaton	*baton = (redisStreamBaton *)arg;
+    char		hash[40+1];
     sds			msg;
     int			sts;
 
@@ -1105,13 +1196,15 @@ redis_series_stream_callback(
     if (sts == 0) {
 	if (testReplyError(reply, REDIS_ESTREAMXADD)) {
 	    infofmt(msg, "duplicate or early stream %s insert at time %s",
-		baton->hash, baton->stamp);
+		redis_series_stream_hash(cmd, hash, sizeof(hash)), baton->stamp);
 	    batoninfo(baton, PMLOG_WARNING, msg);
+	    streamMetricAdd(STREAM_ERRORS, 1);
 	}
-	else {
-	    checkStreamReplyString(baton->info, baton->userdata, reply,
+	else if (checkStreamReplyString(baton->info, baton->userdata, reply,
 		baton->stamp, "stream %s status mismatch at time %s",
-		baton->hash, baton->stamp);
+		redis_series_stream_hash(cmd, hash, sizeof(hash)),
+		baton->stamp) < 0) {
+	    streamMetricAdd(STREAM_ERRORS, 1);
 	}
     }
     doneRedisStreamBaton(baton);
@@ -1132,23 +1225,77 @@ redis_series_timer_callback(
     doneSeriesLoadBaton(baton, "redis_series_timer_callback");
 }
 
-static void
-redis_series_stream(redisSlots *slots, sds stamp, metric_t *metric,
-		const char *hash, void *arg)
+/*
+ * Start a batch of stream commands for all metric values sampled at
+ * one timestamp.  The batch holds a single load baton reference and
+ * each XADD a reference to the batch, replacing per-command batons.
+ * Commands are queued on the (per-slot) Redis connections as they are
+ * issued and written out together when the event loop next runs.
+ */
+void
+redis_series_batch(redisSlots *slots, sds timestamp, void *arg)
 {
     seriesLoadBaton		*load = (seriesLoadBaton *)arg;
     redisStreamBaton		*baton;
-    unsigned int		count;
-    int				i, sts, type;
-    sds				cmd, key, name, stream = sdsempty();
+    sds				msg;
+
+    seriesBatonCheckMagic(load, MAGIC_LOAD, "redis_series_batch");
+    assert(load->stream == NULL);
 
     if ((baton = malloc(sizeof(redisStreamBaton))) == NULL) {
-	stream = sdscatfmt(stream, "OOM creating stream baton");
-	batoninfo(load, PMLOG_ERROR, stream);
+	infofmt(msg, "OOM creating stream baton");
+	batoninfo(load, PMLOG_ERROR, msg);
 	return;
     }
-    initRedisStreamBaton(baton, slots, stamp, hash, load);
-    seriesBatonReferences(load, 2, "redis_series_stream");
+    initRedisStreamBaton(baton, slots, timestamp, load);
+    seriesBatonReference(load, "redis_series_batch");
+    seriesBatonReference(baton, "redis_series_batch");
+    load->stream = baton;
+}
+
+void
+redis_series_batched(redisSlots *slots, void *arg)
+{
+    seriesLoadBaton		*load = (seriesLoadBaton *)arg;
+    redisStreamBaton		*baton = (redisStreamBaton *)load->stream;
+
+    if (baton == NULL)
+	return;
+    load->stream = NULL;
+
+    if (baton->count) {
+	streamMetricAdd(STREAM_SAMPLES, 1);
+	streamMetricSet(STREAM_BATCH, baton->count);
+    }
+    doneRedisStreamBaton(baton);
+}
+
+/*
+ * Refresh the stream expiry (to stream.expire seconds) at most once per
+ * stream.expire.refresh interval, rather than after every XADD - so a
+ * stream may be removed up to that much earlier than stream.expire
+ * seconds after its last update.
+ */
+static int
+redis_series_expire(metric_t *metric, time_t now)
+{
+    if (metric->expire > now) {
+	streamMetricAdd(STREAM_EXPIRES_SKIPPED, metric->numnames);
+	return 0;
+    }
+    metric->expire = now + streamrefresh;
+    streamMetricAdd(STREAM_EXPIRES, metric->numnames);
+    return 1;
+}
+
+static void
+redis_series_stream(redisSlots *slots, redisStreamBaton *baton,
+		metric_t *metric, const char *hash, int expire, void *arg)
+{
+    seriesLoadBaton		*load = (seriesLoadBaton *)arg;
+    unsigned int		count, values = 0;
+    int				i, sts, type;
+    sds				cmd, key, name, stream = sdsempty();
 
     count = 6;	/* XADD key MAXLEN ~ len stamp */
     key = sdscatfmt(sdsempty(), "pcp:values:series:%s", hash);
@@ -1157,12 +1304,18 @@ redis_series_stream(redisSlots *slots, sds stamp, metric_t *metric,
 	stream = series_stream_append(stream,
 			sdsnewlen("-1", 2), sdscatfmt(sdsempty(), "%i", sts));
 	count += 2;
+    } else if (streampacked && packed_values_type(metric->desc.type) &&
+		(metric->desc.indom == PM_INDOM_NULL || metric->u.vlist == NULL ||
+		 metric->u.vlist->listcount > 0)) {
+	stream = series_stream_packed(stream, metric, &values);
+	count += 2;
     } else {
 	name = sdsempty();
 	type = metric->desc.type;
 	if (metric->desc.indom == PM_INDOM_NULL || metric->u.vlist == NULL) {
 	    stream = series_stream_value(stream, name, type, &metric->u.atom);
 	    count += 2;
+	    values++;
 	} else if (metric->u.vlist->listcount <= 0) {
 	    stream = series_stream_append(stream, sdsnew("0"), sdsnew("0"));
 	    count += 2;
@@ -1176,6 +1329,7 @@ redis_series_stream(redisSlots *slots, sds stamp, metric_t *metric,
 		name = sdscpylen(name, (const char *)inst->name.hash, sizeof(inst->name.hash));
 		stream = series_stream_value(stream, name, type, &v->atom);
 		count += 2;
+		values++;
 	    }
 	}
 	sdsfree(name);
@@ -1187,32 +1341,46 @@ redis_series_stream(redisSlots *slots, sds stamp, metric_t *metric,
     cmd = redis_param_str(cmd, "MAXLEN", sizeof("MAXLEN")-1);
     cmd = redis_param_str(cmd, "~", 1);
     cmd = redis_param_sds(cmd, maxstreamlen);
-    cmd = redis_param_sds(cmd, stamp);
+    cmd = redis_param_sds(cmd, baton->stamp);
     cmd = redis_param_raw(cmd, stream);
     sdsfree(stream);
 
+    seriesBatonReference(baton, "redis_series_stream");
+    baton->count++;
+    streamMetricAdd(STREAM_XADDS, 1);
+    streamMetricAdd(STREAM_VALUES, values);
     redisSlotsRequest(slots, XADD, key, cmd, redis_series_stream_callback, baton);
 
+    if (!expire)
+	return;
+
     key = sdscatfmt(sdsempty(), "pcp:values:series:%s", hash);
     cmd = redis_command(3);	/* EXPIRE key timer */
     cmd = redis_param_str(cmd, EXPIRE, EXPIRE_LEN);
     cmd = redis_param_sds(cmd, key);
     cmd = redis_param_sds(cmd, streamexpire);
 
+    seriesBatonReference(load, "redis_series_stream");
     redisSlotsRequest(slots, EXPIRE, key, cmd, redis_series_timer_callback, load);
 }
 
 static void
 redis_series_streamed(sds stamp, metric_t *metric, void *arg)
 {
-    seriesLoadBaton		*baton= (seriesLoadBaton *)arg;
-    redisSlots			*slots = baton->slots;
+    seriesLoadBaton		*load = (seriesLoadBaton *)arg;
+    redisStreamBaton		*baton = (redisStreamBaton *)load->stream;
+    redisSlots			*slots = load->slots;
     char			hashbuf[42];
-    int				i;
+    int				i, expire;
 
+    if (baton == NULL)	/* batch could not be started */
+	return;
+    assert(sdscmp(stamp, baton->stamp) == 0);
+
+    expire = redis_series_expire(metric, time(NULL));
     for (i = 0; i < metric->numnames; i++) {
 	pmwebapi_hash_str(metric->names[i].hash, hashbuf, sizeof(hashbuf));
-	redis_series_stream(slots, stamp, metric, hashbuf, arg);
+	redis_series_stream(slots, baton, metric, hashbuf, expire, arg);
     }
 }
 
@@ -1245,19 +1413,33 @@ redis_update_version_callback(
     redis_slots_end_phase(baton);
 }
 
+/*
+ * Series written by this library are readable with schema v2 unless
+ * they are being packed, in which case the schema version is raised
+ * to v3 so that earlier versions refuse to use (misread) the streams.
+ * This allows a gradual migration - readers upgraded first, then the
+ * writers have stream.packed enabled.
+ */
+static unsigned int
+redis_series_version(void)
+{
+    return streampacked ? SERIES_VERSION : SERIES_VERSION_MIN;
+}
+
 static void
 redis_update_version(redisSlotsBaton *baton)
 {
-    sds			cmd, key;
-    const char		ver[] = TO_STRING(SERIES_VERSION);
+    sds			cmd, key, ver;
 
     seriesBatonReference(baton, "redis_update_version");
 
     key = sdsnew("pcp:version:schema");
+    ver = sdscatfmt(sdsempty(), "%u", redis_series_version());
     cmd = redis_command(3);
     cmd = redis_param_str(cmd, SETS, SETS_LEN);
     cmd = redis_param_sds(cmd, key);
-    cmd = redis_param_str(cmd, ver, sizeof(ver)-1);
+    cmd = redis_param_sds(cmd, ver);
+    sdsfree(ver);
     redisSlotsRequest(baton->slots, SETS, key, cmd, redis_update_version_callback, baton);
 }
 
@@ -1280,11 +1462,12 @@ redis_load_series_version_callback(
 	baton->version = 0;	/* NIL - no version key yet */
     } else if (reply->type == REDIS_REPLY_STRING) {
 	version = (unsigned int)atoi(reply->str);
-	if (version == 0 || version == SERIES_VERSION) {
+	if (version == 0 ||
+	    (version >= SERIES_VERSION_MIN && version <= SERIES_VERSION)) {
 	    baton->version = version;
 	} else {
-	    infofmt(msg, "unsupported series schema (got v%u, expected v%u)",
-			version, SERIES_VERSION);
+	    infofmt(msg, "unsupported series schema (got v%u, expected v%u-v%u)",
+			version, SERIES_VERSION_MIN, SERIES_VERSION);
 	    batoninfo(baton, PMLOG_ERROR, msg);
 	}
     } else if (reply->type == REDIS_REPLY_ERROR) {
@@ -1300,8 +1483,8 @@ redis_load_series_version_callback(
 	baton->version = 0;	/* NIL - no version key yet */
     }
 
-    /* set the version when none found (first time through) */
-    if (version != SERIES_VERSION && baton->version != -1) {
+    /* set the version when none found, or when starting to pack values */
+    if (version < redis_series_version() && baton->version != -1) {
 	/* drop reference from schema version request */
 	seriesBatonDereference(baton, "redis_load_series_version_callback");
 	redis_update_version(arg);
@@ -1741,6 +1924,7 @@ pmSeriesSetMetricRegistry(pmSeriesModule *module, mmv_registry_t *registry)
 static void
 redisSeriesInit(struct dict *config)
 {
+    long	expire;
     sds		option;
 
     if (!cursorcount) {
@@ -1763,6 +1947,20 @@ redisSeriesInit(struct dict *config)
 	else
 	    streamexpire = sdsnew("86400");	/* 1 day (without changes) */
     }
+
+    if ((option = pmIniFileLookup(config, "pmseries", "stream.expire.refresh")))
+	streamrefresh = strtol(option, NULL, 10);
+    else
+	streamrefresh = 600;	/* 10 minutes */
+    /* refresh well before expiry, else a stream could briefly vanish */
+    if ((expire = strtol(streamexpire, NULL, 10)) > 0 &&
+	streamrefresh > expire / 2)
+	streamrefresh = expire / 2;
+    if (streamrefresh < 0)
+	streamrefresh = 0;
+
+    if ((option = pmIniFileLookup(config, "pmseries", "stream.packed")))
+	streampacked = (strcasecmp(option, "true") == 0);
 }
 
 void
@@ -1772,6 +1970,7 @@ redisGlobalsInit(struct dict *config)
     redisSearchInit(config);
     redisScriptsInit();
     redisMapsInit();
+    seriesCacheInit(config);
 }
 
 int
@@ -1786,6 +1985,9 @@ pmSeriesSetup(pmSeriesModule *module, void *arg)
     /* create global EVAL hashes and string map caches */
     redisGlobalsInit(data->config);
 
+    /* instrument the query cache of recent time series values */
+    seriesCacheMetrics(data->metrics);
+
     /* fast path for when Redis has been setup already */
     if (data->slots) {
 	module->on_setup(arg);
@@ -1809,6 +2011,7 @@ pmSeriesClose(pmSeriesModule *module)
     if (data) {
 	if (!data->shareslots)
 	    redisSlotsFree(data->slots);
+	seriesCacheClose();
 	memset(data, 0, sizeof(seriesModuleData));
 	free(data);
     }
@@ -1879,6 +2082,48 @@ pmDiscoverSetMetricRegistry(pmDiscoverModule *module, mmv_registry_t *registry)
     return -ENOMEM;
 }
 
+static void
+redis_series_stream_metrics(mmv_registry_t *registry)
+{
+    static const struct {
+	const char	*name;
+	mmv_metric_sem_t sem;
+	const char	*help;
+    } metrics[NUM_STREAM_METRICS] = {
+	[STREAM_SAMPLES] = { "series.stream.samples", MMV_SEM_COUNTER,
+		"Samples (timestamps) with values streamed to Redis" },
+	[STREAM_XADDS] = { "series.stream.xadds", MMV_SEM_COUNTER,
+		"XADD commands issued to append series values" },
+	[STREAM_VALUES] = { "series.stream.values", MMV_SEM_COUNTER,
+		"Metric instance values appended to series streams" },
+	[STREAM_ERRORS] = { "series.stream.errors", MMV_SEM_COUNTER,
+		"XADD commands that failed, including duplicate timestamps" },
+	[STREAM_EXPIRES] = { "series.stream.expires", MMV_SEM_COUNTER,
+		"EXPIRE commands issued to refresh series stream TTLs" },
+	[STREAM_EXPIRES_SKIPPED] = { "series.stream.expires_skipped",
+		MMV_SEM_COUNTER,
+		"Stream TTL refreshes avoided as within stream.expire.refresh" },
+	[STREAM_BATCH] = { "series.stream.batch", MMV_SEM_INSTANT,
+		"XADD commands in the most recently streamed sample batch" },
+    };
+    pmUnits		countunits = MMV_UNITS(0,0,1,0,0,PM_COUNT_ONE);
+    pmInDom		noindom = MMV_INDOM_NULL;
+    int			i;
+
+    if (registry == NULL)
+	return;
+
+    for (i = 0; i < NUM_STREAM_METRICS; i++)
+	mmv_stats_add_metric(registry, metrics[i].name, i + 1,
+		MMV_TYPE_U64, metrics[i].sem, countunits, noindom,
+		metrics[i].help, NULL);
+
+    if ((streammap = mmv_stats_start(registry)) == NULL)
+	return;
+    for (i = 0; i < NUM_STREAM_METRICS; i++)
+	streammetrics[i] = mmv_lookup_value_desc(streammap, metrics[i].name, NULL);
+}
+
 int
 pmDiscoverSetup(pmDiscoverModule *module, pmDiscoverCallBacks *cbs, void *arg)
 {
@@ -1936,6 +2181,9 @@ pmDiscoverSetup(pmDiscoverModule *module, pmDiscoverCallBacks *cbs, void *arg)
     redisScriptsInit();
     redisMapsInit();
 
+    /* instrument the values streamed for each discovered sample */
+    redis_series_stream_metrics(data->metrics);
+
     if (!logdir)
 	logdir = fallback;
 
@@ -1957,6 +2205,10 @@ pmDiscoverClose(pmDiscoverModule *module)
 
     if (discover) {
 	pmDiscoverUnregister(discover->handle);
+	if (discover->metrics) {	/* registry is freed by the caller */
+	    memset(streammetrics, 0, sizeof(streammetrics));
+	    streammap = NULL;
+	}
 	if (!discover->shareslots)
 	    redisSlotsFree(discover->slots);
 	for (i = 0; i < discover->exclude_names; i++)
@@ -114,6 +114,8 @@ extern void redisGlobalsInit(struct dict *);
 extern void redis_series_source(redisSlots *, void *);
 extern void redis_series_mark(redisSlots *, sds, int, void *);
 extern void redis_series_metric(redisSlots *, metric_t *, sds, int, int, void *);
+extern void redis_series_batch(redisSlots *, sds, void *);
+extern void redis_series_batched(redisSlots *, void *);
 
 /*
  * Asynchronous schema load baton structures
@@ -152,6 +154,8 @@ typedef struct seriesLoadBaton {
     const char		**metrics;	/* metric specification strings */
     dict		*errors;	/* PMIDs where errors observed */
     dict		*wanted;	/* allowed metrics list PMIDs */
+    void		*stream;	/* current sample stream batch */
+    struct seriesLoadWorker *worker;	/* one of a parallel load */
 
     int			error;
     void		*arg;
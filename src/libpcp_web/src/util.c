@@ -553,6 +553,7 @@ pmwebapi_metric_hash(metric_t *metric)
     sdsfree(identifier);
 
     metric->cached = 0;
+    metric->expire = 0;	/* new stream identifiers need a TTL */
 }
 
 void
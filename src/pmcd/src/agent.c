@@ -25,6 +25,9 @@
 #if defined(HAVE_SYS_RESOURCE_H)
 #include <sys/resource.h>
 #endif
+#if defined(HAVE_POLL_H)
+#include <poll.h>
+#endif
 
 static pid_t
 waitpid_pmcd(int *status)
@@ -239,3 +242,79 @@ HarvestAgents(unsigned int total)
     sts |= HarvestAgentByParent(tp, 0);
     return sts;
 }
+
+/* Agents with a request outstanding, for AgentsReady() */
+int
+AgentBusy(const AgentInfo *ap)
+{
+    return ap->status.busy;
+}
+
+/*
+ * Wait up to timeout (forever if NULL) for input from the agents for
+ * which wanted() is true, and set status.ready for those with input.
+ * Returns the number of agents ready, 0 on timeout, or -1 on error,
+ * as for select(2).
+ *
+ * Uses poll(2) where available, as an agent (re)started once pmcd
+ * has many clients may have a descriptor beyond FD_SETSIZE.
+ */
+int
+AgentsReady(int (*wanted)(const AgentInfo *), struct timeval *timeout)
+{
+#if defined(HAVE_POLL_H)
+    static struct pollfd	*pfd;
+    static int			npfd;
+    int				msec = -1;
+    int				n = 0;
+    int				i, sts;
+
+    if (nAgents > npfd) {
+	struct pollfd	*tmp;
+
+	if ((tmp = (struct pollfd *)realloc(pfd, nAgents * sizeof(*pfd))) == NULL)
+	    pmNoMem("AgentsReady", nAgents * sizeof(*pfd), PM_FATAL_ERR);
+	pfd = tmp;
+	npfd = nAgents;
+    }
+    for (i = 0; i < nAgents; i++) {
+	agent[i].status.ready = 0;
+	if (!wanted(&agent[i]))
+	    continue;
+	pfd[n].fd = agent[i].outFd;
+	pfd[n].events = POLLIN;
+	pfd[n].revents = 0;
+	n++;
+    }
+    if (timeout != NULL)
+	msec = timeout->tv_sec * 1000 + (timeout->tv_usec + 999) / 1000;
+    if ((sts = poll(pfd, n, msec)) <= 0)
+	return sts;
+    for (i = n = 0; i < nAgents; i++) {
+	if (wanted(&agent[i]) && pfd[n++].revents != 0)
+	    agent[i].status.ready = 1;
+    }
+    return sts;
+#else
+    __pmFdSet	fds;
+    int		maxFd = -1;
+    int		i, sts;
+
+    __pmFD_ZERO(&fds);
+    for (i = 0; i < nAgents; i++) {
+	agent[i].status.ready = 0;
+	if (!wanted(&agent[i]))
+	    continue;
+	__pmFD_SET(agent[i].outFd, &fds);
+	if (agent[i].outFd > maxFd)
+	    maxFd = agent[i].outFd;
+    }
+    if ((sts = __pmSelectRead(maxFd+1, &fds, timeout)) <= 0)
+	return sts;
+    for (i = 0; i < nAgents; i++) {
+	if (wanted(&agent[i]) && __pmFD_ISSET(agent[i].outFd, &fds))
+	    agent[i].status.ready = 1;
+    }
+    return sts;
+#endif
+}
@@ -108,7 +108,15 @@ AcceptNewClient(int reqfd)
 
     pmcd_openfds_sethi(fd);
 
-    __pmFD_SET(fd, &clientFds);
+    if (eventFd < 0)
+	__pmFD_SET(fd, &clientFds);
+    else if (EventAddClient(fd, i) < 0) {
+	pmNotifyErr(LOG_ERR, "AcceptNewClient(%d): cannot watch fd %d: %s\n",
+			reqfd, fd, osstrerror());
+	client[i].fd = fd;
+	DeleteClient(&client[i]);
+	return NULL;
+    }
     __pmSetVersionIPC(fd, UNKNOWN_VERSION);	/* before negotiation */
     __pmSetSocketIPC(fd);
 
@@ -188,7 +196,10 @@ DeleteClient(ClientInfo *cp)
 	return;
     }
     if (cp->fd != -1) {
-	__pmFD_CLR(cp->fd, &clientFds);
+	if (eventFd < 0)
+	    __pmFD_CLR(cp->fd, &clientFds);
+	else
+	    EventDelClient(cp->fd);
 	__pmCloseSocket(cp->fd);
     }
     if (i == nClients-1) {
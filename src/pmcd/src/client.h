@@ -40,6 +40,7 @@ PMCD_DATA extern ClientInfo *client;		/* Array of clients */
 PMCD_DATA extern int	nClients;		/* Number of entries in array */
 extern int		maxClientFd;		/* largest fd for a client */
 extern __pmFdSet	clientFds;		/* for client select() */
+extern int		eventFd;		/* epoll descriptor, else -1 */
 PMCD_DATA extern int	this_client_id;		/* client for current request */
 
 /* prototypes */
@@ -54,4 +55,7 @@ extern int CheckAccountAccess(ClientInfo *);
 
 extern char *nameclient(int);
 
+extern int EventAddClient(int, int);
+extern void EventDelClient(int);
+
 #endif /* PMCD_CLIENT_H */
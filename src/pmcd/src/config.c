@@ -2401,6 +2401,14 @@ DupAgent(AgentInfo *dest, AgentInfo *src)
 	dest->ipc.pipe.agentPid = src->ipc.pipe.agentPid;
 }
 
+/* Agents that may have died without pmcd noticing, for AgentsReady() */
+static int
+AgentMayHaveDied(const AgentInfo *ap)
+{
+    return ap->status.connected &&
+	   (ap->ipcType == AGENT_SOCKET || ap->ipcType == AGENT_PIPE);
+}
+
 void
 ParseRestartAgents(char *fileName)
 {
@@ -2411,37 +2419,26 @@ ParseRestartAgents(char *fileName)
     AgentInfo	*oldAgent;
     int		oldNAgents;
     AgentInfo	*ap;
-    __pmFdSet	fds;
 
     /* Clean up any deceased agents.  We haven't seen an agent's death unless
      * a PDU transfer involving the agent has occurred.  This cleans up others
      * as well.
      */
-    __pmFD_ZERO(&fds);
-    j = -1;
     for (i = 0; i < nAgents; i++) {
-	ap = &agent[i];
-	if (ap->status.connected &&
-	    (ap->ipcType == AGENT_SOCKET || ap->ipcType == AGENT_PIPE)) {
-
-	    __pmFD_SET(ap->outFd, &fds);
-	    if (ap->outFd > j)
-		j = ap->outFd;
-	}
+	if (AgentMayHaveDied(&agent[i]))
+	    break;
     }
-    if (++j) {
+    if (i < nAgents) {
 	/* any agent with output ready has either closed the file descriptor or
 	 * sent an unsolicited PDU.  Clean up the agent in either case.
 	 */
 	struct timeval	timeout = {0, 0};
 
-	sts = __pmSelectRead(j, &fds, &timeout);
+	sts = AgentsReady(AgentMayHaveDied, &timeout);
 	if (sts > 0) {
 	    for (i = 0; i < nAgents; i++) {
 		ap = &agent[i];
-		if (ap->status.connected &&
-		    (ap->ipcType == AGENT_SOCKET || ap->ipcType == AGENT_PIPE) &&
-		    __pmFD_ISSET(ap->outFd, &fds)) {
+		if (AgentMayHaveDied(ap) && ap->status.ready) {
 
 		    /* try to discover more ... */
 		    __pmPDU	*pb;
@@ -339,6 +339,26 @@ SendFetch(DomPmidList *dpList, AgentInfo *aPtr, ClientInfo *cPtr, int ctxnum)
     return result;
 }
 
+/*
+ * Account for the time an agent took to service the current fetch,
+ * measured from when the request was dispatched to the agent.  The
+ * latency (usec) is returned so that the caller can identify which
+ * agent was on the critical path for the client's request.
+ */
+static __uint32_t
+FetchLatency(AgentInfo *ap)
+{
+    struct timeval	now;
+    double		usec;
+
+    pmtimevalNow(&now);
+    usec = pmtimevalSub(&now, &ap->fetchStart) * 1000000.0;
+    ap->fetchStats.last = usec > 0 ? (__uint32_t)usec : 0;
+    ap->fetchStats.time += ap->fetchStats.last;
+    ap->fetchStats.count++;
+    return ap->fetchStats.last;
+}
+
 /*
  * pmResults coming back from PMDAs have their timestamp field
  * overloaded to contain out-of-band information such as state
@@ -354,6 +374,303 @@ ExtractState(pmResult *result)
     return (int)byte;
 }
 
+/*
+ * Fetch coalescing - when pmcd_coalesce is non-zero, the most recent
+ * pmResult from each agent is kept, and a later fetch for a subset of
+ * the same pmIDs, with the same instance profile, that arrives within
+ * pmcd_coalesce milliseconds is answered from it without calling the
+ * agent again.  Agents that use client attributes (credentials or
+ * containers) only share results between clients with the same ones.
+ * The pmcd PMDA reports on pmcd itself, so is never coalesced.
+ */
+
+#define PMCD_DOMAIN	2	/* see pmns/stdpmid */
+
+/* Origin of each per-agent result in DoFetch */
+#define RESULT_NONE	0	/* not fetched, or an error result */
+#define RESULT_AGENT	1	/* a good result from the agent */
+#define RESULT_SHARED	2	/* vsets borrowed from the coalesce cache */
+
+typedef struct {
+    int			seqnum;		/* pmcd_seqnum when result was cached */
+    struct timeval	when;		/* When fetch was sent to the agent */
+    pmProfile		*profile;	/* Instance profile used for the fetch */
+    char		*identity;	/* Client attributes seen by the agent */
+    pmResult		*result;	/* The agent's result */
+} FetchCache;
+
+static FetchCache	fetchCache[MAXDOMID+1];
+static int		nCached;
+
+static int
+CanCoalesce(AgentInfo *ap)
+{
+    return pmcd_coalesce > 0 && ap->pmDomainId != PMCD_DOMAIN &&
+	   ap->status.connected && !ap->status.fenced;
+}
+
+static void
+FreeFetchCache(FetchCache *fcp)
+{
+    if (fcp->result == NULL)
+	return;
+    pmFreeResult(fcp->result);
+    __pmFreeProfile(fcp->profile);
+    if (fcp->identity)
+	free(fcp->identity);
+    memset(fcp, 0, sizeof(*fcp));
+    nCached--;
+}
+
+/*
+ * The client attributes passed on to an agent that asked for them,
+ * encoded as a string that is used to compare one client with another.
+ */
+static char *
+ClientIdentity(AgentInfo *ap, ClientInfo *cip, char *buf, size_t buflen)
+{
+    static const int	attrs[] = {
+	PCP_ATTR_USERID, PCP_ATTR_GROUPID, PCP_ATTR_CONTAINER
+    };
+    __pmHashNode	*hp;
+    size_t		len = 0;
+    int			i;
+
+    if ((ap->status.flags & (PDU_FLAG_AUTH|PDU_FLAG_CONTAINER)) == 0)
+	return NULL;
+    buf[0] = '\0';
+    for (i = 0; i < (int)(sizeof(attrs) / sizeof(attrs[0])) && len < buflen; i++) {
+	hp = __pmHashSearch(attrs[i], &cip->attrs);
+	len += pmsprintf(buf + len, buflen - len, "%d=%s;", attrs[i],
+			hp ? (char *)hp->data : "");
+    }
+    return buf;
+}
+
+static int
+ProfileEqual(const pmProfile *a, const pmProfile *b)
+{
+    const pmInDomProfile	*pa, *pb;
+    int				i;
+
+    if (a->state != b->state || a->profile_len != b->profile_len)
+	return 0;
+    for (i = 0; i < a->profile_len; i++) {
+	pa = &a->profile[i];
+	pb = &b->profile[i];
+	if (pa->indom != pb->indom || pa->state != pb->state ||
+	    pa->instances_len != pb->instances_len)
+	    return 0;
+	if (pa->instances_len > 0 &&
+	    memcmp(pa->instances, pb->instances, pa->instances_len * sizeof(int)) != 0)
+	    return 0;
+    }
+    return 1;
+}
+
+static pmProfile *
+DupProfile(const pmProfile *profile)
+{
+    pmProfile		*dup;
+    pmInDomProfile	*p;
+    size_t		need;
+    int			i;
+
+    if ((dup = (pmProfile *)calloc(1, sizeof(pmProfile))) == NULL)
+	return NULL;
+    dup->state = profile->state;
+    if (profile->profile_len == 0)
+	return dup;
+    need = profile->profile_len * sizeof(pmInDomProfile);
+    if ((dup->profile = (pmInDomProfile *)calloc(1, need)) == NULL) {
+	free(dup);
+	return NULL;
+    }
+    dup->profile_len = profile->profile_len;
+    for (i = 0; i < profile->profile_len; i++) {
+	p = &dup->profile[i];
+	*p = profile->profile[i];
+	p->instances = NULL;
+	if (p->instances_len == 0)
+	    continue;
+	need = p->instances_len * sizeof(int);
+	if ((p->instances = (int *)malloc(need)) == NULL) {
+	    p->instances_len = 0;
+	    __pmFreeProfile(dup);
+	    return NULL;
+	}
+	memcpy(p->instances, profile->profile[i].instances, need);
+    }
+    return dup;
+}
+
+/*
+ * DSO agents reuse their pmResult on the next fetch, so take a private
+ * copy with all pmValueBlocks individually allocated (PM_VAL_DPTR) so
+ * that pmFreeResult can release it later.
+ */
+static pmResult *
+DupResult(const pmResult *result)
+{
+    pmResult		*dup;
+    pmValueSet		*vsp, *nvsp;
+    pmValueBlock	*vbp;
+    size_t		need;
+    int			i, j;
+
+    need = sizeof(pmResult) + (result->numpmid - 1) * sizeof(pmValueSet *);
+    if ((dup = (pmResult *)malloc(need)) == NULL)
+	return NULL;
+    dup->timestamp = result->timestamp;
+    dup->numpmid = 0;
+    for (i = 0; i < result->numpmid; i++) {
+	vsp = result->vset[i];
+	need = sizeof(pmValueSet);
+	if (vsp->numval > 1)
+	    need += (vsp->numval - 1) * sizeof(pmValue);
+	if ((nvsp = (pmValueSet *)malloc(need)) == NULL)
+	    goto fail;
+	memcpy(nvsp, vsp, need);
+	dup->vset[dup->numpmid++] = nvsp;
+	if (vsp->numval <= 0 || vsp->valfmt == PM_VAL_INSITU)
+	    continue;
+	nvsp->valfmt = PM_VAL_DPTR;
+	for (j = 0; j < vsp->numval; j++) {
+	    need = vsp->vlist[j].value.pval->vlen;
+	    if ((vbp = (pmValueBlock *)malloc(need)) == NULL) {
+		nvsp->numval = j;
+		goto fail;
+	    }
+	    memcpy(vbp, vsp->vlist[j].value.pval, need);
+	    nvsp->vlist[j].value.pval = vbp;
+	}
+    }
+    return dup;
+
+fail:
+    pmFreeResult(dup);
+    return NULL;
+}
+
+/*
+ * Look for a recent result from this agent that can answer the fetch.
+ * If found, return a pmResult with the requested pmValueSets borrowed
+ * from the cached result (so only the pmResult itself is to be freed).
+ */
+static pmResult *
+CoalesceLookup(DomPmidList *dpList, AgentInfo *ap, ClientInfo *cip,
+		pmProfile *profile, struct timeval *now)
+{
+    FetchCache	*fcp = &fetchCache[ap->pmDomainId];
+    pmResult	*result;
+    char	buf[256], *identity;
+    size_t	need;
+    int		i, j, k;
+
+    if (fcp->result == NULL)
+	goto miss;
+    if (fcp->seqnum != pmcd_seqnum ||
+	pmtimevalSub(now, &fcp->when) * 1000.0 > (double)pmcd_coalesce) {
+	FreeFetchCache(fcp);
+	goto miss;
+    }
+    if (!ProfileEqual(profile, fcp->profile))
+	goto miss;
+    identity = ClientIdentity(ap, cip, buf, sizeof(buf));
+    if ((identity == NULL) != (fcp->identity == NULL) ||
+	(identity != NULL && strcmp(identity, fcp->identity) != 0))
+	goto miss;
+
+    need = sizeof(pmResult) + (dpList->listSize - 1) * sizeof(pmValueSet *);
+    if ((result = (pmResult *)malloc(need)) == NULL)
+	goto miss;
+    result->timestamp = fcp->result->timestamp;
+    result->numpmid = dpList->listSize;
+    /*
+     * pmIDs usually come back in the order they were last requested,
+     * so start each search where the previous one matched.
+     */
+    for (i = j = 0; i < dpList->listSize; i++) {
+	for (k = 0; k < fcp->result->numpmid; k++, j++) {
+	    if (j == fcp->result->numpmid)
+		j = 0;
+	    if (fcp->result->vset[j]->pmid == dpList->list[i])
+		break;
+	}
+	if (k == fcp->result->numpmid) {
+	    free(result);
+	    goto miss;
+	}
+	result->vset[i] = fcp->result->vset[j];
+    }
+    ap->fetchStats.hit++;
+    if (pmDebugOptions.appl0)
+	fprintf(stderr, "DoFetch: coalesced %d metrics from \"%s\" agent\n",
+		dpList->listSize, ap->pmDomainLabel);
+    return result;
+
+miss:
+    ap->fetchStats.miss++;
+    return NULL;
+}
+
+/*
+ * Keep the agent's result for later fetches.  Returns non-zero if
+ * the result itself was kept (and must not be freed by the caller).
+ */
+static int
+CoalesceSave(AgentInfo *ap, ClientInfo *cip, pmProfile *profile,
+		pmResult *result)
+{
+    FetchCache	*fcp = &fetchCache[ap->pmDomainId];
+    pmProfile	*dupprof;
+    pmResult	*dupres;
+    char	buf[256], *identity;
+
+    if ((dupprof = DupProfile(profile)) == NULL)
+	return 0;
+    if ((identity = ClientIdentity(ap, cip, buf, sizeof(buf))) != NULL &&
+	(identity = strdup(identity)) == NULL) {
+	__pmFreeProfile(dupprof);
+	return 0;
+    }
+    if (ap->ipcType != AGENT_DSO)
+	dupres = result;		/* decoded from a PDU, just keep it */
+    else if ((dupres = DupResult(result)) == NULL) {
+	__pmFreeProfile(dupprof);
+	if (identity)
+	    free(identity);
+	return 0;
+    }
+    FreeFetchCache(fcp);
+    fcp->seqnum = pmcd_seqnum;
+    fcp->when = ap->fetchStart;
+    fcp->profile = dupprof;
+    fcp->identity = identity;
+    fcp->result = dupres;
+    nCached++;
+    return dupres == result;
+}
+
+/*
+ * Forget the result kept for this agent, after a store to it, so the
+ * next fetch sees the stored values.
+ */
+void
+CoalesceForget(AgentInfo *ap)
+{
+    FreeFetchCache(&fetchCache[ap->pmDomainId]);
+}
+
+static void
+CoalesceFlush(void)
+{
+    int		i;
+
+    for (i = 0; i <= MAXDOMID && nCached > 0; i++)
+	FreeFetchCache(&fetchCache[i]);
+}
+
 int
 DoFetch(ClientInfo *cip, __pmPDU* pb)
 {
@@ -370,28 +687,36 @@ DoFetch(ClientInfo *cip, __pmPDU* pb)
     static int		nDoms = 0;
     static pmResult	**results = NULL;
     static int		*resIndex = NULL;
-    __pmFdSet		waitFds;
-    __pmFdSet		readyFds;
+    static int		*origin = NULL;
     int			nWait;
-    int			maxFd;
+    int			nDispatch;
+    int			pass;
+    int			slowest = -1;
+    __uint32_t		latency;
+    __uint32_t		maxLatency = 0;
     struct timeval	timeout;
     __pmHashCtl		*hcp;
     __pmHashNode	*hp;
     pmProfile		*profile;
+    struct timeval	now;
 
     if (nAgents > nDoms) {
 	if (results != NULL)
 	    free(results);
 	if (resIndex != NULL)
 	    free(resIndex);
+	if (origin != NULL)
+	    free(origin);
 	results = (pmResult **)malloc((nAgents + 1) * sizeof (pmResult *));
 	resIndex = (int *)malloc((nAgents + 1) * sizeof(int));
-	if (results == NULL || resIndex == NULL) {
-	    pmNoMem("DoFetch.results", (nAgents + 1) * sizeof (pmResult *) + (nAgents + 1) * sizeof(int), PM_FATAL_ERR);
+	origin = (int *)malloc((nAgents + 1) * sizeof(int));
+	if (results == NULL || resIndex == NULL || origin == NULL) {
+	    pmNoMem("DoFetch.results", (nAgents + 1) * sizeof (pmResult *) + 2 * (nAgents + 1) * sizeof(int), PM_FATAL_ERR);
 	}
 	nDoms = nAgents;
     }
     memset(results, 0, (nAgents + 1) * sizeof(results[0]));
+    memset(origin, 0, (nAgents + 1) * sizeof(origin[0]));
 
     sts = __pmDecodeFetch(pb, &ctxnum, &when, &nPmids, &pmidList);
     if (sts < 0)
@@ -427,27 +752,53 @@ DoFetch(ClientInfo *cip, __pmPDU* pb)
 
     dList = SplitPmidList(nPmids, pmidList);
 
+    if (pmcd_coalesce > 0)
+	pmtimevalNow(&now);
+    else if (nCached > 0)
+	CoalesceFlush();
+
     /* For each domain in the split pmidList, dispatch the per-domain subset
-     * of pmIDs to the appropriate agent.  For DSO agents, the pmResult will
-     * come back immediately.  If a request cannot be sent to an agent, a
-     * suitable pmResult (containing metric not available values) will be
-     * returned.
+     * of pmIDs to the appropriate agent.  This is done in two passes - the
+     * first sends the fetch PDUs to all daemon agents, the second calls the
+     * DSO agents (for which the pmResult will come back immediately).  So
+     * all of the daemon agents are working on their results concurrently
+     * while pmcd is busy inside the DSOs, rather than waiting until after
+     * every DSO agent earlier in the list has been serviced.  If a request
+     * cannot be sent to an agent, a suitable pmResult (containing metric
+     * not available values) will be returned.  Agents that returned the
+     * requested metrics very recently may be skipped altogether (see
+     * CoalesceLookup above).
      */
-    __pmFD_ZERO(&waitFds);
     nWait = 0;
-    maxFd = -1;
-    for (i = 0; dList[i].domain != -1; i++) {
-	j = mapdom[dList[i].domain];
-	results[j] = SendFetch(&dList[i], &agent[j], cip, ctxnum);
-	if (results[j] == NULL) { /* Wait for agent's response */
-	    int fd = agent[j].outFd;
-	    agent[j].status.busy = 1;
-	    __pmFD_SET(fd, &waitFds);
-	    if (fd > maxFd)
-		maxFd = fd;
-	    nWait++;
-	} else {
-	    changes |= ExtractState(results[j]);
+    nDispatch = 0;
+    for (pass = 0; pass < 2; pass++) {
+	for (i = 0; dList[i].domain != -1; i++) {
+	    j = mapdom[dList[i].domain];
+	    if ((agent[j].ipcType == AGENT_DSO) != pass)
+		continue;
+	    if (CanCoalesce(&agent[j]) &&
+		(results[j] = CoalesceLookup(&dList[i], &agent[j], cip,
+					     profile, &now)) != NULL) {
+		origin[j] = RESULT_SHARED;
+		continue;
+	    }
+	    nDispatch++;
+	    pmtimevalNow(&agent[j].fetchStart);
+	    results[j] = SendFetch(&dList[i], &agent[j], cip, ctxnum);
+	    if (results[j] == NULL) { /* Wait for agent's response */
+		agent[j].status.busy = 1;
+		nWait++;
+	    } else {
+		if (pass == 1) {
+		    if ((latency = FetchLatency(&agent[j])) >= maxLatency) {
+			maxLatency = latency;
+			slowest = j;
+		    }
+		    if (!agent[j].status.madeDsoResult)
+			origin[j] = RESULT_AGENT;
+		}
+		changes |= ExtractState(results[j]);
+	    }
 	}
     }
     /* Construct pmResult for bad-pmID list */
@@ -456,14 +807,13 @@ DoFetch(ClientInfo *cip, __pmPDU* pb)
 
     /* Wait for results to roll in from agents */
     while (nWait > 0) {
-        __pmFD_COPY(&readyFds, &waitFds);
 	if (nWait > 1) {
 	    timeout.tv_sec = pmcd_timeout;
 	    timeout.tv_usec = 0;
 
             retry:
 	    setoserror(0);
-	    sts = __pmSelectRead(maxFd+1, &readyFds, &timeout);
+	    sts = AgentsReady(AgentBusy, &timeout);
 
 	    if (sts == 0) {
 		pmNotifyErr(LOG_INFO, "DoFetch: select timeout");
@@ -478,6 +828,10 @@ DoFetch(ClientInfo *cip, __pmPDU* pb)
 			results[i] = MakeBadResult(dList[j].listSize,
 						   dList[j].list,
 						   PM_ERR_NOAGENT);
+			if ((latency = FetchLatency(&agent[i])) >= maxLatency) {
+			    maxLatency = latency;
+			    slowest = i;
+			}
 			pmcd_trace(TR_RECV_TIMEOUT, agent[i].outFd, PDU_RESULT, 0);
 			CleanupAgent(&agent[i], AT_COMM, agent[i].inFd);
 		    }
@@ -494,23 +848,32 @@ DoFetch(ClientInfo *cip, __pmPDU* pb)
 		exit(1);
 	    }
 	}
+	else {
+	    /* only one agent to wait for, __pmGetPDU does the waiting */
+	    for (i = 0; i < nAgents; i++)
+		agent[i].status.ready = agent[i].status.busy;
+	}
 
 	/* Read results from agents that have them ready */
 	for (i = 0; i < nAgents; i++) {
 	    AgentInfo	*ap = &agent[i];
 	    int		pinpdu;
-	    if (!ap->status.busy || !__pmFD_ISSET(ap->outFd, &readyFds))
+	    if (!ap->status.busy || !ap->status.ready)
 		continue;
 	    ap->status.busy = 0;
-	    __pmFD_CLR(ap->outFd, &waitFds);
 	    nWait--;
 	    pinpdu = sts = __pmGetPDU(ap->outFd, ANY_SIZE, pmcd_timeout, &pb);
+	    if ((latency = FetchLatency(ap)) >= maxLatency) {
+		maxLatency = latency;
+		slowest = i;
+	    }
 	    if (sts > 0)
 		pmcd_trace(TR_RECV_PDU, ap->outFd, sts, (int)((__psint_t)pb & 0xffffffff));
 	    if (sts == PDU_RESULT) {
 		if ((sts = __pmDecodeResult(pb, &results[i])) >= 0) {
 		    if (results[i]->numpmid == aFreq[i]) {
 			changes |= ExtractState(results[i]);
+			origin[i] = RESULT_AGENT;
 		    } else {
 			if (pmDebugOptions.appl0)
 			    pmNotifyErr(LOG_ERR, "DoFetch: \"%s\" agent given %d pmIDs, returned %d\n",
@@ -565,6 +928,10 @@ DoFetch(ClientInfo *cip, __pmPDU* pb)
 	}
     }
 
+    /* Only interesting to report the slowest agent if there was a choice */
+    if (nDispatch > 1 && slowest >= 0)
+	agent[slowest].fetchStats.critical++;
+
     if (changes)
 	MarkStateChanges(changes);
 
@@ -600,10 +967,19 @@ DoFetch(ClientInfo *cip, __pmPDU* pb)
     }
 
     /*
-     * pmFreeResult() all the accumulated results.
+     * pmFreeResult() all the accumulated results, or keep them for
+     * coalescing with subsequent fetches.
      */
     for (i = 0; dList[i].domain != -1; i++) {
 	j = mapdom[dList[i].domain];
+	if (origin[j] == RESULT_SHARED) {
+	    /* pmValueSets belong to the coalesce cache */
+	    free(results[j]);
+	    continue;
+	}
+	if (origin[j] == RESULT_AGENT && CanCoalesce(&agent[j]) &&
+	    CoalesceSave(&agent[j], cip, profile, results[j]))
+	    continue;
 	if (agent[j].ipcType == AGENT_DSO && agent[j].status.connected &&
 	    !agent[j].status.madeDsoResult)
 	    /* Living DSO's manage their own pmResult skeleton unless
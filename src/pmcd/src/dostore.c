@@ -134,10 +134,7 @@ DoStore(ClientInfo *cp, __pmPDU* pb)
     pmResult	*result;
     pmResult	**dResult;
     int		i;
-    __pmFdSet	readyFds;
-    __pmFdSet	waitFds;
     int		nWait = 0;
-    int		maxFd = -1;
     int		badStore;		/* != 0 => store to nonexistent agent */
     int		notReady = 0;		/* != 0 => store to agent that's not ready */
     struct timeval	timeout;
@@ -150,12 +147,11 @@ DoStore(ClientInfo *cp, __pmPDU* pb)
 
     /* Send the per-domain results to their respective agents */
 
-    __pmFD_ZERO(&waitFds);
     for (i = 0; dResult[i]->numpmid > 0; i++) {
-	int fd;
 	ap = pmcd_agent(((__pmID_int *)&dResult[i]->vset[0]->pmid)->domain);
 	/* If it's in a "good" list, pmID has agent that is connected */
 	assert(ap != NULL);
+	CoalesceForget(ap);
 
 	if (ap->ipcType == AGENT_DSO) {
 	    if (ap->ipc.dso.dispatch.comm.pmda_interface >= PMDA_INTERFACE_5)
@@ -170,10 +166,6 @@ DoStore(ClientInfo *cp, __pmPDU* pb)
 		s = __pmSendResult(ap->inFd, cp - client, dResult[i]);
 		if (s >= 0) {
 		    ap->status.busy = 1;
-		    fd = ap->outFd;
-		    __pmFD_SET(fd, &waitFds);
-		    if (fd > maxFd)
-			maxFd = fd;
 		    nWait++;
 		}
 		else if (s == PM_ERR_IPC || sts == PM_ERR_TIMEOUT || s == -EPIPE) {
@@ -200,14 +192,13 @@ DoStore(ClientInfo *cp, __pmPDU* pb)
     /* Collect error PDUs containing store status from each active agent */
 
     while (nWait > 0) {
-        __pmFD_COPY(&readyFds, &waitFds);
 	if (nWait > 1) {
 	    timeout.tv_sec = pmcd_timeout;
 	    timeout.tv_usec = 0;
 
 	    retry:
 	    setoserror(0);
-	    s = __pmSelectRead(maxFd+1, &readyFds, &timeout);
+	    s = AgentsReady(AgentBusy, &timeout);
 
 	    if (s == 0) {
 		pmNotifyErr(LOG_INFO, "DoStore: select timeout");
@@ -232,14 +223,18 @@ DoStore(ClientInfo *cp, __pmPDU* pb)
 		exit(1);
 	    }
 	}
+	else {
+	    /* only one agent to wait for, __pmGetPDU does the waiting */
+	    for (i = 0; i < nAgents; i++)
+		agent[i].status.ready = agent[i].status.busy;
+	}
 
 	for (i = 0; i < nAgents; i++) {
 	    int		pinpdu;
 	    ap = &agent[i];
-	    if (!ap->status.busy || !__pmFD_ISSET(ap->outFd, &readyFds))
+	    if (!ap->status.busy || !ap->status.ready)
 		continue;
 	    ap->status.busy = 0;
-	    __pmFD_CLR(ap->outFd, &waitFds);
 	    nWait--;
 	    pinpdu = s = __pmGetPDU(ap->outFd, ANY_SIZE, pmcd_timeout, &pb);
 	    if (s > 0)
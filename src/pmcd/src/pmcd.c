@@ -17,6 +17,9 @@
 #include "libpcp.h"
 #include <sys/stat.h>
 #include <assert.h>
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
 
 #define PMDAROOT	1	/* domain identifier for pmdaroot(1) */
 #define SHUTDOWNWAIT	15	/* PMDAs wait time, in 10msec increments */
@@ -53,6 +56,14 @@ static uid_t	killer_uid;
 #endif
 static int	killer_sig;
 
+int		eventFd = -1;		/* epoll(7) descriptor, else select(2) */
+
+/* Types of descriptor registered with eventFd, see EventCtl() */
+#define EVENT_REQUEST	1		/* request port - new client pending */
+#define EVENT_CLIENT	2		/* connected client - PDU pending */
+#define EVENT_AGENT	3		/* not ready agent - PDU pending */
+#define MAXEVENTS	128		/* maximum events per ClientLoop wakeup */
+
 static void
 DontStart(void)
 {
@@ -105,6 +116,7 @@ static pmLongOptions longopts[] = {
     { "", 1, 'L', "BYTES", "maximum size for PDUs from clients [default 65536]" },
     { "", 1, 'q', "TIME", "PMDA initial negotiation timeout (seconds) [default 3]" },
     { "", 1, 't', "TIME", "PMDA response timeout (seconds) [default 5]" },
+    { "", 1, 'w', "MSEC", "coalesce PMDA fetches within this window [default 0, off]" },
     { "verify", 0, 'v', 0, "check validity of pmcd configuration, then exit" },
     PMAPI_OPTIONS_HEADER("Connection options"),
     { "interface", 1, 'i', "ADDR", "accept connections on this IP address" },
@@ -121,7 +133,7 @@ static pmLongOptions longopts[] = {
 
 static pmOptions opts = {
     .flags = PM_OPTFLAG_POSIX,
-    .short_options = "Ac:C:D:fH:i:l:L:M:N:n:p:P:q:Qs:St:T:U:vx:?",
+    .short_options = "Ac:C:D:fH:i:l:L:M:N:n:p:P:q:Qs:St:T:U:vw:x:?",
     .long_options = longopts,
 };
 
@@ -267,6 +279,17 @@ ParseOptions(int argc, char *argv[], int *nports)
 		username = opts.optarg;
 		break;
 
+	    case 'w':
+		val = (int)strtol(opts.optarg, &endptr, 10);
+		if (*endptr != '\0' || val < 0) {
+		    pmprintf("%s: -w requires a positive numeric argument\n",
+			pmGetProgname());
+		    opts.errors++;
+		} else {
+		    pmcd_coalesce = val;
+		}
+		break;
+
 	    case 'v':
 		verify = 1;
 		break;
@@ -299,136 +322,144 @@ ParseOptions(int argc, char *argv[], int *nports)
 }
 
 /*
- * Determine which clients (if any) have sent data to the server and handle it
- * as required.
+ * Read and handle one PDU that the client in slot i has sent to the server.
  */
-void
-HandleClientInput(__pmFdSet *fdsPtr)
+static void
+HandleClientPDU(int i)
 {
     int		sts;
-    int		i;
+    int		pinpdu;
     __pmPDU	*pb;
     __pmPDUHdr	*php;
     ClientInfo	*cp;
 
-    for (i = 0; i < nClients; i++) {
-	int		pinpdu;
+    cp = &client[i];
+    this_client_id = i;
 
-	if (!client[i].status.connected || !__pmFD_ISSET(client[i].fd, fdsPtr))
-	    continue;
+    pinpdu = sts = __pmGetPDU(cp->fd, LIMIT_SIZE, pmcd_timeout, &pb);
+    if (sts > 0) {
+	pmcd_trace(TR_RECV_PDU, cp->fd, sts, (int)((__psint_t)pb & 0xffffffff));
+    } else {
+	CleanupClient(cp, sts);
+	return;
+    }
 
-	cp = &client[i];
-	this_client_id = i;
+    php = (__pmPDUHdr *)pb;
+    if (__pmVersionIPC(cp->fd) == UNKNOWN_VERSION && php->type != PDU_CREDS) {
+	/* old V1 client protocol, no longer supported */
+	sts = PM_ERR_IPC;
+	CleanupClient(cp, sts);
+	__pmUnpinPDUBuf(pb);
+	return;
+    }
 
-	pinpdu = sts = __pmGetPDU(cp->fd, LIMIT_SIZE, pmcd_timeout, &pb);
-	if (sts > 0) {
-	    pmcd_trace(TR_RECV_PDU, cp->fd, sts, (int)((__psint_t)pb & 0xffffffff));
-	} else {
-	    CleanupClient(cp, sts);
-	    continue;
-	}
+    if (pmDebugOptions.appl0)
+	ShowClients(stderr);
 
-	php = (__pmPDUHdr *)pb;
-	if (__pmVersionIPC(cp->fd) == UNKNOWN_VERSION && php->type != PDU_CREDS) {
-	    /* old V1 client protocol, no longer supported */
-	    sts = PM_ERR_IPC;
-	    CleanupClient(cp, sts);
-	    __pmUnpinPDUBuf(pb);
-	    continue;
-	}
+    switch (php->type) {
+	case PDU_PROFILE:
+	    sts = (cp->denyOps & PMCD_OP_FETCH) ?
+		  PM_ERR_PERMISSION : DoProfile(cp, pb);
+	    break;
 
-	if (pmDebugOptions.appl0)
-	    ShowClients(stderr);
+	case PDU_FETCH:
+	    sts = (cp->denyOps & PMCD_OP_FETCH) ?
+		  PM_ERR_PERMISSION : DoFetch(cp, pb);
+	    break;
 
-	switch (php->type) {
-	    case PDU_PROFILE:
-		sts = (cp->denyOps & PMCD_OP_FETCH) ?
-		      PM_ERR_PERMISSION : DoProfile(cp, pb);
-		break;
+	case PDU_INSTANCE_REQ:
+	    sts = (cp->denyOps & PMCD_OP_FETCH) ?
+		  PM_ERR_PERMISSION : DoInstance(cp, pb);
+	    break;
 
-	    case PDU_FETCH:
-		sts = (cp->denyOps & PMCD_OP_FETCH) ?
-		      PM_ERR_PERMISSION : DoFetch(cp, pb);
-		break;
+	case PDU_LABEL_REQ:
+	    sts = (cp->denyOps & PMCD_OP_FETCH) ?
+		  PM_ERR_PERMISSION : DoLabel(cp, pb);
+	    break;
 
-	    case PDU_INSTANCE_REQ:
-		sts = (cp->denyOps & PMCD_OP_FETCH) ?
-		      PM_ERR_PERMISSION : DoInstance(cp, pb);
-		break;
+	case PDU_DESC_REQ:
+	    sts = (cp->denyOps & PMCD_OP_FETCH) ?
+		  PM_ERR_PERMISSION : DoDesc(cp, pb);
+	    break;
 
-	    case PDU_LABEL_REQ:
-		sts = (cp->denyOps & PMCD_OP_FETCH) ?
-		      PM_ERR_PERMISSION : DoLabel(cp, pb);
-		break;
+	case PDU_TEXT_REQ:
+	    sts = (cp->denyOps & PMCD_OP_FETCH) ?
+		  PM_ERR_PERMISSION : DoText(cp, pb);
+	    break;
 
-	    case PDU_DESC_REQ:
-		sts = (cp->denyOps & PMCD_OP_FETCH) ?
-		      PM_ERR_PERMISSION : DoDesc(cp, pb);
-		break;
+	case PDU_RESULT:
+	    sts = (cp->denyOps & PMCD_OP_STORE) ?
+		  PM_ERR_PERMISSION : DoStore(cp, pb);
+	    break;
 
-	    case PDU_TEXT_REQ:
-		sts = (cp->denyOps & PMCD_OP_FETCH) ?
-		      PM_ERR_PERMISSION : DoText(cp, pb);
-		break;
+	case PDU_PMNS_IDS:
+	    sts = (cp->denyOps & PMCD_OP_FETCH) ?
+		  PM_ERR_PERMISSION : DoPMNSIDs(cp, pb);
+	    break;
 
-	    case PDU_RESULT:
-		sts = (cp->denyOps & PMCD_OP_STORE) ?
-		      PM_ERR_PERMISSION : DoStore(cp, pb);
-		break;
+	case PDU_PMNS_NAMES:
+	    sts = (cp->denyOps & PMCD_OP_FETCH) ?
+		  PM_ERR_PERMISSION : DoPMNSNames(cp, pb);
+	    break;
 
-	    case PDU_PMNS_IDS:
-		sts = (cp->denyOps & PMCD_OP_FETCH) ?
-		      PM_ERR_PERMISSION : DoPMNSIDs(cp, pb);
-		break;
+	case PDU_PMNS_CHILD:
+	    sts = (cp->denyOps & PMCD_OP_FETCH) ?
+		  PM_ERR_PERMISSION : DoPMNSChild(cp, pb);
+	    break;
 
-	    case PDU_PMNS_NAMES:
-		sts = (cp->denyOps & PMCD_OP_FETCH) ?
-		      PM_ERR_PERMISSION : DoPMNSNames(cp, pb);
-		break;
+	case PDU_PMNS_TRAVERSE:
+	    sts = (cp->denyOps & PMCD_OP_FETCH) ?
+		  PM_ERR_PERMISSION : DoPMNSTraverse(cp, pb);
+	    break;
 
-	    case PDU_PMNS_CHILD:
-		sts = (cp->denyOps & PMCD_OP_FETCH) ?
-		      PM_ERR_PERMISSION : DoPMNSChild(cp, pb);
-		break;
+	case PDU_CREDS:
+	    sts = DoCreds(cp, pb);
+	    break;
 
-	    case PDU_PMNS_TRAVERSE:
-		sts = (cp->denyOps & PMCD_OP_FETCH) ?
-		      PM_ERR_PERMISSION : DoPMNSTraverse(cp, pb);
-		break;
+	default:
+	    sts = PM_ERR_IPC;
+    }
+    if (sts < 0) {
+	if (pmDebugOptions.appl0)
+	    fprintf(stderr, "PDU:  %s client[%d]: %s\n",
+		__pmPDUTypeStr(php->type), i, pmErrStr(sts));
+	/* Make sure client still alive before sending. */
+	if (cp->status.connected) {
+	    pmcd_trace(TR_XMIT_PDU, cp->fd, PDU_ERROR, sts);
+	    sts = __pmSendError(cp->fd, FROM_ANON, sts);
+	    if (sts < 0)
+		pmNotifyErr(LOG_ERR, "HandleClientInput: "
+		    "error sending Error PDU to client[%d] %s\n", i, pmErrStr(sts));
+	}
+    }
+    if (pinpdu > 0)
+	__pmUnpinPDUBuf(pb);
 
-	    case PDU_CREDS:
-		sts = DoCreds(cp, pb);
-		break;
+    /*
+     * May need to send connection attributes to interested PMDAs, if
+     * something changed for this client during this PDU exchange.
+     */
+    if (client[i].status.attributes) {
+	if (pmDebugOptions.appl1)
+	    pmNotifyErr(LOG_INFO, "Client idx=%d,seq=%d attrs reset\n",
+			    i, client[i].seq);
+	AgentsAttributes(i);
+    }
+}
 
-	    default:
-		sts = PM_ERR_IPC;
-	}
-	if (sts < 0) {
-	    if (pmDebugOptions.appl0)
-		fprintf(stderr, "PDU:  %s client[%d]: %s\n",
-		    __pmPDUTypeStr(php->type), i, pmErrStr(sts));
-	    /* Make sure client still alive before sending. */
-	    if (cp->status.connected) {
-		pmcd_trace(TR_XMIT_PDU, cp->fd, PDU_ERROR, sts);
-		sts = __pmSendError(cp->fd, FROM_ANON, sts);
-		if (sts < 0)
-		    pmNotifyErr(LOG_ERR, "HandleClientInput: "
-			"error sending Error PDU to client[%d] %s\n", i, pmErrStr(sts));
-	    }
-	}
-	if (pinpdu > 0)
-	    __pmUnpinPDUBuf(pb);
+/*
+ * Determine which clients (if any) have sent data to the server and handle it
+ * as required.
+ */
+void
+HandleClientInput(__pmFdSet *fdsPtr)
+{
+    int		i;
 
-	/*
-	 * May need to send connection attributes to interested PMDAs, if
-	 * something changed for this client during this PDU exchange.
-	 */
-	if (client[i].status.attributes) {
-	    if (pmDebugOptions.appl1)
-		pmNotifyErr(LOG_INFO, "Client idx=%d,seq=%d attrs reset\n",
-				i, client[i].seq);
-	    AgentsAttributes(i);
-	}
+    for (i = 0; i < nClients; i++) {
+	if (!client[i].status.connected || !__pmFD_ISSET(client[i].fd, fdsPtr))
+	    continue;
+	HandleClientPDU(i);
     }
 }
 
@@ -576,10 +607,8 @@ SignalReloadPMNS(void)
     /* Reload PMNS if necessary. 
      * Note: this will only stat() the base name i.e. ASCII pmns,
      * typically $PCP_VAR_DIR/pmns/root and not $PCP_VAR_DIR/pmns/root.bin .
-     * This is considered a very low risk problem, as the binary
-     * PMNS is always compiled from the ASCII version;
-     * when one changes so should the other.
-     * This caveat was allowed to make the code a lot simpler. 
+     * This is sufficient, as the compiled PMNS image is only used
+     * when it was built from the current version of the ASCII file.
      */
     if (__pmHasPMNSFileChanged(pmnsfile)) {
 	pmNotifyErr(LOG_INFO, "Reloading PMNS \"%s\"",
@@ -597,70 +626,78 @@ SignalReloadPMNS(void)
     }
 }
 
+/* Process I/O on the file descriptor from an agent that was marked as not
+ * ready to handle PDUs, returning 1 if the agent is now ready.
+ */
+static int
+HandleReadyAgent(AgentInfo *ap)
+{
+    int		s, sts;
+    int		fd = ap->outFd;
+    int		reason;
+    int		pinpdu;
+    int		ready = 0;
+    __pmPDU	*pb;
+
+    /* Expect an error PDU containing PM_ERR_PMDAREADY */
+    reason = AT_COMM;	/* most errors are protocol failures */
+    pinpdu = sts = __pmGetPDU(ap->outFd, ANY_SIZE, pmcd_timeout, &pb);
+    if (sts > 0)
+	pmcd_trace(TR_RECV_PDU, ap->outFd, sts, (int)((__psint_t)pb & 0xffffffff));
+    if (sts == PDU_ERROR) {
+	s = __pmDecodeError(pb, &sts);
+	if (s < 0) {
+	    sts = s;
+	    pmcd_trace(TR_RECV_ERR, ap->outFd, PDU_ERROR, sts);
+	}
+	else {
+	    /* sts is the status code from the error PDU */
+	    if (pmDebugOptions.appl0)
+		pmNotifyErr(LOG_INFO,
+		     "%s agent (not ready) sent %s status(%d)\n",
+		     ap->pmDomainLabel,
+		     sts == PM_ERR_PMDAREADY ?
+				 "ready" : "unknown", sts);
+	    if (sts == PM_ERR_PMDAREADY) {
+		ap->status.notReady = 0;
+		sts = 1;
+		ready++;
+	    }
+	    else {
+		pmcd_trace(TR_RECV_ERR, ap->outFd, PDU_ERROR, sts);
+		sts = PM_ERR_IPC;
+	    }
+	}
+    }
+    else {
+	if (sts < 0)
+	    pmcd_trace(TR_RECV_ERR, ap->outFd, PDU_RESULT, sts);
+	else
+	    pmcd_trace(TR_WRONG_PDU, ap->outFd, PDU_ERROR, sts);
+	sts = PM_ERR_IPC; /* Wrong PDU type */
+    }
+    if (pinpdu > 0)
+	__pmUnpinPDUBuf(pb);
+
+    if (ap->ipcType != AGENT_DSO && sts <= 0)
+	CleanupAgent(ap, reason, fd);
+    return ready;
+}
+
 /* Process I/O on file descriptors from agents that were marked as not ready
  * to handle PDUs.
  */
 static int
 HandleReadyAgents(__pmFdSet *readyFds)
 {
-    int		i, s, sts;
-    int		fd;
-    int		reason;
+    int		i;
     int		ready = 0;
     AgentInfo	*ap;
-    __pmPDU	*pb;
 
     for (i = 0; i < nAgents; i++) {
 	ap = &agent[i];
-	if (ap->status.notReady) {
-	    fd = ap->outFd;
-	    if (__pmFD_ISSET(fd, readyFds)) {
-		int		pinpdu;
-
-		/* Expect an error PDU containing PM_ERR_PMDAREADY */
-		reason = AT_COMM;	/* most errors are protocol failures */
-		pinpdu = sts = __pmGetPDU(ap->outFd, ANY_SIZE, pmcd_timeout, &pb);
-		if (sts > 0)
-		    pmcd_trace(TR_RECV_PDU, ap->outFd, sts, (int)((__psint_t)pb & 0xffffffff));
-		if (sts == PDU_ERROR) {
-		    s = __pmDecodeError(pb, &sts);
-		    if (s < 0) {
-			sts = s;
-			pmcd_trace(TR_RECV_ERR, ap->outFd, PDU_ERROR, sts);
-		    }
-		    else {
-			/* sts is the status code from the error PDU */
-			if (pmDebugOptions.appl0)
-			    pmNotifyErr(LOG_INFO,
-				 "%s agent (not ready) sent %s status(%d)\n",
-				 ap->pmDomainLabel,
-				 sts == PM_ERR_PMDAREADY ?
-					     "ready" : "unknown", sts);
-			if (sts == PM_ERR_PMDAREADY) {
-			    ap->status.notReady = 0;
-			    sts = 1;
-			    ready++;
-			}
-			else {
-			    pmcd_trace(TR_RECV_ERR, ap->outFd, PDU_ERROR, sts);
-			    sts = PM_ERR_IPC;
-			}
-		    }
-		}
-		else {
-		    if (sts < 0)
-			pmcd_trace(TR_RECV_ERR, ap->outFd, PDU_RESULT, sts);
-		    else
-			pmcd_trace(TR_WRONG_PDU, ap->outFd, PDU_ERROR, sts);
- 		    sts = PM_ERR_IPC; /* Wrong PDU type */
-		}
-		if (pinpdu > 0)
-		    __pmUnpinPDUBuf(pb);
-
-		if (ap->ipcType != AGENT_DSO && sts <= 0)
-		    CleanupAgent(ap, reason, fd);
-	    }
-	}
+	if (ap->status.notReady && __pmFD_ISSET(ap->outFd, readyFds))
+	    ready += HandleReadyAgent(ap);
     }
     return ready;
 }
@@ -746,6 +783,155 @@ CheckNewClient(__pmFdSet * fdset, int rfd, int family)
     }
 }
 
+#ifdef HAVE_SYS_EPOLL_H
+static int
+EventCtl(int op, int fd, int type, int index)
+{
+    struct epoll_event	event;
+
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.u64 = ((__uint64_t)type << 32) | (__uint32_t)index;
+    return epoll_ctl(eventFd, op, fd, &event);
+}
+#endif
+
+/* Start watching a newly accepted client (in slot index) for requests. */
+int
+EventAddClient(int fd, int index)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    return EventCtl(EPOLL_CTL_ADD, fd, EVENT_CLIENT, index);
+#else
+    return -ENOSYS;
+#endif
+}
+
+/* Stop watching a client, before its descriptor is closed. */
+void
+EventDelClient(int fd)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    EventCtl(EPOLL_CTL_DEL, fd, EVENT_CLIENT, 0);
+#else
+    (void)fd;
+#endif
+}
+
+/*
+ * Wait for client requests using epoll(7) rather than select(2) where
+ * available.  The cost of each wakeup is then proportional to the number
+ * of ready descriptors rather than the number of connected clients, and
+ * there is no FD_SETSIZE ceiling on client descriptors.  Setting
+ * PMCD_EPOLL=0 in the environment retains the select(2) loop.
+ */
+static void
+EventInit(void)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    char	*args;
+    int		fd;
+
+    if ((args = getenv("PMCD_EPOLL")) != NULL && strcmp(args, "0") == 0) {
+	fprintf(stderr, "Warning: epoll disabled from PMCD_EPOLL=%s in environment\n", args);
+	return;
+    }
+    if ((eventFd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+	pmNotifyErr(LOG_WARNING, "EventInit: epoll_create1 failed, "
+			"using select: %s\n", osstrerror());
+	return;
+    }
+    for (fd = 0; fd <= maxReqPortFd; fd++) {
+	if (!__pmFD_ISSET(fd, &clientFds))
+	    continue;
+	if (EventCtl(EPOLL_CTL_ADD, fd, EVENT_REQUEST, fd) < 0) {
+	    pmNotifyErr(LOG_WARNING, "EventInit: cannot watch request port "
+			"(fd %d), using select: %s\n", fd, osstrerror());
+	    close(eventFd);
+	    eventFd = -1;
+	    return;
+	}
+    }
+#endif
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+/*
+ * The epoll(7) equivalent of one select(2) iteration of ClientLoop.
+ * Request ports and clients remain registered for their lifetime.
+ * Agents that are not ready are registered only for the duration of
+ * the wait, as there are few of them and their descriptors change as
+ * they are restarted (and may be closed while handling events).
+ */
+static int
+HandleEvents(int *reload_namespace)
+{
+    struct epoll_event	events[MAXEVENTS];
+    __pmFdSet		requestFds;
+    AgentInfo		*ap;
+    int			i, n, type, index;
+    int			nrequests = 0;
+
+    for (i = 0; i < nAgents; i++) {
+	ap = &agent[i];
+	if (!ap->status.notReady)
+	    continue;
+	EventCtl(EPOLL_CTL_ADD, ap->outFd, EVENT_AGENT, i);
+	if (pmDebugOptions.appl0)
+	    pmNotifyErr(LOG_INFO, "not ready: check %s agent on fd %d\n",
+			ap->pmDomainLabel, ap->outFd);
+    }
+
+    n = epoll_wait(eventFd, events, MAXEVENTS, -1);
+
+    for (i = 0; i < nAgents; i++) {
+	ap = &agent[i];
+	if (ap->status.notReady)
+	    EventCtl(EPOLL_CTL_DEL, ap->outFd, EVENT_AGENT, i);
+    }
+
+    if (n < 0)
+	return (oserror() == EINTR) ? 0 : -oserror();
+
+    /* new clients first, then agents, then client requests - as select */
+    __pmFD_ZERO(&requestFds);
+    for (i = 0; i < n; i++) {
+	if ((int)(events[i].data.u64 >> 32) == EVENT_REQUEST) {
+	    __pmFD_SET((int)(events[i].data.u64 & 0xffffffff), &requestFds);
+	    nrequests++;
+	}
+    }
+    if (nrequests)
+	__pmServerAddNewClients(&requestFds, CheckNewClient);
+
+    for (i = 0; i < n; i++) {
+	type = (int)(events[i].data.u64 >> 32);
+	index = (int)(events[i].data.u64 & 0xffffffff);
+	if (type != EVENT_AGENT || index >= nAgents)
+	    continue;
+	if (agent[index].status.notReady && HandleReadyAgent(&agent[index]))
+	    *reload_namespace = 1;
+    }
+
+    for (i = 0; i < n; i++) {
+	type = (int)(events[i].data.u64 >> 32);
+	index = (int)(events[i].data.u64 & 0xffffffff);
+	/*
+	 * Client slots are only reused by clients accepted in a later
+	 * iteration, so a connected client here is the one that is ready.
+	 */
+	if (type != EVENT_CLIENT || index >= nClients ||
+	    !client[index].status.connected)
+	    continue;
+	if (pmDebugOptions.appl0)
+	    fprintf(stderr, "DATA: from %s (fd %d)\n",
+			FdToString(client[index].fd), client[index].fd);
+	HandleClientPDU(index);
+    }
+    return 0;
+}
+#endif
+
 /* Loop, synchronously processing requests from clients. */
 
 static void
@@ -760,47 +946,59 @@ ClientLoop(void)
 
     for (;;) {
 
-	/* Figure out which file descriptors to wait for input on.  Keep
-	 * track of the highest numbered descriptor for the select call.
-	 */
-	readableFds = clientFds;
-	maxFd = maxClientFd + 1;
-
-	/* If an agent was not ready, it may send an ERROR PDU to indicate it
-	 * is now ready.  Add such agents to the list of file descriptors.
-	 */
-	checkAgents = 0;
-	for (i = 0; i < nAgents; i++) {
-	    AgentInfo	*ap = &agent[i];
-
-	    if (ap->status.notReady) {
-		fd = ap->outFd;
-		__pmFD_SET(fd, &readableFds);
-		if (fd > maxFd)
-		    maxFd = fd + 1;
-		checkAgents = 1;
-		if (pmDebugOptions.appl0)
-		    pmNotifyErr(LOG_INFO,
-				 "not ready: check %s agent on fd %d (max = %d)\n",
-				 ap->pmDomainLabel, fd, maxFd);
+#ifdef HAVE_SYS_EPOLL_H
+	if (eventFd >= 0) {
+	    if ((sts = HandleEvents(&reload_namespace)) < 0) {
+		pmNotifyErr(LOG_ERR, "ClientLoop epoll_wait: %s\n",
+			    pmErrStr(sts));
+		break;
 	    }
 	}
+	else
+#endif
+	{
+	    /* Figure out which file descriptors to wait for input on.  Keep
+	     * track of the highest numbered descriptor for the select call.
+	     */
+	    readableFds = clientFds;
+	    maxFd = maxClientFd + 1;
 
-	sts = __pmSelectRead(maxFd, &readableFds, NULL);
-	if (sts > 0) {
-	    if (pmDebugOptions.appl0)
-		for (i = 0; i <= maxClientFd; i++)
-		    if (__pmFD_ISSET(i, &readableFds))
-			fprintf(stderr, "DATA: from %s (fd %d)\n",
-				FdToString(i), i);
-	    __pmServerAddNewClients(&readableFds, CheckNewClient);
-	    if (checkAgents)
-		reload_namespace = HandleReadyAgents(&readableFds);
-	    HandleClientInput(&readableFds);
-	}
-	else if (sts == -1 && neterror() != EINTR) {
-	    pmNotifyErr(LOG_ERR, "ClientLoop select: %s\n", netstrerror());
-	    break;
+	    /* If an agent was not ready, it may send an ERROR PDU to indicate it
+	     * is now ready.  Add such agents to the list of file descriptors.
+	     */
+	    checkAgents = 0;
+	    for (i = 0; i < nAgents; i++) {
+		AgentInfo	*ap = &agent[i];
+
+		if (ap->status.notReady) {
+		    fd = ap->outFd;
+		    __pmFD_SET(fd, &readableFds);
+		    if (fd > maxFd)
+			maxFd = fd + 1;
+		    checkAgents = 1;
+		    if (pmDebugOptions.appl0)
+			pmNotifyErr(LOG_INFO,
+				     "not ready: check %s agent on fd %d (max = %d)\n",
+				     ap->pmDomainLabel, fd, maxFd);
+		}
+	    }
+
+	    sts = __pmSelectRead(maxFd, &readableFds, NULL);
+	    if (sts > 0) {
+		if (pmDebugOptions.appl0)
+		    for (i = 0; i <= maxClientFd; i++)
+			if (__pmFD_ISSET(i, &readableFds))
+			    fprintf(stderr, "DATA: from %s (fd %d)\n",
+				    FdToString(i), i);
+		__pmServerAddNewClients(&readableFds, CheckNewClient);
+		if (checkAgents)
+		    reload_namespace = HandleReadyAgents(&readableFds);
+		HandleClientInput(&readableFds);
+	    }
+	    else if (sts == -1 && neterror() != EINTR) {
+		pmNotifyErr(LOG_ERR, "ClientLoop select: %s\n", netstrerror());
+		break;
+	    }
 	}
 	if (AgentDied) {
 	    if (restartAgents == -1) {
@@ -1055,6 +1253,8 @@ main(int argc, char *argv[])
     __pmServerDumpRequestPorts(stderr);
     fflush(stderr);
 
+    EventInit();
+
     /* all the work is done here */
     ClientLoop();
 
@@ -93,7 +93,8 @@ typedef struct {
 	    notReady : 1,		/* Agent not ready to process PDUs */
 	    startNotReady : 1,		/* Agent starts in non-ready state */
 	    fenced : 1,			/* Agent fenced; no sampling */
-	    unused : 7,			/* Zero-padded, unused space */
+	    ready : 1,			/* Input ready, see AgentsReady() */
+	    unused : 6,			/* Zero-padded, unused space */
 	    flags : 16;			/* Agent-supplied connection flags */
     } status;
     int		reason;			/* if ! connected */
@@ -102,6 +103,15 @@ typedef struct {
 	SocketInfo socket;
 	PipeInfo   pipe;
     } ipc;
+    struct timeval fetchStart;		/* When current fetch was dispatched */
+    struct {				/* Fetch latency accounting */
+	__uint64_t	count;		/* Fetches completed by this agent */
+	__uint64_t	time;		/* Cumulative fetch latency (usec) */
+	__uint64_t	critical;	/* Fetches where agent was slowest */
+	__uint32_t	last;		/* Most recent fetch latency (usec) */
+	__uint64_t	hit;		/* Fetches served from a coalesced result */
+	__uint64_t	miss;		/* Fetches that could not be coalesced */
+    } fetchStats;
 } AgentInfo;
 
 PMCD_DATA extern AgentInfo	*agent;		/* Array of domain agent structs */
@@ -148,6 +158,8 @@ extern int		AgentDied;	/* for updating mapdom[] */
 PMCD_CALL extern AgentInfo *pmcd_agent(int);
 extern void CleanupAgent(AgentInfo *, int, int);
 extern int HarvestAgents(unsigned int);
+extern int AgentBusy(const AgentInfo *);
+extern int AgentsReady(int (*)(const AgentInfo *), struct timeval *);
 
 /* pmdaroot file descriptor */
 extern int	pmdarootfd;
@@ -155,6 +167,9 @@ extern int	pmdarootfd;
 /* timeout to PMDAs (secs) */
 PMCD_DATA extern int	pmcd_timeout;
 
+/* window for coalescing fetches to PMDAs (msec), zero to disable */
+PMCD_DATA extern int	pmcd_coalesce;
+
 /* timeout for credentials */
 extern int	_creds_timeout;
 
@@ -204,6 +219,7 @@ extern int pmcd_load_libpcp_pmda(void);
  * PDU handling routines
  */
 extern int DoFetch(ClientInfo *, __pmPDU *);
+extern void CoalesceForget(AgentInfo *);
 extern int DoProfile(ClientInfo *, __pmPDU *);
 extern int DoDesc(ClientInfo *, __pmPDU *);
 extern int DoLabel(ClientInfo *, __pmPDU *);
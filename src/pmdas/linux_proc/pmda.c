@@ -1332,6 +1332,11 @@ static pmdaMetric metrictab[] = {
     { PMDA_PMID(CLUSTER_CONTROL, 1), PM_TYPE_U32,
     PM_INDOM_NULL, PM_SEM_INSTANT, PMDA_PMUNITS(0,0,0,0,0,0) } },
 
+/* proc.control.all.workers */
+  { &proc_workers,
+    { PMDA_PMID(CLUSTER_CONTROL, 4), PM_TYPE_U32,
+    PM_INDOM_NULL, PM_SEM_INSTANT, PMDA_PMUNITS(0,0,0,0,0,0) } },
+
 /* proc.control.perclient.threads */
   { NULL,
     { PMDA_PMID(CLUSTER_CONTROL, 2), PM_TYPE_U32,
@@ -1874,7 +1879,13 @@ proc_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
 	else {
 	    if (!have_access)
 		return PM_ERR_PERMISSION;
-	    entry = fetch_proc_pid_stat(inst, active_proc_pid, &sts);
+	    /* only read the files needed for the metric at hand */
+	    if (item == PROC_PID_STAT_ENVIRON)
+		entry = fetch_proc_pid_environ(inst, active_proc_pid, &sts);
+	    else if (item == PROC_PID_STAT_WCHAN_SYMBOL)
+		entry = fetch_proc_pid_wchan(inst, active_proc_pid, &sts);
+	    else
+		entry = fetch_proc_pid_stat(inst, active_proc_pid, &sts);
 	    if (entry == NULL)
 		return sts;
 
@@ -1971,8 +1982,8 @@ proc_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
 		break;
 
 	    case PROC_PID_STAT_WCHAN_SYMBOL: /* proc.psinfo.wchan_s */
-		if (entry->wchan_buf)	/* 2.6+ kernels, /proc/<pid>/wchan */
-		    atom->cp = entry->wchan_buf;
+		/* 2.6+ kernels, /proc/<pid>/wchan */
+		atom->cp = entry->wchan_buf ? entry->wchan_buf : "";
 		break;
 
 	    /* The following 2 case groups need to be here since the #defines don't match the index into the buffer */
@@ -3456,6 +3467,7 @@ proc_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
     case CLUSTER_CONTROL:
 	switch (item) {
 	/* case 1: not reached -- proc.control.all.threads is direct */
+	/* case 4: not reached -- proc.control.all.workers is direct */
 	case 2:	/* proc.control.perclient.threads */
 	    atom->ul = proc_ctx_threads(pmdaGetContext(), threads);
 	    break;
@@ -3475,6 +3487,86 @@ proc_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
     return PMDA_FETCH_STATIC;
 }
 
+/*
+ * Read the per-process files needed for this request using worker
+ * threads (if proc.control.all.workers allows), ahead of pmdaFetch.
+ */
+static void
+proc_prefetch(int numpmid, pmID pmidlist[], pmdaExt *pmda)
+{
+    int		i, hot, flags[2] = { 0, 0 };	/* proc, hotproc */
+
+    for (i = 0; i < numpmid; i++) {
+	unsigned int	cluster = pmID_cluster(pmidlist[i]);
+	unsigned int	item = pmID_item(pmidlist[i]);
+
+	hot = 0;
+	switch (cluster) {
+	case CLUSTER_HOTPROC_PID_STAT:
+	    hot = 1;
+	    /*FALLTHROUGH*/
+	case CLUSTER_PID_STAT:
+	    if (item == PROC_PID_STAT_ENVIRON)
+		flags[hot] |= PROC_PID_FLAG_ENVIRON_FETCHED;
+	    else if (item == PROC_PID_STAT_WCHAN_SYMBOL)
+		flags[hot] |= PROC_PID_FLAG_WCHAN_FETCHED;
+	    else if (item != 99)	/* proc.nprocs */
+		flags[hot] |= PROC_PID_FLAG_STAT_FETCHED;
+	    break;
+	case CLUSTER_HOTPROC_PID_STATM:
+	    hot = 1;
+	    /*FALLTHROUGH*/
+	case CLUSTER_PID_STATM:
+	    if (item == PROC_PID_STATM_MAPS)
+		flags[hot] |= PROC_PID_FLAG_MAPS_FETCHED;
+	    else
+		flags[hot] |= PROC_PID_FLAG_STATM_FETCHED;
+	    break;
+	case CLUSTER_HOTPROC_PID_STATUS:
+	    hot = 1;
+	    /*FALLTHROUGH*/
+	case CLUSTER_PID_STATUS:
+	    flags[hot] |= PROC_PID_FLAG_STATUS_FETCHED;
+	    break;
+	case CLUSTER_HOTPROC_PID_SCHEDSTAT:
+	    hot = 1;
+	    /*FALLTHROUGH*/
+	case CLUSTER_PID_SCHEDSTAT:
+	    flags[hot] |= PROC_PID_FLAG_SCHEDSTAT_FETCHED;
+	    break;
+	case CLUSTER_HOTPROC_PID_IO:
+	    hot = 1;
+	    /*FALLTHROUGH*/
+	case CLUSTER_PID_IO:
+	    flags[hot] |= PROC_PID_FLAG_IO_FETCHED;
+	    break;
+	case CLUSTER_HOTPROC_PID_SMAPS:
+	    hot = 1;
+	    /*FALLTHROUGH*/
+	case CLUSTER_PID_SMAPS:
+	    flags[hot] |= PROC_PID_FLAG_SMAPS_FETCHED;
+	    break;
+	case CLUSTER_HOTPROC_PID_FD:
+	    hot = 1;
+	    /*FALLTHROUGH*/
+	case CLUSTER_PID_FD:
+	    flags[hot] |= PROC_PID_FLAG_FD_FETCHED;
+	    break;
+	case CLUSTER_HOTPROC_PID_OOM_SCORE:
+	    hot = 1;
+	    /*FALLTHROUGH*/
+	case CLUSTER_PID_OOM_SCORE:
+	    flags[hot] |= PROC_PID_FLAG_OOM_SCORE_FETCHED;
+	    break;
+	}
+    }
+
+    if (flags[0])
+	prefetch_proc_pid(&proc_pid, flags[0], pmda);
+    if (flags[1])
+	prefetch_proc_pid(&hotproc_pid, flags[1], pmda);
+}
+
 static int
 proc_fetch(int numpmid, pmID pmidlist[], pmResult **resp, pmdaExt *pmda)
 {
@@ -3492,8 +3584,11 @@ proc_fetch(int numpmid, pmID pmidlist[], pmResult **resp, pmdaExt *pmda)
 		"proc_fetch", have_access, all_access,
 		proc_ctx_access(pmda->e_context));
 
-    if ((sts = proc_refresh(pmda, need_refresh)) == 0)
+    if ((sts = proc_refresh(pmda, need_refresh)) == 0) {
+	if (have_access && proc_workers > 1)
+	    proc_prefetch(numpmid, pmidlist, pmda);
 	sts = pmdaFetch(numpmid, pmidlist, resp, pmda);
+    }
 
     have_access = all_access || proc_ctx_revert(pmda->e_context);
     if (pmDebugOptions.auth)
@@ -3532,6 +3627,17 @@ proc_store(pmResult *result, pmdaExt *pmda)
 			threads = av.ul;
 		}
 		break;
+	    case 4: /* proc.control.all.workers */
+		if (!have_access)
+		    sts = PM_ERR_PERMISSION;
+		else if ((sts = pmExtractValue(vsp->valfmt, &vsp->vlist[0],
+				PM_TYPE_U32, &av, PM_TYPE_U32)) >= 0) {
+		    if (av.ul < 1 || av.ul > PROC_MAX_WORKERS)
+			sts = PM_ERR_BADSTORE;
+		    else
+			proc_workers = av.ul;
+		}
+		break;
 	    case 2: /* proc.control.perclient.threads */
 		if ((sts = pmExtractValue(vsp->valfmt, &vsp->vlist[0],
 				PM_TYPE_U32, &av, PM_TYPE_U32)) >= 0) {
@@ -3853,6 +3959,12 @@ proc_init(pmdaInterface *dp)
 	threads = atoi(envpath);
     if ((envpath = getenv("PROC_ACCESS")) != NULL)
 	all_access = atoi(envpath);
+    if ((envpath = getenv("PROC_KEEP_OPEN")) != NULL)
+	proc_keep_open = atoi(envpath);
+    if (proc_keep_open)
+	init_proc_keep_open();
+    if ((envpath = getenv("PROC_WORKERS")) != NULL)
+	proc_workers = atoi(envpath);
 
     if (_isDSO) {
 	char helppath[MAXPATHLEN];
@@ -3949,14 +4061,16 @@ pmLongOptions	longopts[] = {
     PMDAOPT_DOMAIN,
     PMDAOPT_LOGFILE,
     { "with-threads", 0, 'L', 0, "include threads in the all-processes instance domain" },
+    { "keep-open", 0, 'O', 0, "keep per-process /proc files open between fetches" },
     { "from-cgroup", 1, 'r', "NAME", "restrict monitoring to processes in the named cgroup" },
     PMDAOPT_USERNAME,
+    { "workers", 1, 'W', "N", "threads reading per-process files [default 1]" },
     PMOPT_HELP,
     PMDA_OPTIONS_END
 };
 
 pmdaOptions	opts = {
-    .short_options = "AD:d:l:Lr:U:?",
+    .short_options = "AD:d:l:LOr:U:W:?",
     .long_options = longopts,
 };
 
@@ -3967,6 +4081,8 @@ main(int argc, char **argv)
     pmdaInterface	dispatch;
     char		helppath[MAXPATHLEN];
     char		*username = "root";
+    char		*endnum;
+    long		workers;
 
     _isDSO = 0;
     pmSetProgname(argv[0]);
@@ -3982,9 +4098,22 @@ main(int argc, char **argv)
 	case 'L':
 	    threads = 1;
 	    break;
+	case 'O':
+	    proc_keep_open = 1;
+	    break;
 	case 'r':
 	    cgroups = opts.optarg;
 	    break;
+	case 'W':
+	    workers = strtol(opts.optarg, &endnum, 10);
+	    if (*endnum != '\0' || workers < 1 || workers > PROC_MAX_WORKERS) {
+		pmprintf("%s: -W requires a number of threads from 1 to %d\n",
+			pmGetProgname(), PROC_MAX_WORKERS);
+		opts.errors++;
+	    }
+	    else
+		proc_workers = workers;
+	    break;
 	}
     }
 
@@ -23,6 +23,9 @@
 #include <dirent.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/resource.h>
+#include <pthread.h>
+#include <signal.h>
 #include <pwd.h>
 #include <grp.h>
 #include "proc_pid.h"
@@ -33,6 +36,33 @@
 
 static proc_pid_list_t procpids; /* previous pids list that the proc pmda uses */
 static void refresh_proc_pidlist(proc_pid_t *, proc_pid_list_t *);
+static void close_proc_pid_files(proc_pid_entry_t *);
+
+/*
+ * With proc_keep_open set, the /proc/<pid> directory of each process and
+ * those of its files sampled most often (proc_pid_files) stay open from
+ * one fetch to the next.  Values are then refreshed with a single pread
+ * from offset zero, rather than building a path and doing an open, some
+ * reads and a close each time; other files are opened relative to the
+ * directory.  The kernel checks access to the kept open files when they
+ * are read, with the credentials of the client we are acting for at the
+ * time, and those opened relative to the directory are checked when they
+ * are opened, so no values are disclosed beyond those seen without -O.
+ *
+ * Kept open files refer to the process they were opened for, even once
+ * that has exited - reads then fail (ESRCH) and the entry is dropped at
+ * the next refresh, whether its pid has been reused by then or not.
+ */
+int proc_keep_open;
+static int proc_open_max;	/* most files we are prepared to keep open */
+static int proc_open_count;	/* files (and directories) kept open now */
+
+static const char *proc_pid_files[NR_PROC_PID_FILES] = {
+    "stat", "statm", "status", "schedstat", "wchan",
+};
+
+/* open files left for everything else when keeping /proc files open */
+#define PROC_OPEN_RESERVE	256
 
 
 /* Hotproc variables */
@@ -818,6 +848,35 @@ disable_hotproc(void)
     conf_gen = 0;
 }
 
+static void
+free_proc_pid_entry(proc_pid_entry_t *ep)
+{
+    close_proc_pid_files(ep);
+    if (ep->instname != NULL)
+	free(ep->instname);
+    if (ep->name != NULL)
+	free(ep->name);
+    if (ep->stat_buf != NULL)
+	free(ep->stat_buf);
+    if (ep->status_buf != NULL)
+	free(ep->status_buf);
+    if (ep->statm_buf != NULL)
+	free(ep->statm_buf);
+    if (ep->maps_buf != NULL)
+	free(ep->maps_buf);
+    if (ep->smaps_buf != NULL)
+	free(ep->smaps_buf);
+    if (ep->schedstat_buf != NULL)
+	free(ep->schedstat_buf);
+    if (ep->io_buf != NULL)
+	free(ep->io_buf);
+    if (ep->wchan_buf != NULL)
+	free(ep->wchan_buf);
+    if (ep->environ_buf != NULL)
+	free(ep->environ_buf);
+    free(ep);
+}
+
 static void
 refresh_proc_pidlist(proc_pid_t *proc_pid, proc_pid_list_t *pids)
 {
@@ -830,12 +889,25 @@ refresh_proc_pidlist(proc_pid_t *proc_pid, proc_pid_list_t *pids)
     pmdaIndom *indomp = proc_pid->indom;
 
     /*
-     * invalidate all entries so we can harvest pids that have exited
+     * invalidate all entries so we can harvest pids that have exited,
+     * dropping those already seen to have exited through a kept open
+     * file (if the pid is listed again below, it has been reused)
      */
     for (i=0; i < proc_pid->pidhash.hsize; i++) {
-	for (node=proc_pid->pidhash.hash[i]; node != NULL; node = node->next) {
+	for (prev=NULL, node=proc_pid->pidhash.hash[i]; node != NULL; node = next) {
+	    next = node->next;
 	    ep = (proc_pid_entry_t *)node->data;
+	    if (ep->flags & PROC_PID_FLAG_EXITED) {
+		if (prev == NULL)
+		    proc_pid->pidhash.hash[i] = next;
+		else
+		    prev->next = next;
+		free_proc_pid_entry(ep);
+		free(node);
+		continue;
+	    }
 	    ep->flags = 0;
+	    prev = node;
 	}
     }
 
@@ -854,6 +926,10 @@ refresh_proc_pidlist(proc_pid_t *proc_pid, proc_pid_list_t *pids)
 	    memset(ep, 0, sizeof(proc_pid_entry_t));
 
 	    ep->id = pids->pids[i];
+	    ep->dirfd = -1;
+	    for (k = 0; k < NR_PROC_PID_FILES; k++)
+		ep->fds[k] = -1;
+	    k = 0;
 
 	    pmsprintf(buf, sizeof(buf), "%s/proc/%d/cmdline", proc_statspath, pids->pids[i]);
 	    if ((fd = open(buf, O_RDONLY)) >= 0) {
@@ -978,34 +1054,11 @@ refresh_proc_pidlist(proc_pid_t *proc_pid, proc_pid_list_t *pids)
 	    else {
 		// This process has exited.
 	        //fprintf(stderr, "DELETED key=%d name=\"%s\"\n", ep->id, ep->name);
-		if (ep->instname != NULL)
-		    free(ep->instname);
-		if (ep->name != NULL)
-		    free(ep->name);
-		if (ep->stat_buf != NULL)
-		    free(ep->stat_buf);
-		if (ep->status_buf != NULL)
-		    free(ep->status_buf);
-		if (ep->statm_buf != NULL)
-		    free(ep->statm_buf);
-		if (ep->maps_buf != NULL)
-		    free(ep->maps_buf);
-		if (ep->smaps_buf != NULL)
-		    free(ep->smaps_buf);
-		if (ep->schedstat_buf != NULL)
-		    free(ep->schedstat_buf);
-		if (ep->io_buf != NULL)
-		    free(ep->io_buf);
-		if (ep->wchan_buf != NULL)
-		    free(ep->wchan_buf);
-		if (ep->environ_buf != NULL)
-		    free(ep->environ_buf);
-
 	    	if (prev == NULL)
 		    proc_pid->pidhash.hash[i] = node->next;
 		else
 		    prev->next = node->next;
-		free(ep);
+		free_proc_pid_entry(ep);
 		free(node);
 	    }
 	    if ((node = next) == NULL)
@@ -1087,6 +1140,149 @@ refresh_hotproc_pid(proc_pid_t *proc_pid, int threads, const char *cgroups)
 
 
 
+/*
+ * Allow for keeping /proc/<pid> files open (-O option), raising the soft
+ * limit on open files as far as we can and leaving some for other uses.
+ */
+void
+init_proc_keep_open(void)
+{
+    struct rlimit	limit;
+
+    if (getrlimit(RLIMIT_NOFILE, &limit) < 0) {
+	pmNotifyErr(LOG_WARNING, "cannot keep /proc files open: getrlimit: %s",
+			osstrerror());
+	proc_keep_open = 0;
+	return;
+    }
+    if (limit.rlim_cur < limit.rlim_max) {
+	rlim_t	current = limit.rlim_cur;
+
+	limit.rlim_cur = limit.rlim_max;
+	if (setrlimit(RLIMIT_NOFILE, &limit) < 0)
+	    limit.rlim_cur = current;
+    }
+    if (limit.rlim_cur > 2 * PROC_OPEN_RESERVE)
+	proc_open_max = limit.rlim_cur - PROC_OPEN_RESERVE;
+    else
+	proc_open_max = limit.rlim_cur / 2;
+    if (pmDebugOptions.libpmda)
+	fprintf(stderr, "init_proc_keep_open: up to %d files kept open\n",
+			proc_open_max);
+}
+
+static void
+close_proc_pid_files(proc_pid_entry_t *ep)
+{
+    int		i;
+
+    for (i = 0; i < NR_PROC_PID_FILES; i++) {
+	if (ep->fds[i] >= 0) {
+	    close(ep->fds[i]);
+	    ep->fds[i] = -1;
+	    __sync_sub_and_fetch(&proc_open_count, 1);
+	}
+    }
+    if (ep->dirfd >= 0) {
+	close(ep->dirfd);
+	ep->dirfd = -1;
+	__sync_sub_and_fetch(&proc_open_count, 1);
+    }
+}
+
+/*
+ * Account for one more kept open file, if we are still under the limit;
+ * otherwise fail with EMFILE.  Worker threads (see prefetch_proc_pid)
+ * may be opening files for different processes at the same time.
+ */
+static int
+proc_open_reserve(void)
+{
+    if (__sync_add_and_fetch(&proc_open_count, 1) <= proc_open_max)
+	return 1;
+    __sync_sub_and_fetch(&proc_open_count, 1);
+    setoserror(EMFILE);
+    return 0;
+}
+
+/*
+ * Return the kept open /proc/<pid> directory for ep (or the task one, if
+ * we want thread info), opening it if need be.  On failure -1 is returned
+ * with errno set, EMFILE if no more files are to be kept open.
+ */
+static int
+proc_keep_dir(proc_pid_entry_t *ep)
+{
+    int		fd = -1;
+    char	buf[128];
+
+    if (ep->dirfd >= 0 && ep->dirtask == procpids.threads)
+	return ep->dirfd;
+    close_proc_pid_files(ep);
+
+    if (!proc_open_reserve())
+	return -1;
+    if (procpids.threads) {
+	pmsprintf(buf, sizeof(buf), "%s/proc/%d/task/%d",
+			proc_statspath, ep->id, ep->id);
+	fd = open(buf, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	/* fallback to /proc path if task path open fails */
+    }
+    if (fd < 0) {
+	pmsprintf(buf, sizeof(buf), "%s/proc/%d", proc_statspath, ep->id);
+	fd = open(buf, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    }
+    if (fd < 0) {
+	int	sts = oserror();
+
+	__sync_sub_and_fetch(&proc_open_count, 1);
+	if (pmDebugOptions.libpmda && pmDebugOptions.desperate) {
+	    char ebuf[1024];
+	    fprintf(stderr, "proc_keep_dir: open(\"%s\") failed: %s\n",
+			    buf, pmErrStr_r(-sts, ebuf, sizeof(ebuf)));
+	}
+	setoserror(sts);
+	return -1;
+    }
+    ep->dirtask = procpids.threads;
+    return ep->dirfd = fd;
+}
+
+/*
+ * Return one of the kept open proc_pid_files for ep, opening it if need
+ * be; failures are as for proc_keep_dir.
+ */
+static int
+proc_keep_file(proc_pid_entry_t *ep, int file)
+{
+    int		dirfd, fd, sts;
+
+    if ((dirfd = proc_keep_dir(ep)) < 0)
+	return -1;
+    if (ep->fds[file] >= 0)
+	return ep->fds[file];
+
+    if (!proc_open_reserve())
+	return -1;
+    if ((fd = openat(dirfd, proc_pid_files[file], O_RDONLY | O_CLOEXEC)) < 0) {
+	sts = oserror();
+	__sync_sub_and_fetch(&proc_open_count, 1);
+	/* no such process any more, or (older kernels) maybe no such file */
+	if (sts == ESRCH ||
+	    (sts == ENOENT && faccessat(dirfd, "stat", F_OK, 0) < 0))
+	    ep->flags |= PROC_PID_FLAG_EXITED;
+	if (pmDebugOptions.libpmda && pmDebugOptions.desperate) {
+	    char ebuf[1024];
+	    fprintf(stderr, "proc_keep_file: openat(%d, \"%s\") failed: %s\n",
+			    ep->id, proc_pid_files[file],
+			    pmErrStr_r(-sts, ebuf, sizeof(ebuf)));
+	}
+	setoserror(sts);
+	return -1;
+    }
+    return ep->fds[file] = fd;
+}
+
 /*
  * Open a proc file, taking into account that we may want thread info
  * rather than process information.
@@ -1099,9 +1295,17 @@ refresh_hotproc_pid(proc_pid_t *proc_pid, int threads, const char *cgroups)
 static int
 proc_open(const char *base, proc_pid_entry_t *ep)
 {
-    int fd;
+    int fd, dirfd;
     char buf[128];
 
+    if (proc_keep_open && (dirfd = proc_keep_dir(ep)) >= 0) {
+	if ((fd = openat(dirfd, base, O_RDONLY | O_CLOEXEC)) < 0 && oserror() == ESRCH)
+	    ep->flags |= PROC_PID_FLAG_EXITED;
+	if (pmDebugOptions.libpmda && pmDebugOptions.desperate)
+	    fprintf(stderr, "proc_open: openat(%d, \"%s\") -> fd=%d\n",
+			    ep->id, base, fd);
+	return fd;
+    }
     if (procpids.threads) {
 	pmsprintf(buf, sizeof(buf), "%s/proc/%d/task/%d/%s",
 			proc_statspath, ep->id, ep->id, base);
@@ -1138,7 +1342,18 @@ proc_opendir(const char *base, proc_pid_entry_t *ep)
 {
     DIR *dir;
     char buf[128];
+    int fd, dirfd;
 
+    if (proc_keep_open && (dirfd = proc_keep_dir(ep)) >= 0) {
+	if ((fd = openat(dirfd, base, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+	    if (oserror() == ESRCH)
+		ep->flags |= PROC_PID_FLAG_EXITED;
+	    return NULL;
+	}
+	if ((dir = fdopendir(fd)) == NULL)
+	    close(fd);
+	return dir;
+    }
     if (procpids.threads) {
 	pmsprintf(buf, sizeof(buf), "%s/proc/%d/task/%d/%s", proc_statspath, ep->id, ep->id, base);
 	if ((dir = opendir(buf)) != NULL) {
@@ -1166,7 +1381,7 @@ proc_opendir(const char *base, proc_pid_entry_t *ep)
 /*
  * error mapping for fetch routines ...
  * EACCESS, EINVAL => no values (don't disclose anything else)
- * ENOENT => PM_ERR_APPVERSION
+ * ENOENT, ESRCH => PM_ERR_APPVERSION
  */
 static int
 maperr(void)
@@ -1174,7 +1389,7 @@ maperr(void)
     int		sts = -oserror();
 
     if (sts == -EACCES || sts == -EINVAL) sts = 0;
-    else if (sts == -ENOENT) sts = PM_ERR_APPVERSION;
+    else if (sts == -ENOENT || sts == -ESRCH) sts = PM_ERR_APPVERSION;
     return sts;
 }
 
@@ -1215,6 +1430,71 @@ read_proc_entry(int fd, int *lenp, char **bufp)
     return sts;
 }
 
+/*
+ * Read a kept open file from the start, into a buffer grown as needed.
+ * The kernel produces these (seq_file) in full on each read when there
+ * is space, so a short read is the end of the file.
+ */
+static int
+pread_proc_entry(proc_pid_entry_t *ep, int fd, int *lenp, char **bufp)
+{
+    int		n, len = 0, size = *lenp;
+    char	*p;
+
+    if (size < 1024)
+	size = 1024;
+    for (;;) {
+	if (*bufp == NULL || size > *lenp) {
+	    if ((p = (char *)realloc(*bufp, size + 1)) == NULL)
+		return -ENOMEM;
+	    *bufp = p;
+	    *lenp = size;
+	}
+	if ((n = pread(fd, *bufp + len, size - len, len)) <= 0)
+	    break;
+	len += n;
+	if (len < size)
+	    break;
+	size *= 2;
+    }
+
+    if (len > 0) {
+	(*bufp)[len] = '\0';
+	return 0;
+    }
+    if (n < 0) {
+	if (oserror() == ESRCH)
+	    ep->flags |= PROC_PID_FLAG_EXITED;
+	return maperr();
+    }
+    if (pmDebugOptions.libpmda && pmDebugOptions.desperate)
+	fprintf(stderr, "pread_proc_entry: fd=%d: no data\n", fd);
+    return -ENODATA;
+}
+
+/*
+ * Read one of the proc_pid_files for ep, from the kept open file if we
+ * can, otherwise opening and closing it around the read.
+ */
+static int
+proc_read_file(proc_pid_entry_t *ep, int file, int *lenp, char **bufp)
+{
+    int		fd, sts;
+
+    if (proc_keep_open) {
+	if ((fd = proc_keep_file(ep, file)) >= 0)
+	    return pread_proc_entry(ep, fd, lenp, bufp);
+	if (oserror() != EMFILE && oserror() != ENFILE)
+	    return maperr();
+	/* no more files are to be kept open, so just this once */
+    }
+    if ((fd = proc_open(proc_pid_files[file], ep)) < 0)
+	return maperr();
+    sts = read_proc_entry(fd, lenp, bufp);
+    close(fd);
+    return sts;
+}
+
 /*
  * fetch a proc/<pid>/stat entry for pid
  */
@@ -1223,8 +1503,6 @@ fetch_proc_pid_stat(int id, proc_pid_t *proc_pid, int *sts)
 {
     __pmHashNode	*node = __pmHashSearch(id, &proc_pid->pidhash);
     proc_pid_entry_t	*ep = node ? (proc_pid_entry_t *)node->data : NULL;
-    char		*p;
-    int			fd;
 
     *sts = 0;
     if (!ep)
@@ -1233,27 +1511,53 @@ fetch_proc_pid_stat(int id, proc_pid_t *proc_pid, int *sts)
     if (!(ep->flags & PROC_PID_FLAG_STAT_FETCHED)) {
 	if (ep->stat_buflen > 0)
 	    ep->stat_buf[0] = '\0';
-	if ((fd = proc_open("stat", ep)) < 0)
-	    *sts = maperr();
-	else {
-	    *sts = read_proc_entry(fd, &ep->stat_buflen, &ep->stat_buf);
-	    close(fd);
-	}
+	*sts = proc_read_file(ep, PROC_PID_FILE_STAT, &ep->stat_buflen, &ep->stat_buf);
 	ep->flags |= PROC_PID_FLAG_STAT_FETCHED;
     }
 
+    return (*sts < 0) ? NULL : ep;
+}
+
+/*
+ * fetch a proc/<pid>/wchan entry for pid
+ */
+proc_pid_entry_t *
+fetch_proc_pid_wchan(int id, proc_pid_t *proc_pid, int *sts)
+{
+    __pmHashNode	*node = __pmHashSearch(id, &proc_pid->pidhash);
+    proc_pid_entry_t	*ep = node ? (proc_pid_entry_t *)node->data : NULL;
+
+    *sts = 0;
+    if (!ep)
+	return NULL;
+
     if (!(ep->flags & PROC_PID_FLAG_WCHAN_FETCHED)) {
 	if (ep->wchan_buflen > 0)
 	    ep->wchan_buf[0] = '\0';
-	if ((fd = proc_open("wchan", ep)) < 0)
-	    ; /* ignore failure here, backwards compat */
-	else {
-	    *sts = read_proc_entry(fd, &ep->wchan_buflen, &ep->wchan_buf);
-	    close(fd);
-	}
+	*sts = proc_read_file(ep, PROC_PID_FILE_WCHAN, &ep->wchan_buflen, &ep->wchan_buf);
+	if (*sts != PM_ERR_APPVERSION)
+	    *sts = 0; /* ignore failure here, backwards compat */
 	ep->flags |= PROC_PID_FLAG_WCHAN_FETCHED;
     }
 
+    return (*sts < 0) ? NULL : ep;
+}
+
+/*
+ * fetch a proc/<pid>/environ entry for pid
+ */
+proc_pid_entry_t *
+fetch_proc_pid_environ(int id, proc_pid_t *proc_pid, int *sts)
+{
+    __pmHashNode	*node = __pmHashSearch(id, &proc_pid->pidhash);
+    proc_pid_entry_t	*ep = node ? (proc_pid_entry_t *)node->data : NULL;
+    char		*p;
+    int			fd;
+
+    *sts = 0;
+    if (!ep)
+	return NULL;
+
     if (!(ep->flags & PROC_PID_FLAG_ENVIRON_FETCHED)) {
 	if (ep->environ_buflen > 0)
 	    ep->environ_buf[0] = '\0';
@@ -1290,9 +1594,7 @@ fetch_proc_pid_stat(int id, proc_pid_t *proc_pid, int *sts)
 	ep->flags |= PROC_PID_FLAG_ENVIRON_FETCHED;
     }
 
-    if (*sts < 0)
-    	return NULL;
-    return ep;
+    return (*sts < 0) ? NULL : ep;
 }
 
 /*
@@ -1333,17 +1635,11 @@ fetch_proc_pid_status(int id, proc_pid_t *proc_pid, int *sts)
 	return NULL;
 
     if (!(ep->flags & PROC_PID_FLAG_STATUS_FETCHED)) {
-	int	fd;
 	char	*curline;
 
 	if (ep->status_buflen > 0)
 	    ep->status_buf[0] = '\0';
-	if ((fd = proc_open("status", ep)) < 0)
-	    *sts = maperr();
-	else {
-	    *sts = read_proc_entry(fd, &ep->status_buflen, &ep->status_buf);
-	    close(fd);
-	}
+	*sts = proc_read_file(ep, PROC_PID_FILE_STATUS, &ep->status_buflen, &ep->status_buf);
 
 	if (*sts == 0) {
 	    /* assign pointers to individual lines in buffer */
@@ -1528,16 +1824,9 @@ fetch_proc_pid_statm(int id, proc_pid_t *proc_pid, int *sts)
     	return NULL;
 
     if (!(ep->flags & PROC_PID_FLAG_STATM_FETCHED)) {
-	int fd;
-
 	if (ep->statm_buflen > 0)
 	    ep->statm_buf[0] = '\0';
-	if ((fd = proc_open("statm", ep)) < 0)
-	    *sts = maperr();
-	else {
-	    *sts = read_proc_entry(fd, &ep->statm_buflen, &ep->statm_buf);
-	    close(fd);
-	}
+	*sts = proc_read_file(ep, PROC_PID_FILE_STATM, &ep->statm_buflen, &ep->statm_buf);
 	ep->flags |= PROC_PID_FLAG_STATM_FETCHED;
     }
 
@@ -1602,16 +1891,9 @@ fetch_proc_pid_schedstat(int id, proc_pid_t *proc_pid, int *sts)
 	return NULL;
 
     if (!(ep->flags & PROC_PID_FLAG_SCHEDSTAT_FETCHED)) {
-	int		fd;
-
 	if (ep->schedstat_buflen > 0)
 	    ep->schedstat_buf[0] = '\0';
-	if ((fd = proc_open("schedstat", ep)) < 0)
-	    *sts = maperr();
-	else {
-	    *sts = read_proc_entry(fd, &ep->schedstat_buflen, &ep->schedstat_buf);
-	    close(fd);
-	}
+	*sts = proc_read_file(ep, PROC_PID_FILE_SCHEDSTAT, &ep->schedstat_buflen, &ep->schedstat_buf);
 	ep->flags |= PROC_PID_FLAG_SCHEDSTAT_FETCHED;
     }
 
@@ -1991,6 +2273,208 @@ fetch_proc_pid_oom_score(int id, proc_pid_t *proc_pid, int *sts)
     return (*sts < 0) ? NULL : ep;
 }
 
+/*
+ * With proc_workers above one, the files behind the per-process metrics
+ * in a fetch request are read (and parsed) for all instances up front,
+ * by this thread and a pool of worker threads, each claiming chunks of
+ * the instance list in turn and filling in the entries it claimed.  The
+ * pmdaFetch callbacks then find these already fetched.  Only the fetch
+ * routines that touch nothing beyond their own entry are used this way,
+ * the cgroup and label ones (shared string dictionary) are left to the
+ * callbacks as before.
+ *
+ * Workers act with the credentials of the current client too, as the C
+ * library applies setresuid(2) and setresgid(2) to all threads.
+ */
+unsigned int proc_workers = 1;
+
+#define PREFETCH_CHUNK	32	/* instances claimed by a thread at once */
+#define PREFETCH_FLAGS	(PROC_PID_FLAG_STAT_FETCHED | \
+			 PROC_PID_FLAG_STATM_FETCHED | \
+			 PROC_PID_FLAG_MAPS_FETCHED | \
+			 PROC_PID_FLAG_STATUS_FETCHED | \
+			 PROC_PID_FLAG_SCHEDSTAT_FETCHED | \
+			 PROC_PID_FLAG_IO_FETCHED | \
+			 PROC_PID_FLAG_WCHAN_FETCHED | \
+			 PROC_PID_FLAG_FD_FETCHED | \
+			 PROC_PID_FLAG_ENVIRON_FETCHED | \
+			 PROC_PID_FLAG_OOM_SCORE_FETCHED | \
+			 PROC_PID_FLAG_SMAPS_FETCHED)
+
+typedef struct {
+    proc_pid_t		*proc_pid;
+    int			flags;	/* PROC_PID_FLAG_*_FETCHED values wanted */
+    int			count;	/* instances in the list */
+    int			*insts;	/* list of instances (pids) to fetch */
+    int			next;	/* next unclaimed instance in the list */
+} prefetch_t;
+
+static pthread_mutex_t	prefetch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	prefetch_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t	prefetch_done = PTHREAD_COND_INITIALIZER;
+static prefetch_t	prefetch;	/* current request, under prefetch_lock */
+static unsigned int	prefetch_gen;	/* bumped for each new request */
+static int		prefetch_threads;	/* worker threads started */
+static int		prefetch_wanted;	/* workers joining this request */
+static int		prefetch_busy;	/* workers not yet done with it */
+static int		prefetch_size;	/* space allocated for insts */
+
+static void
+prefetch_proc_pid_entry(proc_pid_t *proc_pid, int inst, int flags)
+{
+    int		sts;
+
+    if (flags & PROC_PID_FLAG_STAT_FETCHED)
+	fetch_proc_pid_stat(inst, proc_pid, &sts);
+    if (flags & PROC_PID_FLAG_STATM_FETCHED)
+	fetch_proc_pid_statm(inst, proc_pid, &sts);
+    if (flags & PROC_PID_FLAG_MAPS_FETCHED)
+	fetch_proc_pid_maps(inst, proc_pid, &sts);
+    if (flags & PROC_PID_FLAG_STATUS_FETCHED)
+	fetch_proc_pid_status(inst, proc_pid, &sts);
+    if (flags & PROC_PID_FLAG_SCHEDSTAT_FETCHED)
+	fetch_proc_pid_schedstat(inst, proc_pid, &sts);
+    if (flags & PROC_PID_FLAG_IO_FETCHED)
+	fetch_proc_pid_io(inst, proc_pid, &sts);
+    if (flags & PROC_PID_FLAG_WCHAN_FETCHED)
+	fetch_proc_pid_wchan(inst, proc_pid, &sts);
+    if (flags & PROC_PID_FLAG_FD_FETCHED)
+	fetch_proc_pid_fd(inst, proc_pid, &sts);
+    if (flags & PROC_PID_FLAG_ENVIRON_FETCHED)
+	fetch_proc_pid_environ(inst, proc_pid, &sts);
+    if (flags & PROC_PID_FLAG_OOM_SCORE_FETCHED)
+	fetch_proc_pid_oom_score(inst, proc_pid, &sts);
+    if (flags & PROC_PID_FLAG_SMAPS_FETCHED)
+	fetch_proc_pid_smaps(inst, proc_pid, &sts);
+}
+
+static void
+prefetch_chunks(prefetch_t *pp)
+{
+    int		i, last;
+
+    while ((i = __sync_fetch_and_add(&pp->next, PREFETCH_CHUNK)) < pp->count) {
+	if ((last = i + PREFETCH_CHUNK) > pp->count)
+	    last = pp->count;
+	for (; i < last; i++)
+	    prefetch_proc_pid_entry(pp->proc_pid, pp->insts[i], pp->flags);
+    }
+}
+
+static void *
+prefetch_worker(void *arg)
+{
+    int			id = (int)(intptr_t)arg;
+    unsigned int	gen = 0;
+
+    pthread_mutex_lock(&prefetch_lock);
+    for (;;) {
+	while (gen == prefetch_gen)
+	    pthread_cond_wait(&prefetch_start, &prefetch_lock);
+	gen = prefetch_gen;
+	if (id >= prefetch_wanted)	/* not needed this time around */
+	    continue;
+	pthread_mutex_unlock(&prefetch_lock);
+	prefetch_chunks(&prefetch);
+	pthread_mutex_lock(&prefetch_lock);
+	if (--prefetch_busy == 0)
+	    pthread_cond_signal(&prefetch_done);
+    }
+    return NULL;
+}
+
+/*
+ * Start worker threads up to proc_workers (less this thread), with all
+ * signals blocked so that these are all handled by the main thread.
+ */
+static int
+prefetch_start_workers(void)
+{
+    static int		warned;
+    pthread_t		thread;
+    sigset_t		all, saved;
+    int			sts = 0;
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &saved);
+    while (prefetch_threads < proc_workers - 1) {
+	if ((sts = pthread_create(&thread, NULL, prefetch_worker,
+				(void *)(intptr_t)prefetch_threads)) != 0)
+	    break;
+	pthread_detach(thread);
+	prefetch_threads++;
+    }
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+
+    if (sts != 0 && !warned) {
+	pmNotifyErr(LOG_WARNING, "cannot start proc worker thread: %s",
+			pmErrStr(-sts));
+	warned = 1;
+    }
+    return prefetch_threads;
+}
+
+/*
+ * Read the files behind the given PROC_PID_FLAG_*_FETCHED flags, for all
+ * instances in the profile of the current request, using up to
+ * proc_workers threads (including this one).  Lists too short to split
+ * are left to the fetch callbacks.
+ */
+void
+prefetch_proc_pid(proc_pid_t *proc_pid, int flags, pmdaExt *pmda)
+{
+    pmdaIndom		*indomp = proc_pid->indom;
+    int			i, count = 0, workers;
+
+    if ((flags &= PREFETCH_FLAGS) == 0 || proc_workers <= 1 ||
+	indomp->it_numinst < 2 * PREFETCH_CHUNK)
+	return;
+
+    if (indomp->it_numinst > prefetch_size) {
+	int	*insts, size = indomp->it_numinst;
+
+	if ((insts = realloc(prefetch.insts, size * sizeof(int))) == NULL)
+	    return;
+	prefetch.insts = insts;
+	prefetch_size = size;
+    }
+    for (i = 0; i < indomp->it_numinst; i++) {
+	if (__pmInProfile(indomp->it_indom, pmda->e_prof, indomp->it_set[i].i_inst))
+	    prefetch.insts[count++] = indomp->it_set[i].i_inst;
+    }
+    if (count < 2 * PREFETCH_CHUNK)
+	return;
+
+    workers = prefetch_start_workers();
+    if (workers > (count - 1) / PREFETCH_CHUNK)
+	workers = (count - 1) / PREFETCH_CHUNK;
+    if (pmDebugOptions.libpmda)
+	fprintf(stderr, "prefetch_proc_pid: %d instances, flags 0x%x, "
+			"%d worker threads\n", count, flags, workers);
+
+    /* the hotproc timer must not refresh instances from under the workers */
+    __pmAFblock();
+
+    pthread_mutex_lock(&prefetch_lock);
+    prefetch.proc_pid = proc_pid;
+    prefetch.flags = flags;
+    prefetch.count = count;
+    prefetch.next = 0;
+    prefetch_wanted = prefetch_busy = workers;
+    prefetch_gen++;
+    pthread_cond_broadcast(&prefetch_start);
+    pthread_mutex_unlock(&prefetch_lock);
+
+    prefetch_chunks(&prefetch);
+
+    pthread_mutex_lock(&prefetch_lock);
+    while (prefetch_busy > 0)
+	pthread_cond_wait(&prefetch_done, &prefetch_lock);
+    pthread_mutex_unlock(&prefetch_lock);
+
+    __pmAFunblock();
+}
+
 /*
  * Extract the ith (space separated) field from a char buffer.
  * The first field starts at zero.  There is a special case we
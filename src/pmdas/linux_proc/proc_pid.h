@@ -301,6 +301,21 @@ enum {
     PROC_PID_FLAG_ENVIRON_FETCHED	= 1<<11,
     PROC_PID_FLAG_OOM_SCORE_FETCHED	= 1<<12,
     PROC_PID_FLAG_SMAPS_FETCHED		= 1<<13,
+    PROC_PID_FLAG_EXITED		= 1<<14,
+};
+
+/*
+ * /proc/<pid> files that can be kept open between fetches (-O option)
+ */
+enum {
+    PROC_PID_FILE_STAT = 0,
+    PROC_PID_FILE_STATM,
+    PROC_PID_FILE_STATUS,
+    PROC_PID_FILE_SCHEDSTAT,
+    PROC_PID_FILE_WCHAN,
+
+    /* number of files that can be kept open for each pid */
+    NR_PROC_PID_FILES
 };
 
 typedef struct {
@@ -309,6 +324,11 @@ typedef struct {
     char		*name;	/* full command line and args */
     char		*instname; /* external instance name (truncated <pid> cmdline) */
 
+    /* /proc/<pid> (or task) directory and files kept open, or -1 */
+    int			dirfd;
+    int			dirtask; /* dirfd is /proc/<pid>/task/<pid> */
+    int			fds[NR_PROC_PID_FILES];
+
     /* /proc/<pid>/stat cluster */
     int			stat_buflen;
     char		*stat_buf;
@@ -395,9 +415,24 @@ extern void disable_hotproc();
 /* init the hotproc data structures */
 extern void init_hotproc_pid(proc_pid_t *);
 
+/* keep /proc/<pid> files open between fetches, raising the open files limit */
+extern int proc_keep_open;
+extern void init_proc_keep_open(void);
+
+/* read files for many processes at once, using worker threads */
+#define PROC_MAX_WORKERS 256
+extern unsigned int proc_workers;
+extern void prefetch_proc_pid(proc_pid_t *, int, pmdaExt *);
+
 /* fetch a proc/<pid>/stat entry for pid */
 extern proc_pid_entry_t *fetch_proc_pid_stat(int, proc_pid_t *, int *);
 
+/* fetch a proc/<pid>/wchan entry for pid */
+extern proc_pid_entry_t *fetch_proc_pid_wchan(int, proc_pid_t *, int *);
+
+/* fetch a proc/<pid>/environ entry for pid */
+extern proc_pid_entry_t *fetch_proc_pid_environ(int, proc_pid_t *, int *);
+
 /* fetch a proc/<pid>/statm entry for pid */
 extern proc_pid_entry_t *fetch_proc_pid_statm(int, proc_pid_t *, int *);
 
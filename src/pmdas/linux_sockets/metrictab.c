@@ -28,6 +28,12 @@ pmdaMetric metrictable[] = {
 	    PM_TYPE_STRING, PM_INDOM_NULL, PM_SEM_DISCRETE,
 	    PMDA_PMUNITS(0,0,0,0,0,0) }},
 
+    { /* network.persocket.collector */
+	.m_user = &ss_collector,
+	.m_desc = { PMDA_PMID(CLUSTER_GLOBAL, 1),
+	    PM_TYPE_STRING, PM_INDOM_NULL, PM_SEM_DISCRETE,
+	    PMDA_PMUNITS(0,0,0,0,0,0) }},
+
     { /* network.persocket.netid */
 	.m_user = OFFSET(ss_stats_t, netid),
 	.m_desc = { PMDA_PMID(CLUSTER_SS, 0),
@@ -103,7 +103,16 @@ sockets_fetchCallBack(pmdaMetric *metric, unsigned int inst, pmAtomValue *atom)
 
     switch (cluster) {
     case CLUSTER_GLOBAL:
-	atom->cp = ss_filter;
+	switch (pmID_item(metric->m_desc.pmid)) {
+	case 0: /* network.persocket.filter */
+	    atom->cp = ss_filter;
+	    break;
+	case 1: /* network.persocket.collector */
+	    atom->cp = ss_collector;
+	    break;
+	default:
+	    return PM_ERR_PMID;
+	}
     	break;
 
     case CLUSTER_SS:
@@ -170,6 +179,18 @@ sockets_store(pmResult *result, pmdaExt *pmda)
 			ss_filter = av.cp; /* TODO filter syntax check */
 		    }
 		    break;
+	    	case 1: /* network.persocket.collector */
+		    if ((sts = pmExtractValue(vsp->valfmt, &vsp->vlist[0],
+			PM_TYPE_STRING, &av, PM_TYPE_STRING)) >= 0) {
+			if (strcmp(av.cp, "netlink") == 0)
+			    ss_use_netlink = 1;
+			else if (strcmp(av.cp, "ss") == 0)
+			    ss_use_netlink = 0;
+			else
+			    sts = PM_ERR_BADSTORE;
+			free(av.cp);
+		    }
+		    break;
 		default:
 		    sts = PM_ERR_PMID;
 		    break;
@@ -0,0 +1,880 @@
+/*
+ * Copyright (c) 2021 Red Hat.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/*
+ * Native socket collection using NETLINK_SOCK_DIAG (inet_diag) requests,
+ * the same kernel interface ss(8) uses, decoded into ss_stats_t with the
+ * same conversions and formatting as "ss -noemitauOH" so that either
+ * collector gives the same metric values.  Socket states and sport/dport
+ * comparisons in network.persocket.filter are passed to the kernel (as
+ * idiag_states and INET_DIAG_REQ_BYTECODE), for any other filter syntax
+ * the caller falls back to running ss.
+ */
+
+#include <pcp/pmapi.h>
+#include <pcp/pmda.h>
+#include "libpcp.h"
+#include <ftw.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/sock_diag.h>
+#include <linux/inet_diag.h>
+#include "ss_stats.h"
+
+int ss_use_netlink = 1; /* storable: network.persocket.collector */
+
+#ifndef INET_DIAG_SKV6ONLY
+#define INET_DIAG_SKV6ONLY 11
+#endif
+#ifndef INET_DIAG_CGROUP_ID
+#define INET_DIAG_CGROUP_ID 21
+#endif
+
+/* socket states, as in the kernel (include/net/tcp_states.h) */
+enum {
+    SS_UNKNOWN, SS_ESTABLISHED, SS_SYN_SENT, SS_SYN_RECV, SS_FIN_WAIT1,
+    SS_FIN_WAIT2, SS_TIME_WAIT, SS_CLOSE, SS_CLOSE_WAIT, SS_LAST_ACK,
+    SS_LISTEN, SS_CLOSING, SS_NEW_SYN_RECV, SS_MAX
+};
+
+#define SS_ALL		((1 << SS_NEW_SYN_RECV) - 1)
+#define SS_CONN		(SS_ALL & ~((1 << SS_LISTEN) | (1 << SS_CLOSE)))
+
+/* state names as printed by ss */
+static const char *ss_state_name[SS_MAX] = {
+    "UNKNOWN", "ESTAB", "SYN-SENT", "SYN-RECV", "FIN-WAIT-1", "FIN-WAIT-2",
+    "TIME-WAIT", "UNCONN", "CLOSE-WAIT", "LAST-ACK", "LISTEN", "CLOSING",
+    "SYN-RECV"
+};
+
+/* state names accepted in filters, as ss(8) */
+static struct {
+    char	*name;
+    int		states;
+} ss_state_filter[] = {
+    { "all", SS_ALL },
+    { "connected", SS_CONN },
+    { "synchronized", SS_CONN & ~(1 << SS_SYN_SENT) },
+    { "bucket", (1 << SS_SYN_RECV) | (1 << SS_TIME_WAIT) },
+    { "big", SS_ALL & ~((1 << SS_SYN_RECV) | (1 << SS_TIME_WAIT)) },
+    { "established", 1 << SS_ESTABLISHED },
+    { "syn-sent", 1 << SS_SYN_SENT },
+    { "syn-recv", 1 << SS_SYN_RECV },
+    { "fin-wait-1", 1 << SS_FIN_WAIT1 },
+    { "fin-wait-2", 1 << SS_FIN_WAIT2 },
+    { "time-wait", 1 << SS_TIME_WAIT },
+    { "closed", 1 << SS_CLOSE },
+    { "unconnected", 1 << SS_CLOSE },
+    { "close-wait", 1 << SS_CLOSE_WAIT },
+    { "last-ack", 1 << SS_LAST_ACK },
+    { "listening", 1 << SS_LISTEN },
+    { "closing", 1 << SS_CLOSING },
+    { NULL }
+};
+
+/* timer names as printed by ss, indexed by idiag_timer */
+static const char *ss_timer_name[] = {
+    "off", "on", "keepalive", "timewait", "persist", "unknown"
+};
+
+/*
+ * Layout of struct tcp_info from <linux/tcp.h>, up to the fields ss
+ * reports.  Kept here as older kernel headers lack the later fields;
+ * the kernel only sends as much of it as it knows about.
+ */
+typedef struct {
+    __uint8_t	state;
+    __uint8_t	ca_state;
+    __uint8_t	retransmits;
+    __uint8_t	probes;
+    __uint8_t	backoff;
+    __uint8_t	options;
+    __uint8_t	snd_wscale : 4, rcv_wscale : 4;
+    __uint8_t	delivery_rate_app_limited : 1, fastopen_client_fail : 2;
+    __uint32_t	rto;
+    __uint32_t	ato;
+    __uint32_t	snd_mss;
+    __uint32_t	rcv_mss;
+    __uint32_t	unacked;
+    __uint32_t	sacked;
+    __uint32_t	lost;
+    __uint32_t	retrans;
+    __uint32_t	fackets;
+    __uint32_t	last_data_sent;
+    __uint32_t	last_ack_sent;
+    __uint32_t	last_data_recv;
+    __uint32_t	last_ack_recv;
+    __uint32_t	pmtu;
+    __uint32_t	rcv_ssthresh;
+    __uint32_t	rtt;
+    __uint32_t	rttvar;
+    __uint32_t	snd_ssthresh;
+    __uint32_t	snd_cwnd;
+    __uint32_t	advmss;
+    __uint32_t	reordering;
+    __uint32_t	rcv_rtt;
+    __uint32_t	rcv_space;
+    __uint32_t	total_retrans;
+    __uint64_t	pacing_rate;
+    __uint64_t	max_pacing_rate;
+    __uint64_t	bytes_acked;
+    __uint64_t	bytes_received;
+    __uint32_t	segs_out;
+    __uint32_t	segs_in;
+    __uint32_t	notsent_bytes;
+    __uint32_t	min_rtt;
+    __uint32_t	data_segs_in;
+    __uint32_t	data_segs_out;
+    __uint64_t	delivery_rate;
+    __uint64_t	busy_time;
+    __uint64_t	rwnd_limited;
+    __uint64_t	sndbuf_limited;
+    __uint32_t	delivered;
+    __uint32_t	delivered_ce;
+    __uint64_t	bytes_sent;
+    __uint64_t	bytes_retrans;
+    __uint32_t	dsack_dups;
+    __uint32_t	reord_seen;
+} ss_tcp_info_t;
+
+#define SS_TCPI_OPT_TIMESTAMPS	1
+#define SS_TCPI_OPT_SACK	2
+#define SS_TCPI_OPT_WSCALE	4
+
+/* INET_DIAG_SKMEMINFO array indices, as SK_MEMINFO_* */
+enum {
+    SS_MEM_RMEM_ALLOC, SS_MEM_RCVBUF, SS_MEM_WMEM_ALLOC, SS_MEM_SNDBUF,
+    SS_MEM_FWD_ALLOC, SS_MEM_WMEM_QUEUED, SS_MEM_OPTMEM, SS_MEM_BACKLOG,
+    SS_MEM_DROPS, SS_MEM_VARS
+};
+
+/* sport/dport comparisons, each becomes one or two bytecode tests */
+#define SS_MAX_PORTOPS	32
+
+static struct {
+    char		*filter;	/* copy of ss_filter compiled below */
+    int			supported;	/* filter can be done by the kernel */
+    __uint32_t		states;
+    int			nops;
+    struct {
+	int		code;		/* INET_DIAG_BC_[SD]_{GE,LE} */
+	int		port;
+	int		ne;		/* port != value, code unused */
+	int		sport;
+    } ops[SS_MAX_PORTOPS];
+    int			bclen;
+    struct inet_diag_bc_op bytecode[5 * SS_MAX_PORTOPS];
+} ss_nlfilter;
+
+static int ss_nlfd = -1;
+static __uint32_t ss_nlseq;
+
+static int
+ss_netlink_port(const char *str)
+{
+    char	*end;
+    long	port;
+
+    if (*str == ':')
+	str++;
+    port = strtol(str, &end, 10);
+    if (*str == '\0' || *end != '\0' || port < 0 || port > 65535)
+	return -1;
+    return (int)port;
+}
+
+static int
+ss_netlink_portop(int sport, const char *op, int port)
+{
+    int		n = ss_nlfilter.nops;
+    int		ge = sport ? INET_DIAG_BC_S_GE : INET_DIAG_BC_D_GE;
+    int		le = sport ? INET_DIAG_BC_S_LE : INET_DIAG_BC_D_LE;
+
+    if (n + 2 > SS_MAX_PORTOPS)
+	return -1;
+    ss_nlfilter.ops[n].ne = 0;
+    ss_nlfilter.ops[n].sport = sport;
+    if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0 || strcmp(op, "eq") == 0) {
+	ss_nlfilter.ops[n].code = ge;
+	ss_nlfilter.ops[n++].port = port;
+	ss_nlfilter.ops[n].ne = 0;
+	ss_nlfilter.ops[n].sport = sport;
+	ss_nlfilter.ops[n].code = le;
+	ss_nlfilter.ops[n++].port = port;
+    }
+    else if (strcmp(op, "!=") == 0 || strcmp(op, "ne") == 0 || strcmp(op, "neq") == 0) {
+	ss_nlfilter.ops[n].ne = 1;
+	ss_nlfilter.ops[n++].port = port;
+    }
+    else if (strcmp(op, ">=") == 0 || strcmp(op, "ge") == 0) {
+	ss_nlfilter.ops[n].code = ge;
+	ss_nlfilter.ops[n++].port = port;
+    }
+    else if (strcmp(op, "<=") == 0 || strcmp(op, "le") == 0) {
+	ss_nlfilter.ops[n].code = le;
+	ss_nlfilter.ops[n++].port = port;
+    }
+    else if ((strcmp(op, ">") == 0 || strcmp(op, "gt") == 0) && port < 65535) {
+	ss_nlfilter.ops[n].code = ge;
+	ss_nlfilter.ops[n++].port = port + 1;
+    }
+    else if ((strcmp(op, "<") == 0 || strcmp(op, "lt") == 0) && port > 0) {
+	ss_nlfilter.ops[n].code = le;
+	ss_nlfilter.ops[n++].port = port - 1;
+    }
+    else
+	return -1;
+    ss_nlfilter.nops = n;
+    return 0;
+}
+
+/*
+ * Build the bytecode for the port comparisons, all of which must hold.
+ * The kernel only accepts programs where every test can be reached by
+ * following the "yes" jumps from the start, and the socket is accepted
+ * when the last of those ends exactly at the end of the program.  So
+ * each test jumps to the next one when true, and past the end of the
+ * program (rejecting the socket) when false.  "port != N" is tested as
+ * "port >= N" and "port <= N", both true going on to an unconditional
+ * jump past the end, either false skipping over that jump.
+ */
+static void
+ss_netlink_bytecode(void)
+{
+    struct inet_diag_bc_op	*bc = ss_nlfilter.bytecode;
+    int				i, len = 0, pos = 0, sport;
+
+    for (i = 0; i < ss_nlfilter.nops; i++)
+	len += (ss_nlfilter.ops[i].ne ? 5 : 2) * sizeof(*bc);
+
+    for (i = 0; i < ss_nlfilter.nops; i++) {
+	if (ss_nlfilter.ops[i].ne) {
+	    sport = ss_nlfilter.ops[i].sport;
+	    bc[0].code = sport ? INET_DIAG_BC_S_GE : INET_DIAG_BC_D_GE;
+	    bc[0].yes = 2 * sizeof(*bc);
+	    bc[0].no = 5 * sizeof(*bc);
+	    bc[1].code = bc[1].yes = 0;
+	    bc[1].no = ss_nlfilter.ops[i].port;
+	    bc[2].code = sport ? INET_DIAG_BC_S_LE : INET_DIAG_BC_D_LE;
+	    bc[2].yes = 2 * sizeof(*bc);
+	    bc[2].no = 3 * sizeof(*bc);
+	    bc[3].code = bc[3].yes = 0;
+	    bc[3].no = ss_nlfilter.ops[i].port;
+	    bc[4].code = INET_DIAG_BC_JMP;
+	    bc[4].yes = sizeof(*bc);
+	    bc[4].no = len - pos - 4 * sizeof(*bc) + 4;
+	    bc += 5;
+	    pos += 5 * sizeof(*bc);
+	}
+	else {
+	    bc[0].code = ss_nlfilter.ops[i].code;
+	    bc[0].yes = 2 * sizeof(*bc);
+	    bc[0].no = len - pos + 4;
+	    bc[1].code = bc[1].yes = 0;
+	    bc[1].no = ss_nlfilter.ops[i].port;
+	    bc += 2;
+	    pos += 2 * sizeof(*bc);
+	}
+    }
+    ss_nlfilter.bclen = len;
+}
+
+/*
+ * Compile the network.persocket.filter string, if it only selects
+ * socket states and compares ports.  Otherwise (addresses, "or", "not",
+ * grouping, service names, etc) it is left for ss to interpret.
+ */
+static int
+ss_netlink_filter(const char *filter)
+{
+    char	*copy, *tok, *op, *arg, *save = NULL;
+    int		i, port, states = SS_ALL, saw_states = 0;
+
+    if (ss_nlfilter.filter && strcmp(ss_nlfilter.filter, filter) == 0)
+	return ss_nlfilter.supported ? 0 : -1;
+
+    free(ss_nlfilter.filter);
+    if ((ss_nlfilter.filter = strdup(filter)) == NULL ||
+	(copy = strdup(filter)) == NULL) {
+	free(ss_nlfilter.filter);
+	ss_nlfilter.filter = NULL;
+	return -1;
+    }
+    ss_nlfilter.supported = 0;
+    ss_nlfilter.nops = 0;
+
+    for (tok = strtok_r(copy, " \t\n", &save); tok != NULL;
+	 tok = strtok_r(NULL, " \t\n", &save)) {
+	if (strcmp(tok, "state") == 0 || strcmp(tok, "exclude") == 0 ||
+	    strcmp(tok, "excl") == 0) {
+	    if ((arg = strtok_r(NULL, " \t\n", &save)) == NULL)
+		goto unsupported;
+	    for (i = 0; ss_state_filter[i].name != NULL; i++)
+		if (strcmp(arg, ss_state_filter[i].name) == 0)
+		    break;
+	    if (ss_state_filter[i].name == NULL)
+		goto unsupported;
+	    if (tok[0] == 's') {
+		if (!saw_states)
+		    states = 0;
+		states |= ss_state_filter[i].states;
+	    }
+	    else {
+		if (!saw_states)
+		    states = SS_ALL;
+		states &= ~ss_state_filter[i].states;
+	    }
+	    saw_states = 1;
+	}
+	else if (strcmp(tok, "sport") == 0 || strcmp(tok, "dport") == 0) {
+	    if ((op = strtok_r(NULL, " \t\n", &save)) == NULL ||
+		(arg = strtok_r(NULL, " \t\n", &save)) == NULL ||
+		(port = ss_netlink_port(arg)) < 0 ||
+		ss_netlink_portop(tok[0] == 's', op, port) < 0)
+		goto unsupported;
+	}
+	else if (strcmp(tok, "and") != 0 && strcmp(tok, "&") != 0 &&
+		 strcmp(tok, "&&") != 0)
+	    goto unsupported;
+    }
+
+    ss_nlfilter.states = states;
+    ss_netlink_bytecode();
+    ss_nlfilter.supported = 1;
+    free(copy);
+    return 0;
+
+unsupported:
+    if (pmDebugOptions.appl0)
+	fprintf(stderr, "%s: filter \"%s\" not supported, using ss\n",
+		pmGetProgname(), filter);
+    free(copy);
+    return -1;
+}
+
+/*
+ * Socket cgroup identifiers are cgroup2 directory inode numbers, map
+ * them to paths (relative to the cgroup2 mount point, as ss reports)
+ * by walking that hierarchy.  This is redone when an unknown id is
+ * seen, at most once per refresh.
+ */
+static __pmHashCtl	ss_cgroups;
+static char		ss_cgroup_mount[MAXPATHLEN];
+static int		ss_cgroup_mountlen;
+static int		ss_cgroup_walked;
+
+typedef struct {
+    __uint64_t		id;
+    char		path[];
+} ss_cgroup_t;
+
+static __pmHashWalkState
+ss_cgroup_free(const __pmHashNode *hp, void *cp)
+{
+    (void)cp;
+    free(hp->data);
+    return PM_HASH_WALK_DELETE_NEXT;
+}
+
+static int
+ss_cgroup_add(const char *path, const struct stat *sbuf, int flag, struct FTW *ftw)
+{
+    ss_cgroup_t	*cg;
+    const char	*name = path + ss_cgroup_mountlen;
+    size_t	len;
+
+    (void)ftw;
+    if (flag != FTW_D)
+	return 0;
+    if (*name == '\0')
+	name = "/";
+    len = strlen(name) + 1;
+    if ((cg = (ss_cgroup_t *)malloc(sizeof(*cg) + len)) == NULL)
+	return -1;
+    cg->id = sbuf->st_ino;
+    memcpy(cg->path, name, len);
+    if (__pmHashAdd((unsigned int)cg->id, cg, &ss_cgroups) < 0) {
+	free(cg);
+	return -1;
+    }
+    return 0;
+}
+
+static void
+ss_cgroup_walk(void)
+{
+    FILE	*fp;
+    char	line[MAXPATHLEN + 256], mount[MAXPATHLEN], type[64];
+
+    __pmHashWalkCB(ss_cgroup_free, NULL, &ss_cgroups);
+    if (ss_cgroup_mount[0] == '\0') {
+	if ((fp = fopen("/proc/mounts", "r")) == NULL)
+	    return;
+	while (fgets(line, sizeof(line), fp) != NULL) {
+	    if (sscanf(line, "%*s %s %63s", mount, type) == 2 &&
+		strcmp(type, "cgroup2") == 0) {
+		pmsprintf(ss_cgroup_mount, sizeof(ss_cgroup_mount), "%s", mount);
+		break;
+	    }
+	}
+	fclose(fp);
+	ss_cgroup_mountlen = strlen(ss_cgroup_mount);
+	if (ss_cgroup_mountlen == 0)
+	    return;
+    }
+    nftw(ss_cgroup_mount, ss_cgroup_add, 16, FTW_PHYS | FTW_MOUNT);
+}
+
+static const char *
+ss_cgroup_path(__uint64_t id)
+{
+    __pmHashNode	*hp;
+    ss_cgroup_t		*cg;
+    int			pass;
+
+    for (pass = 0; pass < 2; pass++) {
+	for (hp = __pmHashSearch((unsigned int)id, &ss_cgroups);
+	     hp != NULL; hp = hp->next) {
+	    cg = (ss_cgroup_t *)hp->data;
+	    if (hp->key == (unsigned int)id && cg->id == id)
+		return cg->path;
+	}
+	if (ss_cgroup_walked)
+	    break;
+	ss_cgroup_walk();
+	ss_cgroup_walked = 1;
+    }
+    return NULL;
+}
+
+/*
+ * Sockets seen over netlink, by sock_diag cookie (unique for the life
+ * of the kernel), mapped to their instance so that the instance name
+ * is only formatted and hashed for sockets not seen before.  Entries
+ * for sockets not seen in a refresh are dropped at its end.
+ */
+static __pmHashCtl	ss_sockets;
+static unsigned int	ss_generation;
+
+typedef struct {
+    __uint64_t		cookie;
+    int			inst;
+    unsigned int	generation;	/* last refresh this socket was seen */
+} ss_socket_t;
+
+static unsigned int
+ss_socket_key(__uint64_t cookie)
+{
+    return (unsigned int)(cookie ^ (cookie >> 32));
+}
+
+static __pmHashWalkState
+ss_socket_expire(const __pmHashNode *hp, void *cp)
+{
+    ss_socket_t	*sp = (ss_socket_t *)hp->data;
+
+    (void)cp;
+    if (sp->generation == ss_generation)
+	return PM_HASH_WALK_NEXT;
+    free(sp);
+    return PM_HASH_WALK_DELETE_NEXT;
+}
+
+/* as ss_store(), but finding a known socket by its cookie */
+static void
+ss_netlink_store(int indom, ss_stats_t *parsed_ss)
+{
+    __pmHashNode	*hp;
+    ss_socket_t		*sp = NULL;
+    ss_stats_t		*ss = NULL;
+    char		*name;
+    int			inst;
+
+    for (hp = __pmHashSearch(ss_socket_key(parsed_ss->sk), &ss_sockets);
+	 hp != NULL; hp = hp->next) {
+	sp = (ss_socket_t *)hp->data;
+	if (sp->cookie == parsed_ss->sk)
+	    break;
+	sp = NULL;
+    }
+
+    if (sp != NULL && parsed_ss->state[0] != '\0' &&
+	pmdaCacheLookup(indom, sp->inst, &name, (void **)&ss) >= 0 && ss != NULL) {
+	*ss = *parsed_ss;
+	ss->instid = pmdaCacheStore(indom, PMDA_CACHE_ADD, name, (void *)ss);
+	sp->generation = ss_generation;
+	return;
+    }
+
+    /* new socket (or its instance has gone), look it up by name */
+    if ((inst = ss_store(indom, parsed_ss)) < 0)
+	return;
+    if (sp == NULL) {
+	if ((sp = (ss_socket_t *)malloc(sizeof(*sp))) == NULL)
+	    return;
+	sp->cookie = parsed_ss->sk;
+	if (__pmHashAdd(ss_socket_key(sp->cookie), sp, &ss_sockets) < 0) {
+	    free(sp);
+	    return;
+	}
+    }
+    sp->inst = inst;
+    sp->generation = ss_generation;
+}
+
+/* as ss print_ms_timer() */
+static void
+ss_netlink_timer(char *buf, int buflen, unsigned int timeout)
+{
+    int		secs, msecs, minutes, len = 0;
+
+    secs = timeout / 1000;
+    minutes = secs / 60;
+    secs = secs % 60;
+    msecs = timeout % 1000;
+    buf[0] = '\0';
+    if (minutes) {
+	msecs = 0;
+	len = pmsprintf(buf, buflen, "%dmin", minutes);
+	if (minutes > 9)
+	    secs = 0;
+    }
+    if (secs) {
+	if (secs > 9)
+	    msecs = 0;
+	len += pmsprintf(buf + len, buflen - len, "%d%s", secs, msecs ? "." : "sec");
+    }
+    if (msecs)
+	pmsprintf(buf + len, buflen - len, "%03dms", msecs);
+}
+
+/* address and port as ss -n prints them */
+static void
+ss_netlink_addr(char *buf, int buflen, int family, const void *addr,
+		unsigned int port, int v6only, unsigned int ifindex)
+{
+    char	host[INET6_ADDRSTRLEN], ifname[IF_NAMESIZE + 1] = "";
+    char	portstr[8] = "*";
+
+    if (ifindex && if_indextoname(ifindex, ifname + 1) != NULL)
+	ifname[0] = '%';
+    if (port)
+	pmsprintf(portstr, sizeof(portstr), "%u", port);
+
+    if (family == AF_INET) {
+	inet_ntop(AF_INET, addr, host, sizeof(host));
+	pmsprintf(buf, buflen, "%s%s:%s", host, ifname, portstr);
+    }
+    else if (!v6only && IN6_IS_ADDR_UNSPECIFIED((const struct in6_addr *)addr))
+	pmsprintf(buf, buflen, "*%s:%s", ifname, portstr);
+    else {
+	inet_ntop(AF_INET6, addr, host, sizeof(host));
+	pmsprintf(buf, buflen, "[%s]%s:%s", host, ifname, portstr);
+    }
+}
+
+static void
+ss_netlink_tcp_info(ss_stats_t *ss, const ss_tcp_info_t *info, const char *cong)
+{
+    ss->ts = (info->options & SS_TCPI_OPT_TIMESTAMPS) != 0;
+    ss->sack = (info->options & SS_TCPI_OPT_SACK) != 0;
+    ss->cubic = (cong && strcmp(cong, "cubic") == 0);
+    if (info->options & SS_TCPI_OPT_WSCALE) {
+	ss->wscale_snd = info->snd_wscale;
+	ss->wscale_rcv = info->rcv_wscale;
+	pmsprintf(ss->wscale_str, sizeof(ss->wscale_str), "%d,%d",
+		ss->wscale_snd, ss->wscale_rcv);
+    }
+    if (info->rto && info->rto != 3000000)
+	ss->rto = (double)info->rto / 1000;
+    ss->backoff = info->backoff;
+    if (info->rtt) {
+	ss->round_trip_rtt = (double)info->rtt / 1000;
+	ss->round_trip_rttvar = (double)info->rttvar / 1000;
+	pmsprintf(ss->round_trip_str, sizeof(ss->round_trip_str), "%g/%g",
+		ss->round_trip_rtt, ss->round_trip_rttvar);
+    }
+    ss->ato = (double)info->ato / 1000;
+    ss->mss = info->snd_mss;
+    ss->pmtu = info->pmtu;
+    ss->rcvmss = info->rcv_mss;
+    ss->advmss = info->advmss;
+    ss->cwnd = info->snd_cwnd;
+    if (info->snd_ssthresh < 0xFFFF)
+	ss->ssthresh = info->snd_ssthresh;
+    ss->bytes_sent = info->bytes_sent;
+    ss->bytes_retrans = info->bytes_retrans;
+    ss->bytes_acked = info->bytes_acked;
+    ss->bytes_received = info->bytes_received;
+    ss->segs_out = info->segs_out;
+    ss->segs_in = info->segs_in;
+    ss->data_segs_out = info->data_segs_out;
+    ss->data_segs_in = info->data_segs_in;
+    /* rates are reported by ss in bits per second, rounded */
+    if (info->rtt && info->snd_mss && info->snd_cwnd)
+	ss->send = (double)(__uint64_t)((double)info->snd_cwnd *
+			info->snd_mss * 8000000.0 / info->rtt + 0.5);
+    ss->lastsnd = info->last_data_sent;
+    ss->lastrcv = info->last_data_recv;
+    ss->lastack = info->last_ack_recv;
+    if (info->pacing_rate != ~(__uint64_t)0)
+	ss->pacing_rate = (double)info->pacing_rate * 8;
+    ss->delivery_rate = (double)info->delivery_rate * 8;
+    ss->delivered = info->delivered;
+    ss->app_limited = info->delivery_rate_app_limited;
+    ss->reord_seen = info->reord_seen;
+    ss->busy = info->busy_time / 1000;
+    if (info->busy_time)
+	ss->rwnd_limited = info->rwnd_limited / 1000;
+    ss->unacked = info->unacked;
+    if (info->retrans || info->total_retrans)
+	pmsprintf(ss->retrans_str, sizeof(ss->retrans_str), "%u/%u",
+		info->retrans, info->total_retrans);
+    ss->dsack_dups = info->dsack_dups;
+    ss->rcv_rtt = (double)info->rcv_rtt / 1000;
+    ss->rcv_space = info->rcv_space;
+    ss->lost = info->lost;
+    ss->rcv_ssthresh = info->rcv_ssthresh;
+    ss->minrtt = (double)info->min_rtt / 1000;
+    ss->notsent = info->notsent_bytes;
+}
+
+/* decode one inet_diag_msg, returns 0 if it has a known state */
+static int
+ss_netlink_parse(struct nlmsghdr *nlh, const char *netid, ss_stats_t *ss)
+{
+    struct inet_diag_msg	*r = (struct inet_diag_msg *)NLMSG_DATA(nlh);
+    struct rtattr		*attr;
+    ss_tcp_info_t		info;
+    const char			*cong = NULL, *path;
+    __uint32_t			*mem = NULL;
+    __uint64_t			cgroup_id = 0;
+    char			expire[16];
+    int				len, memlen = 0, have_info = 0;
+
+    if (r->idiag_state >= SS_MAX)
+	return -1;
+
+    memset(ss, 0, sizeof(*ss));
+    len = nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*r));
+    for (attr = (struct rtattr *)(r + 1); RTA_OK(attr, len);
+	 attr = RTA_NEXT(attr, len)) {
+	switch (attr->rta_type) {
+	case INET_DIAG_INFO:
+	    memset(&info, 0, sizeof(info));
+	    memcpy(&info, RTA_DATA(attr),
+		    RTA_PAYLOAD(attr) < sizeof(info) ? RTA_PAYLOAD(attr) : sizeof(info));
+	    have_info = 1;
+	    break;
+	case INET_DIAG_SKMEMINFO:
+	    mem = (__uint32_t *)RTA_DATA(attr);
+	    memlen = RTA_PAYLOAD(attr) / sizeof(__uint32_t);
+	    break;
+	case INET_DIAG_CONG:
+	    cong = (const char *)RTA_DATA(attr);
+	    break;
+	case INET_DIAG_SKV6ONLY:
+	    ss->v6only = *(__uint8_t *)RTA_DATA(attr);
+	    break;
+	case INET_DIAG_CGROUP_ID:
+	    memcpy(&cgroup_id, RTA_DATA(attr), sizeof(cgroup_id));
+	    break;
+	}
+    }
+
+    pmsprintf(ss->netid, sizeof(ss->netid), "%s", netid);
+    pmsprintf(ss->state, sizeof(ss->state), "%s", ss_state_name[r->idiag_state]);
+    ss->recvq = r->idiag_rqueue;
+    ss->sendq = r->idiag_wqueue;
+    ss_netlink_addr(ss->src, sizeof(ss->src), r->idiag_family,
+		r->id.idiag_src, ntohs(r->id.idiag_sport), ss->v6only, r->id.idiag_if);
+    ss_netlink_addr(ss->dst, sizeof(ss->dst), r->idiag_family,
+		r->id.idiag_dst, ntohs(r->id.idiag_dport), ss->v6only, 0);
+    ss->inode = r->idiag_inode;
+    ss->uid = r->idiag_uid;
+    ss->sk = ((__uint64_t)r->id.idiag_cookie[1] << 32) | r->id.idiag_cookie[0];
+
+    if (r->idiag_timer) {
+	ss_netlink_timer(expire, sizeof(expire), r->idiag_expires);
+	pmsprintf(ss->timer_name, sizeof(ss->timer_name), "%s",
+		ss_timer_name[r->idiag_timer > 4 ? 5 : r->idiag_timer]);
+	pmsprintf(ss->timer_expire_str, sizeof(ss->timer_expire_str), "%s", expire);
+	ss->timer_retrans = r->idiag_retrans;
+	pmsprintf(ss->timer_str, sizeof(ss->timer_str), "%s,%s,%d",
+		ss->timer_name, expire, ss->timer_retrans);
+    }
+
+    if (cgroup_id && (path = ss_cgroup_path(cgroup_id)) != NULL)
+	pmsprintf(ss->cgroup, sizeof(ss->cgroup), "%s", path);
+
+    if (mem && memlen > SS_MEM_OPTMEM) {
+	ss->skmem_rmem_alloc = mem[SS_MEM_RMEM_ALLOC];
+	ss->skmem_rcv_buf = mem[SS_MEM_RCVBUF];
+	ss->skmem_wmem_alloc = mem[SS_MEM_WMEM_ALLOC];
+	ss->skmem_snd_buf = mem[SS_MEM_SNDBUF];
+	ss->skmem_fwd_alloc = mem[SS_MEM_FWD_ALLOC];
+	ss->skmem_wmem_queued = mem[SS_MEM_WMEM_QUEUED];
+	ss->skmem_ropt_mem = mem[SS_MEM_OPTMEM];
+	len = pmsprintf(ss->skmem_str, sizeof(ss->skmem_str),
+		"r%u,rb%u,t%u,tb%u,f%u,w%u,o%u",
+		mem[SS_MEM_RMEM_ALLOC], mem[SS_MEM_RCVBUF],
+		mem[SS_MEM_WMEM_ALLOC], mem[SS_MEM_SNDBUF],
+		mem[SS_MEM_FWD_ALLOC], mem[SS_MEM_WMEM_QUEUED],
+		mem[SS_MEM_OPTMEM]);
+	if (memlen > SS_MEM_BACKLOG) {
+	    ss->skmem_back_log = mem[SS_MEM_BACKLOG];
+	    len += pmsprintf(ss->skmem_str + len, sizeof(ss->skmem_str) - len,
+		",bl%u", mem[SS_MEM_BACKLOG]);
+	}
+	if (memlen > SS_MEM_DROPS) {
+	    ss->skmem_sock_drop = mem[SS_MEM_DROPS];
+	    pmsprintf(ss->skmem_str + len, sizeof(ss->skmem_str) - len,
+		",d%u", mem[SS_MEM_DROPS]);
+	}
+    }
+
+    if (have_info)
+	ss_netlink_tcp_info(ss, &info, cong);
+
+    return 0;
+}
+
+/* one dump request, for one address family and protocol */
+static int
+ss_netlink_dump(int indom, int family, int protocol, const char *netid)
+{
+    struct {
+	struct nlmsghdr		nlh;
+	struct inet_diag_req_v2	r;
+    } req;
+    struct rtattr		rta;
+    struct sockaddr_nl		nladdr = { .nl_family = AF_NETLINK };
+    struct iovec		iov[3];
+    struct msghdr		msg;
+    struct nlmsghdr		*nlh;
+    struct nlmsgerr		*err;
+    static long			buf[8192];
+    ss_stats_t			ss;
+    int				n;
+
+    memset(&req, 0, sizeof(req));
+    req.nlh.nlmsg_len = sizeof(req);
+    req.nlh.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+    req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.nlh.nlmsg_seq = ++ss_nlseq;
+    req.r.sdiag_family = family;
+    req.r.sdiag_protocol = protocol;
+    req.r.idiag_states = ss_nlfilter.states;
+    req.r.idiag_ext = (1 << (INET_DIAG_INFO - 1)) |
+		      (1 << (INET_DIAG_CONG - 1)) |
+		      (1 << (INET_DIAG_SKMEMINFO - 1));
+
+    iov[0].iov_base = &req;
+    iov[0].iov_len = sizeof(req);
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &nladdr;
+    msg.msg_namelen = sizeof(nladdr);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 1;
+    if (ss_nlfilter.bclen) {
+	rta.rta_type = INET_DIAG_REQ_BYTECODE;
+	rta.rta_len = RTA_LENGTH(ss_nlfilter.bclen);
+	iov[1].iov_base = &rta;
+	iov[1].iov_len = sizeof(rta);
+	iov[2].iov_base = ss_nlfilter.bytecode;
+	iov[2].iov_len = ss_nlfilter.bclen;
+	msg.msg_iovlen = 3;
+	req.nlh.nlmsg_len += RTA_LENGTH(ss_nlfilter.bclen);
+    }
+    if (sendmsg(ss_nlfd, &msg, 0) < 0)
+	return -oserror();
+
+    for (;;) {
+	if ((n = recv(ss_nlfd, buf, sizeof(buf), 0)) < 0) {
+	    if (oserror() == EINTR)
+		continue;
+	    return -oserror();
+	}
+	if (n == 0)
+	    return -EPROTO;
+	for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, n); nlh = NLMSG_NEXT(nlh, n)) {
+	    if (nlh->nlmsg_seq != ss_nlseq)
+		continue;
+	    if (nlh->nlmsg_type == NLMSG_DONE)
+		return 0;
+	    if (nlh->nlmsg_type == NLMSG_ERROR) {
+		err = (struct nlmsgerr *)NLMSG_DATA(nlh);
+		/* no diag module for this family and protocol */
+		if (err->error == -ENOENT)
+		    return 0;
+		return err->error < 0 ? err->error : -EPROTO;
+	    }
+	    if (nlh->nlmsg_type != SOCK_DIAG_BY_FAMILY)
+		continue;
+	    if (ss_netlink_parse(nlh, netid, &ss) == 0)
+		ss_netlink_store(indom, &ss);
+	}
+    }
+}
+
+/*
+ * Refresh the sockets instance domain over netlink, in the same order
+ * as ss lists them.  Returns a negative value (without having changed
+ * the cache) if this cannot be done and ss should be used instead.
+ */
+int
+ss_netlink_refresh(int indom)
+{
+    static const struct {
+	int	family;
+	int	protocol;
+	char	*netid;
+    } dumps[] = {
+	{ AF_INET, IPPROTO_UDP, "udp" },
+	{ AF_INET6, IPPROTO_UDP, "udp" },
+	{ AF_INET, IPPROTO_TCP, "tcp" },
+	{ AF_INET6, IPPROTO_TCP, "tcp" },
+    };
+    int		i, sts;
+
+    if (!ss_use_netlink || getenv("PCPQA_PMDA_SOCKETS") != NULL)
+	return -EOPNOTSUPP;
+    if (ss_netlink_filter(ss_filter) < 0)
+	return -EOPNOTSUPP;
+    if (ss_nlfd < 0) {
+	if ((ss_nlfd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_SOCK_DIAG)) < 0)
+	    return -oserror();
+    }
+
+    ss_cgroup_walked = 0;
+    ss_generation++;
+    pmdaCacheOp(indom, PMDA_CACHE_INACTIVE);
+    for (i = 0; i < sizeof(dumps) / sizeof(dumps[0]); i++) {
+	if ((sts = ss_netlink_dump(indom, dumps[i].family, dumps[i].protocol,
+			dumps[i].netid)) < 0) {
+	    if (pmDebugOptions.appl0)
+		fprintf(stderr, "%s: netlink sock_diag: %s, using ss\n",
+			pmGetProgname(), pmErrStr(sts));
+	    /* the socket may have unread replies, start over next time */
+	    close(ss_nlfd);
+	    ss_nlfd = -1;
+	    return sts;
+	}
+    }
+    __pmHashWalkCB(ss_socket_expire, NULL, &ss_sockets);
+    return 0;
+}
@@ -188,8 +188,8 @@ ss_parse(char *line, ss_stats_t *ss)
     int sts = 0;
 
     memset(&ss_p, 0, sizeof(ss_p));
-    sscanf(line, "%s %s %u %u %s %s",
-    	ss_p.netid, ss_p.state, &ss_p.sendq, &ss_p.recvq, ss_p.src, ss_p.dst);
+    sscanf(line, "%s %s %d %d %s %s",
+    	ss_p.netid, ss_p.state, &ss_p.recvq, &ss_p.sendq, ss_p.src, ss_p.dst);
 
     /* skip first 6 fields, already scanned (above) */
     for (i=0; i < 6; i++)
@@ -232,7 +232,9 @@ ss_parse(char *line, ss_stats_t *ss)
 		    break;
 		case PM_TYPE_U64:
 		    p += parse_table[i].len;
-		    *(__uint64_t *)(parse_table[i].addr) = strtoull(p, NULL, 10);
+		    /* the socket cookie is printed in hex */
+		    *(__uint64_t *)(parse_table[i].addr) = strtoull(p, NULL,
+			parse_table[i].addr == &ss_p.sk ? 16 : 10);
 		    break;
 		case PM_TYPE_FLOAT:
 		    p += parse_table[i].len;
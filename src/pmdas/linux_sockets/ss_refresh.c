@@ -32,37 +32,61 @@ ss_free(void *p)
     free(ss);
 }
 
+char *ss_collector = "ss"; /* network.persocket.collector */
+
+/* add or update the cache entry for one socket, returns its instance */
+int
+ss_store(int indom, ss_stats_t *parsed_ss)
+{
+    ss_stats_t *ss = NULL;
+    int sts, inst;
+    char instname[128];
+
+    if (parsed_ss->state[0] == '\0')
+	return PM_ERR_INST; /* transient with no state, ignore */
+    ss_instname(parsed_ss, instname, sizeof(instname));
+    sts = pmdaCacheLookupName(indom, instname, &inst, (void **)&ss);
+    if (sts < 0 || ss == NULL) {
+	/* new entry */
+	if ((ss = (ss_stats_t *)malloc(sizeof(ss_stats_t))) == NULL)
+	    return -ENOMEM;
+    }
+    *ss = *parsed_ss;
+    ss->instid = pmdaCacheStore(indom, PMDA_CACHE_ADD, instname, (void **)ss);
+    return ss->instid;
+}
+
 int
 ss_refresh(int indom)
 {
     FILE *fp;
     int sts = 0;
-    ss_stats_t *ss, parsed_ss;
-    int inst;
-    char instname[128];
+    ss_stats_t parsed_ss;
     char line[4096] = {0};
 
-    if ((fp = ss_open_stream()) == NULL)
-    	return -errno;
+    if (ss_filter == NULL) {
+	/* pmstore to network.persocket.filter frees this if changing */
+	if ((ss_filter = strdup(SS_DEFAULT_FILTER)) == NULL)
+	    return -ENOMEM;
+    }
+
+    /* native collection, unless the filter needs ss to interpret it */
+    if (ss_netlink_refresh(indom) >= 0)
+	ss_collector = "netlink";
+    else {
+	if ((fp = ss_open_stream()) == NULL)
+	    return -errno;
+
+	/* invalidate all cache entries */
+	pmdaCacheOp(indom, PMDA_CACHE_INACTIVE);
 
-    /* invalidate all cache entries */
-    pmdaCacheOp(indom, PMDA_CACHE_INACTIVE);
-    
-    while (fgets(line, sizeof(line), fp) != NULL) {
-	ss_parse(line, &parsed_ss);
-	ss_instname(&parsed_ss, instname, sizeof(instname));
-	ss = NULL;
-	sts = pmdaCacheLookupName(indom, instname, &inst, (void **)&ss);
-	if (sts < 0 || ss == NULL) {
-	    /* new entry */
-	    ss = (ss_stats_t *)malloc(sizeof(ss_stats_t));
+	while (fgets(line, sizeof(line), fp) != NULL) {
+	    ss_parse(line, &parsed_ss);
+	    ss_store(indom, &parsed_ss);
 	}
-	*ss = parsed_ss;
-	if (ss->state[0] == '\0')
-	    continue; /* transient with no state, ignore */
-	ss->instid = pmdaCacheStore(indom, PMDA_CACHE_ADD, instname, (void **)ss);
+	ss_close_stream(fp);
+	ss_collector = "ss";
     }
-    ss_close_stream(fp);
 
     /* purge inactive/closed sockets after 10min, and free private data */
     pmdaCachePurgeCallback(indom, 600, ss_free);
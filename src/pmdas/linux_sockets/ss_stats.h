@@ -86,8 +86,15 @@ typedef struct ss_stats {
     __uint32_t		notsent;
 } ss_stats_t;
 
+/* default filter: reduces logging overheads */
+#define SS_DEFAULT_FILTER "state connected"
+
 extern int ss_refresh(int);
+extern int ss_store(int, ss_stats_t *);
 extern int ss_parse(char *, ss_stats_t *);
 extern FILE *ss_open_stream(void);
 extern void ss_close_stream(FILE *);
+extern int ss_netlink_refresh(int);
 extern char *ss_filter; /* current string value of network.persocket.filter */
+extern char *ss_collector; /* network.persocket.collector, used by last refresh */
+extern int ss_use_netlink; /* zero if ss has been stored as the collector */
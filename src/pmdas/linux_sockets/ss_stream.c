@@ -18,9 +18,6 @@
 
 #define SS_OPTIONS "-noemitauOH"
 
-/* default filter: reduces logging overheads */
-#define SS_DEFAULT_FILTER "state connected"
-
 char *ss_filter = NULL; /* storable: network.persocket.filter */
 
 FILE *
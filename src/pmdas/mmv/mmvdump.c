@@ -22,6 +22,8 @@
 #include <sys/stat.h>
 #include <strings.h>
 
+static mmv_disk_stripes_t *stripes;
+
 int
 dump_indoms(void *addr, size_t size, int idx, long base, __uint64_t offset, __int32_t count)
 {
@@ -349,31 +351,75 @@ dump_metrics(void *addr, size_t size, int idx, long base, __uint64_t offset, __i
     return dump_metrics2(addr, size, idx, base, offset, count);
 }
 
+int
+stripes_sum(void *addr, size_t size, mmv_disk_value_t *value, int type, pmAtomValue *atom)
+{
+    pmAtomValue *slot;
+    __uint64_t off = value->extra;
+    int i;
+
+    if (stripes == NULL || off < stripes->offset ||
+	off + sizeof(pmAtomValue) > stripes->offset + stripes->size)
+	return 0;
+
+    for (i = 0; i < stripes->count; i++, off += stripes->size) {
+	if (size < off + sizeof(pmAtomValue))
+	    return 0;
+	slot = (pmAtomValue *)((char *)addr + off);
+	switch (type) {
+	case MMV_TYPE_I32:
+	    atom->l += slot->l;
+	    break;
+	case MMV_TYPE_U32:
+	    atom->ul += slot->ul;
+	    break;
+	case MMV_TYPE_I64:
+	    atom->ll += slot->ll;
+	    break;
+	case MMV_TYPE_U64:
+	    atom->ull += slot->ull;
+	    break;
+	case MMV_TYPE_FLOAT:
+	    atom->f += slot->f;
+	    break;
+	case MMV_TYPE_DOUBLE:
+	    atom->d += slot->d;
+	    break;
+	}
+    }
+    return 1;
+}
+
 int
 dump_value(void *addr, size_t size, mmv_disk_value_t *vals, int i, int toc, int type)
 {
     mmv_disk_string_t *string;
+    pmAtomValue atom = vals[i].value;
     struct timeval tv;
     __int64_t t;
+    int striped = 0;
+
+    if (type != MMV_TYPE_STRING && type != MMV_TYPE_ELAPSED && vals[i].extra)
+	striped = stripes_sum(addr, size, &vals[i], type, &atom);
 
     switch (type) {
     case MMV_TYPE_I32:
-	printf(" = %d", vals[i].value.l);
+	printf(" = %d", atom.l);
 	break;
     case MMV_TYPE_U32:
-	printf(" = %u", vals[i].value.ul);
+	printf(" = %u", atom.ul);
 	break;
     case MMV_TYPE_I64:
-	printf(" = %" PRIi64, vals[i].value.ll);
+	printf(" = %" PRIi64, atom.ll);
 	break;
     case MMV_TYPE_U64:
-	printf(" = %" PRIu64, vals[i].value.ull);
+	printf(" = %" PRIu64, atom.ull);
 	break;
     case MMV_TYPE_FLOAT:
-	printf(" = %f", vals[i].value.f);
+	printf(" = %f", atom.f);
 	break;
     case MMV_TYPE_DOUBLE:
-	printf(" = %lf", vals[i].value.d);
+	printf(" = %lf", atom.d);
 	break;
     case MMV_TYPE_STRING:
 	string = (mmv_disk_string_t *)((char *)addr + vals[i].extra);
@@ -399,6 +445,8 @@ dump_value(void *addr, size_t size, mmv_disk_value_t *vals, int i, int toc, int
     default:
 	printf("Unknown type %d", type);
     }
+    if (striped)
+	printf(" (striped, stripe offset %"PRIi64")", vals[i].extra);
     putchar('\n');
     return 0;
 }
@@ -563,6 +611,27 @@ dump_labels(void *addr, size_t size, int idx, long base, __uint64_t offset, __in
     return 0;
 }
 
+int
+dump_stripes(void *addr, size_t size, int idx, long base, __uint64_t offset, __int32_t count)
+{
+    mmv_disk_stripes_t *sp = (mmv_disk_stripes_t *)((char *)addr + offset);
+
+    printf("\nTOC[%d]: offset %ld, stripes offset %"PRIu64" (%d entries)\n",
+		idx, base, offset, count);
+
+    if (size < offset + sizeof(mmv_disk_stripes_t)) {
+	printf("Bad file size: too small for toc[%d] stripes\n", idx);
+	return 1;
+    }
+    printf("  %u stripes of %u values, %"PRIu64" bytes apart from offset %"PRIu64"\n",
+		sp->count, sp->slots, sp->size, sp->offset);
+    if (size < sp->offset + (__uint64_t)sp->count * sp->size) {
+	printf("Bad file size: too small for toc[%d] stripe[%u]\n", idx, sp->count - 1);
+	return 1;
+    }
+    return 0;
+}
+
 static char *
 flagstr(int flags)
 {
@@ -651,6 +720,17 @@ dump(const char *file, void *addr, size_t size)
     }
     toc = (mmv_disk_toc_t *)((char *)addr + sizeof(mmv_disk_header_t));
 
+    /* striped values are summed as they are reported, so find any first */
+    for (i = 0; i < hdr->tocs; i++) {
+	offset = toc[i].offset;
+	if (toc[i].type == MMV_TOC_STRIPES &&
+	    size >= offset + sizeof(mmv_disk_stripes_t)) {
+	    stripes = (mmv_disk_stripes_t *)((char *)addr + offset);
+	    if (size < stripes->offset + (__uint64_t)stripes->count * stripes->size)
+		stripes = NULL;
+	}
+    }
+
     for (i = sts = 0; i < hdr->tocs; i++) {
 	__uint64_t base = ((char *)&toc[i] - (char *)addr);
 
@@ -688,6 +768,10 @@ dump(const char *file, void *addr, size_t size)
 	    if (dump_labels(addr, size, i, base, offset, count))
 		sts = 1;
 	    break;    
+	case MMV_TOC_STRIPES:
+	    if (dump_stripes(addr, size, i, base, offset, count))
+		sts = 1;
+	    break;
 	default:
 	    printf("Unrecognised TOC[%d] type: 0x%x\n", i, type);
 	    sts = 1;
@@ -67,6 +67,7 @@ typedef struct {
     mmv_disk_metric_t	*metrics1;	/* v1 metric descs in mmap */
     mmv_disk_metric2_t	*metrics2;	/* v2 metric descs in mmap */
     mmv_disk_label_t	*labels; 	/* labels desc in mmap */
+    mmv_disk_stripes_t	*stripes;	/* per-CPU value stripes in mmap */
     int			vcnt;		/* number of values */
     int			mcnt1;		/* number of metrics */
     int			mcnt2;		/* number of v2 metrics */
@@ -104,6 +105,7 @@ typedef struct {
 #define MAX_MMV_SERIAL	((1<<22)-1)
 #define MAX_MMV_CLUSTER ((1<<12)-1)
 #define MAX_MMV_LABELS	((1<<8)-1)
+#define MAX_MMV_STRIPES	((1<<12)-1)
 
 /*
  * Check cluster number validity (must be in range 0 .. 1<<12).
@@ -802,6 +804,25 @@ map_stats(pmdaExt *pmda)
 		s->lcnt = count;
 	    	break;
 
+	    case MMV_TOC_STRIPES: {
+		mmv_disk_stripes_t *sp = (mmv_disk_stripes_t *)
+					((char *)s->addr + offset);
+
+		if (s->len < offset + sizeof(mmv_disk_stripes_t) ||
+		    sp->count < 1 || sp->count > MAX_MMV_STRIPES ||
+		    sp->size > s->len || sp->offset > s->len ||
+		    s->len < sp->offset + sp->count * sp->size ||
+		    sp->size < sp->slots * sizeof(pmAtomValue)) {
+		    if (pmDebugOptions.appl0) {
+			pmNotifyErr(LOG_ERR, "MMV: %s - "
+				"bad stripes offset: %"PRIu64, s->name, offset);
+		    }
+		    continue;
+		}
+		s->stripes = sp;
+		break;
+	    }
+
 	    default:
 		if (pmDebugOptions.appl0) {
 		    pmNotifyErr(LOG_DEBUG, "MMV: %s - bad TOC type (%x)",
@@ -919,6 +940,46 @@ mmv_lookup_stat_metric_value(agent_t *agent, pmID pmid, unsigned int inst,
     return mmv_lookup_stat_metric(agent, pmid, inst, stats, value, NULL, NULL);
 }
 
+/*
+ * Add the slots of a striped value in every stripe to its value.
+ */
+static void
+mmv_stripes_sum(stats_t *s, mmv_disk_value_t *v, int type, pmAtomValue *atom)
+{
+    mmv_disk_stripes_t	*sp = s->stripes;
+    pmAtomValue		*slot;
+    __uint64_t		offset = v->extra;
+    int			i;
+
+    if (sp == NULL || offset < sp->offset ||
+	offset + sizeof(pmAtomValue) > sp->offset + sp->slots * sizeof(pmAtomValue))
+	return;
+
+    for (i = 0; i < sp->count; i++, offset += sp->size) {
+	slot = (pmAtomValue *)((char *)s->addr + offset);
+	switch (type) {
+	    case MMV_TYPE_I32:
+		atom->l += slot->l;
+		break;
+	    case MMV_TYPE_U32:
+		atom->ul += slot->ul;
+		break;
+	    case MMV_TYPE_I64:
+		atom->ll += slot->ll;
+		break;
+	    case MMV_TYPE_U64:
+		atom->ull += slot->ull;
+		break;
+	    case MMV_TYPE_FLOAT:
+		atom->f += slot->f;
+		break;
+	    case MMV_TYPE_DOUBLE:
+		atom->d += slot->d;
+		break;
+	}
+    }
+}
+
 /*
  * callback provided to pmdaFetch
  */
@@ -964,16 +1025,22 @@ mmv_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
 		if ((flags & MMV_FLAG_SENTINEL) &&
 		    (memcmp(atom, &aNaN, sizeof(*atom)) == 0))
 		    return PMDA_FETCH_NOVALUES;
+		if (v->extra)
+		    mmv_stripes_sum(s, v, sts, atom);
 		break;
 	    case MMV_TYPE_FLOAT:
 		memcpy(atom, &v->value, sizeof(pmAtomValue));
 		if ((flags & MMV_FLAG_SENTINEL) && atom->f == fNaN)
 		    return PMDA_FETCH_NOVALUES;
+		if (v->extra)
+		    mmv_stripes_sum(s, v, sts, atom);
 		break;
 	    case MMV_TYPE_DOUBLE:
 		memcpy(atom, &v->value, sizeof(pmAtomValue));
 		if ((flags & MMV_FLAG_SENTINEL) && atom->d == dNaN)
 		    return PMDA_FETCH_NOVALUES;
+		if (v->extra)
+		    mmv_stripes_sum(s, v, sts, atom);
 		break;
 	    case MMV_TYPE_ELAPSED: {
 		atom->ll = v->value.ll;
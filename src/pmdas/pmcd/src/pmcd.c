@@ -87,6 +87,8 @@ static pmDesc	desctab[] = {
     { PMDA_PMID(0,24), PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_DISCRETE, PMDA_PMUNITS(0,0,0,0,0,0) },
 /* labels */
     { PMDA_PMID(0,25), PM_TYPE_STRING, PM_INDOM_NULL, PM_SEM_INSTANT, PMDA_PMUNITS(0,0,0,0,0,0) },
+/* control.coalesce */
+    { PMDA_PMID(0,26), PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_DISCRETE, PMDA_PMUNITS(0,1,0,0,PM_TIME_MSEC,0) },
 
 /* pdu_in.error */
     { PMDA_PMID(1,0), PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_COUNTER, PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) },
@@ -187,6 +189,18 @@ static pmDesc	desctab[] = {
     { PMDA_PMID(4,2), PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_INSTANT, PMDA_PMUNITS(0,0,0,0,0,0) },
 /* agent.name */
     { PMDA_PMID(4,3), PM_TYPE_STRING, PM_INDOM_NULL, PM_SEM_DISCRETE, PMDA_PMUNITS(0,0,0,0,0,0) },
+/* agent.fetch.count */
+    { PMDA_PMID(4,4), PM_TYPE_U64, PM_INDOM_NULL, PM_SEM_COUNTER, PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) },
+/* agent.fetch.time */
+    { PMDA_PMID(4,5), PM_TYPE_U64, PM_INDOM_NULL, PM_SEM_COUNTER, PMDA_PMUNITS(0,1,0,0,PM_TIME_USEC,0) },
+/* agent.fetch.latency */
+    { PMDA_PMID(4,6), PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_INSTANT, PMDA_PMUNITS(0,1,0,0,PM_TIME_USEC,0) },
+/* agent.fetch.critical */
+    { PMDA_PMID(4,7), PM_TYPE_U64, PM_INDOM_NULL, PM_SEM_COUNTER, PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) },
+/* agent.coalesce.hit */
+    { PMDA_PMID(4,8), PM_TYPE_U64, PM_INDOM_NULL, PM_SEM_COUNTER, PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) },
+/* agent.coalesce.miss */
+    { PMDA_PMID(4,9), PM_TYPE_U64, PM_INDOM_NULL, PM_SEM_COUNTER, PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) },
 
 /* pmie.configfile */
     { PMDA_PMID(5,0), PM_TYPE_STRING, PM_INDOM_NULL, PM_SEM_DISCRETE, PMDA_PMUNITS(0,0,0,0,0,0) },
@@ -208,6 +222,10 @@ static pmDesc	desctab[] = {
     { PMDA_PMID(5,8), PM_TYPE_FLOAT, PM_INDOM_NULL, PM_SEM_DISCRETE, PMDA_PMUNITS(0,-1,1,0,PM_TIME_SEC,PM_COUNT_ONE) },
 /* pmie.eval.actual */
     { PMDA_PMID(5,9), PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_COUNTER, PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) },
+/* pmie.eval.fetch_time */
+    { PMDA_PMID(5,10), PM_TYPE_U64, PM_INDOM_NULL, PM_SEM_COUNTER, PMDA_PMUNITS(0,1,0,0,PM_TIME_USEC,0) },
+/* pmie.eval.rule_time */
+    { PMDA_PMID(5,11), PM_TYPE_U64, PM_INDOM_NULL, PM_SEM_COUNTER, PMDA_PMUNITS(0,1,0,0,PM_TIME_USEC,0) },
 
 /* client.whoami */
     { PMDA_PMID(6,0), PM_TYPE_STRING, PM_INDOM_NULL, PM_SEM_DISCRETE, PMDA_PMUNITS(0,0,0,0,0,0) },
@@ -527,7 +545,9 @@ refresh_pmie_indom(void)
 				fullpath, osstrerror());
 		    continue;
 		}
-		if (statbuf.st_size != sizeof(pmiestats_t))
+		/* version 2 added fields at the end, accept either */
+		if (statbuf.st_size != sizeof(pmiestats_t) &&
+		    statbuf.st_size != PMIESTATS_V1_SIZE)
 		    continue;
 		if  ((endp = strdup(dp->d_name)) == NULL) {
 		    pmNoMem("pmie iname", strlen(dp->d_name), PM_RECOV_ERR);
@@ -553,7 +573,8 @@ refresh_pmie_indom(void)
 		    free(endp);
 		    continue;
 		}
-		else if (((pmiestats_t *)ptr)->version != 1) {
+		else if (((pmiestats_t *)ptr)->version !=
+			(statbuf.st_size == PMIESTATS_V1_SIZE ? 1 : 2)) {
 		    pmNotifyErr(LOG_WARNING, "incompatible pmie version: %s",
 				fullpath);
 		    __pmMemoryUnmap(ptr, statbuf.st_size);
@@ -592,6 +613,20 @@ refresh_pmie_indom(void)
     return npmies;
 }
 
+/*
+ * Is there a value for a pmie metric from this pmie instance - the
+ * fetch and rule times are only in the stats of newer (version 2) pmie
+ */
+static int
+pmie_value(unsigned int item, pmie_t *pmie)
+{
+    if (!__pmInProfile(pmieindom, _profile, pmie->pid))
+	return 0;
+    if (item == 10 || item == 11)	/* pmie.eval.{fetch,rule}_time */
+	return ((pmiestats_t *)pmie->mmap)->version >= 2;
+    return 1;
+}
+
 static int
 pmcd_instance_reg(int inst, char *name, pmInResult **result)
 {
@@ -1533,6 +1568,10 @@ pmcd_fetch(int numpmid, pmID pmidlist[], pmResult **resp, pmdaExt *pmda)
 				fetch_labels(pmda->e_context, &atom, &host);
 				break;
 
+			case 26:	/* control.coalesce */
+				atom.ul = pmcd_coalesce;
+				break;
+
 			default:
 				sts = atom.l = PM_ERR_PMID;
 				break;
@@ -1654,6 +1693,24 @@ pmcd_fetch(int numpmid, pmID pmidlist[], pmResult **resp, pmdaExt *pmda)
 			case 3:		/* agent.name */
 			    atom.cp = agent[j].pmDomainLabel;
 			    break;
+			case 4:		/* agent.fetch.count */
+			    atom.ull = agent[j].fetchStats.count;
+			    break;
+			case 5:		/* agent.fetch.time */
+			    atom.ull = agent[j].fetchStats.time;
+			    break;
+			case 6:		/* agent.fetch.latency */
+			    atom.ul = agent[j].fetchStats.last;
+			    break;
+			case 7:		/* agent.fetch.critical */
+			    atom.ull = agent[j].fetchStats.critical;
+			    break;
+			case 8:		/* agent.coalesce.hit */
+			    atom.ull = agent[j].fetchStats.hit;
+			    break;
+			case 9:		/* agent.coalesce.miss */
+			    atom.ull = agent[j].fetchStats.miss;
+			    break;
 			default:
 			    sts = atom.l = PM_ERR_PMID;
 			    break;
@@ -1677,7 +1734,7 @@ pmcd_fetch(int numpmid, pmID pmidlist[], pmResult **resp, pmdaExt *pmda)
 	    case 5:	/* pmie metrics */
 		refresh_pmie_indom();
 		for (j = numval = 0; j < npmies; j++) {
-		    if (__pmInProfile(pmieindom, _profile, pmies[j].pid))
+		    if (pmie_value(item, &pmies[j]))
 			numval++;
 		}
 		if (numval != 1) {
@@ -1688,7 +1745,7 @@ pmcd_fetch(int numpmid, pmID pmidlist[], pmResult **resp, pmdaExt *pmda)
 		    vset->pmid = pmidlist[i];
 		}
 		for (j = numval = 0; j < npmies; ++j) {
-		    if (!__pmInProfile(pmieindom, _profile, pmies[j].pid))
+		    if (!pmie_value(item, &pmies[j]))
 			continue;
 		    vset->vlist[numval].inst = pmies[j].pid;
 		    pmie = (pmiestats_t *)pmies[j].mmap;
@@ -1723,6 +1780,12 @@ pmcd_fetch(int numpmid, pmID pmidlist[], pmResult **resp, pmdaExt *pmda)
 			case 9:		/* pmie.eval.actual */
 			    atom.ul = pmie->eval_actual;
 			    break;
+			case 10:	/* pmie.eval.fetch_time */
+			    atom.ull = pmie->fetch_time;
+			    break;
+			case 11:	/* pmie.eval.rule_time */
+			    atom.ull = pmie->rule_time;
+			    break;
 			default:
 			    sts = atom.l = PM_ERR_PMID;
 			    break;
@@ -1944,6 +2007,14 @@ pmcd_store(pmResult *result, pmdaExt *pmda)
 		/* bump ... intended for QA */
 		pmcd_seqnum++;
 	    }
+	    else if (item == 26) { /* pmcd.control.coalesce */
+		val = vsp->vlist[0].value.lval;
+		if (val < 0) {
+		    sts = PM_ERR_SIGN;
+		    break;
+		}
+		pmcd_coalesce = val;
+	    }
 	    else {
 		sts = PM_ERR_PMID;
 		break;
@@ -0,0 +1,292 @@
+/*
+ * Copyright (c) 2021 Red Hat.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+#include <math.h>
+
+#include "utils.h"
+#include "aggregators.h"
+#include "aggregator-metrics.h"
+#include "aggregator-metric-duration-sketch.h"
+#include "aggregator-metric-duration.h"
+#include "config-reader.h"
+
+/**
+ * Smallest number of buckets allocated at once
+ */
+#define DURATION_SKETCH_MIN_BINS 32
+
+/**
+ * Gets index of bucket counting given value
+ * @arg sketch - Target sketch
+ * @arg value - Positive value
+ * @return bucket index
+ */
+static int
+get_sketch_bin_index(struct sketch_duration_collection* sketch, double value) {
+    return (int)ceil(log(value) / sketch->log_gamma);
+}
+
+/**
+ * Reallocates buckets so that indexes low to high can be counted, leaving some room to grow on both sides.
+ * When that would take more than DURATION_SKETCH_MAX_BINS the lowest buckets are collapsed into one.
+ * @arg sketch - Target sketch
+ * @arg low - Lowest index to be counted
+ * @arg high - Highest index to be counted
+ */
+static void
+resize_sketch_bins(struct sketch_duration_collection* sketch, int low, int high) {
+    size_t span = (size_t)(high - low) + 1;
+    size_t length = span * 2;
+    if (length < DURATION_SKETCH_MIN_BINS) {
+        length = DURATION_SKETCH_MIN_BINS;
+    }
+    if (length > DURATION_SKETCH_MAX_BINS) {
+        length = DURATION_SKETCH_MAX_BINS;
+    }
+    int offset;
+    if (span >= length) {
+        offset = high - (int)length + 1;
+    } else {
+        offset = low - (int)(length - span) / 2;
+    }
+    unsigned long long* bins = (unsigned long long*) calloc(length, sizeof(unsigned long long));
+    ALLOC_CHECK("Unable to allocate memory for duration sketch buckets.");
+    size_t i;
+    for (i = 0; i < sketch->length; i++) {
+        int index = sketch->offset + (int)i;
+        if (index < offset) {
+            index = offset;
+        }
+        bins[index - offset] += sketch->bins[i];
+    }
+    free(sketch->bins);
+    sketch->bins = bins;
+    sketch->length = length;
+    sketch->offset = offset;
+}
+
+/**
+ * Makes sure bucket with given index can be counted
+ * @arg sketch - Target sketch
+ * @arg index - Bucket index
+ * @return position of bucket to use in sketch->bins
+ */
+static size_t
+get_sketch_bin(struct sketch_duration_collection* sketch, int index) {
+    if (sketch->bins == NULL) {
+        resize_sketch_bins(sketch, index, index);
+    } else if (index >= sketch->offset + (int)sketch->length) {
+        resize_sketch_bins(sketch, sketch->offset, index);
+    } else if (index < sketch->offset && sketch->length < DURATION_SKETCH_MAX_BINS) {
+        resize_sketch_bins(sketch, index, sketch->offset + (int)sketch->length - 1);
+    }
+    if (index < sketch->offset) {
+        index = sketch->offset;
+    }
+    return (size_t)(index - sketch->offset);
+}
+
+/**
+ * Creates sketch duration value
+ * @arg relative_error - Relative accuracy of quantiles
+ * @arg value - initial value
+ * @arg out - Placeholder for created sketch
+ */
+void
+create_sketch_duration_value(double relative_error, double value, void** out) {
+    struct sketch_duration_collection* sketch = (struct sketch_duration_collection*) malloc(sizeof(struct sketch_duration_collection));
+    ALLOC_CHECK("Unable to assign memory for duration sketch.");
+    *sketch = (struct sketch_duration_collection) { 0 };
+    sketch->gamma = (1 + relative_error) / (1 - relative_error);
+    sketch->log_gamma = log(sketch->gamma);
+    update_sketch_duration_value(value, sketch);
+    *out = sketch;
+}
+
+/**
+ * Adds value to sketch
+ * @arg value - New value
+ * @arg sketch - Sketch to which value should be added
+ */
+void
+update_sketch_duration_value(double value, struct sketch_duration_collection* sketch) {
+    if (value > 0) {
+        size_t bin = get_sketch_bin(sketch, get_sketch_bin_index(sketch, value));
+        sketch->bins[bin] += 1;
+    } else {
+        sketch->zero_count += 1;
+    }
+    if (sketch->count == 0 || value < sketch->min) {
+        sketch->min = value;
+    }
+    if (sketch->count == 0 || value > sketch->max) {
+        sketch->max = value;
+    }
+    /* Welford's method, avoids catastrophic cancellation in std deviation */
+    sketch->count += 1;
+    double delta = value - sketch->mean;
+    sketch->mean += delta / sketch->count;
+    sketch->m2 += delta * (value - sketch->mean);
+}
+
+/**
+ * Merges values counted in one sketch into another, both have to be created with same relative error
+ * @arg dest - Sketch to merge into
+ * @arg src - Sketch to merge from, left unchanged
+ * @return 1 on success, 0 when sketches are not compatible
+ */
+int
+merge_sketch_duration_value(struct sketch_duration_collection* dest, struct sketch_duration_collection* src) {
+    if (dest->gamma != src->gamma) {
+        return 0;
+    }
+    if (src->count == 0) {
+        return 1;
+    }
+    size_t i;
+    for (i = 0; i < src->length; i++) {
+        if (src->bins[i] != 0) {
+            size_t bin = get_sketch_bin(dest, src->offset + (int)i);
+            dest->bins[bin] += src->bins[i];
+        }
+    }
+    dest->zero_count += src->zero_count;
+    if (dest->count == 0 || src->min < dest->min) {
+        dest->min = src->min;
+    }
+    if (dest->count == 0 || src->max > dest->max) {
+        dest->max = src->max;
+    }
+    /* Chan et al. parallel variant of Welford's method */
+    double count = (double)dest->count + (double)src->count;
+    double delta = src->mean - dest->mean;
+    dest->m2 += src->m2 + delta * delta * ((double)dest->count * (double)src->count / count);
+    dest->mean += delta * ((double)src->count / count);
+    dest->count += src->count;
+    return 1;
+}
+
+/**
+ * Gets value at given quantile, with the same rank as the exact duration aggregation would use,
+ * estimated as value in the middle of its bucket so it is within relative error of the actual value
+ * @arg sketch - Target sketch
+ * @arg quantile - Quantile from 0 to 1
+ * @return value at quantile
+ */
+static double
+get_sketch_quantile(struct sketch_duration_collection* sketch, double quantile) {
+    unsigned long long rank = (unsigned long long)round(quantile * (double)sketch->count);
+    if (rank == 0) {
+        rank = 1;
+    }
+    unsigned long long cumulative = sketch->zero_count;
+    if (cumulative >= rank) {
+        return sketch->min;
+    }
+    size_t i;
+    for (i = 0; i < sketch->length; i++) {
+        cumulative += sketch->bins[i];
+        if (cumulative >= rank) {
+            double value = 2 * pow(sketch->gamma, sketch->offset + (int)i) / (sketch->gamma + 1);
+            if (value < sketch->min) {
+                return sketch->min;
+            }
+            if (value > sketch->max) {
+                return sketch->max;
+            }
+            return value;
+        }
+    }
+    return sketch->max;
+}
+
+/**
+ * Gets duration values meta data from given sketch
+ * @arg sketch - Target sketch
+ * @arg instance - What information to extract
+ * @return duration instance value
+ */
+double
+get_sketch_duration_instance(struct sketch_duration_collection* sketch, enum DURATION_INSTANCE instance) {
+    if (sketch == NULL || sketch->count == 0) {
+        return 0;
+    }
+    switch (instance) {
+        case DURATION_MIN:
+            return sketch->min;
+        case DURATION_MAX:
+            return sketch->max;
+        case DURATION_AVERAGE:
+            return sketch->mean;
+        case DURATION_COUNT:
+            return (double)sketch->count;
+        case DURATION_STANDARD_DEVIATION:
+            return sqrt(sketch->m2 / (double)sketch->count);
+        case DURATION_MEDIAN:
+            return get_sketch_quantile(sketch, 0.5);
+        case DURATION_PERCENTILE90:
+            return get_sketch_quantile(sketch, 0.9);
+        case DURATION_PERCENTILE95:
+            return get_sketch_quantile(sketch, 0.95);
+        case DURATION_PERCENTILE99:
+            return get_sketch_quantile(sketch, 0.99);
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Gets memory used by given sketch
+ * @arg sketch - Target sketch
+ * @return size in bytes
+ */
+size_t
+get_sketch_duration_memory_size(struct sketch_duration_collection* sketch) {
+    return sizeof(struct sketch_duration_collection) + sketch->length * sizeof(unsigned long long);
+}
+
+/**
+ * Prints sketch metadata in human readable way
+ * @arg f - Opened file handle, doesn't close it when finished
+ * @arg sketch - Target sketch
+ */
+void
+print_sketch_duration_value(FILE* f, struct sketch_duration_collection* sketch) {
+    fprintf(f, "min             = %lf\n", get_sketch_duration_instance(sketch, DURATION_MIN));
+    fprintf(f, "max             = %lf\n", get_sketch_duration_instance(sketch, DURATION_MAX));
+    fprintf(f, "median          = %lf\n", get_sketch_duration_instance(sketch, DURATION_MEDIAN));
+    fprintf(f, "average         = %lf\n", get_sketch_duration_instance(sketch, DURATION_AVERAGE));
+    fprintf(f, "percentile90    = %lf\n", get_sketch_duration_instance(sketch, DURATION_PERCENTILE90));
+    fprintf(f, "percentile95    = %lf\n", get_sketch_duration_instance(sketch, DURATION_PERCENTILE95));
+    fprintf(f, "percentile99    = %lf\n", get_sketch_duration_instance(sketch, DURATION_PERCENTILE99));
+    fprintf(f, "count           = %lf\n", get_sketch_duration_instance(sketch, DURATION_COUNT));
+    fprintf(f, "std deviation   = %lf\n", get_sketch_duration_instance(sketch, DURATION_STANDARD_DEVIATION));
+    fprintf(f, "buckets         = %lu\n", (unsigned long)sketch->length);
+}
+
+/**
+ * Frees sketch duration metric value
+ * @arg config
+ * @arg value - value to be freed
+ */
+void
+free_sketch_duration_value(struct agent_config* config, void* value) {
+    (void)config;
+    struct sketch_duration_collection* sketch = (struct sketch_duration_collection*)value;
+    if (sketch != NULL) {
+        if (sketch->bins != NULL) {
+            free(sketch->bins);
+        }
+        free(sketch);
+    }
+}
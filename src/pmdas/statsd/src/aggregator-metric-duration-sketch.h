@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2021 Red Hat.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+#ifndef AGGREGATOR_DURATION_SKETCH_
+#define AGGREGATOR_DURATION_SKETCH_
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include "aggregator-metrics.h"
+#include "aggregator-metric-duration.h"
+#include "config-reader.h"
+
+/**
+ * Upper bound on number of buckets kept by a single sketch, when exceeded the lowest buckets are collapsed together
+ */
+#define DURATION_SKETCH_MAX_BINS 2048
+
+/**
+ * Represents DDSketch duration aggregation unit
+ * Value x > 0 is counted in bucket i = ceil(log(x) / log(gamma)), gamma = (1 + relative_error) / (1 - relative_error),
+ * so any quantile is returned within relative_error of an actual value
+ */
+typedef struct sketch_duration_collection {
+    unsigned long long* bins;
+    size_t length;
+    int offset;
+    double gamma;
+    double log_gamma;
+    unsigned long long zero_count;
+    unsigned long long count;
+    double min;
+    double max;
+    double mean;
+    double m2;
+} sketch_duration_collection;
+
+/**
+ * Creates sketch duration value
+ * @arg relative_error - Relative accuracy of quantiles
+ * @arg value - initial value
+ * @arg out - Placeholder for created sketch
+ */
+extern void
+create_sketch_duration_value(double relative_error, double value, void** out);
+
+/**
+ * Adds value to sketch
+ * @arg value - New value
+ * @arg sketch - Sketch to which value should be added
+ */
+extern void
+update_sketch_duration_value(double value, struct sketch_duration_collection* sketch);
+
+/**
+ * Merges values counted in one sketch into another, both have to be created with same relative error
+ * @arg dest - Sketch to merge into
+ * @arg src - Sketch to merge from, left unchanged
+ * @return 1 on success, 0 when sketches are not compatible
+ */
+extern int
+merge_sketch_duration_value(struct sketch_duration_collection* dest, struct sketch_duration_collection* src);
+
+/**
+ * Gets duration values meta data from given sketch
+ * @arg sketch - Target sketch
+ * @arg instance - What information to extract
+ * @return duration instance value
+ */
+extern double
+get_sketch_duration_instance(struct sketch_duration_collection* sketch, enum DURATION_INSTANCE instance);
+
+/**
+ * Gets memory used by given sketch
+ * @arg sketch - Target sketch
+ * @return size in bytes
+ */
+extern size_t
+get_sketch_duration_memory_size(struct sketch_duration_collection* sketch);
+
+/**
+ * Prints sketch metadata in human readable way
+ * @arg f - Opened file handle, doesn't close it when finished
+ * @arg sketch - Target sketch
+ */
+extern void
+print_sketch_duration_value(FILE* f, struct sketch_duration_collection* sketch);
+
+/**
+ * Frees sketch duration metric value
+ * @arg config
+ * @arg value - value to be freed
+ */
+extern void
+free_sketch_duration_value(struct agent_config* config, void* value);
+
+#endif
@@ -22,6 +22,7 @@
 #include "aggregator-metric-duration.h"
 #include "aggregator-metric-duration-exact.h"
 #include "aggregator-metric-duration-hdr.h"
+#include "aggregator-metric-duration-sketch.h"
 #include "errno.h"
 #include "utils.h"
 
@@ -41,23 +42,32 @@ create_duration_value(struct agent_config* config, struct statsd_datagram* datag
     if (new_value < 0) {
         return 0;
     }
-    if (config->duration_aggregation_type == DURATION_AGGREGATION_TYPE_HDR_HISTOGRAM) {
-        create_hdr_duration_value(
-            (unsigned long long) new_value, 
-            out
-        );
-    } else {
-        create_exact_duration_value(
-            (unsigned long long) new_value,
-            out
-        );
+    switch (config->duration_aggregation_type) {
+        case DURATION_AGGREGATION_TYPE_HDR_HISTOGRAM:
+            create_hdr_duration_value(
+                (unsigned long long) new_value, 
+                out
+            );
+            break;
+        case DURATION_AGGREGATION_TYPE_SKETCH:
+            create_sketch_duration_value(
+                config->duration_sketch_relative_error,
+                new_value,
+                out
+            );
+            break;
+        default:
+            create_exact_duration_value(
+                (unsigned long long) new_value,
+                out
+            );
     }
     return 1;
 }
 
 /**
  * Updates duration metric record of value subtype
- * @arg config - Config from which we know what duration type is, either HDR or exact
+ * @arg config - Config from which we know what duration type is, either HDR, sketch or exact
  * @arg item - Item to be updated
  * @arg datagram - Data to update the item with
  * @return 1 on success, 0 on fail
@@ -75,16 +85,24 @@ update_duration_value(struct agent_config* config, struct statsd_datagram* datag
     if (new_value < 0) {
         return 0;
     }
-    if (config->duration_aggregation_type == DURATION_AGGREGATION_TYPE_HDR_HISTOGRAM) {
-        update_hdr_duration_value(
-            (unsigned long long) new_value,
-            (struct hdr_histogram*) value
-        );
-    } else {
-        update_exact_duration_value(
-            (unsigned long long) new_value,
-            (struct exact_duration_collection*) value
-        );
+    switch (config->duration_aggregation_type) {
+        case DURATION_AGGREGATION_TYPE_HDR_HISTOGRAM:
+            update_hdr_duration_value(
+                (unsigned long long) new_value,
+                (struct hdr_histogram*) value
+            );
+            break;
+        case DURATION_AGGREGATION_TYPE_SKETCH:
+            update_sketch_duration_value(
+                new_value,
+                (struct sketch_duration_collection*) value
+            );
+            break;
+        default:
+            update_exact_duration_value(
+                (unsigned long long) new_value,
+                (struct exact_duration_collection*) value
+            );
     }
     return 1;
 }
@@ -92,17 +110,22 @@ update_duration_value(struct agent_config* config, struct statsd_datagram* datag
 /**
  * Extracts duration metric meta values from duration metric record
  * @arg config - Config which contains info on which duration aggregating type we are using
- * @arg value - Either "struct exact_duration_collection*" or "struct hdr_histogram*", basically value from metric that has type of "duration"
+ * @arg value - One of "struct exact_duration_collection*", "struct hdr_histogram*" or "struct sketch_duration_collection*", basically value from metric that has type of "duration"
  * @arg instance - What information to extract
  * @return duration instance value
  */
 double
 get_duration_instance(struct agent_config* config, void* value, enum DURATION_INSTANCE instance) {
     double result = 0;
-    if (config->duration_aggregation_type == DURATION_AGGREGATION_TYPE_BASIC) {
-        result = get_exact_duration_instance((struct exact_duration_collection*)value, instance);
-    } else {
-        result = get_hdr_histogram_duration_instance((struct hdr_histogram*)value, instance);
+    switch (config->duration_aggregation_type) {
+        case DURATION_AGGREGATION_TYPE_BASIC:
+            result = get_exact_duration_instance((struct exact_duration_collection*)value, instance);
+            break;
+        case DURATION_AGGREGATION_TYPE_SKETCH:
+            result = get_sketch_duration_instance((struct sketch_duration_collection*)value, instance);
+            break;
+        default:
+            result = get_hdr_histogram_duration_instance((struct hdr_histogram*)value, instance);
     }
     return result;
 }
@@ -123,6 +146,9 @@ print_duration_metric_value(struct agent_config* config, FILE* f, void* value) {
             case DURATION_AGGREGATION_TYPE_HDR_HISTOGRAM:
                 print_hdr_duration_value(f, (struct hdr_histogram*)value);
                 break;
+            case DURATION_AGGREGATION_TYPE_SKETCH:
+                print_sketch_duration_value(f, (struct sketch_duration_collection*)value);
+                break;
         }
     }
 }
@@ -158,5 +184,8 @@ free_duration_value(struct agent_config* config, void* value) {
         case DURATION_AGGREGATION_TYPE_HDR_HISTOGRAM:
             free_hdr_duration_value(config, value);
             break;
+        case DURATION_AGGREGATION_TYPE_SKETCH:
+            free_sketch_duration_value(config, value);
+            break;
     }
 }
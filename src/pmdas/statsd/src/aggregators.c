@@ -30,14 +30,11 @@
 #include "aggregator-stats.h"
 
 /**
- * Mutex guarding aggregator proccesing, so there are no race condiditions if we request debug output.
+ * This is shared with a function thats called from signal handler, should debug data be requested.
+ * Each aggregator thread has its own processing lock (see aggregator_args), so debug output takes all of them.
  */
-static pthread_mutex_t g_aggregator_processing_lock;
-
-/**
- * This is shared with a function thats called from signal handler, should debug data be requested
- */
-static struct aggregator_args* g_aggregator_args = NULL;
+static struct aggregator_args** g_aggregator_args = NULL;
+static size_t g_aggregator_count = 0;
 
 /**
  * Thread startpoint - passes down given datagram to aggregator to record value it contains (should be used for a single new thread)
@@ -46,13 +43,14 @@ static struct aggregator_args* g_aggregator_args = NULL;
 void*
 aggregator_exec(void* args) {
     pthread_setname_np(pthread_self(), "Aggregator");
-    g_aggregator_args = (struct aggregator_args*)args;
+    pthread_mutex_t* processing_lock = &((struct aggregator_args*)args)->processing_lock;
     struct agent_config* config = ((struct aggregator_args*)args)->config;
     struct pmda_metrics_container* metrics_container = ((struct aggregator_args*)args)->metrics_container;
     struct pmda_stats_container* stats_container = ((struct aggregator_args*)args)->stats_container;
     chan_t* parser_to_aggregator = ((struct aggregator_args*)args)->parser_to_aggregator;
 
     struct parser_to_aggregator_message* message;
+    struct parser_to_aggregator_message* next;
     struct timespec t0, t1;
     unsigned long time_spent_aggregating;
     int should_exit;
@@ -69,30 +67,37 @@ aggregator_exec(void* args) {
             break;
         }
         if (should_exit) {
-            free_parser_to_aggregator_message(message);
+            for (; message != NULL; message = next) {
+                next = message->next;
+                free_parser_to_aggregator_message(message);
+            }
             continue;
         }
-        pthread_mutex_lock(&g_aggregator_processing_lock);
-        process_stat(config, stats_container, STAT_RECEIVED, NULL);
-        if (message->type == PARSER_RESULT_PARSED) {
-            clock_gettime(CLOCK_MONOTONIC, &t0);
-            int status = process_metric(config, metrics_container, (struct statsd_datagram*) message->data);
-            clock_gettime(CLOCK_MONOTONIC, &t1);
-            time_spent_aggregating = t1.tv_nsec - t0.tv_nsec;
-            process_stat(config, stats_container, STAT_PARSED, NULL);
-            process_stat(config, stats_container, STAT_TIME_SPENT_PARSING, &message->time);
-            if (status) {
-                process_stat(config, stats_container, STAT_AGGREGATED, NULL);
-                process_stat(config, stats_container, STAT_TIME_SPENT_AGGREGATING, &time_spent_aggregating);
-            } else {
+        // parsers send lists of all the datagrams for this aggregator parsed together
+        pthread_mutex_lock(processing_lock);
+        for (; message != NULL; message = next) {
+            next = message->next;
+            process_stat(config, stats_container, STAT_RECEIVED, NULL);
+            if (message->type == PARSER_RESULT_PARSED) {
+                clock_gettime(CLOCK_MONOTONIC, &t0);
+                int status = process_metric(config, metrics_container, (struct statsd_datagram*) message->data);
+                clock_gettime(CLOCK_MONOTONIC, &t1);
+                time_spent_aggregating = (t1.tv_sec - t0.tv_sec) * 1000000000L + (t1.tv_nsec - t0.tv_nsec);
+                process_stat(config, stats_container, STAT_PARSED, NULL);
+                process_stat(config, stats_container, STAT_TIME_SPENT_PARSING, &message->time);
+                if (status) {
+                    process_stat(config, stats_container, STAT_AGGREGATED, NULL);
+                    process_stat(config, stats_container, STAT_TIME_SPENT_AGGREGATING, &time_spent_aggregating);
+                } else {
+                    process_stat(config, stats_container, STAT_DROPPED, NULL);
+                }
+            } else if (message->type == PARSER_RESULT_DROPPED) {
                 process_stat(config, stats_container, STAT_DROPPED, NULL);
+                process_stat(config, stats_container, STAT_TIME_SPENT_PARSING, &message->time);
             }
-        } else if (message->type == PARSER_RESULT_DROPPED) {
-            process_stat(config, stats_container, STAT_DROPPED, NULL);
-            process_stat(config, stats_container, STAT_TIME_SPENT_PARSING, &message->time);
+            free_parser_to_aggregator_message(message);
         }
-        free_parser_to_aggregator_message(message);
-        pthread_mutex_unlock(&g_aggregator_processing_lock);
+        pthread_mutex_unlock(processing_lock);
     }
     VERBOSE_LOG(2, "Aggregator thread exiting.");
     pthread_exit(NULL);
@@ -103,11 +108,16 @@ aggregator_exec(void* args) {
  */
 void
 aggregator_debug_output() {
-    if (g_aggregator_args != NULL) {
-        pthread_mutex_lock(&g_aggregator_processing_lock);
-        write_metrics_to_file(g_aggregator_args->config, g_aggregator_args->metrics_container);
-        write_stats_to_file(g_aggregator_args->config, g_aggregator_args->stats_container);
-        pthread_mutex_unlock(&g_aggregator_processing_lock);
+    size_t i;
+    if (g_aggregator_count > 0) {
+        for (i = 0; i < g_aggregator_count; i++) {
+            pthread_mutex_lock(&g_aggregator_args[i]->processing_lock);
+        }
+        write_metrics_to_file(g_aggregator_args[0]->config, g_aggregator_args[0]->metrics_container);
+        write_stats_to_file(g_aggregator_args[0]->config, g_aggregator_args[0]->stats_container);
+        for (i = g_aggregator_count; i > 0; i--) {
+            pthread_mutex_unlock(&g_aggregator_args[i - 1]->processing_lock);
+        }
     }
 }
 
@@ -127,6 +137,9 @@ free_parser_to_aggregator_message(struct parser_to_aggregator_message* message)
 
 /**
  * Creates arguments for Agregator thread
+ * All aggregator threads share the metrics and stats containers, but each
+ * gets its own channel and processing lock - parsers send all datagrams
+ * for any one metric to the same aggregator thread
  * @arg config - Application config
  * @arg parsed_channel - Parser -> Aggregator channel
  * @arg pcp_request_channel - PCP -> Aggregator channel
@@ -147,5 +160,24 @@ create_aggregator_args(
     aggregator_args->parser_to_aggregator = parser_to_aggregator;
     aggregator_args->metrics_container = m;
     aggregator_args->stats_container = s;
+    pthread_mutex_init(&aggregator_args->processing_lock, NULL);
+    g_aggregator_args = (struct aggregator_args**) realloc(g_aggregator_args, (g_aggregator_count + 1) * sizeof(struct aggregator_args*));
+    ALLOC_CHECK("Unable to assign memory for aggregator list.");
+    g_aggregator_args[g_aggregator_count++] = aggregator_args;
     return aggregator_args;
 }
+
+/**
+ * Frees arguments of all Aggregator threads
+ */
+void
+free_aggregator_args() {
+    size_t i;
+    for (i = 0; i < g_aggregator_count; i++) {
+        pthread_mutex_destroy(&g_aggregator_args[i]->processing_lock);
+        free(g_aggregator_args[i]);
+    }
+    free(g_aggregator_args);
+    g_aggregator_args = NULL;
+    g_aggregator_count = 0;
+}
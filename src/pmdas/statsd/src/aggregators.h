@@ -16,6 +16,7 @@
 #define AGGREGATORS_
 
 #include <stddef.h>
+#include <pthread.h>
 #include <pcp/dict.h>
 #include <chan/chan.h>
 
@@ -29,6 +30,7 @@ typedef struct aggregator_args
     chan_t* parser_to_aggregator;
     struct pmda_metrics_container* metrics_container;
     struct pmda_stats_container* stats_container;
+    pthread_mutex_t processing_lock;
 } aggregator_args;
 
 /**
@@ -68,4 +70,10 @@ create_aggregator_args(
     struct pmda_stats_container* s
 );
 
+/**
+ * Frees arguments of all Aggregator threads
+ */
+extern void
+free_aggregator_args();
+
 #endif
@@ -28,17 +28,27 @@ typedef enum PARSER_TYPE {
 
 typedef enum DURATION_AGGREGATION_TYPE {
     DURATION_AGGREGATION_TYPE_BASIC = 0,
-    DURATION_AGGREGATION_TYPE_HDR_HISTOGRAM = 1
+    DURATION_AGGREGATION_TYPE_HDR_HISTOGRAM = 1,
+    DURATION_AGGREGATION_TYPE_SKETCH = 2
 } DURATION_AGGREGATION_TYPE;
 
+/**
+ * Upper bound for each of listener_threads, parser_threads and aggregator_threads
+ */
+#define MAX_AGENT_THREADS 64
+
 typedef struct agent_config {
     enum DURATION_AGGREGATION_TYPE duration_aggregation_type;
+    double duration_sketch_relative_error;
     enum PARSER_TYPE parser_type;
     unsigned long int max_udp_packet_size;
     unsigned int verbose;
     unsigned int show_version;
     unsigned int max_unprocessed_packets;
     unsigned int port;
+    unsigned int listener_threads;
+    unsigned int parser_threads;
+    unsigned int aggregator_threads;
     char* debug_output_filename;
     char* username;
 } agent_config;
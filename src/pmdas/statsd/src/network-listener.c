@@ -21,6 +21,7 @@
 #include <chan/chan.h>
 #include <pthread.h>
 #include <sys/types.h>
+#include <sys/socket.h>
 #include <signal.h>
 
 #include "network-listener.h"
@@ -30,19 +31,21 @@
 #include "config-reader.h"
 
 /**
- * Thread entrypoint - listens on address and port specified in config 
- * for UDP/TCP containing StatsD payload and then sends it over to parser thread for parsing
- * @arg args - network_listener_args
+ * Datagrams read from the socket with each system call
  */
-void*
-network_listener_exec(void* args) {
-    pthread_setname_np(pthread_self(), "Net. Listener");
-    static char* end_message = "PMDASTATSD_EXIT"; 
-    struct agent_config* config = ((struct network_listener_args*)args)->config;
-    chan_t* network_listener_to_parser = ((struct network_listener_args*)args)->network_listener_to_parser;
+#define RECV_BATCH_SIZE 64
+
+/**
+ * Opens and binds the UDP socket for one listener thread - with several
+ * listener threads each gets its own socket bound to the same port, and
+ * the kernel spreads incoming datagrams across them
+ * @arg config - Application config
+ * @return socket file descriptor
+ */
+static int
+open_listener_socket(struct agent_config* config) {
     const char* hostname = 0;
     struct addrinfo hints;
-    fd_set readfds;
     memset(&hints, 0, sizeof(hints));
     hints.ai_family = AF_UNSPEC;
     hints.ai_socktype = SOCK_DGRAM;
@@ -59,64 +62,177 @@ network_listener_exec(void* args) {
     if (fd == -1) {
         DIE("failed creating socket (err=%s)", strerror(errno));
     }
+#ifdef SO_REUSEPORT
+    if (config->listener_threads > 1) {
+        int one = 1;
+        if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) == -1) {
+            DIE("failed setting SO_REUSEPORT on socket (err=%s)", strerror(errno));
+        }
+    }
+#endif
     if (bind(fd, res->ai_addr, res->ai_addrlen) == -1) {
         DIE("failed binding socket (err=%s)", strerror(errno));
     }
+    freeaddrinfo(res);
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    return fd;
+}
+
+/**
+ * Reads as many waiting datagrams as fit into given buffers, without blocking
+ * @arg fd - Socket
+ * @arg buffers - RECV_BATCH_SIZE buffers
+ * @arg buffer_size - Size of each buffer
+ * @arg lengths - Receives length of each datagram read
+ * @return number of datagrams read, 0 if there were none
+ */
+static int
+receive_batch(int fd, char** buffers, size_t buffer_size, size_t* lengths) {
+    int i, count;
+#ifdef MSG_WAITFORONE
+    struct mmsghdr msgs[RECV_BATCH_SIZE];
+    struct iovec iovecs[RECV_BATCH_SIZE];
+    memset(msgs, 0, sizeof(msgs));
+    for (i = 0; i < RECV_BATCH_SIZE; i++) {
+        iovecs[i].iov_base = buffers[i];
+        iovecs[i].iov_len = buffer_size;
+        msgs[i].msg_hdr.msg_iov = &iovecs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    count = recvmmsg(fd, msgs, RECV_BATCH_SIZE, MSG_WAITFORONE, NULL);
+    if (count == -1) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            return 0;
+        }
+        DIE("%s", strerror(errno));
+    }
+    for (i = 0; i < count; i++) {
+        lengths[i] = msgs[i].msg_len;
+    }
+#else
+    for (count = 0; count < RECV_BATCH_SIZE; count++) {
+        ssize_t length = recv(fd, buffers[count], buffer_size, 0);
+        if (length == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                break;
+            }
+            DIE("%s", strerror(errno));
+        }
+        lengths[count] = length;
+    }
+#endif
+    return count;
+}
+
+/**
+ * Sends end message to parser threads, once the last listener thread is done
+ * @arg args - network_listener_args
+ */
+static void
+send_end_messages(struct network_listener_args* args) {
+    static char* end_message = "PMDASTATSD_EXIT";
+    size_t length = strlen(end_message) + 1;
+    unsigned int i;
+
+    if (__sync_sub_and_fetch(args->listeners_running, 1) != 0) {
+        return;
+    }
+    for (i = 0; i < args->config->parser_threads; i++) {
+        struct unprocessed_statsd_datagram* datagram = (struct unprocessed_statsd_datagram*) malloc(sizeof(struct unprocessed_statsd_datagram));
+        ALLOC_CHECK("Unable to assign memory for struct representing unprocessed datagrams.");
+        datagram->value = (char*) malloc(sizeof(char) * length);
+        ALLOC_CHECK("Unable to assign memory for datagram value.");
+        memcpy(datagram->value, end_message, length);
+        chan_send(args->network_listener_to_parser, datagram);
+    }
+}
+
+/**
+ * Thread entrypoint - listens on address and port specified in config 
+ * for UDP/TCP containing StatsD payload and then sends it over to parser thread for parsing
+ * Datagrams are read in batches and each batch is sent to parsers as a single
+ * message, with payloads separated by newlines as in a multi-metric datagram
+ * @arg args - network_listener_args
+ */
+void*
+network_listener_exec(void* args) {
+    pthread_setname_np(pthread_self(), "Net. Listener");
+    static char* end_message = "PMDASTATSD_EXIT"; 
+    struct agent_config* config = ((struct network_listener_args*)args)->config;
+    chan_t* network_listener_to_parser = ((struct network_listener_args*)args)->network_listener_to_parser;
+    fd_set readfds;
+    int fd = open_listener_socket(config);
     VERBOSE_LOG(0, "Socket enstablished.");
     VERBOSE_LOG(0, "Waiting for datagrams.");
-    fcntl(fd, F_SETFL, O_NONBLOCK);
     struct timeval tv;
-    freeaddrinfo(res);
-    int max_udp_packet_size = config->max_udp_packet_size;
-    char *buffer = (char *) malloc(max_udp_packet_size * sizeof(char));
-    struct sockaddr_storage src_addr;
-    socklen_t src_addr_len = sizeof(src_addr);
-    int rv;
-    while(1) {
+    size_t max_udp_packet_size = config->max_udp_packet_size;
+    size_t end_message_length = strlen(end_message);
+    char* buffers[RECV_BATCH_SIZE];
+    size_t lengths[RECV_BATCH_SIZE];
+    int i, count, rv, exiting = 0;
+    for (i = 0; i < RECV_BATCH_SIZE; i++) {
+        buffers[i] = (char *) malloc(max_udp_packet_size * sizeof(char));
+        ALLOC_CHECK("Unable to assign memory for datagram buffers.");
+    }
+    while(!exiting) {
         FD_ZERO(&readfds);
         FD_SET(fd, &readfds);
         tv.tv_sec = 1;
         tv.tv_usec = 0;
         rv = select(fd + 1, &readfds, NULL, NULL, &tv);
-        if (rv == 1) {
-            ssize_t count = recvfrom(fd, buffer, max_udp_packet_size, 0, (struct sockaddr*)&src_addr, &src_addr_len);
-            if (count == -1) {
-                DIE("%s", strerror(errno));
-            } 
-            // since we checked for -1
-            else if ((signed int)count == max_udp_packet_size) { 
-                VERBOSE_LOG(2, "Datagram too large for buffer: truncated and skipped");
-            } else {
-                struct unprocessed_statsd_datagram* datagram = (struct unprocessed_statsd_datagram*) malloc(sizeof(struct unprocessed_statsd_datagram));
-                ALLOC_CHECK("Unable to assign memory for struct representing unprocessed datagrams.");
-                datagram->value = (char*) malloc(sizeof(char) * (count + 1));
-                ALLOC_CHECK("Unable to assign memory for datagram value.");
-                memcpy(datagram->value, buffer, count);
-                datagram->value[count] = '\0';
-                if (strcmp(end_message, datagram->value) == 0) {
-                    free_unprocessed_datagram(datagram);
+        if (rv != 1) {
+            if (check_exit_flag()) {
+                break;
+            }
+            continue;
+        }
+        // drain the socket, batch by batch, before waiting again
+        do {
+            count = receive_batch(fd, buffers, max_udp_packet_size, lengths);
+            size_t total = 0;
+            for (i = 0; i < count; i++) {
+                if (lengths[i] == max_udp_packet_size) {
+                    VERBOSE_LOG(2, "Datagram too large for buffer: truncated and skipped");
+                    lengths[i] = 0;
+                } else if (lengths[i] == end_message_length &&
+                           memcmp(end_message, buffers[i], end_message_length) == 0) {
+                    // other listener threads notice the flag without the signal
+                    set_exit_flag();
                     kill(getpid(), SIGINT);
+                    exiting = 1;
+                    count = i;
                     break;
                 }
-                chan_send(network_listener_to_parser, datagram);
+                if (lengths[i] > 0) {
+                    total += lengths[i] + 1;
+                }
             }
-            memset(buffer, 0, max_udp_packet_size);
-            rv = 0;
-        } else {
-            int exit_flag = check_exit_flag();
-            if (exit_flag) {        
-                break;
+            if (total == 0) {
+                continue;
             }
-        }
+            struct unprocessed_statsd_datagram* datagram = (struct unprocessed_statsd_datagram*) malloc(sizeof(struct unprocessed_statsd_datagram));
+            ALLOC_CHECK("Unable to assign memory for struct representing unprocessed datagrams.");
+            datagram->value = (char*) malloc(sizeof(char) * total);
+            ALLOC_CHECK("Unable to assign memory for datagram value.");
+            char* p = datagram->value;
+            for (i = 0; i < count; i++) {
+                if (lengths[i] == 0) {
+                    continue;
+                }
+                memcpy(p, buffers[i], lengths[i]);
+                p += lengths[i];
+                *p++ = '\n';
+            }
+            *(p - 1) = '\0';
+            chan_send(network_listener_to_parser, datagram);
+        } while (count == RECV_BATCH_SIZE && !exiting);
     }
     VERBOSE_LOG(2, "Network listener thread exiting.");
-    struct unprocessed_statsd_datagram* datagram = (struct unprocessed_statsd_datagram*) malloc(sizeof(struct unprocessed_statsd_datagram));
-    ALLOC_CHECK("Unable to assign memory for struct representing unprocessed datagrams.");
-    size_t length = strlen(end_message) + 1;
-    datagram->value = (char*) malloc(sizeof(char) * length);
-    memcpy(datagram->value, end_message, length);
-    chan_send(network_listener_to_parser, datagram);
-    free(buffer);
+    close(fd);
+    for (i = 0; i < RECV_BATCH_SIZE; i++) {
+        free(buffers[i]);
+    }
+    send_end_messages((struct network_listener_args*)args);
     pthread_exit(NULL);
 }
 
@@ -138,14 +254,15 @@ free_unprocessed_datagram(struct unprocessed_statsd_datagram* datagram) {
  * Creates arguments for network listener thread
  * @arg config - Application config
  * @arg unprocessed_channel - Network listener -> Parser
- * @arg stats_sink - Channel for sending stats about PMDA itself
+ * @arg listeners_running - Count of listener threads still running, shared by all of them
  * @return network_listener_args
  */
 struct network_listener_args*
-create_listener_args(struct agent_config* config, chan_t* network_listener_to_parser) {
+create_listener_args(struct agent_config* config, chan_t* network_listener_to_parser, int* listeners_running) {
     struct network_listener_args* listener_args = (struct network_listener_args*) malloc(sizeof(struct network_listener_args));
     ALLOC_CHECK("Unable to assign memory for listener arguments.");
     listener_args->config = config;
     listener_args->network_listener_to_parser = network_listener_to_parser;
+    listener_args->listeners_running = listeners_running;
     return listener_args;
 }
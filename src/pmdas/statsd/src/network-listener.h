@@ -29,6 +29,7 @@ typedef struct network_listener_args
 {
     struct agent_config* config;
     chan_t* network_listener_to_parser;
+    int* listeners_running;
 } network_listener_args;
 
 /**
@@ -50,9 +51,10 @@ free_unprocessed_datagram(struct unprocessed_statsd_datagram* datagram);
  * Creates arguments for network listener thread
  * @arg config - Application config
  * @arg network_listener_to_parser - Network listener -> Parser
+ * @arg listeners_running - Count of listener threads still running, shared by all of them
  * @return network_listener_args
  */
 extern struct network_listener_args*
-create_listener_args(struct agent_config* config, chan_t* network_listener_to_parser);
+create_listener_args(struct agent_config* config, chan_t* network_listener_to_parser, int* listeners_running);
 
 #endif
@@ -24,8 +24,77 @@
 #include "aggregators.h"
 #include "parser-basic.h"
 #include "parser-ragel.h"
+#include "dict-callbacks.h"
 #include "utils.h"
 
+/**
+ * Queues message for aggregator thread responsible for the metric it concerns,
+ * so that all updates of any one metric are processed by the same aggregator
+ * @arg config - Application config
+ * @arg heads - First queued message for each aggregator
+ * @arg tails - Last queued message for each aggregator
+ * @arg message - Message to queue
+ */
+static void
+queue_for_aggregator(
+    struct agent_config* config,
+    struct parser_to_aggregator_message** heads,
+    struct parser_to_aggregator_message** tails,
+    struct parser_to_aggregator_message* message
+) {
+    size_t shard = 0;
+    if (config->aggregator_threads > 1 && message->data != NULL) {
+        shard = str_hash_callback(message->data->name) % config->aggregator_threads;
+    }
+    message->next = NULL;
+    if (heads[shard] == NULL) {
+        heads[shard] = message;
+    } else {
+        tails[shard]->next = message;
+    }
+    tails[shard] = message;
+}
+
+/**
+ * Sends messages queued for each aggregator, as one list per aggregator
+ * @arg config - Application config
+ * @arg parser_to_aggregator - Parser -> Aggregator channels, one per aggregator
+ * @arg heads - First queued message for each aggregator
+ */
+static void
+send_to_aggregators(struct agent_config* config, chan_t** parser_to_aggregator, struct parser_to_aggregator_message** heads) {
+    unsigned int i;
+    for (i = 0; i < config->aggregator_threads; i++) {
+        if (heads[i] != NULL) {
+            chan_send(parser_to_aggregator[i], heads[i]);
+            heads[i] = NULL;
+        }
+    }
+}
+
+/**
+ * Sends end message to each aggregator thread, once the last parser thread is done
+ * @arg args - parser_args
+ */
+static void
+send_end_messages(struct parser_args* args) {
+    unsigned int i;
+
+    if (__sync_sub_and_fetch(args->parsers_running, 1) != 0) {
+        return;
+    }
+    for (i = 0; i < args->config->aggregator_threads; i++) {
+        struct parser_to_aggregator_message* message =
+            (struct parser_to_aggregator_message*) malloc(sizeof(struct parser_to_aggregator_message));
+        ALLOC_CHECK("Unable to assign memory for parser to aggregator message.");
+        message->type = PARSER_RESULT_END;
+        message->time = 0;
+        message->data = NULL;
+        message->next = NULL;
+        chan_send(args->parser_to_aggregator[i], message);
+    }
+}
+
 /**
  * Thread entrypoint - listens to incoming payload on a unprocessed channel
  * and sends over successfully parsed data over to Aggregator thread via processed channel
@@ -37,7 +106,7 @@ parser_exec(void* args) {
     static char* network_end_message = "PMDASTATSD_EXIT";
     struct agent_config* config = ((struct parser_args*)args)->config;
     chan_t* network_listener_to_parser = ((struct parser_args*)args)->network_listener_to_parser;
-    chan_t* parser_to_aggregator = ((struct parser_args*)args)->parser_to_aggregator;
+    chan_t** parser_to_aggregator = ((struct parser_args*)args)->parser_to_aggregator;
     datagram_parse_callback parse_datagram;
     if ((int)config->parser_type == (int)PARSER_TYPE_BASIC) {
         parse_datagram = &basic_parser_parse;
@@ -47,6 +116,9 @@ parser_exec(void* args) {
     struct unprocessed_statsd_datagram* datagram;
     ALLOC_CHECK("Unable to allocate space for unprocessed statsd datagram.");
     char delim[] = "\n";
+    char* saveptr;
+    struct parser_to_aggregator_message* heads[MAX_AGENT_THREADS] = { NULL };
+    struct parser_to_aggregator_message* tails[MAX_AGENT_THREADS];
     struct timespec t0, t1;
     unsigned long time_spent_parsing;
     int should_exit;
@@ -68,7 +140,7 @@ parser_exec(void* args) {
             continue;
         }
         struct statsd_datagram* parsed;
-        char* tok = strtok(datagram->value, delim);
+        char* tok = strtok_r(datagram->value, delim, &saveptr);
         while (tok != NULL) {
             clock_gettime(CLOCK_MONOTONIC, &t0);
             int success = parse_datagram(tok, &parsed);
@@ -76,29 +148,24 @@ parser_exec(void* args) {
             struct parser_to_aggregator_message* message =
                 (struct parser_to_aggregator_message*) malloc(sizeof(struct parser_to_aggregator_message));
             ALLOC_CHECK("Unable to assign memory for parser to aggregator message.");
-            time_spent_parsing = (t1.tv_nsec) - (t0.tv_nsec);
+            time_spent_parsing = (t1.tv_sec - t0.tv_sec) * 1000000000L + (t1.tv_nsec - t0.tv_nsec);
             message->time = time_spent_parsing;
             if (success) {
                 message->data = parsed;
                 message->type = PARSER_RESULT_PARSED;
-                chan_send(parser_to_aggregator, message);
+                queue_for_aggregator(config, heads, tails, message);
             } else {
                 message->data = NULL;
                 message->type = PARSER_RESULT_DROPPED;
-                chan_send(parser_to_aggregator, message);
+                queue_for_aggregator(config, heads, tails, message);
             }
-            tok = strtok(NULL, delim);
+            tok = strtok_r(NULL, delim, &saveptr);
         }
+        send_to_aggregators(config, parser_to_aggregator, heads);
         free_unprocessed_datagram(datagram);
     }
     VERBOSE_LOG(2, "Parser exiting.");
-    struct parser_to_aggregator_message* message =
-        (struct parser_to_aggregator_message*) malloc(sizeof(struct parser_to_aggregator_message));
-    ALLOC_CHECK("Unable to assign memory for parser to aggregator message.");
-    message->type = PARSER_RESULT_END;
-    message->time = 0;
-    message->data = NULL;
-    chan_send(parser_to_aggregator, message);
+    send_end_messages((struct parser_args*)args);
     pthread_exit(NULL);
 }
 
@@ -106,16 +173,18 @@ parser_exec(void* args) {
  * Creates arguments for parser thread
  * @arg config - Application config
  * @arg network_listener_to_parser - Network listener -> Parser
- * @arg parser_to_aggregator - Parser -> Aggregator
+ * @arg parser_to_aggregator - Parser -> Aggregator channels, one per aggregator
+ * @arg parsers_running - Count of parser threads still running, shared by all of them
  * @return parser_args
  */
 struct parser_args*
-create_parser_args(struct agent_config* config, chan_t* network_listener_to_parser, chan_t* parser_to_aggregator) {
+create_parser_args(struct agent_config* config, chan_t* network_listener_to_parser, chan_t** parser_to_aggregator, int* parsers_running) {
     struct parser_args* parser_args = (struct parser_args*) malloc(sizeof(struct parser_args));
     ALLOC_CHECK("Unable to assign memory for parser arguments.");
     parser_args->config = config;
     parser_args->network_listener_to_parser = network_listener_to_parser;
     parser_args->parser_to_aggregator = parser_to_aggregator;
+    parser_args->parsers_running = parsers_running;
     return parser_args;
 }
 
@@ -24,7 +24,8 @@ typedef struct parser_args
 {
     struct agent_config* config;
     chan_t* network_listener_to_parser;
-    chan_t* parser_to_aggregator;
+    chan_t** parser_to_aggregator;
+    int* parsers_running;
 } parser_args;
 
 typedef enum METRIC_TYPE { 
@@ -51,6 +52,7 @@ typedef struct parser_to_aggregator_message
     struct statsd_datagram* data;
     enum PARSER_RESULT_TYPE type;
     unsigned long time;
+    struct parser_to_aggregator_message* next; // rest of datagrams parsed together
 } parser_to_aggregator_message;
 
 typedef struct statsd_datagram
@@ -76,11 +78,12 @@ parser_exec(void* args);
  * Creates arguments for parser thread
  * @arg config - Application config
  * @arg network_listener_to_parser - Network listener -> Parser
- * @arg parser_to_aggregator - Parser -> Aggregator
+ * @arg parser_to_aggregator - Parser -> Aggregator channels, one per aggregator
+ * @arg parsers_running - Count of parser threads still running, shared by all of them
  * @return parser_args
  */
 extern struct parser_args*
-create_parser_args(struct agent_config* config, chan_t* network_listener_to_parser, chan_t* parser_to_aggregator);
+create_parser_args(struct agent_config* config, chan_t* network_listener_to_parser, chan_t** parser_to_aggregator, int* parsers_running);
 
 /**
  * 
@@ -912,17 +912,21 @@ statsd_resolve_static_metric_fetch(pmdaMetric* mdesc, unsigned int instance, pmA
         case 13:
         {
             char* result;
-            char* basic = "Basic";
-            char* ragel = "HDR histogram";
-            if (config->duration_aggregation_type == DURATION_AGGREGATION_TYPE_BASIC) {
-                result = (char*) malloc(sizeof(char) * 6);
-                ALLOC_CHECK("Unable to allocate memory for duration aggregation type value.");
-                memcpy(result, basic, 6);
-            } else {
-                result = (char*) malloc(sizeof(char) * 14);
-                ALLOC_CHECK("Unable to allocate memory for duration aggregation type value.");
-                memcpy(result, ragel, 14);
+            char* type;
+            switch (config->duration_aggregation_type) {
+                case DURATION_AGGREGATION_TYPE_BASIC:
+                    type = "Basic";
+                    break;
+                case DURATION_AGGREGATION_TYPE_SKETCH:
+                    type = "DDSketch";
+                    break;
+                default:
+                    type = "HDR histogram";
             }
+            size_t length = strlen(type) + 1;
+            result = (char*) malloc(sizeof(char) * length);
+            ALLOC_CHECK("Unable to allocate memory for duration aggregation type value.");
+            memcpy(result, type, length);
             (*atom)->cp = result;
             break;
         }
@@ -17,6 +17,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <signal.h>
+#include <sys/socket.h>
 
 #include "pmdastatsd.h"
 #include "config-reader.h"
@@ -253,14 +254,15 @@ main_PDU_loop(pmdaInterface* dispatch) {
 }
 
 static int _isDSO = 1; /* for local contexts */
-static pthread_t network_listener;
-static pthread_t aggregator;
-static pthread_t parser;
+static pthread_t network_listeners[MAX_AGENT_THREADS];
+static pthread_t aggregators[MAX_AGENT_THREADS];
+static pthread_t parsers[MAX_AGENT_THREADS];
 static chan_t* network_listener_to_parser;
-static chan_t* parser_to_aggregator;
+static chan_t* parser_to_aggregator[MAX_AGENT_THREADS];
 static struct network_listener_args* listener_thread_args;
-static struct aggregator_args* aggregator_thread_args;
 static struct parser_args* parser_thread_args;
+static int listeners_running;
+static int parsers_running;
 static struct agent_config config;
 static struct pmda_data_extension data = { 0 };
 char help_file_path[MAXPATHLEN];
@@ -272,6 +274,7 @@ statsd_init(pmdaInterface *dispatch)
 {
     struct pmda_metrics_container* metrics;
     struct pmda_stats_container* stats;
+    unsigned int i;
     int pthread_errno, sep = pmPathSeparator();
 
     if (_isDSO) {
@@ -289,6 +292,13 @@ statsd_init(pmdaInterface *dispatch)
 
     signal(SIGUSR1, signal_handler);
 
+#ifndef SO_REUSEPORT
+    if (config.listener_threads > 1) {
+        pmNotifyErr(LOG_INFO, "Sockets can not share a port here, using a single listener thread.");
+        config.listener_threads = 1;
+    }
+#endif
+
     metrics = init_pmda_metrics(&config);
     stats = init_pmda_stats(&config);
     init_data_ext(&data, &config, metrics, stats);
@@ -297,22 +307,34 @@ statsd_init(pmdaInterface *dispatch)
     if (network_listener_to_parser == NULL) {
 	    DIE("Unable to create channel network listener -> parser.");
     }
-    parser_to_aggregator = chan_init(config.max_unprocessed_packets);
-    if (parser_to_aggregator == NULL) {
-	    DIE("Unable to create channel parser -> aggregator.");
+    // one channel per aggregator, each aggregating its own share of the metrics
+    for (i = 0; i < config.aggregator_threads; i++) {
+        parser_to_aggregator[i] = chan_init(config.max_unprocessed_packets);
+        if (parser_to_aggregator[i] == NULL) {
+            DIE("Unable to create channel parser -> aggregator.");
+        }
     }
 
-    listener_thread_args = create_listener_args(&config, network_listener_to_parser);
-    parser_thread_args = create_parser_args(&config, network_listener_to_parser, parser_to_aggregator);
-    aggregator_thread_args = create_aggregator_args(&config, parser_to_aggregator, metrics, stats);
+    listeners_running = config.listener_threads;
+    parsers_running = config.parser_threads;
+    listener_thread_args = create_listener_args(&config, network_listener_to_parser, &listeners_running);
+    parser_thread_args = create_parser_args(&config, network_listener_to_parser, parser_to_aggregator, &parsers_running);
 
     pthread_errno = 0; 
-    pthread_errno = pthread_create(&network_listener, NULL, network_listener_exec, listener_thread_args);
-    PTHREAD_CHECK(pthread_errno);
-    pthread_errno = pthread_create(&parser, NULL, parser_exec, parser_thread_args);
-    PTHREAD_CHECK(pthread_errno);
-    pthread_errno = pthread_create(&aggregator, NULL, aggregator_exec, aggregator_thread_args);
-    PTHREAD_CHECK(pthread_errno);
+    for (i = 0; i < config.aggregator_threads; i++) {
+        struct aggregator_args* aggregator_thread_args =
+            create_aggregator_args(&config, parser_to_aggregator[i], metrics, stats);
+        pthread_errno = pthread_create(&aggregators[i], NULL, aggregator_exec, aggregator_thread_args);
+        PTHREAD_CHECK(pthread_errno);
+    }
+    for (i = 0; i < config.parser_threads; i++) {
+        pthread_errno = pthread_create(&parsers[i], NULL, parser_exec, parser_thread_args);
+        PTHREAD_CHECK(pthread_errno);
+    }
+    for (i = 0; i < config.listener_threads; i++) {
+        pthread_errno = pthread_create(&network_listeners[i], NULL, network_listener_exec, listener_thread_args);
+        PTHREAD_CHECK(pthread_errno);
+    }
 
     if (dispatch->status != 0) {
         pthread_exit(NULL);
@@ -342,31 +364,41 @@ statsd_init(pmdaInterface *dispatch)
 
 static void
 statsd_done(void) {    
-    if (pthread_join(network_listener, NULL) != 0) {
-        DIE("Error joining network network listener thread.");
-    } else {
-        VERBOSE_LOG(2, "Network listener thread joined.");
+    unsigned int i;
+
+    for (i = 0; i < config.listener_threads; i++) {
+        if (pthread_join(network_listeners[i], NULL) != 0) {
+            DIE("Error joining network network listener thread.");
+        } else {
+            VERBOSE_LOG(2, "Network listener thread joined.");
+        }
     }
-    if (pthread_join(parser, NULL) != 0) {
-        DIE("Error joining datagram parser thread.");
-    } else {
-        VERBOSE_LOG(2, "Parser thread joined.");
+    for (i = 0; i < config.parser_threads; i++) {
+        if (pthread_join(parsers[i], NULL) != 0) {
+            DIE("Error joining datagram parser thread.");
+        } else {
+            VERBOSE_LOG(2, "Parser thread joined.");
+        }
     }
-    if (pthread_join(aggregator, NULL) != 0) {    
-        DIE("Error joining datagram aggregator thread.");
-    } else {
-        VERBOSE_LOG(2, "Aggregator thread joined.");
+    for (i = 0; i < config.aggregator_threads; i++) {
+        if (pthread_join(aggregators[i], NULL) != 0) {    
+            DIE("Error joining datagram aggregator thread.");
+        } else {
+            VERBOSE_LOG(2, "Aggregator thread joined.");
+        }
     }
 
     free_shared_data(&config, &data);
     free(listener_thread_args);
     free(parser_thread_args);
-    free(aggregator_thread_args);
+    free_aggregator_args();
     
     chan_close(network_listener_to_parser);
-    chan_close(parser_to_aggregator);
     chan_dispose(network_listener_to_parser);
-    chan_dispose(parser_to_aggregator);
+    for (i = 0; i < config.aggregator_threads; i++) {
+        chan_close(parser_to_aggregator[i]);
+        chan_dispose(parser_to_aggregator[i]);
+    }
 }
 
 int
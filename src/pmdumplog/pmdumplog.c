@@ -1143,6 +1143,13 @@ main(int argc, char *argv[])
      */
     PM_UNLOCK(ctxp->c_lock);
 
+    /* the metadata dumps below walk the hashed metadata directly */
+    if ((sts = __pmLogLoadAllMeta(ctxp->c_archctl)) < 0) {
+	fprintf(stderr, "%s: Cannot load metadata: %s\n",
+		pmGetProgname(), pmErrStr(sts));
+	exit(1);
+    }
+
     if (mode == PM_MODE_FORW)
 	pmSetMode(mode, &opts.start, 0);
     else
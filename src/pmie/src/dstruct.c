@@ -81,6 +81,7 @@ pmiestats_t	instrument;			/* used if no mmap (archive) */
 
 Task		*taskq = NULL;		/* evaluator task queue */
 Expr		*curr;			/* current executing rule expression */
+unsigned int	fetchcycle;		/* bumped for each task fetch */
 
 SymbolTable	hosts;			/* currently known hosts */
 SymbolTable	metrics;		/* currently known metrics */
@@ -479,6 +480,7 @@ newFetch(Host *owner)
 {
     Fetch *f = (Fetch *) zalloc(sizeof(Fetch));
     f->host = owner;
+    __pmHashInit(&f->pmidhash);
     return f;
 }
 
@@ -603,6 +605,7 @@ freeFetch(Fetch *f)
 	pmDestroyContext(f->handle);
 	if (f->result) pmFreeResult(f->result);
 	if (f->pmids) free(f->pmids);
+	__pmHashClear(&f->pmidhash);
 	free(f);
     }
 }
@@ -1328,6 +1331,7 @@ dumpTask(Task *t)
     fprintf(stderr, "  eval time: ");
     showFullTime(stderr, t->eval);
     fputc('\n', stderr);
+    fprintf(stderr, "  last fetch: %.6f rules: %.6f\n", t->fetchtime, t->ruletime);
     fprintf(stderr, "  retry delta: ");
     if (t->retry == 0)
 	fprintf(stderr, "N/A");
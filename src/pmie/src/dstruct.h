@@ -111,6 +111,8 @@ typedef struct expr {
     /* evaluator */
     Eval	    *eval;	/* evaluator function */
     int		    valid;	/* number of valid samples */
+    struct expr	    *share;	/* equivalent fetch evaluated earlier */
+    unsigned int    cycle;	/* fetch cycle last evaluated in */
 
     /* description of value matrix */
     int		    hdom;	/* cardinality of host dimension */
@@ -184,7 +186,9 @@ typedef struct fetch {
     int            handle;      /* PMCS context handle */
     int		   npmids;	/* number of metrics in fetch */
     pmID	   *pmids;	/* array of metric ids to fetch */
+    __pmHashCtl	   pmidhash;	/* pmid -> index into pmids and result */
     pmResult       *result;     /* result of fetch */
+    int		   status;	/* result of last pmFetch */
 } Fetch;
 
 /* set of bundled fetches for single host (may be archive or live):
@@ -216,6 +220,8 @@ typedef struct task {
     Symbol	  *rules;	/* array of rules to be evaluated */
     Host          *hosts;	/* fetches to be executed and waiting */
     pmResult	  *rslt;	/* for secret agent mode */
+    RealTime	  fetchtime;	/* duration of last fetches */
+    RealTime	  ruletime;	/* duration of last rule evaluation */
 } Task;
 
 /* value semantics - as in pmDesc plus following */
@@ -426,6 +432,7 @@ extern SymbolTable metrics;	/* currently known metrics */
 
 extern Task	   *taskq;	/* evaluator task queue */
 extern Expr	   *curr;	/* current executing rule expression */
+extern unsigned int fetchcycle;	/* bumped for each task fetch */
 
 extern RealTime	   now;		/* current time */
 extern RealTime    start;	/* start evaluation */
@@ -203,6 +203,7 @@ eval(Task *task)
 {
     Symbol	*s;
     pmValueSet  *vset;
+    RealTime	before, fetched, done;
     int		i;
 
     if (pmDebugOptions.appl2) {
@@ -211,7 +212,9 @@ eval(Task *task)
     }
 
     /* fetch metrics */
+    before = getReal();
     taskFetch(task);
+    fetched = getReal();
 
     /* evaluate rule expressions */
     s = task->rules;
@@ -223,6 +226,12 @@ eval(Task *task)
 	}
 	s++;
     }
+    done = getReal();
+
+    task->fetchtime = fetched - before;
+    task->ruletime = done - fetched;
+    perf->fetch_time += (__uint64_t)(task->fetchtime * 1000000);
+    perf->rule_time += (__uint64_t)(task->ruletime * 1000000);
 
     if (verbose) {
 
@@ -844,6 +853,7 @@ run(void)
 	else
 	    t->retry = 0;
 	t->tick = 0;
+	shareFetches(t);
 	t = t->next;
     }
 
@@ -376,7 +376,7 @@ startmonitor(void)
     strncpy(perf->defaultfqdn, "(uninitialized)", sizeof(perf->defaultfqdn));
     perf->defaultfqdn[sizeof(perf->defaultfqdn)-1] = '\0';
 
-    perf->version = 1;
+    perf->version = 2;
 }
 
 
@@ -44,7 +44,10 @@ main(int argc, char **argv)
 	    fprintf(stderr, "%s: %s\n", argv[1], strerror(errno));
 	    return 1;
 	}
-	if ((sts = read(fd, &stats, sizeof(stats))) != sizeof(stats)) {
+	memset(&stats, 0, sizeof(stats));
+	/* version 1 files end before the fetch and rule times */
+	if ((sts = read(fd, &stats, sizeof(stats))) != sizeof(stats) &&
+	    sts != PMIESTATS_V1_SIZE) {
 	    fprintf(stderr, "%s: read %d != %d as expected\n", argv[1], sts, (int)sizeof(stats));
 	}
 	else {
@@ -74,6 +77,10 @@ main(int argc, char **argv)
 	    printf("%s:eval_unknown=%d\n", p, stats.eval_unknown);
 	    printf("%s:eval_actual=%d\n", p, stats.eval_actual);
 	    printf("%s:version=%d\n", p, stats.version);
+	    if (stats.version >= 2) {
+		printf("%s:fetch_time=%" FMT_UINT64 "\n", p, stats.fetch_time);
+		printf("%s:rule_time=%" FMT_UINT64 "\n", p, stats.rule_time);
+	    }
 	}
 	argc--;
 	argv++;
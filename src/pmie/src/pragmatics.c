@@ -25,6 +25,8 @@
 
 #include <math.h>
 #include <ctype.h>
+#include <signal.h>
+#include <pthread.h>
 #include "pmapi.h"
 #include "libpcp.h"
 #include "dstruct.h"
@@ -294,7 +296,6 @@ findFetch(Host *h, Metric *m)
 {
     Fetch	    *f;
     int		    sts;
-    int		    i;
     int		    n;
     pmID	    pmid = m->desc.pmid;
     pmID	    *p;
@@ -332,21 +333,16 @@ findFetch(Host *h, Metric *m)
 	h->fetches = f;
     }
 
-    /* look for existing pmid */
-    p = f->pmids;
-    n = f->npmids;
-    for (i = 0; i < n; i++) {
-	if (*p == pmid) break;
-	p++;
-    }
-
-    /* add new pmid */
-    if (i == n) {
+    /* look for existing pmid, else add new pmid */
+    if (__pmHashSearch(pmid, &f->pmidhash) == NULL) {
+	n = f->npmids;
 	p = f->pmids;
 	p = ralloc(p, (n+1) * sizeof(pmID));
 	p[n] = pmid;
 	f->npmids = n + 1;
 	f->pmids = p;
+	if (__pmHashAdd(pmid, (void *)(__psint_t)n, &f->pmidhash) < 0)
+	    pmNoMem("pmie.findFetch", sizeof(__pmHashNode), PM_FATAL_ERR);
     }
 
     return f;
@@ -1012,6 +1008,112 @@ mark_all(Host *hdown)
     }
 }
 
+/*
+ * Fetches for different hosts in a task are issued concurrently, so the
+ * time taken is that of the slowest host rather than the sum of them all.
+ * Each Fetch has its own context, so the only state shared between the
+ * fetching threads is the index of the next Fetch to be done.  The threads
+ * are started as they are first needed and then wait for the fetches of
+ * later evaluations, rather than being created for every one.
+ */
+#define MAX_FETCH_THREADS	16
+
+typedef struct {
+    pthread_mutex_t	lock;
+    pthread_cond_t	work;		/* fetches are ready to be done */
+    pthread_cond_t	done;		/* the last fetch has been done */
+    Fetch		**fetches;
+    int			nfetches;
+    int			next;		/* index of the next fetch to do */
+    int			ndone;		/* number of fetches completed */
+    int			nthreads;	/* threads in the pool */
+} FetchPool;
+
+static FetchPool	pool = {
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+    PTHREAD_COND_INITIALIZER
+};
+
+static void
+fetchOne(Fetch *f)
+{
+    if ((f->status = pmUseContext(f->handle)) >= 0)
+	f->status = pmFetch(f->npmids, f->pmids, &f->result);
+    if (f->status < 0)
+	f->result = NULL;
+}
+
+/* do fetches until none remain to be started, called with the lock held */
+static void
+fetchNext(void)
+{
+    int		i;
+
+    while (pool.next < pool.nfetches) {
+	i = pool.next++;
+	pthread_mutex_unlock(&pool.lock);
+	fetchOne(pool.fetches[i]);
+	pthread_mutex_lock(&pool.lock);
+	if (++pool.ndone == pool.nfetches)
+	    pthread_cond_signal(&pool.done);
+    }
+}
+
+static void *
+fetchWorker(void *arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&pool.lock);
+    for (;;) {
+	while (pool.next >= pool.nfetches)
+	    pthread_cond_wait(&pool.work, &pool.lock);
+	fetchNext();
+    }
+    /*NOTREACHED*/
+    return NULL;
+}
+
+static void
+fetchAll(Fetch **fetches, int nfetches)
+{
+    pthread_attr_t	attr;
+    pthread_t		thread;
+    sigset_t		all, saved;
+    int			nthreads = nfetches - 1;	/* and this one */
+
+    if (nthreads > MAX_FETCH_THREADS - 1)
+	nthreads = MAX_FETCH_THREADS - 1;
+
+    pthread_mutex_lock(&pool.lock);
+    if (pool.nthreads < nthreads) {
+	/* signals are handled by the main thread only */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &saved);
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	while (pool.nthreads < nthreads) {
+	    if (pthread_create(&thread, &attr, fetchWorker, NULL) != 0)
+		break;
+	    pool.nthreads++;
+	}
+	pthread_attr_destroy(&attr);
+	pthread_sigmask(SIG_SETMASK, &saved, NULL);
+    }
+
+    pool.fetches = fetches;
+    pool.nfetches = nfetches;
+    pool.next = pool.ndone = 0;
+    pthread_cond_broadcast(&pool.work);
+
+    /* this thread fetches too, and alone if no threads could be created */
+    fetchNext();
+    while (pool.ndone < pool.nfetches)
+	pthread_cond_wait(&pool.done, &pool.lock);
+    pool.fetches = NULL;
+    pool.nfetches = pool.next = pool.ndone = 0;
+    pthread_mutex_unlock(&pool.lock);
+}
+
 /* execute fetches for given Task */
 void
 taskFetch(Task *t)
@@ -1022,41 +1124,57 @@ taskFetch(Task *t)
     Metric	*m;
     pmResult	*r;
     pmValueSet	**v;
+    __pmHashNode *hp;
+    Fetch	**fetches = NULL;
+    int		nfetches = 0;
     int		i;
     int		sts;
 
-    /* do all fetches, quick as you can */
-    h = t->hosts;
-    while (h) {
-	f = h->fetches;
-	while (f) {
+    fetchcycle++;
+
+    /* gather all fetches, releasing the previous results */
+    for (h = t->hosts; h; h = h->next) {
+	for (f = h->fetches; f; f = f->next) {
 	    if (f->result) pmFreeResult(f->result);
-	    if (! h->down) {
-		pmUseContext(f->handle);
-		if ((sts = pmFetch(f->npmids, f->pmids, &f->result)) < 0) {
-		    if (archives) {
-			if (sts == PM_ERR_LOGREC) {
-			    fprintf(stderr, "%s: pmFetch failed: %s\n", pmGetProgname(),
-				    pmErrStr(sts));
-			    exit(1);
-			}
-		    }
-		    else {
-			pmNotifyErr(LOG_ERR, "pmFetch from %s failed: %s\n",
-				symName(f->host->name), pmErrStr(sts));
-			host_state_changed(symName(f->host->conn), STATE_LOSTCONN);
-			h->down = 1;
-			mark_all(h);
-		    }
-		    f->result = NULL;
-		}
+	    f->result = NULL;
+	    if (h->down)
+		continue;
+	    fetches = (Fetch **)ralloc(fetches, (nfetches+1) * sizeof(Fetch *));
+	    fetches[nfetches++] = f;
+	}
+    }
+
+    /* do all fetches, quick as you can */
+    if (archives || nfetches < 2) {
+	for (i = 0; i < nfetches; i++)
+	    fetchOne(fetches[i]);
+    }
+    else {
+	fetchAll(fetches, nfetches);
+    }
+
+    /* then handle any failures, in the order the fetches were made */
+    for (i = 0; i < nfetches; i++) {
+	f = fetches[i];
+	h = f->host;
+	if ((sts = f->status) >= 0 || h->down)
+	    continue;
+	if (archives) {
+	    if (sts == PM_ERR_LOGREC) {
+		fprintf(stderr, "%s: pmFetch failed: %s\n", pmGetProgname(),
+			pmErrStr(sts));
+		exit(1);
 	    }
-	    else
-		f->result = NULL;
-	    f = f->next;
 	}
-	h = h->next;
+	else {
+	    pmNotifyErr(LOG_ERR, "pmFetch from %s failed: %s\n",
+			symName(h->name), pmErrStr(sts));
+	    host_state_changed(symName(h->conn), STATE_LOSTCONN);
+	    h->down = 1;
+	    mark_all(h);
+	}
     }
+    free(fetches);
 
     /* sort and distribute pmValueSets to requesting Metrics */
     h = t->hosts;
@@ -1074,19 +1192,19 @@ taskFetch(Task *t)
 		    v++;
 		}
 
-		/* distribute pmValueSets to Metrics */
+		/*
+		 * distribute pmValueSets to Metrics - the result has
+		 * a pmValueSet for each pmid, in the order requested
+		 */
 		p = f->profiles;
 		while (p) {
 		    m = p->metrics;
 		    while (m) {
-			for (i = 0; i < r->numpmid; i++) {
-			    if (m->desc.pmid == r->vset[i]->pmid) {
-				if (r->vset[i]->numval > 0) {
-				    m->vset = r->vset[i];
-				    m->stamp = pmtimevalToReal(&r->timestamp);
-				}
-				break;
-			    }
+			if ((hp = __pmHashSearch(m->desc.pmid, &f->pmidhash)) != NULL &&
+			    (i = (int)(__psint_t)hp->data) < r->numpmid &&
+			    r->vset[i]->numval > 0) {
+			    m->vset = r->vset[i];
+			    m->stamp = pmtimevalToReal(&r->timestamp);
 			}
 			m = m->next;
 		    }
@@ -1100,6 +1218,104 @@ taskFetch(Task *t)
 }
 
 
+/*
+ * Is there a CND_INSTANT node above this fetch?  If so, counters are
+ * not converted to rates.
+ */
+static int
+instant(Expr *x)
+{
+    Expr	*p;
+
+    for (p = x->parent; p != NULL; p = p->parent) {
+	if (p->op == CND_INSTANT)
+	    return 1;
+    }
+    return 0;
+}
+
+/* do two fetch nodes always produce the same values? */
+static int
+sameFetch(Expr *x, Expr *y)
+{
+    Metric	*m = x->metrics;
+    Metric	*n = y->metrics;
+    int		i;
+
+    if (x->hdom != y->hdom || instant(x) != instant(y))
+	return 0;
+    for (i = 0; i < x->hdom; i++, m++, n++) {
+	if (m->mname != n->mname || m->hconn != n->hconn ||
+	    m->specinst != n->specinst ||
+	    m->desc.type == PM_TYPE_STRING || n->desc.type == PM_TYPE_STRING)
+	    return 0;
+    }
+    return 1;
+}
+
+static void
+shareExpr(Expr *x, Expr ***fetches, int *nfetches)
+{
+    int		i;
+
+    if (x == NULL)
+	return;
+    if (x->op == CND_FETCH) {
+	x->share = NULL;
+	if (x->metrics == NULL)
+	    return;
+	for (i = 0; i < *nfetches; i++) {
+	    if (sameFetch((*fetches)[i], x)) {
+		x->share = (*fetches)[i];
+		return;
+	    }
+	}
+	*fetches = (Expr **)ralloc(*fetches, (*nfetches+1) * sizeof(Expr *));
+	(*fetches)[(*nfetches)++] = x;
+	return;
+    }
+    /* in evaluation order, and only through nodes owned by x */
+    if (x->arg1 && x->arg1->parent == x)
+	shareExpr(x->arg1, fetches, nfetches);
+    if (x->arg2 && x->arg2->parent == x)
+	shareExpr(x->arg2, fetches, nfetches);
+}
+
+/*
+ * Find fetch nodes that are equivalent to one evaluated before them in
+ * the same Task, so that the values extracted (and rates computed) for
+ * the first one can be reused - see shared() in fetch.sk.  Only those
+ * parts of each rule that are evaluated unconditionally are considered,
+ * i.e. not actions and not rulesets.
+ */
+void
+shareFetches(Task *task)
+{
+    Symbol	*s;
+    Expr	*x;
+    Expr	**fetches = NULL;
+    int		nfetches = 0;
+    int		i;
+
+    s = task->rules;
+    for (i = 0; i < task->nrules; i++, s++) {
+	x = symValue(*s);
+	if (x->op == CND_RULESET)
+	    continue;
+	if (x->op == RULE)
+	    shareExpr(x->arg1, &fetches, &nfetches);
+	else
+	    shareExpr(x, &fetches, &nfetches);
+    }
+    if (pmDebugOptions.appl1 && pmDebugOptions.desperate) {
+	fprintf(stderr, "shareFetches: task " PRINTF_P_PFX "%p: %d distinct fetch nodes\n",
+		task, nfetches);
+    }
+    if (fetches)
+	free(fetches);
+}
+
+
 /* send pmDescriptors for all expressions in given task */
 void
 sendDescs(Task *task)
@@ -67,6 +67,9 @@ void pragmatics(Symbol, RealTime);
 /* execute fetches for given Task */
 void taskFetch(Task *);
 
+/* share evaluation of equivalent fetches in given Task */
+void shareFetches(Task *);
+
 /* convert Expr value to pmValueSet value */
 void fillVSet(Expr *, pmValueSet *);
 
@@ -14,6 +14,7 @@
 #ifndef STATS_H
 #define STATS_H
 
+#include <stddef.h>
 #include <sys/types.h>
 #include <sys/param.h>
 
@@ -33,6 +34,11 @@ typedef struct {
     unsigned int	eval_unknown;		/* pmcd.pmie.eval.unknown  */
     unsigned int	eval_actual;		/* pmcd.pmie.eval.actual   */
     unsigned int	version;
+    __uint64_t		fetch_time;		/* pmcd.pmie.eval.fetch_time */
+    __uint64_t		rule_time;		/* pmcd.pmie.eval.rule_time  */
 } pmiestats_t;
 
+/* version 1 stats files end before the fetch and rule evaluation times */
+#define PMIESTATS_V1_SIZE	offsetof(pmiestats_t, fetch_time)
+
 #endif /* STATS_H */
@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2021 Red Hat.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * Compress PCP archive files into the block-compressed formats that
+ * libpcp can read with random access, replacing each file (like xz(1)
+ * or gzip(1) do) so this can be used as the pmlogger_daily compression
+ * program.  Input files may themselves be compressed in any format
+ * libpcp understands, so archives can be converted from (say) .xz.
+ */
+
+#include <sys/stat.h>
+#include <utime.h>
+#include "pmapi.h"
+#include "libpcp.h"
+
+static pmLongOptions longopts[] = {
+    PMAPI_OPTIONS_HEADER("Options"),
+    { "blocksize", 1, 'b', "N", "uncompressed size of each block [default 1M]" },
+    { "compress", 1, 'c', "FORMAT", "zstd or lz4 [default zstd]" },
+    PMOPT_DEBUG,
+    { "force", 0, 'f', 0, "overwrite existing output files" },
+    { "keep", 0, 'k', 0, "keep (do not remove) input files" },
+    { "verbose", 0, 'v', 0, "report compression ratio for each file" },
+    PMOPT_HELP,
+    PMAPI_OPTIONS_END
+};
+
+static pmOptions opts = {
+    .flags = PM_OPTFLAG_DONE,
+    .short_options = "b:c:D:fkv?",
+    .long_options = longopts,
+    .short_usage = "[options] file ...",
+};
+
+static const struct {
+    const char	*name;
+    const char	*suffix;
+} formats[] = {
+    { "zstd",	".zst" },
+    { "lz4",	".lz4" },
+};
+
+static const char	*suffix = ".zst";
+static size_t		blocksize;
+static int		fflag;
+static int		kflag;
+static int		vflag;
+
+static int
+compress(const char *fname)
+{
+    __pmFILE		*in, *out;
+    struct stat		sbuf;
+    struct utimbuf	times;
+    char		oname[MAXPATHLEN];
+    char		buf[65536];
+    char		*p;
+    size_t		bytes;
+    long		isize, osize;
+    int			sts = 0;
+
+    /* replace any compression suffix on the input name */
+    pmsprintf(oname, sizeof(oname), "%s", fname);
+    if ((p = strrchr(oname, '.')) != NULL && __pmLogCompressedSuffix(p)) {
+	if (strcmp(p, suffix) == 0) {
+	    fprintf(stderr, "%s: %s: already compressed\n", pmGetProgname(), fname);
+	    return 0;
+	}
+	*p = '\0';
+    }
+    p = oname + strlen(oname);
+    pmsprintf(p, sizeof(oname) - (p - oname), "%s", suffix);
+
+    if (stat(fname, &sbuf) < 0) {
+	fprintf(stderr, "%s: %s: %s\n", pmGetProgname(), fname, osstrerror());
+	return 1;
+    }
+    if (!S_ISREG(sbuf.st_mode)) {
+	fprintf(stderr, "%s: %s: not a regular file\n", pmGetProgname(), fname);
+	return 1;
+    }
+    if (!fflag && access(oname, F_OK) == 0) {
+	fprintf(stderr, "%s: %s: already exists\n", pmGetProgname(), oname);
+	return 1;
+    }
+
+    if ((in = __pmFopen(fname, "r")) == NULL) {
+	fprintf(stderr, "%s: %s: cannot open: %s\n", pmGetProgname(), fname, osstrerror());
+	return 1;
+    }
+    if ((out = __pmFopen(oname, "w")) == NULL) {
+	fprintf(stderr, "%s: %s: cannot create: %s\n", pmGetProgname(), oname, osstrerror());
+	__pmFclose(in);
+	return 1;
+    }
+    if (blocksize && __pmSetvbuf(out, NULL, _IOFBF, blocksize) < 0) {
+	fprintf(stderr, "%s: %s: cannot set block size: %s\n", pmGetProgname(), oname, osstrerror());
+	sts = 1;
+    }
+
+    for (isize = 0; sts == 0 && (bytes = __pmFread(buf, 1, sizeof(buf), in)) > 0; isize += bytes) {
+	if (__pmFwrite(buf, 1, bytes, out) != bytes) {
+	    fprintf(stderr, "%s: %s: write failed: %s\n", pmGetProgname(), oname, osstrerror());
+	    sts = 1;
+	}
+    }
+    if (sts == 0 && __pmFerror(in)) {
+	fprintf(stderr, "%s: %s: read failed: %s\n", pmGetProgname(), fname, osstrerror());
+	sts = 1;
+    }
+    __pmFclose(in);
+    if (__pmFclose(out) != 0 && sts == 0) {
+	fprintf(stderr, "%s: %s: close failed: %s\n", pmGetProgname(), oname, osstrerror());
+	sts = 1;
+    }
+    if (sts != 0) {
+	unlink(oname);
+	return sts;
+    }
+
+    /* like the other compression programs, preserve permissions and times */
+    chmod(oname, sbuf.st_mode & 07777);
+    times.actime = sbuf.st_atime;
+    times.modtime = sbuf.st_mtime;
+    utime(oname, &times);
+
+    if (vflag) {
+	osize = stat(oname, &sbuf) < 0 ? 0 : (long)sbuf.st_size;
+	printf("%s: %ld -> %ld bytes (%.1f%%)\n", oname, isize, osize,
+		isize ? 100.0 * osize / isize : 0.0);
+    }
+    if (!kflag && unlink(fname) < 0) {
+	fprintf(stderr, "%s: %s: cannot remove: %s\n", pmGetProgname(), fname, osstrerror());
+	return 1;
+    }
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    char	*endnum;
+    int		c, i, sts = 0;
+
+    while ((c = pmGetOptions(argc, argv, &opts)) != EOF) {
+	switch (c) {
+	case 'b':
+	    blocksize = strtoul(opts.optarg, &endnum, 10);
+	    if (*endnum == 'k' || *endnum == 'K') {
+		blocksize *= 1024;
+		endnum++;
+	    }
+	    else if (*endnum == 'm' || *endnum == 'M') {
+		blocksize *= 1024 * 1024;
+		endnum++;
+	    }
+	    if (*endnum != '\0' || blocksize == 0) {
+		pmprintf("%s: -b requires a positive size argument\n",
+			pmGetProgname());
+		opts.errors++;
+	    }
+	    break;
+	case 'c':
+	    for (i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+		if (strcmp(opts.optarg, formats[i].name) == 0)
+		    break;
+	    }
+	    if (i == sizeof(formats) / sizeof(formats[0])) {
+		pmprintf("%s: unknown compression format \"%s\"\n",
+			pmGetProgname(), opts.optarg);
+		opts.errors++;
+	    }
+	    else
+		suffix = formats[i].suffix;
+	    break;
+	case 'f':
+	    fflag = 1;
+	    break;
+	case 'k':
+	    kflag = 1;
+	    break;
+	case 'v':
+	    vflag = 1;
+	    break;
+	default:
+	    opts.errors++;
+	    break;
+	}
+    }
+    if (opts.errors || opts.optind >= argc) {
+	pmUsageMessage(&opts);
+	exit(1);
+    }
+
+    for (i = opts.optind; i < argc; i++)
+	sts |= compress(argv[i]);
+
+    exit(sts);
+}
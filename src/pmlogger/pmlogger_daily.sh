@@ -218,7 +218,7 @@ then
 fi
 COMPRESSREGEX=""
 COMPRESSREGEX_CMDLINE=""
-COMPRESSREGEX_DEFAULT="\.(index|Z|gz|bz2|zip|xz|lzma|lzo|lz4)$"
+COMPRESSREGEX_DEFAULT="\.(index|mindex|Z|gz|bz2|zip|xz|lzma|lzo|lz4|zst)$"
 
 # threshold size to roll $PCP_LOG_DIR/NOTICES
 #
@@ -1410,6 +1410,14 @@ END	{ if (inlist != "") print lastdate,inlist }' >$tmp/list
 				    fi
 				done
 			    fi
+			    # if any input archive has a metadata index (pmlogger -M)
+			    # then so should the output archive
+			    #
+			    mindex=false
+			    for arch in $inlist
+			    do
+				[ -f $arch.mindex ] && mindex=true
+			    done
 			    narch=`echo $inlist | wc -w | sed -e 's/ //g'`
 			    if [ "$narch" = 1 ]
 			    then
@@ -1445,6 +1453,21 @@ END	{ if (inlist != "") print lastdate,inlist }' >$tmp/list
 				    _error "problems executing pmlogger_merge for host \"$host\""
 				fi
 			    fi
+			    if $mindex
+			    then
+				# pmlogmv moves the index, but it is stale if
+				# pmlogrewrite has been run above, and
+				# pmlogger_merge does not create one
+				#
+				if $SHOWME
+				then
+				    echo "+ pmlogmindex $outfile"
+				elif [ -f $outfile.meta ]
+				then
+				    pmlogmindex $outfile \
+				    || _warning "problems creating metadata index for $outfile"
+				fi
+			    fi
 			fi
 		    done
 		fi
@@ -305,7 +305,7 @@ then
 		$PCP_ECHO_PROG $PCP_ECHO_N ".""$PCP_ECHO_C"
 	    done
 	fi
-	eval $RM -f $input.index* $input.meta* $input.[0-9]*
+	eval $RM -f $input.index* $input.mindex* $input.meta* $input.[0-9]*
     done
     $VERBOSE && echo " done"
 fi
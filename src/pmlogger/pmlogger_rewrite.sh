@@ -132,7 +132,7 @@ do
 	# crude filter here ... more precise filtering later on
 	#
 	find "$try" -type f \
-	| egrep '(\.meta|\.index|\.[0-9][0-9]*)($|(\.xz|\.lzma|\.bz2|\.bz|\.gz|\.Z|\.z)$)' >>$tmp/args
+	| egrep '(\.meta|\.index|\.[0-9][0-9]*)($|(\.xz|\.lzma|\.bz2|\.bz|\.gz|\.Z|\.z|\.zst|\.lz4)$)' >>$tmp/args
     else
 	echo "$try" >>$tmp/args
     fi
@@ -329,6 +329,14 @@ do
 			echo "Warning: no gzip(1), cannot recompress $file"
 		    fi
 		    ;;
+		*.zst)
+		    pmlogcompress -c zstd "$file"
+		    $very_verbose && echo "changed and recompressed: $old_file"
+		    ;;
+		*.lz4)
+		    pmlogcompress -c lz4 "$file"
+		    $very_verbose && echo "changed and recompressed: $old_file"
+		    ;;
 		*)
 		    echo "Botch: cannot handle rewriting file name change: $old_file -> $file"
 		    ;;
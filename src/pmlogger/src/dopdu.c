@@ -1368,10 +1368,14 @@ do_request(__pmPDU *pb)
 	case LOG_REQUEST_SYNC:
 	    /*
 	     * Don't need to check access controls, as this is now
-	     * a no-op with unbuffered I/O from pmlogger.
+	     * a no-op with unbuffered I/O from pmlogger ... except for
+	     * compressed data volumes, where flushing ends the current
+	     * block so other processes can read the recent records.
 	     *
-	     * Do nothing, simply send status 0 back to pmlc.
+	     * Simply send status 0 back to pmlc.
 	     */
+	    if (logctl.l_compress != NULL)
+		__pmFflush(archctl.ac_mfp);
 	    sts = __pmSendError(clientfd, FROM_ANON, 0);
 	    break;
 
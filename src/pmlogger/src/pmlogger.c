@@ -57,6 +57,7 @@ struct timeval	delta = { 60, 0 };	/* default logging interval */
 int		sig_code;		/* caught signal */
 int		qa_case;		/* QA error injection state */
 char		*note;			/* note for port map file */
+int		metaindex;		/* write metadata index, see -M */
 
 static int 	    pmcdfd = -1;	/* comms to pmcd */
 static __pmFdSet    fds;		/* file descriptors mask for select */
@@ -113,6 +114,8 @@ run_done(int sts, char *msg)
     __pmFclose(archctl.ac_mfp);
     __pmFclose(archctl.ac_log->l_tifp);
     __pmFclose(archctl.ac_log->l_mdfp);
+    if (archctl.ac_log->l_mifp != NULL)
+	__pmFclose(archctl.ac_log->l_mifp);
 
     if (log_switch_flag) {
     	/*
@@ -559,6 +562,7 @@ static pmLongOptions longopts[] = {
     { "log", 1, 'l', "FILE", "redirect diagnostics and trace output" },
     { "linger", 0, 'L', 0, "run even if not primary logger instance and nothing to log" },
     { "note", 1, 'm', "MSG", "descriptive note to be added to the port map file" },
+    { "metaindex", 0, 'M', 0, "write a metadata index for faster archive open" },
     PMOPT_SPECLOCAL,
     { "local-PMDA", 0, 'o', 0, "metrics sourced without connecting to pmcd" },
     PMOPT_NAMESPACE,
@@ -574,13 +578,14 @@ static pmLongOptions longopts[] = {
     { "volsize", 1, 'v', "SIZE", "switch log volumes after size has been accumulated" },
     { "version", 1, 'V', "NUM", "version for archive (default and only version is 2)" },
     { "", 1, 'x', "FD", "control file descriptor for running from pmRecordControl(3)" },
+    { "compress", 1, 'X', "FORMAT", "write compressed data volumes (zstd or lz4)" },
     { "", 0, 'y', 0, "set timezone for times to local time rather than from PMCD host" },
     PMOPT_HELP,
     PMAPI_OPTIONS_END
 };
 
 static pmOptions opts = {
-    .short_options = "c:CD:fh:H:l:K:Lm:Nn:op:Prs:T:t:uU:v:V:x:y?",
+    .short_options = "c:CD:fh:H:l:K:Lm:MNn:op:Prs:T:t:uU:v:V:x:X:y?",
     .long_options = longopts,
     .short_usage = "[options] archive",
 };
@@ -776,6 +781,7 @@ main(int argc, char **argv)
     int			exit_code = 0;
     char		*exit_msg;
     const char		*name = "pmcd.timezone";
+    const char		*feature, *value;
     pmID		pmid;
     pmResult		*resp;
 
@@ -852,6 +858,10 @@ main(int argc, char **argv)
 			(strncmp(note, "reexec", 6) == 0));
 	    break;
 
+	case 'M':		/* metadata index */
+	    metaindex = 1;
+	    break;
+
 	case 'N':		/* notify service manager (even if not primary) */
 	    notify_service_mgr = 1;
 	    break;
@@ -963,6 +973,29 @@ main(int argc, char **argv)
 	    }
 	    break;
 
+	case 'X':		/* compressed data volumes */
+	    if (strcmp(opts.optarg, "zstd") == 0) {
+		feature = "zstd_decompress";
+		logctl.l_compress = ".zst";
+	    }
+	    else if (strcmp(opts.optarg, "lz4") == 0) {
+		feature = "lz4_decompress";
+		logctl.l_compress = ".lz4";
+	    }
+	    else {
+		pmprintf("%s: -X requires a compression format of zstd or lz4\n",
+			pmGetProgname());
+		opts.errors++;
+		break;
+	    }
+	    if ((value = pmGetAPIConfig(feature)) == NULL ||
+		strcmp(value, "true") != 0) {
+		pmprintf("%s: %s compression is not supported\n",
+			pmGetProgname(), opts.optarg);
+		opts.errors++;
+	    }
+	    break;
+
 	case 'y':
 	    use_localtime = 1;
 	    break;
@@ -1226,6 +1259,11 @@ main(int argc, char **argv)
 	fprintf(stderr, "__pmLogCreate(%s, %s, ...): %s\n", pmcd_host, archName, pmErrStr(sts));
 	exit(1);
     }
+    if (metaindex &&
+	(sts = __pmLogCreateMetaIndex(archName, &archctl)) < 0) {
+	/* not fatal, the archive is still usable without the index */
+	fprintf(stderr, "Warning: __pmLogCreateMetaIndex(%s): %s\n", archName, pmErrStr(sts));
+    }
 
     /*
      * try and establish $TZ from the remote PMCD ...
@@ -1563,7 +1601,7 @@ newvolume(int vol_switch_type)
                                    vol_switch_callback);
     }
 
-    if ((newfp = __pmLogNewFile(archName, nextvol)) != NULL) {
+    if ((newfp = __pmLogNewFileCompress(archName, nextvol, logctl.l_compress)) != NULL) {
 	if (logctl.l_state == PM_LOG_STATE_NEW) {
 	    /*
 	     * nothing has been logged as yet, force out the label records
@@ -137,6 +137,10 @@ _is_archive()
 	    			;;
 	    *.gz|*.Z|*.z)	gzip -dc "$1"
 	    			;;
+	    *.zst)		zstd -dc "$1"
+	    			;;
+	    *.lz4)		lz4 -dc "$1"
+	    			;;
 	    *)			cat "$1"
 	    			;;
 	esac 2>/dev/null \
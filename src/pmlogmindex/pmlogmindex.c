@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2021 Red Hat.
+ * 
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/*
+ * pmlogmindex - create (or recreate) the metadata index of archives
+ * that were not written by pmlogger -M
+ */
+
+#include "pmapi.h"
+#include "libpcp.h"
+
+static int	vflag;		/* -v, report each archive */
+
+static pmLongOptions longopts[] = {
+    PMAPI_OPTIONS_HEADER("Options"),
+    PMOPT_DEBUG,
+    { "verbose", 0, 'v', 0, "report the number of metadata records indexed" },
+    PMOPT_HELP,
+    PMAPI_OPTIONS_END
+};
+
+static pmOptions opts = {
+    .short_options = "D:v?",
+    .long_options = longopts,
+    .short_usage = "[options] archive ...",
+};
+
+static int
+do_archive(const char *name)
+{
+    __pmContext		*ctxp;
+    char		base[MAXPATHLEN];
+    char		path[MAXPATHLEN];
+    int			ctx;
+    int			sts;
+
+    /*
+     * Any existing index is not to be trusted, so remove it before
+     * opening the archive and reading all of the metadata.
+     */
+    strncpy(base, name, sizeof(base));
+    base[sizeof(base)-1] = '\0';
+    __pmLogBaseName(base);
+    pmsprintf(path, sizeof(path), "%s.mindex", base);
+    unlink(path);
+
+    if ((ctx = pmNewContext(PM_CONTEXT_ARCHIVE, name)) < 0) {
+	fprintf(stderr, "%s: Cannot open archive \"%s\": %s\n",
+		pmGetProgname(), name, pmErrStr(ctx));
+	return 1;
+    }
+    if ((ctxp = __pmHandleToPtr(ctx)) == NULL) {
+	fprintf(stderr, "%s: botch: __pmHandleToPtr(%d) returns NULL!\n",
+		pmGetProgname(), ctx);
+	exit(1);
+    }
+
+    if (ctxp->c_archctl->ac_num_logs > 1) {
+	fprintf(stderr, "%s: \"%s\" is more than one archive\n",
+		pmGetProgname(), name);
+	sts = PM_ERR_NOTARCHIVE;
+    }
+    else if ((sts = __pmLogWriteMetaIndex(ctxp->c_archctl)) < 0) {
+	fprintf(stderr, "%s: Cannot write metadata index for \"%s\": %s\n",
+		pmGetProgname(), name, pmErrStr(sts));
+    }
+    else if (vflag)
+	printf("%s: %d metadata records\n", name, sts);
+
+    PM_UNLOCK(ctxp->c_lock);
+    pmDestroyContext(ctx);
+    return sts < 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int			c;
+    int			status = 0;
+
+    while ((c = pmGetOptions(argc, argv, &opts)) != EOF) {
+	switch (c) {
+	case 'v':	/* verbose */
+	    vflag = 1;
+	    break;
+	}
+    }
+
+    if (!opts.errors && opts.optind >= argc) {
+	fprintf(stderr, "Error: no archive specified\n\n");
+	opts.errors++;
+    }
+
+    if (opts.errors) {
+	pmUsageMessage(&opts);
+	exit(EXIT_FAILURE);
+    }
+
+    for ( ; opts.optind < argc; opts.optind++)
+	status |= do_archive(argv[opts.optind]);
+
+    exit(status);
+}
@@ -49,6 +49,8 @@ static char	*oldname;
 static char	*newname;
 /* need a sentinel that is < 0 and ! PM_LOG_VOL_TI amd ! PM_LOG_VOL_META */
 #define PM_LOG_VOL_NONE -100
+/* and another for the optional metadata index, pmlogmindex(1) */
+#define PM_LOG_VOL_MINDEX -3
 static int	lastvol = PM_LOG_VOL_NONE;
 static __pmContext	*ctxp = NULL;
 static char	**sufftab;
@@ -142,6 +144,9 @@ do_link(int vol)
 	    case PM_LOG_VOL_META:
 		    snprintf(src, sizeof(src), "%s.meta%s", oldname, *suff);
 		    break;
+	    case PM_LOG_VOL_MINDEX:
+		    snprintf(src, sizeof(src), "%s.mindex%s", oldname, *suff);
+		    break;
 	    default:
 		    snprintf(src, sizeof(src), "%s.%d%s", oldname, vol, *suff);
 		    break;
@@ -155,6 +160,9 @@ do_link(int vol)
 		case PM_LOG_VOL_META:
 			snprintf(dst, sizeof(src), "%s.meta%s", newname, *suff);
 			break;
+		case PM_LOG_VOL_MINDEX:
+			snprintf(dst, sizeof(src), "%s.mindex%s", newname, *suff);
+			break;
 		default:
 			snprintf(dst, sizeof(src), "%s.%d%s", newname, vol, *suff);
 			break;
@@ -188,6 +196,10 @@ do_link(int vol)
 		if (verbose)
 		    fprintf(stderr, "pmlogmv: Warning: source file %s.meta not found\n", oldname);
 		break;
+	case PM_LOG_VOL_MINDEX:
+		if (verbose > 1)
+		    fprintf(stderr, "pmlogmv: Warning: source file %s.mindex not found\n", oldname);
+		break;
 	default:
 		if (verbose > 1)
 		    fprintf(stderr, "pmlogmv: Warning: source file %s.%d not found\n", oldname, vol);
@@ -214,6 +226,9 @@ do_unlink(int cleanup, char *name, int vol)
 	    case PM_LOG_VOL_META:
 		    snprintf(src, sizeof(src), "%s.meta%s", name, *suff);
 		    break;
+	    case PM_LOG_VOL_MINDEX:
+		    snprintf(src, sizeof(src), "%s.mindex%s", name, *suff);
+		    break;
 	    default:
 		    snprintf(src, sizeof(src), "%s.%d%s", name, vol, *suff);
 		    break;
@@ -245,6 +260,11 @@ cleanup(int sig)
     }
 
     /* order here is the _reverse_ order of creation in main() */
+    if (lastvol == PM_LOG_VOL_MINDEX) {
+	/* newname.mindex was created */
+	do_unlink(1, newname, PM_LOG_VOL_MINDEX);
+	lastvol = PM_LOG_VOL_META;
+    }
     if (lastvol == PM_LOG_VOL_META) {
 	/* newname.meta was created */
 	do_unlink(1, newname, PM_LOG_VOL_META);
@@ -367,6 +387,8 @@ main(int argc, char **argv)
 	goto abandon;
     if (do_link(PM_LOG_VOL_META) < 0)
 	goto abandon;
+    if (do_link(PM_LOG_VOL_MINDEX) < 0)
+	goto abandon;
 
     /* remove oldname files */
     for (i = ctxp->c_archctl->ac_log->l_minvol; i <= ctxp->c_archctl->ac_log->l_maxvol; i++) {
@@ -374,6 +396,7 @@ main(int argc, char **argv)
     }
     do_unlink(0, oldname, PM_LOG_VOL_TI);
     do_unlink(0, oldname, PM_LOG_VOL_META);
+    do_unlink(0, oldname, PM_LOG_VOL_MINDEX);
     return 0;
 
 /* fatal error once we're started ... remove any newname files */
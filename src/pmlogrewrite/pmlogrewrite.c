@@ -1523,6 +1523,13 @@ main(int argc, char **argv)
      */
     PM_UNLOCK(inarch.ctxp->c_lock);
 
+    /* the rules are checked against the hashed metadata directly */
+    if ((sts = __pmLogLoadAllMeta(inarch.ctxp->c_archctl)) < 0) {
+	fprintf(stderr, "%s: Error: cannot load metadata for archive \"%s\": %s\n",
+		pmGetProgname(), inarch.name, pmErrStr(sts));
+	exit(1);
+    }
+
     if ((sts = pmGetArchiveLabel(&inarch.label)) < 0) {
 	fprintf(stderr, "%s: Error: cannot get archive label record (%s): %s\n",
 		pmGetProgname(), inarch.name, pmErrStr(sts));
@@ -1,5 +1,5 @@
 /*
- * pmnsmerge [-adfv] infile [...] outfile
+ * pmnsmerge [-abdfvx] infile [...] outfile
  *
  * Merge PCP PMNS files
  *
@@ -31,6 +31,7 @@ static pmLongOptions longopts[] = {
     PMAPI_OPTIONS_HEADER("Options"),
     PMOPT_DEBUG,
     { "", 0, 'a', 0, "process files in order, ignoring embedded _DATESTAMP control lines" },
+    { "binary", 0, 'b', 0, "also write a compiled image of the output PMNS to outfile.bin" },
     { "dupok", 0, 'd', 0, "duplicate names for the same PMID are allowed [default]" },
     { "force", 0, 'f', 0, "force overwriting of the output file if it exists" },
     { "nodups", 0, 'x', 0, "duplicate names for the same PMID are not allowed" },
@@ -40,7 +41,7 @@ static pmLongOptions longopts[] = {
 };
 
 static pmOptions opts = {
-    .short_options = "aD:dfvx?",
+    .short_options = "abD:dfvx?",
     .long_options = longopts,
     .short_usage = "[options] infile [...] outfile",
 };
@@ -205,6 +206,7 @@ main(int argc, char **argv)
     int		j;
     int		force = 0;
     int		asis = 0;
+    int		binary = 0;
     int		dupok = 1;
     __pmnsNode	*tmp;
 
@@ -220,6 +222,10 @@ main(int argc, char **argv)
 	    asis = 1;
 	    break;
 
+	case 'b':	/* compiled image as well */
+	    binary = 1;
+	    break;
+
 	case 'd':	/* duplicate PMIDs are OK */
 	    fprintf(stderr, "%s: Warning: -d deprecated, duplicate PMNS names allowed by default\n", pmGetProgname());
 	    dupok = 1;
@@ -329,5 +335,11 @@ main(int argc, char **argv)
 	exit(1);
     }
 
+    if (binary && (sts = __pmWritePMNSImage(argv[argc-1])) < 0) {
+	fprintf(stderr, "%s: Error: cannot write compiled PMNS \"%s.bin\": %s\n",
+	    pmGetProgname(), argv[argc-1], pmErrStr(sts));
+	exit(1);
+    }
+
     exit(0);
 }
@@ -1097,6 +1097,7 @@ static pmLongOptions longopts[] = {
     { "load", 0, 'L', 0, "load time series values and metadata" },
     { "query", 0, 'q', 0, "perform a time series query (default)" },
     { "values", 0, 'v', 0, "all known values for given label name(s)" },
+    { "workers", 1, 'w', "N", "load archive(s) using N worker threads" },
     PMOPT_DEBUG,
     PMAPI_OPTIONS_HEADER("Reporting Options"),
     { "all", 0, 'a', 0, "report all metadata (-dilms) for time series" },
@@ -1120,7 +1121,7 @@ static pmLongOptions longopts[] = {
 
 static pmOptions opts = {
     .flags = PM_OPTFLAG_BOUNDARIES,
-    .short_options = "ac:dD:eFg:h:iIlLmMnqp:sStvVZ:?",
+    .short_options = "ac:dD:eFg:h:iIlLmMnqp:sStvVw:Z:?",
     .long_options = longopts,
     .short_usage = "[options] [query ... | labels ... | series ... | source ...]",
     .override = pmseries_overrides,
@@ -1134,7 +1135,9 @@ main(int argc, char *argv[])
     const char		*split = ",";
     const char		*space = " ";
     const char		*inifile = NULL;
+    char		*endnum;
     const char		*redis_host = NULL;
+    const char		*workers = NULL;
     static char		tzbuffer[128];
     unsigned int	redis_port = 6379;	/* default Redis port */
     struct dict		*config;
@@ -1222,6 +1225,15 @@ main(int argc, char *argv[])
 	    flags |= PMSERIES_OPT_VALUES;
 	    break;
 
+	case 'w':	/* worker threads for --load of archives */
+	    if (strtol(opts.optarg, &endnum, 10) < 1 || *endnum != '\0') {
+		pmprintf("%s: -w requires a positive numeric argument\n",
+			pmGetProgname());
+		opts.errors++;
+	    }
+	    workers = opts.optarg;
+	    break;
+
 	case 'Z':	/* timezone for reporting time stamps */
 	    pmsprintf(tzbuffer, sizeof(tzbuffer), "%s", opts.optarg);
 	    setenv("TZ", tzbuffer, 1);
@@ -1256,6 +1268,10 @@ main(int argc, char *argv[])
 			redis_host? redis_host : "localhost", redis_port);
 	    pmIniFileUpdate(config, "pmseries", "servers", option);
 	}
+	if (workers != NULL)
+	    pmIniFileUpdate(config, "pmseries", "load.workers", sdsnew(workers));
+	/* each query is made once only, so caching samples cannot help */
+	pmIniFileUpdate(config, "pmseries", "query.cache.size", sdsnew("0"));
     }
 
     if (flags & PMSERIES_OPT_ALL)